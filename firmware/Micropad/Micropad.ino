@@ -35,6 +35,8 @@
 #include "action_executor.h"
 #include "profile.h"
 #include "profile_manager.h"
+#include "persistence_service.h"
+#include "input_telemetry.h"
 
 // ============================================
 // Global Objects
@@ -50,6 +52,8 @@ WebSocketServer wsServer;
 ActionExecutor actionExecutor;
 ProfileManager profileManager;
 ComboDetector comboDetector;
+PersistenceService persistence;
+InputTelemetry telemetry;
 Preferences preferences;
 
 // ============================================
@@ -63,7 +67,8 @@ void setup() {
     encoder1.init(ENC1_PIN_A, ENC1_PIN_B, ENC1_PIN_SW);
     encoder2.init(ENC2_PIN_A, ENC2_PIN_B, ENC2_PIN_SW);
 
-    if (!profileManager.init()) {
+    persistence.init();
+    if (!profileManager.init(&persistence)) {
         // Continue with default profile
     }
 
@@ -78,6 +83,8 @@ void setup() {
     bleConfig.begin(&protocolHandler);
     protocolHandler.setBLEService(&bleConfig);
     protocolHandler.setBLEKeyboard(&bleKeyboard);
+    protocolHandler.setPersistence(&persistence);
+    protocolHandler.setTelemetry(&telemetry);
 
     // Order required: HID + Config must be registered before advertising (so GATT has config service 4fafc201-...)
     bleKeyboard.startAdvertising();
@@ -117,7 +124,9 @@ void loop() {
     
     // Update communication
     bleConfig.update();
-    protocolHandler.processDeferred();
+    protocolHandler.update();
+    profileManager.update();
+    persistence.update();
     wifiManager.update();
     
     // Check for key combos
@@ -129,6 +138,9 @@ void loop() {
     // Process encoder events
     processEncoders();
     
+    // Input events for a subscribed config client, once the HID reports are out
+    protocolHandler.flushTelemetry();
+    
     // Small delay to prevent overwhelming the system
     delay(1);
 }
@@ -173,24 +185,28 @@ void processCombos() {
 // Key Processing
 // ============================================
 void processKeys() {
-    Profile* currentProfile = profileManager.getCurrentProfile();
+    // Recompile the dispatch table after a profile switch or hot-applied edit.
+    // The generation is read first so a swap in between only costs a recompile.
+    uint32_t generation = profileManager.getProfileGeneration();
+    actionExecutor.bindProfile(*profileManager.getCurrentProfile(), generation);
     
     for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
         if (matrix.justPressed(i)) {
             DEBUG_PRINTF("Key %d pressed\n", i);
-            protocolHandler.keyPressCount[i]++;
-            
-            const Action& action = currentProfile->keys[i].action;
+            persistence.recordKeyPress(i);
             
-            if (action.type == ACTION_PROFILE) {
-                uint8_t targetProfile = action.config.profile.profileId;
+            uint16_t targetProfile = actionExecutor.getProfileSwitch(i);
+            if (targetProfile != PROFILE_ID_NONE) {
                 if (profileManager.profileExists(targetProfile)) {
                     profileManager.setActiveProfile(targetProfile);
                     DEBUG_PRINTF("Switched to profile %d\n", targetProfile);
                 }
-            } else if (action.type != ACTION_NONE) {
-                actionExecutor.execute(action);
+            } else {
+                actionExecutor.dispatch(i);
             }
+            telemetry.recordKey(i, true);
+        } else if (matrix.justReleased(i)) {
+            telemetry.recordKey(i, false);
         }
     }
 }
@@ -199,40 +215,42 @@ void processKeys() {
 // Encoder Processing
 // ============================================
 void processEncoders() {
-    Profile* currentProfile = profileManager.getCurrentProfile();
+    // A key may have switched profiles above
+    uint32_t generation = profileManager.getProfileGeneration();
+    actionExecutor.bindProfile(*profileManager.getCurrentProfile(), generation);
     
     int8_t delta1 = encoder1.getDelta();
     if (delta1 != 0) {
         DEBUG_PRINTF("Encoder 1 turned: %d\n", delta1);
-        protocolHandler.encoderTurnCount[0]++;
+        persistence.recordEncoderTurn(0);
         
-        if (delta1 > 0) {
-            actionExecutor.execute(currentProfile->encoders[0].cwAction);
-        } else {
-            actionExecutor.execute(currentProfile->encoders[0].ccwAction);
-        }
+        actionExecutor.dispatch(DISPATCH_ENCODER_SLOT(0, delta1 > 0 ? ENCODER_INPUT_CW : ENCODER_INPUT_CCW));
+        telemetry.recordEncoderTurn(0, delta1);
     }
     
     if (encoder1.isSWJustPressed()) {
         DEBUG_PRINTLN("Encoder 1 pressed");
-        protocolHandler.keyPressCount[0]++; // count encoder presses too
-        actionExecutor.execute(currentProfile->encoders[0].pressAction);
+        persistence.recordKeyPress(0); // count encoder presses too
+        actionExecutor.dispatch(DISPATCH_ENCODER_SLOT(0, ENCODER_INPUT_PRESS));
+        telemetry.recordEncoderButton(0, true);
+    } else if (encoder1.isSWJustReleased()) {
+        telemetry.recordEncoderButton(0, false);
     }
     
     int8_t delta2 = encoder2.getDelta();
     if (delta2 != 0) {
         DEBUG_PRINTF("Encoder 2 turned: %d\n", delta2);
-        protocolHandler.encoderTurnCount[1]++;
+        persistence.recordEncoderTurn(1);
         
-        if (delta2 > 0) {
-            actionExecutor.execute(currentProfile->encoders[1].cwAction);
-        } else {
-            actionExecutor.execute(currentProfile->encoders[1].ccwAction);
-        }
+        actionExecutor.dispatch(DISPATCH_ENCODER_SLOT(1, delta2 > 0 ? ENCODER_INPUT_CW : ENCODER_INPUT_CCW));
+        telemetry.recordEncoderTurn(1, delta2);
     }
     
     if (encoder2.isSWJustPressed()) {
         DEBUG_PRINTLN("Encoder 2 pressed");
-        actionExecutor.execute(currentProfile->encoders[1].pressAction);
+        actionExecutor.dispatch(DISPATCH_ENCODER_SLOT(1, ENCODER_INPUT_PRESS));
+        telemetry.recordEncoderButton(1, true);
+    } else if (encoder2.isSWJustReleased()) {
+        telemetry.recordEncoderButton(1, false);
     }
 }
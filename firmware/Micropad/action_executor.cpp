@@ -1,117 +1,153 @@
 #include "action_executor.h"
+#include "profile_text.h"
 
 ActionExecutor::ActionExecutor() {
     _bleKeyboard = nullptr;
+    _boundGeneration = DISPATCH_GENERATION_UNBOUND;
+    for (uint8_t i = 0; i < DISPATCH_SLOT_COUNT; i++) {
+        _table[i].kind = DISPATCH_NONE;
+        _table[i].profileId = PROFILE_ID_NONE;
+    }
 }
 
 void ActionExecutor::init(BLEKeyboard* bleKeyboard) {
     _bleKeyboard = bleKeyboard;
 }
 
-void ActionExecutor::execute(const Action& action) {
+void ActionExecutor::_compileTable(const Profile& profile, uint32_t generation) {
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        _compile(profile.keys[i].action, _table[i]);
+    }
+    for (uint8_t e = 0; e < 2; e++) {
+        _compile(profile.encoders[e].cwAction, _table[DISPATCH_ENCODER_SLOT(e, ENCODER_INPUT_CW)]);
+        _compile(profile.encoders[e].ccwAction, _table[DISPATCH_ENCODER_SLOT(e, ENCODER_INPUT_CCW)]);
+        _compile(profile.encoders[e].pressAction, _table[DISPATCH_ENCODER_SLOT(e, ENCODER_INPUT_PRESS)]);
+    }
+    
+    _boundGeneration = generation;
+    DEBUG_PRINTF("Compiled dispatch table for profile %d\n", profile.id);
+}
+
+void ActionExecutor::_send(const DispatchEntry& entry) {
     if (!_bleKeyboard || !_bleKeyboard->isHidReady()) {
         return;
     }
     
-    switch (action.type) {
-        case ACTION_HOTKEY:
-            _executeHotkey(action.config.hotkey);
+    switch (entry.kind) {
+        case DISPATCH_KEY:
+            _bleKeyboard->sendKeyPress(entry.usage, entry.modifiers);
+            DEBUG_PRINTF("Executed hotkey: mod=0x%02X key=0x%02X\n", entry.modifiers, entry.usage);
             break;
-            
-        case ACTION_TEXT:
-            _executeText(action.config.text);
+        
+        case DISPATCH_TEXT:
+            _bleKeyboard->sendText(profileText(entry.usage));
+            DEBUG_PRINTF("Executed text: %s\n", profileText(entry.usage));
             break;
-            
-        case ACTION_MEDIA:
-            _executeMedia(action.config.media);
+        
+        case DISPATCH_MEDIA:
+            _bleKeyboard->sendMediaKey(entry.usage);
+            DEBUG_PRINTF("Executed media key: 0x%04X\n", entry.usage);
             break;
-            
-        case ACTION_MOUSE:
-            _executeMouse(action.config.mouse);
+        
+        case DISPATCH_MOUSE_CLICK:
+            _bleKeyboard->sendMouseClick(entry.usage);
+            DEBUG_PRINTF("Executed mouse click: 0x%02X\n", entry.usage);
             break;
-            
-        case ACTION_MACRO:
-            _executeMacro(action.config.macro);
+        
+        case DISPATCH_MOUSE_SCROLL:
+            _bleKeyboard->sendMouseScroll(entry.value);
+            DEBUG_PRINTF("Executed mouse scroll: %d\n", entry.value);
             break;
-            
-        case ACTION_NONE:
-        default:
+        
+        case DISPATCH_MACRO:
+            _runMacro(*static_cast<const MacroConfig*>(entry.data));
             break;
     }
 }
 
-void ActionExecutor::_executeHotkey(const HotkeyConfig& config) {
-    _bleKeyboard->sendKeyPress(config.key, config.modifiers);
-    DEBUG_PRINTF("Executed hotkey: mod=0x%02X key=0x%02X\n", config.modifiers, config.key);
-}
-
-void ActionExecutor::_executeText(const TextConfig& config) {
-    _bleKeyboard->sendText(config.text);
-    DEBUG_PRINTF("Executed text: %s\n", config.text);
-}
-
-void ActionExecutor::_executeMedia(const MediaConfig& config) {
-    uint16_t mediaKey = 0;
+void ActionExecutor::_compile(const Action& action, DispatchEntry& entry) {
+    entry.kind = DISPATCH_NONE;
+    entry.usage = 0;
+    entry.modifiers = 0;
+    entry.value = 0;
+    entry.profileId = PROFILE_ID_NONE;
+    entry.data = nullptr;
     
-    switch (config.function) {
-        case MEDIA_FUNC_VOLUME_UP:
-            mediaKey = MEDIA_VOLUME_UP;
+    switch (action.type) {
+        case ACTION_HOTKEY:
+            entry.kind = DISPATCH_KEY;
+            entry.usage = action.config.hotkey.key;
+            entry.modifiers = action.config.hotkey.modifiers;
             break;
-        case MEDIA_FUNC_VOLUME_DOWN:
-            mediaKey = MEDIA_VOLUME_DOWN;
+        
+        case ACTION_TEXT:
+            entry.kind = DISPATCH_TEXT;
+            entry.usage = action.config.text.textRef;
             break;
-        case MEDIA_FUNC_MUTE:
-            mediaKey = MEDIA_MUTE;
+        
+        case ACTION_MEDIA:
+            entry.usage = _mediaUsage(action.config.media.function);
+            if (entry.usage != 0) {
+                entry.kind = DISPATCH_MEDIA;
+            }
             break;
-        case MEDIA_FUNC_PLAY_PAUSE:
-            mediaKey = MEDIA_PLAY_PAUSE;
+        
+        case ACTION_MOUSE:
+            switch (action.config.mouse.action) {
+                case MOUSE_ACTION_CLICK:
+                    entry.kind = DISPATCH_MOUSE_CLICK;
+                    entry.usage = MOUSE_LEFT;
+                    break;
+                case MOUSE_ACTION_RIGHT_CLICK:
+                    entry.kind = DISPATCH_MOUSE_CLICK;
+                    entry.usage = MOUSE_RIGHT;
+                    break;
+                case MOUSE_ACTION_MIDDLE_CLICK:
+                    entry.kind = DISPATCH_MOUSE_CLICK;
+                    entry.usage = MOUSE_MIDDLE;
+                    break;
+                case MOUSE_ACTION_SCROLL_UP:
+                    entry.kind = DISPATCH_MOUSE_SCROLL;
+                    entry.value = action.config.mouse.value;
+                    break;
+                case MOUSE_ACTION_SCROLL_DOWN:
+                    entry.kind = DISPATCH_MOUSE_SCROLL;
+                    entry.value = -action.config.mouse.value;
+                    break;
+            }
             break;
-        case MEDIA_FUNC_NEXT:
-            mediaKey = MEDIA_NEXT_TRACK;
+        
+        case ACTION_MACRO:
+            if (action.config.macro.stepCount > 0 && action.config.macro.stepCount <= MAX_MACRO_STEPS) {
+                entry.kind = DISPATCH_MACRO;
+                entry.data = &action.config.macro;
+            }
             break;
-        case MEDIA_FUNC_PREV:
-            mediaKey = MEDIA_PREV_TRACK;
+        
+        case ACTION_PROFILE:
+            entry.profileId = action.config.profile.profileId;
             break;
-        case MEDIA_FUNC_STOP:
-            mediaKey = MEDIA_STOP;
+        
+        case ACTION_NONE:
+        default:
             break;
     }
-    
-    if (mediaKey != 0) {
-        _bleKeyboard->sendMediaKey(mediaKey);
-        DEBUG_PRINTF("Executed media key: 0x%04X\n", mediaKey);
-    }
 }
 
-void ActionExecutor::_executeMouse(const MouseConfig& config) {
-    switch (config.action) {
-        case MOUSE_ACTION_CLICK:
-            _bleKeyboard->sendMouseClick(MOUSE_LEFT);
-            break;
-            
-        case MOUSE_ACTION_RIGHT_CLICK:
-            _bleKeyboard->sendMouseClick(MOUSE_RIGHT);
-            break;
-            
-        case MOUSE_ACTION_MIDDLE_CLICK:
-            _bleKeyboard->sendMouseClick(MOUSE_MIDDLE);
-            break;
-            
-        case MOUSE_ACTION_SCROLL_UP:
-            _bleKeyboard->sendMouseScroll(config.value);
-            break;
-            
-        case MOUSE_ACTION_SCROLL_DOWN:
-            _bleKeyboard->sendMouseScroll(-config.value);
-            break;
+uint16_t ActionExecutor::_mediaUsage(uint8_t function) {
+    switch (function) {
+        case MEDIA_FUNC_VOLUME_UP:   return MEDIA_VOLUME_UP;
+        case MEDIA_FUNC_VOLUME_DOWN: return MEDIA_VOLUME_DOWN;
+        case MEDIA_FUNC_MUTE:        return MEDIA_MUTE;
+        case MEDIA_FUNC_PLAY_PAUSE:  return MEDIA_PLAY_PAUSE;
+        case MEDIA_FUNC_NEXT:        return MEDIA_NEXT_TRACK;
+        case MEDIA_FUNC_PREV:        return MEDIA_PREV_TRACK;
+        case MEDIA_FUNC_STOP:        return MEDIA_STOP;
+        default:                     return 0;
     }
-    
-    DEBUG_PRINTF("Executed mouse action: %d\n", config.action);
 }
 
-void ActionExecutor::_executeMacro(const MacroConfig& config) {
-    if (config.stepCount == 0 || config.stepCount > MAX_MACRO_STEPS) return;
-    
+void ActionExecutor::_runMacro(const MacroConfig& config) {
     for (uint8_t i = 0; i < config.stepCount; i++) {
         const MacroStepConfig& step = config.steps[i];
         
@@ -121,23 +157,24 @@ void ActionExecutor::_executeMacro(const MacroConfig& config) {
                     delay(step.delayMs);
                 }
                 break;
-                
+            
             case 2: // keyPress
                 _bleKeyboard->sendKeyPress(step.key, step.modifiers);
                 delay(10);
                 break;
-                
+            
             case 3: // text
-                _bleKeyboard->sendText(step.text);
+                _bleKeyboard->sendText(profileText(step.textRef));
                 break;
-                
+            
             case 4: { // media
-                MediaConfig mc;
-                mc.function = static_cast<MediaFunction>(step.mediaFunction);
-                _executeMedia(mc);
+                uint16_t usage = _mediaUsage(step.mediaFunction);
+                if (usage != 0) {
+                    _bleKeyboard->sendMediaKey(usage);
+                }
                 break;
             }
-                
+            
             default:
                 break;
         }
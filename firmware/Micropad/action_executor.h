@@ -6,21 +6,68 @@
 #include "profile.h"
 #include "ble_hid.h"
 
+// Dispatch slots: keys 0..MATRIX_KEYS-1, then cw/ccw/press for each encoder
+enum EncoderInput : uint8_t {
+    ENCODER_INPUT_CW = 0,
+    ENCODER_INPUT_CCW,
+    ENCODER_INPUT_PRESS
+};
+#define DISPATCH_SLOT_COUNT (MATRIX_KEYS + 2 * 3)
+#define DISPATCH_ENCODER_SLOT(encoder, input) (MATRIX_KEYS + (encoder) * 3 + (input))
+#define DISPATCH_GENERATION_UNBOUND 0xFFFFFFFFu  // Never a profile generation (they count up from 0)
+
+// What a press sends; dispatch() switches on it
+enum DispatchKind : uint8_t {
+    DISPATCH_NONE = 0,
+    DISPATCH_KEY,
+    DISPATCH_TEXT,
+    DISPATCH_MEDIA,
+    DISPATCH_MOUSE_CLICK,
+    DISPATCH_MOUSE_SCROLL,
+    DISPATCH_MACRO
+};
+
+// One input's action, resolved once when the profile is bound so a press is a
+// single indexed lookup: the kind picks the HID report, the rest is its payload.
+struct DispatchEntry {
+    uint8_t kind;             // DispatchKind
+    uint8_t modifiers;
+    int8_t value;             // Scroll amount (signed)
+    uint16_t usage;           // Keyboard key code, consumer usage, mouse button or text reference
+    uint16_t profileId;       // ACTION_PROFILE target, else PROFILE_ID_NONE
+    const void* data;         // Macro inside the bound profile
+};
+
 class ActionExecutor {
 public:
     ActionExecutor();
     void init(BLEKeyboard* bleKeyboard);
     
-    void execute(const Action& action);
+    // Recompile the dispatch table if `generation` differs from the bound one.
+    // Read the generation before fetching the profile it belongs to. Called
+    // before every press, so the check is inline and the compile is not.
+    void bindProfile(const Profile& profile, uint32_t generation) {
+        if (generation != _boundGeneration) _compileTable(profile, generation);
+    }
     
+    // Inputs with nothing bound return here, without a call
+    void dispatch(uint8_t slot) {
+        if (_table[slot].kind != DISPATCH_NONE) _send(_table[slot]);
+    }
+    // Profile switches need the profile manager, so the caller handles them
+    uint16_t getProfileSwitch(uint8_t slot) const { return _table[slot].profileId; }
+
 private:
     BLEKeyboard* _bleKeyboard;
     
-    void _executeHotkey(const HotkeyConfig& config);
-    void _executeText(const TextConfig& config);
-    void _executeMedia(const MediaConfig& config);
-    void _executeMouse(const MouseConfig& config);
-    void _executeMacro(const MacroConfig& config);
+    DispatchEntry _table[DISPATCH_SLOT_COUNT];
+    uint32_t _boundGeneration;    // DISPATCH_GENERATION_UNBOUND until the first bind
+    
+    void _compileTable(const Profile& profile, uint32_t generation);
+    static void _compile(const Action& action, DispatchEntry& entry);
+    static uint16_t _mediaUsage(uint8_t function);
+    void _send(const DispatchEntry& entry);
+    void _runMacro(const MacroConfig& config);
 };
 
 #endif // ACTION_EXECUTOR_H
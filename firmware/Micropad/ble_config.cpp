@@ -1,5 +1,6 @@
 #include "ble_config.h"
 #include "protocol_handler.h"
+#include "lzss.h"
 
 #if defined(ESP32)
 #include "mbedtls/base64.h"
@@ -7,25 +8,86 @@
 
 BLEConfigService* BLEConfigService::_instance = nullptr;
 
-// Decode Base64 to String (UTF-8). Used for dataB64 chunk payload from Windows app.
-static String base64Decode(const String& in) {
+// Binary frame: marker, flags, sequence (u16 LE), payload length (u16 LE), payload.
+// 0xC1 is never used by MessagePack and isn't '{', so a frame can't be mistaken
+// for a message. The payload is a slice of a JSON or MessagePack message.
+static const uint8_t FRAME_MARKER = 0xC1;
+static const uint8_t FRAME_FLAG_FIRST = 0x01;
+static const uint8_t FRAME_FLAG_LAST = 0x02;
+static const uint8_t FRAME_FLAG_ACK = 0x04;     // Sequence = cumulative ack; payload = window, SACK bits
+static const uint8_t FRAME_FLAG_COMPRESSED = 0x08;  // On a message's first frame: the message is an LZSS stream
+static const uint8_t FRAME_FLAG_ABORT = 0x10;       // Empty frame: the sender gave up on the message in progress
+static const uint16_t ACK_PAYLOAD_SIZE = 6;
+static const uint64_t ACK_INBOX_VALID = 1ULL << 63;
+static const uint16_t FRAME_HEADER_SIZE = 6;
+static const uint16_t ATT_NOTIFY_OVERHEAD = 3;  // Opcode + handle
+static const uint16_t ATT_DEFAULT_MTU = 23;
+static const uint16_t MAX_NOTIFY_SIZE = 512;
+
+// Legacy chunk writes are parsed in place: these helpers work on the raw
+// write so a chunk never becomes a String.
+
+// Position just past the first `token` in data, or nullptr
+static const uint8_t* findToken(const uint8_t* data, size_t length, const char* token) {
+    size_t tokenLength = strlen(token);
+    for (size_t i = 0; i + tokenLength <= length; i++) {
+        if (memcmp(data + i, token, tokenLength) == 0) {
+            return data + i + tokenLength;
+        }
+    }
+    return nullptr;
+}
+
+// Unsigned number after `token`, or -1
+static long parseChunkField(const uint8_t* data, size_t length, const char* token) {
+    const uint8_t* p = findToken(data, length, token);
+    if (!p) return -1;
+    const uint8_t* end = data + length;
+    while (p < end && *p == ' ') p++;
+    long value = -1;
+    while (p < end && *p >= '0' && *p <= '9' && value < 100000) {
+        value = (value < 0 ? 0 : value * 10) + (*p - '0');
+        p++;
+    }
+    return value;
+}
+
+// Exact decoded size of a Base64 run
+static size_t base64DecodedLength(const uint8_t* in, size_t length) {
+    size_t padding = 0;
+    while (length > 0 && in[length - 1] == '=' && padding < 2) {
+        length--;
+        padding++;
+    }
+    return (length * 6) >> 3;
+}
+
+// Legacy "data" payloads escape only quotes and backslashes. Returns the
+// unescaped length; writes the bytes too when out is set.
+static size_t unescapeChunkData(const uint8_t* in, size_t length, uint8_t* out) {
+    size_t written = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = in[i];
+        if (c == '\\' && i + 1 < length && (in[i + 1] == '"' || in[i + 1] == '\\')) {
+            c = in[++i];
+        }
+        if (out) out[written] = c;
+        written++;
+    }
+    return written;
+}
+
+// Decode a chunk payload into exactly `outLength` bytes at out
+static bool decodeChunkPayload(const uint8_t* in, size_t length, bool base64, uint8_t* out, size_t outLength) {
+    if (!base64) {
+        unescapeChunkData(in, length, out);
+        return true;
+    }
 #if defined(ESP32)
-    size_t outLen;
-    size_t inLen = in.length();
-    if (inLen == 0) return String();
-    // Decoded size is at most 3/4 of input
-    unsigned char* buf = (unsigned char*)malloc((inLen / 4 + 1) * 3);
-    if (!buf) return String();
-    int ret = mbedtls_base64_decode(buf, (inLen / 4 + 1) * 3, &outLen, (const unsigned char*)in.c_str(), inLen);
-    String out;
-    if (ret == 0 && outLen > 0) {
-        out = String((char*)buf, outLen);
-    }
-    free(buf);
-    return out;
+    size_t written = 0;
+    return mbedtls_base64_decode(out, outLength, &written, in, length) == 0 && written == outLength;
 #else
-    (void)in;
-    return String();
+    return false;
 #endif
 }
 
@@ -37,9 +99,21 @@ BLEConfigService::BLEConfigService() {
     _bulkChar = nullptr;
     _protocolHandler = nullptr;
     _configClientActive = false;
+    _rxReserved = 0;
     _isReceivingChunked = false;
     _chunkIndex = 0;
     _totalChunks = 0;
+    _chunkStride = 0;
+    _lastChunkLength = 0;
+    _chunkAt = 0;
+    memset(_chunkSeen, 0, sizeof(_chunkSeen));
+    _rxAllocations = 0;
+    _rxTransferAllocations = 0;
+    _rxTransfers = 0;
+    _peerMtu = ATT_DEFAULT_MTU;
+    _configConnHandle = BLE_HS_CONN_HANDLE_NONE;
+    _lastClientCount = 0;
+    _resetTransport();
     _instance = this;
 }
 
@@ -88,8 +162,32 @@ void BLEConfigService::begin(ProtocolHandler* handler) {
 }
 
 void BLEConfigService::update() {
-    if (_server && _server->getConnectedCount() == 0) {
+    uint32_t clients = getClientCount();
+    if (clients == 0) {
         _configClientActive = false;
+        _peerMtu = ATT_DEFAULT_MTU;
+    }
+    // A framed client that left takes its sequence numbers with it
+    if (clients < _lastClientCount && _framedClient && !_isPeerConnected(_configConnHandle)) {
+        _resetTransportLocked();
+    }
+    _lastClientCount = clients;
+    
+    if (!_framedClient) {
+        return;
+    }
+    // Ack the tail of a burst, retry a failed ack, and reopen the receive window
+    // once deferred work is done
+    {
+        std::lock_guard<std::mutex> lock(_rxLock);
+        bool burstEnded = _rxSinceAck > 0 && millis() - _rxLastFrameAt >= BLE_RX_ACK_DELAY_MS;
+        if (burstEnded || _rxAckPending || (_rxAdvertisedWindow == 0 && _receiveWindow() > 0)) {
+            _sendAck();
+        }
+    }
+    if (!_pumpTransmit()) {
+        DEBUG_PRINTLN("ERROR: framed client stopped acking, transport reset");
+        _resetTransportLocked();
     }
 }
 
@@ -97,13 +195,27 @@ bool BLEConfigService::isConfigClientActive() {
     return _configClientActive;
 }
 
+uint32_t BLEConfigService::getRxTransferCount() const {
+    return _rxTransfers;
+}
+
+uint8_t BLEConfigService::getRxTransferAllocations() const {
+    return _rxTransferAllocations;
+}
+
 void BLEConfigService::sendEvent(const String& jsonEvent) {
     if (!isConnected()) {
         return;
     }
     
+    // Clients that send binary frames get binary frames back: no base64, MTU-sized
+    if (_framedClient) {
+        sendFramed((const uint8_t*)jsonEvent.c_str(), jsonEvent.length());
+        return;
+    }
+    
     // Check size
-    if (jsonEvent.length() > 512) {
+    if (jsonEvent.length() > MAX_NOTIFY_SIZE) {
         // Need chunking
         sendChunked(jsonEvent);
     } else {
@@ -121,66 +233,156 @@ uint32_t BLEConfigService::getClientCount() {
     return _server ? _server->getConnectedCount() : 0;
 }
 
-void BLEConfigService::handleWrite(NimBLECharacteristic* pChar) {
+void BLEConfigService::handleWrite(NimBLECharacteristic* pChar, NimBLEConnInfo& connInfo) {
     _configClientActive = true;  // This connection is using config service (browser or app)
-    String value = pChar->getValue().c_str();
+    _peerMtu = connInfo.getMTU();
+    if (connInfo.getConnHandle() != _configConnHandle) {
+        if (_framedClient) {
+            _resetTransportLocked();
+        }
+        _configConnHandle = connInfo.getConnHandle();
+    }
+    NimBLEAttValue raw = pChar->getValue();
+    const uint8_t* data = raw.data();
+    size_t length = raw.length();
+    
+    if (length == 0) {
+        return;
+    }
     
-    if (value.length() == 0) {
+    if (data[0] == FRAME_MARKER) {
+        handleFrame(data, length);
         return;
     }
     
-    DEBUG_PRINTF("BLE Config RX: %s\n", value.substring(0, 100).c_str());
+    // Chunks are decoded from the write itself; only whole messages become a String
+    if (data[0] == '{' && findToken(data, length, "\"chunk\":")) {
+        handleChunkedMessage(data, length);
+        return;
+    }
     
-    // Check if this is a chunked message
-    if (value.indexOf("\"chunk\":") >= 0) {
-        handleChunkedMessage(value);
-    } else {
-        // Complete message, pass to protocol handler
-        if (_protocolHandler) {
-            _protocolHandler->handleMessage(value);
-        }
+    // Built from the length, not c_str(): MessagePack messages contain NUL bytes
+    String value;
+    value.concat((const char*)data, length);
+    
+    if (value[0] == '{') {
+        DEBUG_PRINTF("BLE Config RX: %s\n", value.substring(0, 100).c_str());
+    }
+    
+    // Complete message, pass to protocol handler
+    if (_protocolHandler) {
+        _protocolHandler->handleMessage(std::move(value));
     }
 }
 
 // Chunk format from Windows app: {"chunk":0,"total":N,"dataB64":"base64..."} (preferred)
 // Legacy: {"chunk":0,"total":N,"data":"..."}
-void BLEConfigService::handleChunkedMessage(const String& chunk) {
-    int chunkStart = chunk.indexOf("\"chunk\":") + 8;
-    int chunkEnd = chunk.indexOf(",", chunkStart);
-    int chunkNum = chunk.substring(chunkStart, chunkEnd).toInt();
-    
-    int totalStart = chunk.indexOf("\"total\":") + 8;
-    int totalEnd = chunk.indexOf(",", totalStart);
-    if (totalEnd < 0) totalEnd = chunk.indexOf("}", totalStart);
-    int totalChunks = chunk.substring(totalStart, totalEnd).toInt();
-    
-    String data;
-    int dataB64Start = chunk.indexOf("\"dataB64\":\"");
-    if (dataB64Start >= 0) {
-        dataB64Start += 11;
-        int dataB64End = chunk.indexOf("\"", dataB64Start);
-        String b64 = chunk.substring(dataB64Start, dataB64End);
-        data = base64Decode(b64);
+// All chunks but the last decode to the same size, so chunk N lands at N * stride
+// of a buffer reserved once for the whole message. Duplicates (client retries)
+// are dropped and chunks may arrive in any order.
+void BLEConfigService::handleChunkedMessage(const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(_rxLock);
+    long chunkNum = parseChunkField(data, length, "\"chunk\":");
+    long totalChunks = parseChunkField(data, length, "\"total\":");
+    if (chunkNum < 0 || totalChunks <= 0 || totalChunks > BLE_MAX_CHUNKS || chunkNum >= totalChunks) {
+        DEBUG_PRINTLN("Chunk header invalid, dropped");
+        return;
+    }
+    
+    bool base64 = true;
+    const uint8_t* payload = findToken(data, length, "\"dataB64\":\"");
+    const uint8_t* payloadEnd = nullptr;
+    if (payload) {
+        payloadEnd = (const uint8_t*)memchr(payload, '"', data + length - payload);
     } else {
-        int dataStart = chunk.indexOf("\"data\":\"") + 8;
-        int dataEnd = chunk.lastIndexOf("\"");
-        if (dataEnd > dataStart)
-            data = chunk.substring(dataStart, dataEnd);
-        data.replace("\\\"", "\"");
-        data.replace("\\\\", "\\");
+        base64 = false;
+        payload = findToken(data, length, "\"data\":\"");
+        for (const uint8_t* p = data + length; payload && p > payload; p--) {
+            if (p[-1] == '"') {
+                payloadEnd = p - 1;
+                break;
+            }
+        }
+    }
+    if (!payload || !payloadEnd) {
+        DEBUG_PRINTF("Chunk %ld: no data, dropped\n", chunkNum);
+        return;
     }
+    size_t payloadLength = payloadEnd - payload;
+    size_t rawLength = base64 ? base64DecodedLength(payload, payloadLength)
+                              : unescapeChunkData(payload, payloadLength, nullptr);
     
-    if (chunkNum == 0) {
-        _rxBuffer = "";
-        _isReceivingChunked = true;
-        _chunkIndex = 0;
-        _totalChunks = totalChunks;
+    // Chunk 0 starts a transfer unless this one is still waiting for it. The
+    // last transfer's chunks stay marked, so late retries of them are dropped
+    // rather than mistaken for a new transfer.
+    uint32_t now = millis();
+    uint8_t bit = 1 << (chunkNum & 7);
+    bool seen = _chunkSeen[chunkNum >> 3] & bit;
+    bool waitingForFirst = _isReceivingChunked && !(_chunkSeen[0] & 1);
+    if (totalChunks != _totalChunks || now - _chunkAt > BLE_CHUNK_TIMEOUT_MS
+        || (chunkNum == 0 && !waitingForFirst) || (!_isReceivingChunked && !seen)) {
+        _beginChunkedTransfer(totalChunks);
+        seen = false;
+    }
+    _chunkAt = now;
+    
+    if (seen) {
+        return;  // Retry of a chunk we already have
     }
     
-    _rxBuffer += data;
+    bool last = chunkNum == totalChunks - 1;
+    uint16_t lastIndex = totalChunks - 1;
+    bool tailParked = _chunkSeen[lastIndex >> 3] & (1 << (lastIndex & 7));
+    if (_chunkStride == 0) {
+        if (last && totalChunks > 1) {
+            // The stride comes from a full chunk; park this one until one arrives
+            if (rawLength > sizeof(_chunkTail) || !decodeChunkPayload(payload, payloadLength, base64, _chunkTail, rawLength)) {
+                DEBUG_PRINTF("Chunk %ld: undecodable, dropped\n", chunkNum);
+                return;
+            }
+            _lastChunkLength = rawLength;
+            _chunkSeen[chunkNum >> 3] |= bit;
+            _chunkIndex++;
+            return;
+        }
+        if (rawLength == 0 || (tailParked && _lastChunkLength > rawLength)) {
+            DEBUG_PRINTF("Chunk %ld: bad size, transfer abandoned\n", chunkNum);
+            _abandonChunkedTransfer();
+            return;
+        }
+        if ((size_t)rawLength * totalChunks > BLE_MAX_MESSAGE_BYTES) {
+            DEBUG_PRINTF("Chunked transfer of %ld x %u bytes refused\n", totalChunks, (unsigned)rawLength);
+            _abandonChunkedTransfer();
+            return;
+        }
+        if (!_reserveRx((size_t)rawLength * totalChunks)) {
+            DEBUG_PRINTLN("Chunked transfer: out of memory, abandoned");
+            _abandonChunkedTransfer();
+            return;
+        }
+        _chunkStride = rawLength;
+        if (tailParked) {
+            memcpy(_rxBuffer.begin() + (size_t)lastIndex * _chunkStride, _chunkTail, _lastChunkLength);
+        }
+    }
+    
+    if (last ? rawLength > _chunkStride : rawLength != _chunkStride) {
+        DEBUG_PRINTF("Chunk %ld: %u bytes, expected %u; transfer abandoned\n", chunkNum, (unsigned)rawLength, _chunkStride);
+        _abandonChunkedTransfer();
+        return;
+    }
+    uint8_t* destination = (uint8_t*)_rxBuffer.begin() + (size_t)chunkNum * _chunkStride;
+    if (!decodeChunkPayload(payload, payloadLength, base64, destination, rawLength)) {
+        DEBUG_PRINTF("Chunk %ld: undecodable, dropped\n", chunkNum);
+        return;  // Left unmarked so a retry can still fill it
+    }
+    if (last) {
+        _lastChunkLength = rawLength;
+    }
+    _chunkSeen[chunkNum >> 3] |= bit;
     _chunkIndex++;
     
-    DEBUG_PRINTF("Chunk %d/%d received (%d bytes)\n", _chunkIndex, _totalChunks, data.length());
+    DEBUG_PRINTF("Chunk %ld: %d/%d received (%u bytes)\n", chunkNum, _chunkIndex, _totalChunks, (unsigned)rawLength);
     
     // Do NOT send chunkAck here - it can flood the link and cause disconnect.
     // Web app uses fixed delay between chunks.
@@ -188,17 +390,584 @@ void BLEConfigService::handleChunkedMessage(const String& chunk) {
     // Check if complete
     if (_chunkIndex >= _totalChunks) {
         DEBUG_PRINTLN("All chunks received, processing...");
-        
-        if (_protocolHandler) {
-            _protocolHandler->handleMessage(_rxBuffer);
+        _rxBuffer.remove((size_t)lastIndex * _chunkStride + _lastChunkLength);
+        _deliverRx();
+    }
+}
+
+void BLEConfigService::_beginChunkedTransfer(uint16_t totalChunks) {
+    _isReceivingChunked = true;
+    _chunkIndex = 0;
+    _totalChunks = totalChunks;
+    _chunkStride = 0;
+    _lastChunkLength = 0;
+    memset(_chunkSeen, 0, sizeof(_chunkSeen));
+    _rxAllocations = 0;
+}
+
+// The rest of an abandoned transfer is dropped like duplicates, until its
+// client starts over with chunk 0
+void BLEConfigService::_abandonChunkedTransfer() {
+    _isReceivingChunked = false;
+    memset(_chunkSeen, 0xFF, sizeof(_chunkSeen));
+}
+
+// Size _rxBuffer for a whole message with at most one allocation. String has
+// no resize(), so the reservation is filled to length for chunks to be written
+// at their offsets; the final remove() trims it to the real length.
+bool BLEConfigService::_reserveRx(size_t size) {
+    static const char zeros[64] = {0};
+    _rxBuffer = "";
+    if (size > _rxReserved) {
+        if (!_rxBuffer.reserve(size)) {
+            return false;
         }
-        
-        // Reset
+        _rxReserved = size;
+        _rxAllocations++;
+    }
+    while (_rxBuffer.length() < size) {
+        _rxBuffer.concat(zeros, min(sizeof(zeros), size - _rxBuffer.length()));
+    }
+    return true;
+}
+
+// Hand the reassembled message over. It leaves with its buffer, so the next
+// transfer reserves afresh and the per-transfer count stays exact.
+void BLEConfigService::_deliverRx() {
+    _isReceivingChunked = false;
+    _rxTransfers++;
+    _rxTransferAllocations = _rxAllocations;
+    _rxReserved = 0;
+    String message = std::move(_rxBuffer);
+    _rxBuffer = "";
+    if (_protocolHandler) {
+        _protocolHandler->handleMessage(std::move(message));
+    }
+}
+
+// Binary counterpart of handleChunkedMessage: raw bytes, no base64 or JSON wrapper.
+// Frames ahead of a gap are buffered and acked selectively so only the missing
+// ones are resent.
+void BLEConfigService::handleFrame(const uint8_t* data, size_t length) {
+    if (length < FRAME_HEADER_SIZE) {
+        return;
+    }
+    uint8_t flags = data[1];
+    uint16_t sequence = data[2] | (data[3] << 8);
+    uint16_t payloadLength = data[4] | (data[5] << 8);
+    const uint8_t* payload = data + FRAME_HEADER_SIZE;
+    if (payloadLength != length - FRAME_HEADER_SIZE) {
+        DEBUG_PRINTF("Frame %u: length %u != %u, dropped\n", sequence, payloadLength, length - FRAME_HEADER_SIZE);
+        return;
+    }
+    _framedClient = true;
+    
+    if (flags & FRAME_FLAG_ACK) {
+        if (payloadLength >= ACK_PAYLOAD_SIZE) {
+            uint16_t window = payload[0] | (payload[1] << 8);
+            uint32_t sack = payload[2] | (payload[3] << 8) | ((uint32_t)payload[4] << 16) | ((uint32_t)payload[5] << 24);
+            if (window > 0xFF) window = 0xFF;
+            // Only the latest ack matters; update() applies it on the sending side
+            _ackInbox = ACK_INBOX_VALID | ((uint64_t)sequence << 40) | ((uint64_t)window << 32) | sack;
+        }
+        return;
+    }
+    if (payloadLength > sizeof(_rxSlots[0].data)) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(_rxLock);
+    int16_t ahead = (int16_t)(sequence - _rxSequence);
+    if (ahead < 0 || ahead >= (int16_t)_receiveWindow()) {
+        _sendAck();  // Duplicate (our ack was lost) or outside the window: restate where we are
+        return;
+    }
+    if (ahead > 0) {
+        RxSlot& slot = _rxSlots[sequence % BLE_RX_WINDOW_FRAMES];
+        if (!slot.used) {
+            slot.used = true;
+            slot.flags = flags;
+            slot.length = payloadLength;
+            memcpy(slot.data, payload, payloadLength);
+        }
+        _sendAck();  // Report the gap right away
+        return;
+    }
+    
+    bool delivered = flags & FRAME_FLAG_LAST;
+    _rxLastFrameAt = millis();
+    _acceptFrame(flags, payload, payloadLength);
+    _rxSequence++;
+    // Frames that were waiting behind the gap
+    while (_rxSlots[_rxSequence % BLE_RX_WINDOW_FRAMES].used) {
+        RxSlot& slot = _rxSlots[_rxSequence % BLE_RX_WINDOW_FRAMES];
+        slot.used = false;
+        delivered |= slot.flags & FRAME_FLAG_LAST;
+        _acceptFrame(slot.flags, slot.data, slot.length);
+        _rxSequence++;
+    }
+    
+    if (delivered || ++_rxSinceAck >= BLE_RX_WINDOW_FRAMES / 2) {
+        _sendAck();
+    }
+}
+
+void BLEConfigService::_acceptFrame(uint8_t flags, const uint8_t* payload, uint16_t length) {
+    if (flags & FRAME_FLAG_FIRST) {
         _rxBuffer = "";
+        _isReceivingChunked = true;
+        _rxAllocations = 0;
+        _rxCompressed = flags & FRAME_FLAG_COMPRESSED;
+        if (_rxCompressed) {
+            // The stream announces its size: reserve once, decode straight into the buffer
+            uint32_t original = length >= LZSS_HEADER_SIZE ? lzssOriginalLength(payload) : 0;
+            if (original == 0 || original > BLE_MAX_DECOMPRESSED_BYTES || !_reserveRx(original)) {
+                DEBUG_PRINTF("ERROR: compressed message of %u bytes refused\n", original);
+                _isReceivingChunked = false;
+                return;
+            }
+            _rxDecoder.begin((uint8_t*)_rxBuffer.begin(), original);
+            payload += LZSS_HEADER_SIZE;
+            length -= LZSS_HEADER_SIZE;
+        }
+    } else if (flags & FRAME_FLAG_ABORT) {
+        _isReceivingChunked = false;
+        return;
+    } else if (!_isReceivingChunked) {
+        return;  // Tail of a message whose start was never seen
+    }
+    
+    if (_rxCompressed) {
+        if (!_rxDecoder.feed(payload, length) || ((flags & FRAME_FLAG_LAST) && !_rxDecoder.finished())) {
+            DEBUG_PRINTLN("ERROR: corrupt compressed message dropped");
+            _isReceivingChunked = false;
+            return;
+        }
+        if (flags & FRAME_FLAG_LAST) {
+            _deliverRx();
+        }
+        return;
+    }
+    
+    // Frames don't announce the total, so grow geometrically: String::concat
+    // alone would reallocate (and copy) on every frame
+    size_t needed = _rxBuffer.length() + length;
+    if (needed > BLE_MAX_MESSAGE_BYTES) {
+        DEBUG_PRINTLN("ERROR: framed message over the size limit dropped");
         _isReceivingChunked = false;
-        _chunkIndex = 0;
-        _totalChunks = 0;
+        _rxBuffer = String();  // Give the memory back now, not at the next message
+        _rxReserved = 0;
+        return;
+    }
+    if (needed > _rxReserved) {
+        size_t capacity = min(max(needed, max(_rxReserved * 2, (size_t)1024)), (size_t)BLE_MAX_MESSAGE_BYTES);
+        if (_rxBuffer.reserve(capacity)) {
+            _rxReserved = capacity;
+            _rxAllocations++;
+        }
+    }
+    _rxBuffer.concat((const char*)payload, length);
+    
+    if (flags & FRAME_FLAG_LAST) {
+        _deliverRx();
+    }
+}
+
+// Closed while the request queue is full, so the next request waits in the app,
+// and while the send queue is, so a request refused on arrival has room for the refusal
+uint16_t BLEConfigService::_receiveWindow() {
+    if (_protocolHandler && _protocolHandler->isRequestQueueFull()) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(_txLock);
+    return _txCount < BLE_TX_QUEUE_DEPTH ? BLE_RX_WINDOW_FRAMES : 0;
+}
+
+// Caller holds _rxLock
+bool BLEConfigService::_sendAck() {
+    uint16_t window = _receiveWindow();
+    uint32_t sack = 0;
+    for (uint8_t i = 1; i < BLE_RX_WINDOW_FRAMES; i++) {
+        if (_rxSlots[(uint16_t)(_rxSequence + i) % BLE_RX_WINDOW_FRAMES].used) {
+            sack |= 1UL << (i - 1);
+        }
+    }
+    
+    uint8_t frame[FRAME_HEADER_SIZE + ACK_PAYLOAD_SIZE] = {
+        FRAME_MARKER, FRAME_FLAG_ACK,
+        (uint8_t)(_rxSequence & 0xFF), (uint8_t)(_rxSequence >> 8),
+        ACK_PAYLOAD_SIZE, 0,
+        (uint8_t)(window & 0xFF), (uint8_t)(window >> 8),
+        (uint8_t)(sack & 0xFF), (uint8_t)(sack >> 8), (uint8_t)(sack >> 16), (uint8_t)(sack >> 24)
+    };
+    _rxSinceAck = 0;
+    _rxAdvertisedWindow = window;
+    bool sent = _evtChar && _evtChar->notify(frame, sizeof(frame));
+    _rxAckPending = !sent;
+    return sent;
+}
+
+void BLEConfigService::sendBinary(const uint8_t* data, size_t length) {
+    if (!isConnected()) {
+        return;
+    }
+    sendFramed(data, length);
+}
+
+uint16_t BLEConfigService::getFramePayloadSize() const {
+    uint16_t mtu = _peerMtu < ATT_DEFAULT_MTU ? ATT_DEFAULT_MTU : _peerMtu;
+    uint16_t size = mtu - ATT_NOTIFY_OVERHEAD;
+    if (size > MAX_NOTIFY_SIZE) size = MAX_NOTIFY_SIZE;  // ATT values are at most 512 bytes
+    return size - FRAME_HEADER_SIZE;
+}
+
+bool BLEConfigService::isTransmitIdle() {
+    std::lock_guard<std::mutex> lock(_txLock);
+    return _txCount == 0;
+}
+
+static_assert(BLE_TX_QUEUE_DEPTH > PROTOCOL_REPLY_MESSAGES, "send queue holds a request's replies and a refusal");
+
+bool BLEConfigService::hasTxRoom() {
+    if (!_framedClient) {
+        return true;  // Chunked messages are notified as they are sent
+    }
+    std::lock_guard<std::mutex> lock(_txLock);
+    return BLE_TX_QUEUE_DEPTH - _txCount > PROTOCOL_REPLY_MESSAGES;
+}
+
+// Locks in the order handleFrame takes them: a delivered message may queue a reply
+void BLEConfigService::_resetTransportLocked() {
+    std::lock_guard<std::mutex> rxLock(_rxLock);
+    std::lock_guard<std::mutex> txLock(_txLock);
+    _resetTransport();
+}
+
+bool BLEConfigService::_isPeerConnected(uint16_t connHandle) {
+    if (!_server) return false;
+    std::vector<uint16_t> peers = _server->getPeerDevices();
+    for (size_t i = 0; i < peers.size(); i++) {
+        if (peers[i] == connHandle) return true;
+    }
+    return false;
+}
+
+bool BLEConfigService::isFramedClient() const {
+    return _framedClient;
+}
+
+bool BLEConfigService::isSendingFile(const String& path) {
+    std::lock_guard<std::mutex> lock(_txLock);
+    for (uint8_t i = 0; i < _txCount; i++) {
+        const TxMessage& message = _txQueue[(_txHead + i) % BLE_TX_QUEUE_DEPTH];
+        if (message.fileLength > 0 && message.path == path) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BLEConfigService::setTxCompression(bool enabled) {
+    _txCompression = enabled;
+}
+
+bool BLEConfigService::isTxCompressed() const {
+    return _txCompression;
+}
+
+// Queued; update() sends it as the client's acks allow
+void BLEConfigService::sendFramed(const uint8_t* data, size_t length) {
+    // Compressed outside the lock; kept only if it comes out smaller
+    uint8_t* packed = nullptr;
+    size_t packedLength = 0;
+    if (_txCompression && length >= BLE_COMPRESS_MIN_BYTES) {
+        packed = (uint8_t*)malloc(length);
+        if (packed) {
+            packedLength = lzssCompress(data, length, packed, length - 1);
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(_txLock);
+    TxMessage* message = _reserveTxMessage();
+    if (message && packedLength > 0) {
+        message->data.concat((const char*)packed, packedLength);
+        message->compressed = true;
+    } else if (message) {
+        message->data.concat((const char*)data, length);
+    }
+    free(packed);
+}
+
+bool BLEConfigService::sendFramedFile(const String& prefix, const String& path, uint32_t offset, uint32_t length,
+                                      const String& suffix) {
+    if (!isConnected() || !_framedClient) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_txLock);
+    TxMessage* message = _reserveTxMessage();
+    if (!message) {
+        return false;
+    }
+    message->data = prefix;
+    message->path = path;
+    message->fileOffset = offset;
+    message->fileLength = length;
+    message->suffix = suffix;
+    return true;
+}
+
+// Caller holds _txLock. An empty entry at the tail of the queue, or nullptr when full.
+BLEConfigService::TxMessage* BLEConfigService::_reserveTxMessage() {
+    if (_txCount >= BLE_TX_QUEUE_DEPTH) {
+        DEBUG_PRINTLN("ERROR: framed send queue full, message dropped");
+        return nullptr;
+    }
+    TxMessage& message = _txQueue[(_txHead + _txCount) % BLE_TX_QUEUE_DEPTH];
+    message.data = "";
+    message.path = "";
+    message.fileOffset = 0;
+    message.fileLength = 0;
+    message.suffix = "";
+    message.compressed = false;
+    _txCount++;
+    return &message;
+}
+
+// Caller holds _rxLock and _txLock
+void BLEConfigService::_resetTransport() {
+    for (uint8_t i = 0; i < BLE_TX_QUEUE_DEPTH; i++) {
+        _txQueue[i].data = "";
+        _txQueue[i].path = "";
+        _txQueue[i].fileLength = 0;
+        _txQueue[i].suffix = "";
+    }
+    if (_txFile) {
+        _txFile.close();
+    }
+    _txHead = 0;
+    _txCount = 0;
+    _txBase = 0;
+    _txFrameCount = 0;
+    _txAborted = false;
+    _txPayload = 0;
+    _txNext = 0;
+    _txAcked = 0;
+    _txSacked = 0;
+    _peerWindow = BLE_RX_WINDOW_FRAMES;
+    _congestionWindow = 2;
+    _srttMs = 100;
+    _rtoMs = 300;
+    _txRetransmitted = 0;
+    _txProgressAt = 0;
+    _ackInbox = 0;
+    
+    for (uint8_t i = 0; i < BLE_RX_WINDOW_FRAMES; i++) {
+        _rxSlots[i].used = false;
+    }
+    _rxSequence = 0;
+    _rxSinceAck = 0;
+    _rxLastFrameAt = 0;
+    _rxAdvertisedWindow = BLE_RX_WINDOW_FRAMES;
+    _rxAckPending = false;
+    _rxBuffer = "";
+    _isReceivingChunked = false;
+    _rxCompressed = false;
+    _framedClient = false;
+    _txCompression = false;
+}
+
+void BLEConfigService::_applyAck(uint64_t ack) {
+    uint16_t cumulative = (ack >> 40) & 0xFFFF;
+    uint16_t advanced = cumulative - _txAcked;
+    if (advanced > (uint16_t)(_txNext - _txAcked)) {
+        return;  // Older than what we already have
+    }
+    _peerWindow = (ack >> 32) & 0xFF;
+    _txSacked = ack & 0xFFFFFFFF;
+    if (advanced == 0) {
+        return;
+    }
+    
+    uint32_t now = millis();
+    uint8_t lastSlot = (uint16_t)(cumulative - 1) % BLE_FRAME_WINDOW;
+    if (!(_txRetransmitted & (1UL << lastSlot))) {
+        uint32_t rtt = now - _txSentAt[lastSlot];
+        _srttMs = (7UL * _srttMs + rtt) / 8;
+        _rtoMs = constrain(2 * _srttMs, BLE_TX_RTO_MIN_MS, BLE_TX_RTO_MAX_MS);
+    }
+    for (uint16_t sequence = _txAcked; sequence != cumulative; sequence++) {
+        _txRetransmitted &= ~(1UL << (sequence % BLE_FRAME_WINDOW));
+    }
+    _txAcked = cumulative;
+    _txProgressAt = now;
+    // Additive increase per ack; halved on timeouts below
+    if (_congestionWindow < BLE_FRAME_WINDOW) _congestionWindow++;
+}
+
+bool BLEConfigService::_startNextMessage() {
+    if (_txCount == 0) {
+        return false;
+    }
+    TxMessage& message = _txQueue[_txHead];
+    if (message.fileLength > 0) {
+        _txFile = LittleFS.open(message.path, "r");
+        if (!_txFile) {
+            DEBUG_PRINTF("ERROR: %s unreadable, message dropped\n", message.path.c_str());
+            _finishMessage();
+            return false;
+        }
+    }
+    size_t length = message.data.length() + message.fileLength + message.suffix.length();
+    _txPayload = getFramePayloadSize();
+    _txFrameCount = length == 0 ? 1 : (length + _txPayload - 1) / _txPayload;
+    _txAborted = false;
+    _txBase = _txNext;
+    _txProgressAt = millis();
+    return true;
+}
+
+void BLEConfigService::_finishMessage() {
+    TxMessage& message = _txQueue[_txHead];
+    message.data = "";
+    message.path = "";
+    message.fileLength = 0;
+    message.suffix = "";
+    if (_txFile) {
+        _txFile.close();
+    }
+    _txHead = (_txHead + 1) % BLE_TX_QUEUE_DEPTH;
+    _txCount--;
+    _txFrameCount = 0;
+}
+
+bool BLEConfigService::_sendDataFrame(uint16_t sequence) {
+    const TxMessage& message = _txQueue[_txHead];
+    uint16_t index = sequence - _txBase;
+    size_t offset = (size_t)index * _txPayload;
+    size_t length = message.data.length() + message.fileLength + message.suffix.length();
+    size_t len = min((size_t)_txPayload, length - offset);
+    if (!_txAborted && !_readTxMessage(offset, _txFrame + FRAME_HEADER_SIZE, len)) {
+        // The file went away under the message: end it here rather than send
+        // wrong bytes. Frames already numbered still go out, as abort frames too.
+        DEBUG_PRINTF("ERROR: %s changed while being sent, message aborted\n", message.path.c_str());
+        _txAborted = true;
+        _txFrameCount = max((uint16_t)(index + 1), (uint16_t)(_txNext - _txBase));
+    }
+    
+    uint8_t flags = 0;
+    if (_txAborted) {
+        flags = FRAME_FLAG_ABORT;
+        len = 0;
+    } else if (index == 0) {
+        flags = FRAME_FLAG_FIRST | (message.compressed ? FRAME_FLAG_COMPRESSED : 0);
+    }
+    if (index == _txFrameCount - 1) flags |= FRAME_FLAG_LAST;
+    
+    _txFrame[0] = FRAME_MARKER;
+    _txFrame[1] = flags;
+    _txFrame[2] = sequence & 0xFF;
+    _txFrame[3] = sequence >> 8;
+    _txFrame[4] = len & 0xFF;
+    _txFrame[5] = len >> 8;
+    return _evtChar->notify(_txFrame, FRAME_HEADER_SIZE + len);
+}
+
+// Bytes [offset, offset + length) of the head message. False when the file
+// part comes out short: it was removed or rewritten under the message.
+bool BLEConfigService::_readTxMessage(size_t offset, uint8_t* out, size_t length) {
+    const TxMessage& message = _txQueue[_txHead];
+    size_t prefixLength = message.data.length();
+    size_t fileEnd = prefixLength + message.fileLength;
+    
+    while (length > 0) {
+        size_t n;
+        if (offset < prefixLength) {
+            n = min(length, prefixLength - offset);
+            memcpy(out, message.data.c_str() + offset, n);
+        } else if (offset < fileEnd) {
+            n = min(length, fileEnd - offset);
+            uint32_t position = message.fileOffset + (offset - prefixLength);
+            size_t got = 0;
+            if (_txFile && (_txFile.position() == position || _txFile.seek(position))) {
+                got = _txFile.read(out, n);
+            }
+            if (got < n) {
+                DEBUG_PRINTF("ERROR: short read of %s at %u\n", message.path.c_str(), position);
+                return false;
+            }
+        } else {
+            n = min(length, message.suffix.length() - (offset - fileEnd));
+            memcpy(out, message.suffix.c_str() + (offset - fileEnd), n);
+        }
+        out += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Sliding-window sender: keeps up to min(congestion window, peer's receive
+// window) frames in flight, resends SACK holes at once and anything unacked
+// after the adaptive RTO, and halves the window on timeouts.
+// False when the peer has stopped acking and the transport should be reset.
+bool BLEConfigService::_pumpTransmit() {
+    std::lock_guard<std::mutex> lock(_txLock);
+    
+    uint64_t ack = _ackInbox.exchange(0);
+    if (ack) {
+        _applyAck(ack);
+    }
+    if (_txFrameCount > 0 && (uint16_t)(_txAcked - _txBase) >= _txFrameCount) {
+        _finishMessage();
+    }
+    if (_txFrameCount == 0 && !_startNextMessage()) {
+        return true;
+    }
+    
+    uint32_t now = millis();
+    if (now - _txProgressAt > BLE_TX_GIVE_UP_MS) {
+        return false;
+    }
+    
+    // Frames past the highest one the peer reports holding were not necessarily lost
+    uint16_t inFlight = _txNext - _txAcked;
+    uint16_t holeLimit = 0;
+    for (uint8_t bit = 0; bit < 32; bit++) {
+        if (_txSacked & (1UL << bit)) holeLimit = bit + 1;
+    }
+    
+    bool timedOut = false;
+    for (uint16_t i = 0; i < inFlight; i++) {
+        if (i > 0 && (_txSacked & (1UL << (i - 1)))) continue;
+        uint16_t sequence = _txAcked + i;
+        uint8_t slot = sequence % BLE_FRAME_WINDOW;
+        bool hole = i < holeLimit && !(_txRetransmitted & (1UL << slot));
+        bool expired = now - _txSentAt[slot] > _rtoMs;
+        if (!hole && !expired) continue;
+        
+        if (!_sendDataFrame(sequence)) return true;  // Stack buffers full; next loop
+        timedOut |= expired;
+        _txRetransmitted |= 1UL << slot;
+        _txSentAt[slot] = now;
+    }
+    if (timedOut) {
+        _congestionWindow = max(1, _congestionWindow / 2);
+        _rtoMs = min(_rtoMs * 2, BLE_TX_RTO_MAX_MS);
+    }
+    
+    uint16_t limit = min((uint16_t)_congestionWindow, _peerWindow);
+    while ((uint16_t)(_txNext - _txAcked) < limit && (uint16_t)(_txNext - _txBase) < _txFrameCount) {
+        if (!_sendDataFrame(_txNext)) {
+            // Local buffers are the bottleneck: stop growing past what fits
+            _congestionWindow = max(1, (int)(_txNext - _txAcked));
+            break;
+        }
+        uint8_t slot = _txNext % BLE_FRAME_WINDOW;
+        _txSentAt[slot] = now;
+        _txRetransmitted &= ~(1UL << slot);
+        _txNext++;
     }
+    return true;
 }
 
 void BLEConfigService::sendChunked(const String& message) {
@@ -244,7 +1013,7 @@ void BLEConfigService::sendChunked(const String& message) {
 // Characteristic callbacks
 void ConfigCharCallbacks::onWrite(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo) {
     if (BLEConfigService::_instance) {
-        BLEConfigService::_instance->handleWrite(pCharacteristic);
+        BLEConfigService::_instance->handleWrite(pCharacteristic, connInfo);
     }
 }
 
@@ -3,7 +3,11 @@
 
 #include <Arduino.h>
 #include <NimBLEDevice.h>
+#include <LittleFS.h>
+#include <atomic>
+#include <mutex>
 #include "config.h"
+#include "lzss.h"
 
 // Forward declaration
 class ProtocolHandler;
@@ -15,14 +19,37 @@ public:
     void begin(ProtocolHandler* handler);
     void update();
     
-    // Send events to connected clients
+    // Send events to connected clients. Framed messages are queued and paced out by update().
     void sendEvent(const String& jsonEvent);
+    void sendBinary(const uint8_t* data, size_t length);  // MessagePack messages (always framed)
+    // One framed message made of `prefix`, `length` bytes of the file at `path`
+    // from `offset`, then `suffix`. The file is read a frame at a time as the
+    // message goes out. False (nothing queued) unless the client uses frames.
+    bool sendFramedFile(const String& prefix, const String& path, uint32_t offset, uint32_t length,
+                        const String& suffix);
+    bool isFramedClient() const;
+    // True while a sendFramedFile message for `path` is queued or going out
+    bool isSendingFile(const String& path);
+    // LZSS-compress framed messages to this client (negotiated through getCaps;
+    // off again on disconnect). Compressed messages from the client are always accepted.
+    void setTxCompression(bool enabled);
+    bool isTxCompressed() const;
+    uint16_t getFramePayloadSize() const;
+    bool isTransmitIdle();
+    // Room for a request's replies (PROTOCOL_REPLY_MESSAGES), with one message
+    // left for a refusal from the BLE task. Always true for a chunked client.
+    bool hasTxRoom();
     
     // Connection status
     bool isConnected();
     uint32_t getClientCount();
     bool isConfigClientActive();  // True after at least one CMD write from connected client
     
+    // Reassembly stats (getStats): completed multi-write messages and the heap
+    // allocations the last one needed
+    uint32_t getRxTransferCount() const;
+    uint8_t getRxTransferAllocations() const;
+    
     friend class ConfigCharCallbacks;
     
 private:
@@ -34,22 +61,111 @@ private:
     
     ProtocolHandler* _protocolHandler;
     
-    bool _configClientActive;  // True when we have received a CMD write this connection (browser config client)
+    std::atomic<bool> _configClientActive;  // True when we have received a CMD write this connection (browser config client)
     
+    // Reassembly: chunks and frames are written straight into _rxBuffer, which is
+    // reserved once per message and then handed to the protocol handler
     String _rxBuffer;
+    size_t _rxReserved;           // Capacity reserved in _rxBuffer for this message
     bool _isReceivingChunked;
-    uint16_t _chunkIndex;
+    uint16_t _chunkIndex;         // Distinct chunks received
     uint16_t _totalChunks;
+    uint16_t _chunkStride;        // Decoded bytes per chunk (all but the last); 0 until known
+    uint16_t _lastChunkLength;
+    uint32_t _chunkAt;            // millis() of the last chunk
+    uint8_t _chunkSeen[BLE_MAX_CHUNKS / 8];
+    uint8_t _chunkTail[512];      // Last chunk, when it arrives before the stride is known
+    uint8_t _rxAllocations;       // Heap allocations for the message in progress
+    uint8_t _rxTransferAllocations;
+    uint32_t _rxTransfers;
+    bool _rxCompressed;           // Framed message in progress is an LZSS stream
+    LzssDecoder _rxDecoder;
+    
+    // Binary framing: enabled for a connection once its client sends a frame
+    std::atomic<bool> _framedClient;
+    uint16_t _peerMtu;            // ATT MTU of the config client
+    uint16_t _configConnHandle;   // Connection that last wrote CMD/BULK
+    uint32_t _lastClientCount;
+    
+    // Receiver: frames ahead of a gap wait in slots until the gap is filled
+    struct RxSlot {
+        bool used;
+        uint8_t flags;
+        uint16_t length;
+        uint8_t data[512 - 6];   // Largest frame payload
+    };
+    RxSlot _rxSlots[BLE_RX_WINDOW_FRAMES];
+    uint16_t _rxSequence;         // Next expected inbound frame (our cumulative ack)
+    uint8_t _rxSinceAck;          // Frames taken in order since the last ack
+    uint32_t _rxLastFrameAt;
+    uint16_t _rxAdvertisedWindow;
+    std::atomic<bool> _rxAckPending;
+    std::mutex _rxLock;           // Receive state and reassembly: written by the BLE task, acked and reset from the loop
+    
+    // Sender: sliding window over the message at the head of the queue.
+    // Frames are rebuilt from the message on retransmit, so nothing else is kept.
+    // A message is `data`, then an optional file range, then `suffix`.
+    struct TxMessage {
+        String data;
+        String path;
+        uint32_t fileOffset;
+        uint32_t fileLength;
+        String suffix;
+        bool compressed;          // `data` is an LZSS stream
+    };
+    TxMessage _txQueue[BLE_TX_QUEUE_DEPTH];
+    File _txFile;                 // Open while a file-backed message is in flight
+    std::atomic<bool> _txCompression;
+    uint8_t _txHead;
+    uint8_t _txCount;
+    std::mutex _txLock;           // Queue is filled from the BLE task and the loop
+    uint16_t _txBase;             // Sequence of the current message's first frame
+    uint16_t _txFrameCount;       // 0 when no message is in flight
+    bool _txAborted;              // Its file changed: the rest goes out as abort frames
+    uint16_t _txPayload;          // Frame payload size, fixed per message
+    uint16_t _txNext;             // Next sequence never sent
+    uint16_t _txAcked;            // Peer's cumulative ack
+    uint32_t _txSacked;           // Bit i: _txAcked + 1 + i received out of order
+    uint16_t _peerWindow;
+    uint8_t _congestionWindow;
+    uint16_t _srttMs;
+    uint16_t _rtoMs;
+    uint32_t _txSentAt[BLE_FRAME_WINDOW];
+    uint32_t _txRetransmitted;    // Bit per window slot; no RTT samples from these (Karn)
+    uint32_t _txProgressAt;
+    std::atomic<uint64_t> _ackInbox;   // Latest ack frame, handed from the BLE task to update()
+    uint8_t _txFrame[512];        // Kept off the task stack
     
     static BLEConfigService* _instance;
     
     // Callbacks
     static void onWrite(NimBLECharacteristic* pChar);
-    void handleWrite(NimBLECharacteristic* pChar);
+    void handleWrite(NimBLECharacteristic* pChar, NimBLEConnInfo& connInfo);
     
     // Chunking support
-    void handleChunkedMessage(const String& chunk);
+    void handleChunkedMessage(const uint8_t* data, size_t length);
+    void handleFrame(const uint8_t* data, size_t length);
     void sendChunked(const String& message);
+    void sendFramed(const uint8_t* data, size_t length);
+    void _beginChunkedTransfer(uint16_t totalChunks);
+    void _abandonChunkedTransfer();
+    bool _reserveRx(size_t size);
+    void _deliverRx();
+    
+    // Windowed transfer
+    void _resetTransport();
+    void _resetTransportLocked();
+    bool _isPeerConnected(uint16_t connHandle);
+    uint16_t _receiveWindow();
+    void _acceptFrame(uint8_t flags, const uint8_t* payload, uint16_t length);
+    bool _sendAck();
+    void _applyAck(uint64_t ack);
+    bool _pumpTransmit();
+    bool _startNextMessage();
+    void _finishMessage();
+    bool _sendDataFrame(uint16_t sequence);
+    TxMessage* _reserveTxMessage();
+    bool _readTxMessage(size_t offset, uint8_t* out, size_t length);
 };
 
 // Server callbacks (NimBLE 1.4 uses NimBLEConnInfo in callbacks)
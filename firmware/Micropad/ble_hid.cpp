@@ -16,6 +16,8 @@ public:
         (void)connInfo;
         Serial.printf("[BLE] Client connected, conn_id=%d (total %d)\n", connInfo.getConnHandle(), pServer->getConnectedCount());
         if (g_pKeyboard) g_pKeyboard->onConnect();
+        // Longer link-layer packets so MTU-sized config frames aren't split on air
+        pServer->setDataLen(connInfo.getConnHandle(), BLE_DATA_LENGTH_OCTETS);
         // Keep advertising so a second central can connect (PC HID + browser config at once).
         // Requires CONFIG_BT_NIMBLE_MAX_CONNECTIONS >= 2 in NimBLE library (see MULTI_CONNECTION.md).
         NimBLEDevice::startAdvertising();
@@ -140,6 +142,7 @@ void BLEKeyboard::begin(const char* deviceName, const char* manufacturer) {
     g_pKeyboard = this;
     Serial.println("[BLE] Initializing NimBLE (BLE only, no Classic SPP)...");
     NimBLEDevice::init(deviceName);
+    NimBLEDevice::setMTU(BLE_PREFERRED_MTU);
     NimBLEServer* pServer = NimBLEDevice::createServer();
     if (!pServer) {
         Serial.println("[BLE] ERROR: createServer failed");
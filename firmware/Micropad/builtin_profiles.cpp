@@ -0,0 +1,197 @@
+#include "builtin_profiles.h"
+#include "ble_hid.h"
+#include "profile_text.h"
+
+namespace {
+constexpr BuiltinAction none() {
+    return BuiltinAction{ ACTION_NONE, 0, 0, nullptr };
+}
+
+constexpr BuiltinAction hotkey(uint8_t modifiers, uint8_t key) {
+    return BuiltinAction{ ACTION_HOTKEY, modifiers, key, nullptr };
+}
+
+constexpr BuiltinAction media(MediaFunction function) {
+    return BuiltinAction{ ACTION_MEDIA, static_cast<uint8_t>(function), 0, nullptr };
+}
+
+constexpr BuiltinAction mouse(MouseAction action, int8_t value) {
+    return BuiltinAction{ ACTION_MOUSE, static_cast<uint8_t>(action), static_cast<uint8_t>(value), nullptr };
+}
+
+constexpr BuiltinAction text(const char* str) {
+    return BuiltinAction{ ACTION_TEXT, 0, 0, str };
+}
+
+constexpr BuiltinAction switchProfile(uint16_t id) {
+    return BuiltinAction{ ACTION_PROFILE, static_cast<uint8_t>(id & 0xFF), static_cast<uint8_t>(id >> 8), nullptr };
+}
+
+constexpr BuiltinEncoder encoder(BuiltinAction cw, BuiltinAction ccw, BuiltinAction press, bool acceleration) {
+    return BuiltinEncoder{ cw, ccw, press, acceleration, 4 };
+}
+
+// Volume on the left encoder, scroll on the right (General and Media)
+constexpr BuiltinEncoder VOLUME_ENCODER = encoder(
+    media(MEDIA_FUNC_VOLUME_UP), media(MEDIA_FUNC_VOLUME_DOWN), media(MEDIA_FUNC_MUTE), true);
+constexpr BuiltinEncoder SCROLL_ENCODER = encoder(
+    mouse(MOUSE_ACTION_SCROLL_DOWN, 3), mouse(MOUSE_ACTION_SCROLL_UP, 3), media(MEDIA_FUNC_PLAY_PAUSE), true);
+
+constexpr BuiltinProfile BUILTIN_PROFILES[] = {
+    {
+        0, "General", 1,
+        {
+            hotkey(MODIFIER_LEFT_CTRL, KEY_C),                          // Copy
+            hotkey(MODIFIER_LEFT_CTRL, KEY_V),                          // Paste
+            hotkey(MODIFIER_LEFT_CTRL, KEY_Z),                          // Undo
+            hotkey(MODIFIER_LEFT_CTRL, KEY_Y),                          // Redo
+            hotkey(MODIFIER_LEFT_ALT, KEY_TAB),                         // Switch window
+            hotkey(MODIFIER_LEFT_GUI, KEY_D),                           // Show desktop
+            hotkey(MODIFIER_LEFT_GUI | MODIFIER_LEFT_SHIFT, KEY_S),     // Screenshot
+            hotkey(MODIFIER_LEFT_GUI, KEY_E),                           // Explorer
+            media(MEDIA_FUNC_PREV),
+            media(MEDIA_FUNC_PLAY_PAUSE),
+            media(MEDIA_FUNC_NEXT),
+            text("https://www.youtube.com\n")                           // Open YouTube from the address bar
+        },
+        { VOLUME_ENCODER, SCROLL_ENCODER }
+    },
+    {
+        1, "Media", 1,
+        {
+            media(MEDIA_FUNC_PREV),
+            media(MEDIA_FUNC_PLAY_PAUSE),
+            media(MEDIA_FUNC_NEXT),
+            media(MEDIA_FUNC_STOP),
+            media(MEDIA_FUNC_VOLUME_DOWN),
+            media(MEDIA_FUNC_MUTE),
+            media(MEDIA_FUNC_VOLUME_UP),
+            none(), none(), none(), none(),
+            switchProfile(0)
+        },
+        { VOLUME_ENCODER, SCROLL_ENCODER }
+    },
+    {
+        2, "VS Code", 1,
+        {
+            hotkey(MODIFIER_LEFT_CTRL, KEY_S),                          // Save
+            hotkey(MODIFIER_LEFT_CTRL | MODIFIER_LEFT_SHIFT, KEY_F),    // Find in files
+            hotkey(MODIFIER_LEFT_CTRL, KEY_P),                          // Quick open
+            hotkey(MODIFIER_LEFT_CTRL | MODIFIER_LEFT_SHIFT, KEY_P),    // Command palette
+            hotkey(0, KEY_F5),                                          // Debug
+            hotkey(MODIFIER_LEFT_CTRL, 0x35),                           // Terminal (Ctrl+`)
+            hotkey(MODIFIER_LEFT_CTRL, 0x38),                           // Comment (Ctrl+/)
+            hotkey(MODIFIER_LEFT_ALT | MODIFIER_LEFT_SHIFT, KEY_F),     // Format
+            text("console.log();"),
+            hotkey(MODIFIER_LEFT_CTRL, KEY_B),                          // Toggle sidebar
+            hotkey(MODIFIER_LEFT_CTRL, 0x31),                           // Split editor (Ctrl+\)
+            switchProfile(0)
+        },
+        {
+            // Zoom in / out / reset
+            encoder(hotkey(MODIFIER_LEFT_CTRL, 0x2E), hotkey(MODIFIER_LEFT_CTRL, 0x2D),
+                    hotkey(MODIFIER_LEFT_CTRL, KEY_0), true),
+            // Navigate forward / back, press for quick open
+            encoder(hotkey(MODIFIER_LEFT_ALT, KEY_RIGHT_ARROW), hotkey(MODIFIER_LEFT_ALT, KEY_LEFT_ARROW),
+                    hotkey(MODIFIER_LEFT_CTRL, KEY_P), false)
+        }
+    },
+    {
+        3, "Creative", 1,
+        {
+            hotkey(MODIFIER_LEFT_CTRL, KEY_Z),                          // Undo
+            hotkey(MODIFIER_LEFT_CTRL | MODIFIER_LEFT_SHIFT, KEY_Z),    // Redo
+            hotkey(MODIFIER_LEFT_CTRL, KEY_S),                          // Save
+            hotkey(MODIFIER_LEFT_CTRL | MODIFIER_LEFT_SHIFT, KEY_S),    // Save as
+            hotkey(0, KEY_B),                                           // Brush tool
+            hotkey(0, KEY_E),                                           // Eraser tool
+            hotkey(MODIFIER_LEFT_CTRL | MODIFIER_LEFT_SHIFT, KEY_N),    // New layer
+            hotkey(MODIFIER_LEFT_CTRL, KEY_E),                          // Merge layers
+            hotkey(MODIFIER_LEFT_CTRL, KEY_T),                          // Free transform
+            hotkey(MODIFIER_LEFT_CTRL, KEY_D),                          // Deselect
+            hotkey(MODIFIER_LEFT_CTRL | MODIFIER_LEFT_SHIFT, KEY_I),    // Invert selection
+            switchProfile(0)
+        },
+        {
+            // Brush size ] / [, press to undo
+            encoder(hotkey(0, 0x2F), hotkey(0, 0x2E), hotkey(MODIFIER_LEFT_CTRL, KEY_Z), true),
+            // Zoom in / out / reset
+            encoder(hotkey(MODIFIER_LEFT_CTRL, 0x57), hotkey(MODIFIER_LEFT_CTRL, 0x56),
+                    hotkey(MODIFIER_LEFT_CTRL, KEY_0), true)
+        }
+    }
+};
+
+const uint8_t BUILTIN_PROFILE_COUNT = sizeof(BUILTIN_PROFILES) / sizeof(BUILTIN_PROFILES[0]);
+
+bool expandAction(const BuiltinAction& src, Action& action) {
+    memset(&action, 0, sizeof(Action));
+    action.type = static_cast<ActionType>(src.type);
+
+    switch (src.type) {
+        case ACTION_HOTKEY:
+            action.config.hotkey.modifiers = src.arg0;
+            action.config.hotkey.key = src.arg1;
+            break;
+
+        case ACTION_TEXT:
+            return profileInternText(src.text, strnlen(src.text, TEXT_ACTION_MAX_LENGTH), action.config.text.textRef);
+
+        case ACTION_MEDIA:
+            action.config.media.function = static_cast<MediaFunction>(src.arg0);
+            break;
+
+        case ACTION_MOUSE:
+            action.config.mouse.action = static_cast<MouseAction>(src.arg0);
+            action.config.mouse.value = static_cast<int8_t>(src.arg1);
+            break;
+
+        case ACTION_PROFILE:
+            action.config.profile.profileId = src.arg0 | (src.arg1 << 8);
+            break;
+
+        default:
+            action.type = ACTION_NONE;
+            break;
+    }
+    return true;
+}
+}
+
+const BuiltinProfile* findBuiltinProfile(uint16_t id) {
+    for (uint8_t i = 0; i < BUILTIN_PROFILE_COUNT; i++) {
+        if (BUILTIN_PROFILES[i].id == id) {
+            return &BUILTIN_PROFILES[i];
+        }
+    }
+    return nullptr;
+}
+
+uint8_t getBuiltinProfileCount() {
+    return BUILTIN_PROFILE_COUNT;
+}
+
+const BuiltinProfile& getBuiltinProfile(uint8_t index) {
+    return BUILTIN_PROFILES[index];
+}
+
+bool expandBuiltinProfile(const BuiltinProfile& builtin, Profile& profile) {
+    memset(&profile, 0, sizeof(Profile));
+    profile.id = builtin.id;
+    strlcpy(profile.name, builtin.name, sizeof(profile.name));
+    profile.version = builtin.version;
+
+    bool ok = true;
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        ok = expandAction(builtin.keys[i], profile.keys[i].action) && ok;
+    }
+
+    for (uint8_t i = 0; i < 2; i++) {
+        ok = expandAction(builtin.encoders[i].cw, profile.encoders[i].cwAction) && ok;
+        ok = expandAction(builtin.encoders[i].ccw, profile.encoders[i].ccwAction) && ok;
+        ok = expandAction(builtin.encoders[i].press, profile.encoders[i].pressAction) && ok;
+        profile.encoders[i].acceleration = builtin.encoders[i].acceleration;
+        profile.encoders[i].stepsPerDetent = builtin.encoders[i].stepsPerDetent;
+    }
+    return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef BUILTIN_PROFILES_H
+#define BUILTIN_PROFILES_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "profile.h"
+
+// Factory profiles compiled into flash (rodata) as compact tables. A built-in
+// slot is served straight from here until the user saves over it; only then
+// does it get a copy on LittleFS.
+
+struct BuiltinAction {
+    uint8_t type;
+    uint8_t arg0;      // Hotkey modifiers / media function / mouse action / target profile (low byte)
+    uint8_t arg1;      // Hotkey key / mouse value / target profile (high byte)
+    const char* text;  // ACTION_TEXT only
+};
+
+struct BuiltinEncoder {
+    BuiltinAction cw;
+    BuiltinAction ccw;
+    BuiltinAction press;
+    bool acceleration;
+    uint8_t stepsPerDetent;
+};
+
+struct BuiltinProfile {
+    uint16_t id;
+    const char* name;
+    uint8_t version;
+    BuiltinAction keys[MATRIX_KEYS];
+    BuiltinEncoder encoders[2];
+};
+
+// nullptr if `id` has no built-in profile
+const BuiltinProfile* findBuiltinProfile(uint16_t id);
+
+// Table access, in ascending id order
+uint8_t getBuiltinProfileCount();
+const BuiltinProfile& getBuiltinProfile(uint8_t index);
+
+// Expand a table entry into a full Profile; false if its text didn't fit the pool
+bool expandBuiltinProfile(const BuiltinProfile& builtin, Profile& profile);
+
+#endif // BUILTIN_PROFILES_H
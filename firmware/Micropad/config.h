@@ -51,8 +51,14 @@ const uint8_t COL_PINS[MATRIX_COLS] = {21, 22, 23, 19};
 // Profile Configuration
 // ============================================
 
-#define MAX_PROFILES 8
+#ifndef MAX_PROFILES
+#define MAX_PROFILES 128          // Profiles stored at once (sizes the RAM manifest)
+#endif
+#define PROFILE_ID_MAX 0xFFFE     // Ids are sparse in 0..PROFILE_ID_MAX
+#define PROFILE_ID_NONE 0xFFFF
 #define DEFAULT_PROFILE 0
+#define PROFILE_PREVIEW_TIMEOUT_MS 120000  // Unsaved preview reverts after this long without a previewProfile
+#define PROFILE_FILE_OVERHEAD_BYTES 4096   // Flash a profile file may take beyond its bytes (one LittleFS block)
 
 // ============================================
 // Communication Configuration
@@ -70,6 +76,39 @@ const uint8_t COL_PINS[MATRIX_COLS] = {21, 22, 23, 19};
 #define EVT_CHAR_UUID "4fafc201-1fb5-459e-8fcc-c5c9c331914d"
 #define BULK_CHAR_UUID "4fafc201-1fb5-459e-8fcc-c5c9c331914e"
 
+// Config transfers: frames are sized from the ATT MTU the client negotiates
+#define BLE_PREFERRED_MTU 517          // Largest ATT MTU to accept (512-byte values + header)
+#define BLE_DATA_LENGTH_OCTETS 251     // LE Data Length Extension: one MTU-sized PDU per packet
+#define BLE_FRAME_WINDOW 16            // Most frames the device keeps in flight (congestion window cap)
+#define BLE_RX_WINDOW_FRAMES 8         // Receive window the device advertises (out-of-order frames it buffers)
+#define BLE_RX_ACK_DELAY_MS 5          // Ack a partial burst once frames stop arriving this long
+#define BLE_TX_QUEUE_DEPTH 4           // Outbound framed messages waiting their turn
+#define BLE_TX_RTO_MIN_MS 40           // Retransmit timeout bounds; adapts to the measured ack round trip
+#define BLE_TX_RTO_MAX_MS 2000
+#define BLE_TX_GIVE_UP_MS 8000         // Drop an outbound message after this long without ack progress
+#define BLE_REBOOT_FLUSH_MS 2000       // Longest reboot waits for its framed reply to be acked
+#define BLE_MAX_CHUNKS 256             // Most chunks in one legacy JSON chunked transfer
+#define BLE_MAX_MESSAGE_BYTES (BLE_MAX_CHUNKS * 384)  // Largest uncompressed inbound message: a full
+                                                      // chunked transfer of 512-byte base64 writes
+#define BLE_CHUNK_TIMEOUT_MS 5000      // A chunked transfer idle this long is abandoned by the next chunk
+#define BLE_COMPRESS_MIN_BYTES 128     // Shorter framed messages are sent as they are
+#define BLE_MAX_DECOMPRESSED_BYTES 32768  // Largest message a compressed stream may expand to
+#define PROTOCOL_QUEUE_DEPTH 8         // Requests waiting for the main loop; more get a "busy" reply
+#define PROTOCOL_QUEUE_BYTES 24576     // Request bytes they may hold (one larger request is still taken alone)
+#define PROTOCOL_REPLY_MESSAGES 2      // Framed messages one request may send (its reply, then an event)
+#define PROTOCOL_BATCH_MAX 8           // Queries in one batch request
+#define PROTOCOL_ARCHIVE_ENVELOPE_BYTES 128  // importAll request around the archive: {"v":..,"cmd":"importAll","archive":...}
+#define PROTOCOL_ARCHIVE_MAX_BYTES (BLE_MAX_MESSAGE_BYTES - PROTOCOL_ARCHIVE_ENVELOPE_BYTES)  // Largest archive
+                                                      // importAll takes back, so the most exportAll writes
+#define PROTOCOL_ARCHIVE_INLINE_BYTES (BLE_MAX_DECOMPRESSED_BYTES - PROTOCOL_ARCHIVE_ENVELOPE_BYTES)  // Largest
+                                                      // exportAll reply sent from RAM (compressed or chunked
+                                                      // clients); it goes back compressed as it came
+#define TELEMETRY_QUEUE_EVENTS 16      // Input items per "input" event (fits the event document)
+#define TELEMETRY_INTERVAL_MS 50       // Default gap between "input" events...
+#define TELEMETRY_INTERVAL_MIN_MS 20   // ...and the range a subscriber may ask for
+#define TELEMETRY_INTERVAL_MAX_MS 1000
+#define RESPONSE_CACHE_STATUS_MS 1000  // getDeviceInfo (uptime, freeHeap) is re-read at most this often
+
 // WiFi
 #define WIFI_AP_SSID "Micropad-"
 #define WIFI_AP_PASSWORD "micropad123"
@@ -88,7 +127,16 @@ const uint8_t COL_PINS[MATRIX_COLS] = {21, 22, 23, 19};
 // ============================================
 
 #define PROFILES_PATH "/profiles"
+#define PROFILE_MANIFEST_PATH PROFILES_PATH "/manifest.bin"
+#define PROFILE_JOURNAL_COMPACT_BYTES 1024  // Fold a profile's edit journal into a new snapshot past this size
+#define PROFILE_ARCHIVE_PATH "/archive.json"    // exportAll builds its reply here, removed once sent
+#define PROFILE_IMPORT_PATH "/import"           // importAll stages the archive's profiles here
+#define PROFILE_ARCHIVE_FORMAT "micropad-archive"
+#define PROFILE_ARCHIVE_VERSION 1
 #define PREFS_NAMESPACE "micropad"
+#define PERSIST_ACTIVE_PROFILE_QUIET_MS 3000  // Save the active profile id once switching settles
+#define PERSIST_STATS_QUIET_MS 60000          // Save usage counters after a minute without input...
+#define PERSIST_STATS_MAX_DELAY_MS 600000     // ...or at most this long after the first unsaved count
 
 // ============================================
 // Debug Configuration
@@ -0,0 +1,108 @@
+#include "input_telemetry.h"
+
+InputTelemetry::InputTelemetry() {
+    _count = 0;
+    _dropped = 0;
+    _encoderItem[0] = -1;
+    _encoderItem[1] = -1;
+    _enabled = false;
+    _intervalMs = TELEMETRY_INTERVAL_MS;
+    _drainedAt = 0;
+    _lastProfileId = PROFILE_ID_MAX + 1;
+}
+
+void InputTelemetry::setEnabled(bool enabled, uint16_t intervalMs) {
+    if (intervalMs != 0) {
+        _intervalMs = constrain(intervalMs, TELEMETRY_INTERVAL_MIN_MS, TELEMETRY_INTERVAL_MAX_MS);
+    }
+    // A new subscriber starts from a clean buffer and learns the active profile first
+    if (enabled != _enabled) {
+        _count = 0;
+        _dropped = 0;
+        _encoderItem[0] = -1;
+        _encoderItem[1] = -1;
+        _lastProfileId = PROFILE_ID_MAX + 1;
+    }
+    _enabled = enabled;
+}
+
+bool InputTelemetry::isEnabled() const {
+    return _enabled;
+}
+
+uint16_t InputTelemetry::getIntervalMs() const {
+    return _intervalMs;
+}
+
+void InputTelemetry::recordKey(uint8_t key, bool down) {
+    if (!_enabled) return;
+    _append(INPUT_EVENT_KEY, key, down ? 1 : 0);
+}
+
+void InputTelemetry::recordEncoderTurn(uint8_t encoder, int8_t delta) {
+    if (!_enabled || encoder >= 2) return;
+    
+    // Coalesced: one item per encoder per event, however fast it spins
+    int8_t index = _encoderItem[encoder];
+    if (index >= 0) {
+        _items[index].value += delta;
+        return;
+    }
+    Item* item = _append(INPUT_EVENT_ENCODER, encoder, delta);
+    if (item) {
+        _encoderItem[encoder] = item - _items;
+    }
+}
+
+void InputTelemetry::recordEncoderButton(uint8_t encoder, bool down) {
+    if (!_enabled) return;
+    _append(INPUT_EVENT_ENCODER_BUTTON, encoder, down ? 1 : 0);
+}
+
+void InputTelemetry::recordProfile(uint16_t id) {
+    // Checked every pass: with the buffer full it waits for the next event instead of counting as dropped
+    if (!_enabled || id == _lastProfileId || _count >= TELEMETRY_QUEUE_EVENTS) return;
+    _append(INPUT_EVENT_PROFILE, 0, id);
+    _lastProfileId = id;
+}
+
+bool InputTelemetry::isDue(uint32_t now) const {
+    return _enabled && (_count > 0 || _dropped > 0) && now - _drainedAt >= _intervalMs;
+}
+
+void InputTelemetry::drain(JsonDocument& payload, uint32_t now) {
+    // Times are offsets from the first item, which keeps each item to a few bytes
+    uint32_t base = _count > 0 ? _items[0].at : now;
+    payload["at"] = base;
+    JsonArray items = payload.createNestedArray("e");
+    for (uint8_t i = 0; i < _count; i++) {
+        JsonArray item = items.createNestedArray();
+        item.add(_items[i].at - base);
+        item.add(_items[i].kind);
+        item.add(_items[i].index);
+        item.add(_items[i].value);
+    }
+    if (_dropped > 0) {
+        payload["dropped"] = _dropped;
+    }
+    
+    _count = 0;
+    _dropped = 0;
+    _encoderItem[0] = -1;
+    _encoderItem[1] = -1;
+    _drainedAt = now;
+}
+
+InputTelemetry::Item* InputTelemetry::_append(InputEventKind kind, uint8_t index, int32_t value) {
+    // While the link is backed up the buffer fills; later input is counted, not kept
+    if (_count >= TELEMETRY_QUEUE_EVENTS) {
+        if (_dropped < 0xFFFF) _dropped++;
+        return nullptr;
+    }
+    Item& item = _items[_count++];
+    item.at = millis();
+    item.value = value;
+    item.kind = kind;
+    item.index = index;
+    return &item;
+}
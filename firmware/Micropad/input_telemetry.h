@@ -0,0 +1,59 @@
+#ifndef INPUT_TELEMETRY_H
+#define INPUT_TELEMETRY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+
+// Item kinds of an "input" event (see subscribeEvents)
+enum InputEventKind : uint8_t {
+    INPUT_EVENT_KEY = 0,             // index = key, value = 1 down / 0 up
+    INPUT_EVENT_ENCODER,             // index = encoder, value = detents (+ clockwise), summed per event
+    INPUT_EVENT_ENCODER_BUTTON,      // index = encoder, value = 1 down / 0 up
+    INPUT_EVENT_PROFILE              // value = active profile id
+};
+
+// Live input for a subscribed config client. The main loop records what it
+// has already sent as HID; the protocol handler drains the buffer into one
+// event per interval. Recording is a single check while nobody is subscribed.
+class InputTelemetry {
+public:
+    InputTelemetry();
+    
+    // Subscription; an interval of 0 keeps the current one
+    void setEnabled(bool enabled, uint16_t intervalMs = 0);
+    bool isEnabled() const;
+    uint16_t getIntervalMs() const;
+    
+    void recordKey(uint8_t key, bool down);
+    void recordEncoderTurn(uint8_t encoder, int8_t delta);
+    void recordEncoderButton(uint8_t encoder, bool down);
+    // Recorded only when it differs from the last id seen
+    void recordProfile(uint16_t id);
+    
+    // Something is waiting and the interval since the last drain has passed
+    bool isDue(uint32_t now) const;
+    // Move the waiting items into `payload` ("at", "e", "dropped") and start a new interval
+    void drain(JsonDocument& payload, uint32_t now);
+    
+private:
+    struct Item {
+        uint32_t at;          // millis()
+        int32_t value;
+        uint8_t kind;         // InputEventKind
+        uint8_t index;
+    };
+    Item _items[TELEMETRY_QUEUE_EVENTS];
+    uint8_t _count;
+    uint16_t _dropped;        // Items lost to a full buffer since the last drain
+    int8_t _encoderItem[2];   // Item this interval's turns of each encoder add to, or -1
+    
+    bool _enabled;
+    uint16_t _intervalMs;
+    uint32_t _drainedAt;
+    uint32_t _lastProfileId;  // Above PROFILE_ID_MAX until the first one is recorded
+    
+    Item* _append(InputEventKind kind, uint8_t index, int32_t value);
+};
+
+#endif // INPUT_TELEMETRY_H
@@ -0,0 +1,164 @@
+#include "lzss.h"
+
+namespace {
+const uint16_t WINDOW_SIZE = 1 << LZSS_WINDOW_BITS;
+const uint8_t HASH_BITS = 12;
+const uint16_t NO_POSITION = 0xFFFF;
+const uint8_t MAX_CHAIN = 32;  // Candidates tried per position; bounds the worst case
+
+inline uint16_t hash3(const uint8_t* p) {
+    uint32_t key = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (uint32_t)(key * 2654435761u) >> (32 - HASH_BITS);
+}
+}
+
+size_t lzssCompress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity) {
+    if (length > LZSS_MAX_INPUT || capacity < LZSS_HEADER_SIZE) {
+        return 0;
+    }
+    
+    // head: newest position per hash; prev: the position before it with the same hash
+    uint16_t* head = (uint16_t*)malloc((1 << HASH_BITS) * sizeof(uint16_t));
+    uint16_t* prev = (uint16_t*)malloc(WINDOW_SIZE * sizeof(uint16_t));
+    if (!head || !prev) {
+        free(head);
+        free(prev);
+        return 0;
+    }
+    memset(head, 0xFF, (1 << HASH_BITS) * sizeof(uint16_t));
+    
+    out[0] = (uint8_t)length;
+    out[1] = (uint8_t)(length >> 8);
+    out[2] = (uint8_t)(length >> 16);
+    out[3] = (uint8_t)(length >> 24);
+    size_t written = LZSS_HEADER_SIZE;
+    size_t flagAt = 0;
+    uint8_t flagBits = 8;  // Forces a new group on the first item
+    size_t position = 0;
+    bool fits = true;
+    
+    while (position < length) {
+        if (flagBits == 8) {
+            if (written >= capacity) {
+                fits = false;
+                break;
+            }
+            flagAt = written++;
+            out[flagAt] = 0;
+            flagBits = 0;
+        }
+        
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+        size_t maxLength = min((size_t)LZSS_MAX_MATCH, length - position);
+        if (maxLength >= LZSS_MIN_MATCH) {
+            uint16_t candidate = head[hash3(in + position)];
+            for (uint8_t steps = 0; steps < MAX_CHAIN && candidate != NO_POSITION && candidate < position; steps++) {
+                size_t distance = position - candidate;
+                if (distance > WINDOW_SIZE) break;
+                size_t matched = 0;
+                while (matched < maxLength && in[candidate + matched] == in[position + matched]) {
+                    matched++;
+                }
+                if (matched > bestLength) {
+                    bestLength = matched;
+                    bestDistance = distance;
+                    if (matched == maxLength) break;
+                }
+                uint16_t older = prev[candidate & (WINDOW_SIZE - 1)];
+                if (older >= candidate) break;  // Slot reused by a newer position
+                candidate = older;
+            }
+        }
+        
+        size_t advance;
+        if (bestLength >= LZSS_MIN_MATCH) {
+            if (written + 2 > capacity) {
+                fits = false;
+                break;
+            }
+            out[written++] = (uint8_t)(bestDistance - 1);
+            out[written++] = (uint8_t)(((bestDistance - 1) >> 8) | ((bestLength - LZSS_MIN_MATCH) << 2));
+            advance = bestLength;
+        } else {
+            if (written + 1 > capacity) {
+                fits = false;
+                break;
+            }
+            out[flagAt] |= 1 << flagBits;
+            out[written++] = in[position];
+            advance = 1;
+        }
+        flagBits++;
+        
+        // Index every position covered, so later matches can start inside this one
+        for (size_t end = position + advance; position < end; position++) {
+            if (position + LZSS_MIN_MATCH <= length) {
+                uint16_t h = hash3(in + position);
+                prev[position & (WINDOW_SIZE - 1)] = head[h];
+                head[h] = position;
+            }
+        }
+    }
+    
+    free(head);
+    free(prev);
+    return fits ? written : 0;
+}
+
+uint32_t lzssOriginalLength(const uint8_t* stream) {
+    return (uint32_t)stream[0] | ((uint32_t)stream[1] << 8) | ((uint32_t)stream[2] << 16) |
+           ((uint32_t)stream[3] << 24);
+}
+
+LzssDecoder::LzssDecoder() {
+    begin(nullptr, 0);
+}
+
+void LzssDecoder::begin(uint8_t* out, size_t length) {
+    _out = out;
+    _length = length;
+    _produced = 0;
+    _flags = 0;
+    _flagBits = 0;
+    _haveMatchLow = false;
+    _matchLow = 0;
+}
+
+bool LzssDecoder::feed(const uint8_t* in, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        uint8_t byte = in[i];
+        if (_flagBits == 0) {
+            _flags = byte;
+            _flagBits = 8;
+            continue;
+        }
+        
+        if (_flags & 1) {
+            if (_produced >= _length) return false;
+            _out[_produced++] = byte;
+        } else if (!_haveMatchLow) {
+            _matchLow = byte;
+            _haveMatchLow = true;
+            continue;
+        } else {
+            _haveMatchLow = false;
+            size_t distance = (_matchLow | ((size_t)(byte & 0x03) << 8)) + 1;
+            size_t count = (byte >> 2) + LZSS_MIN_MATCH;
+            if (distance > _produced || count > _length - _produced) return false;
+            // Byte by byte: a match may overlap the bytes it produces
+            const uint8_t* from = _out + _produced - distance;
+            for (size_t n = 0; n < count; n++) {
+                _out[_produced + n] = from[n];
+            }
+            _produced += count;
+        }
+        _flags >>= 1;
+        _flagBits--;
+    }
+    return true;
+}
+
+bool LzssDecoder::finished() const {
+    return _produced == _length && !_haveMatchLow;
+}
@@ -0,0 +1,54 @@
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <Arduino.h>
+
+// LZSS codec for config transfers. Profile JSON repeats the same field names
+// in every key, encoder and macro step, so short back-references win most of
+// the bytes back.
+//
+// Stream: original length (uint32, little-endian), then groups of a flag byte
+// and up to 8 items, flag bit 0 first. Bit set: one literal byte. Bit clear: a
+// 2-byte match, byte 0 = (distance - 1) & 0xFF, byte 1 = (distance - 1) >> 8 |
+// (length - 3) << 2, copying `length` bytes from `distance` back in the output.
+//
+// The decoder keeps no window of its own (matches read the output buffer), so
+// a stream can be decoded as it arrives, straight into the message buffer.
+
+#define LZSS_HEADER_SIZE 4
+#define LZSS_WINDOW_BITS 10                  // 1 KB window
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 63)
+#define LZSS_MAX_INPUT 65534                 // Encoder positions are 16-bit
+
+// Compress `length` bytes into `out`. Returns the stream size, or 0 when it
+// would not fit in `capacity` (the data doesn't compress) or no memory was
+// available for the ~10 KB of match tables.
+size_t lzssCompress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity);
+
+// Original length from a stream's header (at least LZSS_HEADER_SIZE bytes)
+uint32_t lzssOriginalLength(const uint8_t* stream);
+
+// Incremental decoder: feed the stream after its header in pieces of any size
+class LzssDecoder {
+public:
+    LzssDecoder();
+    
+    void begin(uint8_t* out, size_t length);
+    // False once the stream is corrupt (a match reaches before the start, or
+    // output would pass the length from the header)
+    bool feed(const uint8_t* in, size_t length);
+    // Every byte of the original was produced
+    bool finished() const;
+    
+private:
+    uint8_t* _out;
+    size_t _length;
+    size_t _produced;
+    uint8_t _flags;
+    uint8_t _flagBits;       // Items left in the current group
+    bool _haveMatchLow;      // First byte of a match split across feeds
+    uint8_t _matchLow;
+};
+
+#endif // LZSS_H
@@ -0,0 +1,167 @@
+#include "persistence_service.h"
+
+PersistenceService::PersistenceService() {
+    _initialized = false;
+    _activeProfileId = DEFAULT_PROFILE;
+    _savedActiveProfileId = DEFAULT_PROFILE;
+    memset(&_stats, 0, sizeof(_stats));
+    _dirty = 0;
+    _activeChangedAt = 0;
+    _statsChangedAt = 0;
+    _statsDirtySince = 0;
+    _writeCount = 0;
+    _flushCount = 0;
+    _lastFlushMicros = 0;
+    _maxFlushMicros = 0;
+}
+
+bool PersistenceService::init() {
+    if (_initialized) {
+        return true;
+    }
+    
+    if (!_prefs.begin(PREFS_NAMESPACE, false)) {
+        DEBUG_PRINTLN("ERROR: Failed to open preferences");
+        return false;
+    }
+    
+    // Ids were stored as a single byte before sparse ids
+    _activeProfileId = _prefs.getUShort("activeProfileId", _prefs.getUChar("activeProfile", DEFAULT_PROFILE));
+    _savedActiveProfileId = _activeProfileId;
+    
+    if (_prefs.getBytesLength("stats") == sizeof(_stats)) {
+        _prefs.getBytes("stats", &_stats, sizeof(_stats));
+    }
+    
+    _initialized = true;
+    return true;
+}
+
+void PersistenceService::update() {
+    if (_dirty == 0) return;
+    
+    uint32_t now = millis();
+    uint8_t due = 0;
+    
+    if ((_dirty & PERSIST_DIRTY_ACTIVE_PROFILE) && now - _activeChangedAt >= PERSIST_ACTIVE_PROFILE_QUIET_MS) {
+        due |= PERSIST_DIRTY_ACTIVE_PROFILE;
+    }
+    if ((_dirty & PERSIST_DIRTY_STATS) &&
+        (now - _statsChangedAt >= PERSIST_STATS_QUIET_MS || now - _statsDirtySince >= PERSIST_STATS_MAX_DELAY_MS)) {
+        due |= PERSIST_DIRTY_STATS;
+    }
+    
+    if (due) {
+        _write(due);
+    }
+}
+
+void PersistenceService::flush() {
+    if (_dirty) {
+        _write(_dirty);
+    }
+}
+
+void PersistenceService::clear() {
+    if (_initialized) {
+        _prefs.clear();
+        _writeCount++;
+    }
+    _activeProfileId = DEFAULT_PROFILE;
+    _savedActiveProfileId = DEFAULT_PROFILE;
+    memset(&_stats, 0, sizeof(_stats));
+    _dirty = 0;
+}
+
+uint16_t PersistenceService::getActiveProfileId() const {
+    return _activeProfileId;
+}
+
+void PersistenceService::setActiveProfileId(uint16_t id) {
+    _activeProfileId = id;
+    _activeChangedAt = millis();
+    _dirty |= PERSIST_DIRTY_ACTIVE_PROFILE;
+}
+
+void PersistenceService::recordKeyPress(uint8_t key) {
+    if (key >= MATRIX_KEYS) return;
+    _stats.keyPresses[key]++;
+    _statsChangedAt = millis();
+    if (!(_dirty & PERSIST_DIRTY_STATS)) {
+        _statsDirtySince = _statsChangedAt;
+        _dirty |= PERSIST_DIRTY_STATS;
+    }
+}
+
+void PersistenceService::recordEncoderTurn(uint8_t encoder) {
+    if (encoder >= 2) return;
+    _stats.encoderTurns[encoder]++;
+    _statsChangedAt = millis();
+    if (!(_dirty & PERSIST_DIRTY_STATS)) {
+        _statsDirtySince = _statsChangedAt;
+        _dirty |= PERSIST_DIRTY_STATS;
+    }
+}
+
+const PersistentStats& PersistenceService::getStats() const {
+    return _stats;
+}
+
+bool PersistenceService::isDirty() const {
+    return _dirty != 0;
+}
+
+uint32_t PersistenceService::getWriteCount() const {
+    return _writeCount;
+}
+
+uint32_t PersistenceService::getFlushCount() const {
+    return _flushCount;
+}
+
+uint32_t PersistenceService::getLastFlushMicros() const {
+    return _lastFlushMicros;
+}
+
+uint32_t PersistenceService::getMaxFlushMicros() const {
+    return _maxFlushMicros;
+}
+
+void PersistenceService::_write(uint8_t items) {
+    if (!_initialized) return;
+    
+    uint32_t start = micros();
+    uint32_t writes = 0;
+    
+    if (items & PERSIST_DIRTY_ACTIVE_PROFILE) {
+        // Switching away and back again before the flush costs nothing
+        if (_activeProfileId != _savedActiveProfileId) {
+            if (_prefs.putUShort("activeProfileId", _activeProfileId) > 0) {
+                _savedActiveProfileId = _activeProfileId;
+                writes++;
+            } else {
+                DEBUG_PRINTLN("ERROR: Failed to save active profile");
+            }
+        }
+        _dirty &= ~PERSIST_DIRTY_ACTIVE_PROFILE;
+    }
+    
+    if (items & PERSIST_DIRTY_STATS) {
+        if (_prefs.putBytes("stats", &_stats, sizeof(_stats)) == sizeof(_stats)) {
+            writes++;
+        } else {
+            DEBUG_PRINTLN("ERROR: Failed to save stats");
+        }
+        _dirty &= ~PERSIST_DIRTY_STATS;
+    }
+    
+    if (writes > 0) {
+        _writeCount += writes;
+        _flushCount++;
+        _lastFlushMicros = micros() - start;
+        if (_lastFlushMicros > _maxFlushMicros) {
+            _maxFlushMicros = _lastFlushMicros;
+        }
+        DEBUG_PRINTF("Persisted state (%u writes, %u us)\n", writes, _lastFlushMicros);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef PERSISTENCE_SERVICE_H
+#define PERSISTENCE_SERVICE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "config.h"
+
+#define PERSIST_DIRTY_ACTIVE_PROFILE 0x01
+#define PERSIST_DIRTY_STATS          0x02
+
+// Usage counters, stored as one NVS blob
+struct PersistentStats {
+    uint32_t keyPresses[MATRIX_KEYS];
+    uint32_t encoderTurns[2];
+};
+
+// Write-behind cache for small device state kept in NVS. Setters only touch
+// RAM; update() writes an item once it has been quiet for its settle time, so
+// a burst of profile switches or key presses costs one NVS write. Call flush()
+// before rebooting or sleeping.
+class PersistenceService {
+public:
+    PersistenceService();
+    
+    bool init();
+    
+    // Flush items whose quiet period has passed (call from loop)
+    void update();
+    // Write everything pending now
+    void flush();
+    // Erase all stored state and reset the RAM copies (factory reset)
+    void clear();
+    
+    uint16_t getActiveProfileId() const;
+    void setActiveProfileId(uint16_t id);
+    
+    void recordKeyPress(uint8_t key);
+    void recordEncoderTurn(uint8_t encoder);
+    const PersistentStats& getStats() const;
+    
+    // Reporting
+    bool isDirty() const;
+    uint32_t getWriteCount() const;       // NVS writes since boot
+    uint32_t getFlushCount() const;       // Flushes that wrote anything
+    uint32_t getLastFlushMicros() const;
+    uint32_t getMaxFlushMicros() const;
+    
+private:
+    Preferences _prefs;
+    bool _initialized;
+    
+    uint16_t _activeProfileId;
+    uint16_t _savedActiveProfileId;
+    PersistentStats _stats;
+    
+    uint8_t _dirty;                // PERSIST_DIRTY_*
+    uint32_t _activeChangedAt;     // millis() of the last active profile change
+    uint32_t _statsChangedAt;      // millis() of the last counter change
+    uint32_t _statsDirtySince;     // millis() of the first unsaved counter change
+    
+    uint32_t _writeCount;
+    uint32_t _flushCount;
+    uint32_t _lastFlushMicros;
+    uint32_t _maxFlushMicros;
+    
+    void _write(uint8_t items);
+};
+
+#endif // PERSISTENCE_SERVICE_H
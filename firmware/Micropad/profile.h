@@ -44,8 +44,19 @@ struct HotkeyConfig {
     uint8_t key;        // HID key code
 };
 
+// Text payloads live in the device's text pool (see profile_text.h); actions
+// hold a reference into it, TEXT_REF_NONE for an empty string.
+#define TEXT_REF_NONE 0
+#define TEXT_ACTION_MAX_LENGTH 255
+#define MACRO_TEXT_MAX_LENGTH 31
+#define PROFILE_TEXT_BLOCK_BYTES 1024  // The pool is allocated and released a block at a time
+// A full-length text in every macro step of every input takes 10 blocks. The
+// pool holds four such profiles: active, work buffer, one being loaded, and a
+// copy storage reads to compare against.
+#define PROFILE_TEXT_POOL_BYTES 40960
+
 struct TextConfig {
-    char text[128];
+    uint16_t textRef;
 };
 
 struct MediaConfig {
@@ -58,7 +69,7 @@ struct MouseConfig {
 };
 
 struct ProfileSwitchConfig {
-    uint8_t profileId;
+    uint16_t profileId;
 };
 
 // Macro step (embedded in profile for on-device execution)
@@ -69,8 +80,8 @@ struct MacroStepConfig {
     uint16_t delayMs;
     uint8_t key;
     uint8_t modifiers;
-    char text[32];
     uint8_t mediaFunction;
+    uint16_t textRef;
 };
 
 struct MacroConfig {
@@ -107,7 +118,7 @@ struct EncoderConfig {
 
 // Profile structure
 struct Profile {
-    uint8_t id;
+    uint16_t id;
     char name[32];
     uint8_t version;
     KeyConfig keys[MATRIX_KEYS];
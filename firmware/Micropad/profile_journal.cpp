@@ -0,0 +1,501 @@
+#include "profile_journal.h"
+#include "crc32.h"
+#include "profile_text.h"
+
+namespace {
+const uint32_t JOURNAL_MAGIC = 0x474A504D;            // "MPJG"
+const uint32_t JOURNAL_MAGIC_UNGROUPED = 0x4C4A504D;  // "MPJL": every record its own edit
+
+// Largest record payload: a full macro (type + count + 16 steps of 7 bytes + 31 chars)
+const uint16_t JOURNAL_MAX_PAYLOAD = 640;
+
+// Appends fall back to a full save once the journal passes the compaction threshold,
+// so it never holds more than that many minimum-size records plus one full diff
+// (every action, both encoders, the name and its commit).
+const uint16_t JOURNAL_MAX_RECORDS = PROFILE_JOURNAL_COMPACT_BYTES / 8 + JOURNAL_TARGET_COUNT + 4;
+
+const uint8_t RECORD_FLAG_UNDO = 0x01;
+const uint8_t RECORD_FLAG_CANCELLED = 0x02;
+
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t baseSequence;
+};
+
+// Followed by `length` payload bytes and a CRC32 over header + payload
+struct JournalRecordHeader {
+    uint8_t op;
+    uint8_t target;
+    uint16_t length;
+};
+
+Action* actionForTarget(Profile& profile, uint8_t target) {
+    if (target < JOURNAL_TARGET_ENCODER_BASE) {
+        return &profile.keys[target].action;
+    }
+    uint8_t encoder = (target - JOURNAL_TARGET_ENCODER_BASE) / 3;
+    switch ((target - JOURNAL_TARGET_ENCODER_BASE) % 3) {
+        case 0: return &profile.encoders[encoder].cwAction;
+        case 1: return &profile.encoders[encoder].ccwAction;
+        default: return &profile.encoders[encoder].pressAction;
+    }
+}
+
+const Action* actionForTarget(const Profile& profile, uint8_t target) {
+    return actionForTarget(const_cast<Profile&>(profile), target);
+}
+
+// Compact binary form of an action: type byte followed by only the fields that
+// type uses, with text inlined from the pool
+size_t encodeAction(const Action& action, uint8_t* out) {
+    size_t n = 0;
+    out[n++] = static_cast<uint8_t>(action.type);
+
+    switch (action.type) {
+        case ACTION_HOTKEY:
+            out[n++] = action.config.hotkey.modifiers;
+            out[n++] = action.config.hotkey.key;
+            break;
+
+        case ACTION_TEXT:
+        {
+            size_t len = profileTextLength(action.config.text.textRef);
+            memcpy(out + n, profileText(action.config.text.textRef), len);
+            n += len;
+            break;
+        }
+
+        case ACTION_MEDIA:
+            out[n++] = static_cast<uint8_t>(action.config.media.function);
+            break;
+
+        case ACTION_MOUSE:
+            out[n++] = static_cast<uint8_t>(action.config.mouse.action);
+            out[n++] = static_cast<uint8_t>(action.config.mouse.value);
+            break;
+
+        case ACTION_PROFILE:
+            out[n++] = action.config.profile.profileId & 0xFF;
+            out[n++] = action.config.profile.profileId >> 8;
+            break;
+
+        case ACTION_MACRO:
+        {
+            uint8_t count = action.config.macro.stepCount;
+            if (count > MAX_MACRO_STEPS) count = MAX_MACRO_STEPS;
+            out[n++] = count;
+            for (uint8_t i = 0; i < count; i++) {
+                const MacroStepConfig& step = action.config.macro.steps[i];
+                size_t len = profileTextLength(step.textRef);
+                if (len > MACRO_TEXT_MAX_LENGTH) len = MACRO_TEXT_MAX_LENGTH;
+                out[n++] = step.stepType;
+                out[n++] = step.delayMs & 0xFF;
+                out[n++] = step.delayMs >> 8;
+                out[n++] = step.key;
+                out[n++] = step.modifiers;
+                out[n++] = step.mediaFunction;
+                out[n++] = static_cast<uint8_t>(len);
+                memcpy(out + n, profileText(step.textRef), len);
+                n += len;
+            }
+            break;
+        }
+
+        default:
+            out[0] = ACTION_NONE;
+            break;
+    }
+    return n;
+}
+
+// False for a malformed payload, or one whose text doesn't fit the pool
+// (`textFull` then says so); `action` is left as ACTION_NONE
+bool decodeAction(const uint8_t* in, size_t len, Action& action, bool& textFull) {
+    memset(&action, 0, sizeof(Action));
+    action.type = ACTION_NONE;
+    if (len == 0) return false;
+
+    size_t n = 1;
+    switch (in[0]) {
+        case ACTION_NONE:
+            return true;
+
+        case ACTION_HOTKEY:
+            if (len < 3) return false;
+            action.config.hotkey.modifiers = in[1];
+            action.config.hotkey.key = in[2];
+            break;
+
+        case ACTION_TEXT:
+        {
+            uint16_t textRef;
+            if (len - 1 > TEXT_ACTION_MAX_LENGTH) return false;
+            if (!profileInternText((const char*)in + 1, len - 1, textRef)) {
+                textFull = true;
+                return false;
+            }
+            action.config.text.textRef = textRef;
+            break;
+        }
+
+        case ACTION_MEDIA:
+            if (len < 2 || in[1] > MEDIA_FUNC_STOP) return false;
+            action.config.media.function = static_cast<MediaFunction>(in[1]);
+            break;
+
+        case ACTION_MOUSE:
+            if (len < 3 || in[1] > MOUSE_ACTION_SCROLL_DOWN) return false;
+            action.config.mouse.action = static_cast<MouseAction>(in[1]);
+            action.config.mouse.value = static_cast<int8_t>(in[2]);
+            break;
+
+        case ACTION_PROFILE:
+            if (len < 3) return false;
+            action.config.profile.profileId = in[1] | (in[2] << 8);
+            if (action.config.profile.profileId > PROFILE_ID_MAX) return false;
+            break;
+
+        case ACTION_MACRO:
+        {
+            if (len < 2 || in[1] > MAX_MACRO_STEPS) return false;
+            uint8_t count = in[n++];
+            for (uint8_t i = 0; i < count; i++) {
+                MacroStepConfig& step = action.config.macro.steps[i];
+                if (n + 7 > len) {
+                    memset(&action, 0, sizeof(Action));
+                    return false;
+                }
+                step.stepType = in[n++];
+                step.delayMs = in[n] | (in[n + 1] << 8);
+                n += 2;
+                step.key = in[n++];
+                step.modifiers = in[n++];
+                step.mediaFunction = in[n++];
+                uint8_t textLen = in[n++];
+                if (textLen > MACRO_TEXT_MAX_LENGTH || n + textLen > len) {
+                    memset(&action, 0, sizeof(Action));
+                    return false;
+                }
+                if (!profileInternText((const char*)in + n, textLen, step.textRef)) {
+                    memset(&action, 0, sizeof(Action));
+                    textFull = true;
+                    return false;
+                }
+                n += textLen;
+            }
+            action.config.macro.stepCount = count;
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    action.type = static_cast<ActionType>(in[0]);
+    return true;
+}
+
+// Read one record, checking its CRC; leaves the file positioned after it
+bool readRecord(File& file, JournalRecordHeader& record, uint8_t* payload) {
+    if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) return false;
+    if (record.length > JOURNAL_MAX_PAYLOAD) return false;
+    if (file.read(payload, record.length) != record.length) return false;
+
+    uint32_t storedCrc;
+    if (file.read((uint8_t*)&storedCrc, sizeof(storedCrc)) != sizeof(storedCrc)) return false;
+
+    uint32_t crc = crc32Update(0, (const uint8_t*)&record, sizeof(record));
+    crc = crc32Update(crc, payload, record.length);
+    return crc == storedCrc;
+}
+}
+
+ProfileJournal::ProfileJournal() {
+}
+
+JournalState ProfileJournal::replay(uint16_t id, uint32_t baseSequence, Profile* profile) {
+    JournalState state;
+    memset(&state, 0, sizeof(state));
+
+    File file = LittleFS.open(_getPath(id), "r");
+    if (!file) return state;
+
+    JournalHeader header;
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+        (header.magic != JOURNAL_MAGIC && header.magic != JOURNAL_MAGIC_UNGROUPED)) {
+        state.torn = true;
+        file.close();
+        return state;
+    }
+    if (header.baseSequence != baseSequence) {
+        state.stale = true;
+        file.close();
+        return state;
+    }
+    state.ungrouped = header.magic == JOURNAL_MAGIC_UNGROUPED;
+
+    // Pass 1: find record boundaries, stopping at the first one that fails its CRC.
+    // Records are grouped into edits: the records of one save up to its commit, or
+    // a lone undo marker. A save with no commit yet was torn and is dropped whole.
+    uint16_t offsets[JOURNAL_MAX_RECORDS];
+    uint8_t flags[JOURNAL_MAX_RECORDS];
+    uint16_t editStart[JOURNAL_MAX_RECORDS];  // First record of each edit
+    uint16_t edits = 0;
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    uint32_t offset = sizeof(header);
+    uint16_t open = 0;  // Records read since the last complete edit
+    size_t fileSize = file.size();
+    state.length = offset;
+
+    while (offset < fileSize) {
+        JournalRecordHeader record;
+        if (state.records + open >= JOURNAL_MAX_RECORDS || !readRecord(file, record, payload) ||
+            (record.op == JOURNAL_OP_UNDO && open > 0)) {
+            state.torn = true;
+            break;
+        }
+        uint16_t index = state.records + open;
+        offsets[index] = offset;
+        flags[index] = record.op == JOURNAL_OP_UNDO ? RECORD_FLAG_UNDO : 0;
+        open++;
+        offset = file.position();
+        if (record.op == JOURNAL_OP_UNDO || record.op == JOURNAL_OP_COMMIT || state.ungrouped) {
+            editStart[edits++] = state.records;
+            state.records += open;
+            state.length = offset;
+            open = 0;
+        }
+    }
+    if (open > 0) {
+        state.torn = true;
+    }
+
+    // Resolve undo markers newest-first: each one cancels the nearest earlier live edit
+    uint16_t pendingUndo = 0;
+    for (int16_t e = edits - 1; e >= 0; e--) {
+        uint16_t first = editStart[e];
+        uint16_t end = e + 1 < edits ? editStart[e + 1] : state.records;
+        if (flags[first] & RECORD_FLAG_UNDO) {
+            pendingUndo++;
+        } else if (pendingUndo > 0) {
+            for (uint16_t i = first; i < end; i++) {
+                flags[i] |= RECORD_FLAG_CANCELLED;
+            }
+            pendingUndo--;
+        } else {
+            state.undoable++;
+        }
+    }
+
+    // Pass 2: apply surviving edits in order
+    if (profile) {
+        for (uint16_t i = 0; i < state.records; i++) {
+            if (flags[i] & (RECORD_FLAG_UNDO | RECORD_FLAG_CANCELLED)) continue;
+
+            JournalRecordHeader record;
+            file.seek(offsets[i]);
+            if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record) ||
+                file.read(payload, record.length) != record.length) {
+                break;
+            }
+            if (!_applyRecord(record.op, record.target, payload, record.length, *profile)) {
+                state.incomplete = true;
+                break;
+            }
+        }
+    }
+
+    file.close();
+    return state;
+}
+
+bool ProfileJournal::appendDiff(uint16_t id, uint32_t baseSequence, uint32_t& length,
+                                const Profile& before, const Profile& after) {
+    if (before.version != after.version) {
+        return false;
+    }
+
+    ProfileFieldMask fields;
+    memset(&fields, 0, sizeof(fields));
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    uint8_t previous[JOURNAL_MAX_PAYLOAD];
+
+    for (uint8_t target = 0; target < JOURNAL_TARGET_COUNT; target++) {
+        // Encoded forms hold only the fields each type uses
+        size_t n = encodeAction(*actionForTarget(after, target), payload);
+        size_t previousLength = encodeAction(*actionForTarget(before, target), previous);
+        if (n != previousLength || memcmp(payload, previous, n) != 0) {
+            fields.actions |= 1UL << target;
+        }
+    }
+
+    for (uint8_t i = 0; i < 2; i++) {
+        if (before.encoders[i].acceleration != after.encoders[i].acceleration ||
+            before.encoders[i].stepsPerDetent != after.encoders[i].stepsPerDetent) {
+            fields.encoders |= 1 << i;
+        }
+    }
+
+    fields.name = strncmp(before.name, after.name, sizeof(after.name)) != 0;
+    return appendFields(id, baseSequence, length, after, fields);
+}
+
+bool ProfileJournal::appendFields(uint16_t id, uint32_t baseSequence, uint32_t& length,
+                                  const Profile& profile, const ProfileFieldMask& fields) {
+    File file;
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    // `length` only moves once the commit lands, so a failed save leaves the
+    // journal ending at the last complete edit
+    uint32_t pending = length;
+
+    for (uint8_t target = 0; target < JOURNAL_TARGET_COUNT; target++) {
+        if (!(fields.actions & (1UL << target))) continue;
+
+        size_t n = encodeAction(*actionForTarget(profile, target), payload);
+        if (!file && !(file = _openForAppend(id, baseSequence, pending))) return false;
+        if (!_writeRecord(file, JOURNAL_OP_SET_ACTION, target, payload, n, pending)) {
+            file.close();
+            return false;
+        }
+    }
+
+    for (uint8_t i = 0; i < 2; i++) {
+        if (!(fields.encoders & (1 << i))) continue;
+
+        if (!file && !(file = _openForAppend(id, baseSequence, pending))) return false;
+        payload[0] = profile.encoders[i].acceleration ? 1 : 0;
+        payload[1] = profile.encoders[i].stepsPerDetent;
+        if (!_writeRecord(file, JOURNAL_OP_SET_ENCODER, i, payload, 2, pending)) {
+            file.close();
+            return false;
+        }
+    }
+
+    if (fields.name) {
+        if (!file && !(file = _openForAppend(id, baseSequence, pending))) return false;
+        size_t n = strnlen(profile.name, sizeof(profile.name) - 1);
+        if (!_writeRecord(file, JOURNAL_OP_SET_NAME, 0, (const uint8_t*)profile.name, n, pending)) {
+            file.close();
+            return false;
+        }
+    }
+
+    if (!file) {
+        return true;
+    }
+    bool ok = _writeRecord(file, JOURNAL_OP_COMMIT, 0, nullptr, 0, pending);
+    file.close();
+    if (ok) {
+        length = pending;
+    }
+    return ok;
+}
+
+bool ProfileJournal::appendUndo(uint16_t id, uint32_t baseSequence, uint32_t& length) {
+    File file = _openForAppend(id, baseSequence, length);
+    if (!file) return false;
+
+    bool ok = _writeRecord(file, JOURNAL_OP_UNDO, 0, nullptr, 0, length);
+    file.close();
+    return ok;
+}
+
+bool ProfileJournal::remove(uint16_t id) {
+    String path = _getPath(id);
+    return !LittleFS.exists(path) || LittleFS.remove(path);
+}
+
+size_t ProfileJournal::fileSize(uint16_t id) {
+    File file = LittleFS.open(_getPath(id), "r");
+    if (!file) return 0;
+    size_t size = file.size();
+    file.close();
+    return size;
+}
+
+String ProfileJournal::_getPath(uint16_t id) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "%s/profile_%d.jnl", PROFILES_PATH, id);
+    return String(filename);
+}
+
+File ProfileJournal::_openForAppend(uint16_t id, uint32_t baseSequence, uint32_t& length) {
+    if (length > 0) {
+        // A journal from before saves were grouped is folded into a snapshot instead
+        File file = LittleFS.open(_getPath(id), "r");
+        JournalHeader header;
+        bool grouped = file && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                       header.magic == JOURNAL_MAGIC;
+        file.close();
+        return grouped ? LittleFS.open(_getPath(id), "a") : File();
+    }
+
+    // First edit since the base was written: start a fresh journal (drops any stale one)
+    File file = LittleFS.open(_getPath(id), "w");
+    if (!file) return file;
+
+    JournalHeader header;
+    header.magic = JOURNAL_MAGIC;
+    header.baseSequence = baseSequence;
+    if (file.write((const uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+        file.close();
+        return File();
+    }
+    length = sizeof(header);
+    return file;
+}
+
+bool ProfileJournal::_writeRecord(File& file, uint8_t op, uint8_t target, const uint8_t* payload,
+                                  uint16_t length, uint32_t& journalLength) {
+    JournalRecordHeader record;
+    record.op = op;
+    record.target = target;
+    record.length = length;
+
+    uint32_t crc = crc32Update(0, (const uint8_t*)&record, sizeof(record));
+    crc = crc32Update(crc, payload, length);
+
+    size_t written = file.write((const uint8_t*)&record, sizeof(record));
+    if (length > 0) {
+        written += file.write(payload, length);
+    }
+    written += file.write((const uint8_t*)&crc, sizeof(crc));
+
+    if (written != sizeof(record) + length + sizeof(crc)) {
+        return false;
+    }
+    journalLength += written;
+    return true;
+}
+
+bool ProfileJournal::_applyRecord(uint8_t op, uint8_t target, const uint8_t* payload, uint16_t length,
+                                  Profile& profile) {
+    switch (op) {
+        case JOURNAL_OP_SET_ACTION:
+            if (target < JOURNAL_TARGET_COUNT) {
+                bool textFull = false;
+                if (!decodeAction(payload, length, *actionForTarget(profile, target), textFull) && textFull) {
+                    return false;
+                }
+            }
+            break;
+
+        case JOURNAL_OP_SET_NAME:
+            if (length < sizeof(profile.name)) {
+                memset(profile.name, 0, sizeof(profile.name));
+                memcpy(profile.name, payload, length);
+            }
+            break;
+
+        case JOURNAL_OP_SET_ENCODER:
+            if (target < 2 && length >= 2) {
+                profile.encoders[target].acceleration = payload[0] != 0;
+                profile.encoders[target].stepsPerDetent = payload[1];
+            }
+            break;
+
+        default:
+            break;
+    }
+    return true;
+}
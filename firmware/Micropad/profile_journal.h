@@ -0,0 +1,81 @@
+#ifndef PROFILE_JOURNAL_H
+#define PROFILE_JOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "config.h"
+#include "profile.h"
+
+// Append-only log of field-level edits, replayed over a profile's base snapshot
+// at load time (PROFILES_PATH/profile_N.jnl). Each record carries its own CRC,
+// and the records of one save are closed by a commit record: a torn append
+// loses that whole save, and an undo marker cancels it as one edit. The header
+// records the base slot sequence it applies to; once the base is rewritten the
+// journal is stale and ignored.
+
+// Record targets for JOURNAL_OP_SET_ACTION: keys 0..MATRIX_KEYS-1, then
+// cw/ccw/press for each encoder.
+#define JOURNAL_TARGET_ENCODER_BASE MATRIX_KEYS
+#define JOURNAL_TARGET_COUNT (MATRIX_KEYS + 2 * 3)
+
+enum JournalOp : uint8_t {
+    JOURNAL_OP_SET_ACTION = 1,
+    JOURNAL_OP_SET_NAME,
+    JOURNAL_OP_SET_ENCODER,  // acceleration + stepsPerDetent
+    JOURNAL_OP_UNDO,         // Cancels the most recent edit not already cancelled
+    JOURNAL_OP_COMMIT        // Closes the records of one save into a single edit
+};
+
+// Fields touched by a field-level edit: bit per JOURNAL_TARGET for actions,
+// bit per encoder for its acceleration/stepsPerDetent, and the name
+struct ProfileFieldMask {
+    uint32_t actions;
+    uint8_t encoders;
+    bool name;
+};
+
+struct JournalState {
+    uint32_t length;    // Bytes of valid journal (header included); 0 if none
+    uint16_t records;   // Valid records, undo markers and commits included
+    uint16_t undoable;  // Edits (saves) that an undo marker could still cancel
+    bool stale;         // Journal belongs to an older base snapshot
+    bool torn;          // Trailing bytes failed validation or ended mid-save
+    bool ungrouped;     // Written before saves were grouped; only fit for compaction
+    bool incomplete;    // Replay stopped at a text the pool had no room for
+};
+
+class ProfileJournal {
+public:
+    ProfileJournal();
+
+    // Replay the journal of `id` over `profile`, which must already hold the
+    // base snapshot written with `baseSequence`. Pass nullptr to only scan.
+    JournalState replay(uint16_t id, uint32_t baseSequence, Profile* profile);
+
+    // Append one record per field that differs between `before` and `after`,
+    // committed as a single edit. `length` is the current valid journal length
+    // and is updated on success. Returns false if the profiles differ in a way
+    // the journal can't express, or the journal predates grouped edits.
+    bool appendDiff(uint16_t id, uint32_t baseSequence, uint32_t& length,
+                    const Profile& before, const Profile& after);
+
+    // Append one record per field in `fields`, taken from `profile`, as one edit
+    bool appendFields(uint16_t id, uint32_t baseSequence, uint32_t& length,
+                      const Profile& profile, const ProfileFieldMask& fields);
+
+    // Append an undo marker
+    bool appendUndo(uint16_t id, uint32_t baseSequence, uint32_t& length);
+
+    bool remove(uint16_t id);
+    size_t fileSize(uint16_t id);
+
+private:
+    String _getPath(uint16_t id);
+    File _openForAppend(uint16_t id, uint32_t baseSequence, uint32_t& length);
+    bool _writeRecord(File& file, uint8_t op, uint8_t target, const uint8_t* payload, uint16_t length,
+                      uint32_t& journalLength);
+    // False only when a text doesn't fit the pool; other bad records are skipped
+    bool _applyRecord(uint8_t op, uint8_t target, const uint8_t* payload, uint16_t length, Profile& profile);
+};
+
+#endif // PROFILE_JOURNAL_H
@@ -0,0 +1,1041 @@
+#include "profile_json_reader.h"
+#include "profile_text.h"
+#include "crc32.h"
+
+namespace {
+const uint8_t MAX_SKIP_DEPTH = 16;
+
+// Pull tokenizer over a JSON buffer. Readers leave the cursor untouched when
+// the next value has a different type, so callers can fall back to skipValue().
+class JsonCursor {
+public:
+    JsonCursor(const char* data, size_t length) {
+        _p = data;
+        _end = data + length;
+        _failed = false;
+    }
+    
+    bool failed() const {
+        return _failed;
+    }
+    
+    // Next unread byte (after a value: the byte just past it)
+    const char* position() const {
+        return _p;
+    }
+    
+    bool peekIs(char c) {
+        _skipWhitespace();
+        return _p < _end && *_p == c;
+    }
+    
+    bool consume(char c) {
+        if (!peekIs(c)) {
+            _failed = true;
+            return false;
+        }
+        _p++;
+        return true;
+    }
+    
+    // Iterate an object opened with consume('{'). Returns false at the closing
+    // brace (consumed) or on a syntax error.
+    bool nextMember(bool& first, const char*& key, size_t& keyLength) {
+        if (_failed) return false;
+        if (peekIs('}')) {
+            _p++;
+            return false;
+        }
+        if (!first && !consume(',')) return false;
+        first = false;
+        
+        if (!consume('"')) return false;
+        key = _p;
+        if (!_skipStringBody()) return false;
+        keyLength = _p - key - 1;
+        return consume(':');
+    }
+    
+    // Iterate an array opened with consume('[')
+    bool nextElement(bool& first) {
+        if (_failed) return false;
+        if (peekIs(']')) {
+            _p++;
+            return false;
+        }
+        if (!first && !consume(',')) return false;
+        first = false;
+        return true;
+    }
+    
+    bool readInt(int32_t& value) {
+        _skipWhitespace();
+        if (_p >= _end || !(*_p == '-' || (*_p >= '0' && *_p <= '9'))) return false;
+        
+        bool negative = *_p == '-';
+        if (negative) _p++;
+        int64_t result = 0;
+        while (_p < _end && *_p >= '0' && *_p <= '9') {
+            if (result < 0x7FFFFFFF) {
+                result = result * 10 + (*_p - '0');
+            }
+            _p++;
+        }
+        // Fraction and exponent are truncated away, as with `obj[key] | 0`
+        while (_p < _end && (*_p == '.' || *_p == 'e' || *_p == 'E' || *_p == '+' || *_p == '-' ||
+                             (*_p >= '0' && *_p <= '9'))) {
+            _p++;
+        }
+        if (result > 0x7FFFFFFF) result = 0x7FFFFFFF;
+        value = static_cast<int32_t>(negative ? -result : result);
+        return true;
+    }
+    
+    // Whole number up to 0xFFFFFFFF (checksums); anything larger is a syntax error
+    bool readUint32(uint32_t& value) {
+        _skipWhitespace();
+        if (_p >= _end || *_p < '0' || *_p > '9') return false;
+        
+        uint64_t result = 0;
+        while (_p < _end && *_p >= '0' && *_p <= '9' && result <= 0xFFFFFFFF) {
+            result = result * 10 + (*_p - '0');
+            _p++;
+        }
+        if (result > 0xFFFFFFFF) {
+            _failed = true;
+            return false;
+        }
+        value = static_cast<uint32_t>(result);
+        return true;
+    }
+    
+    bool readBool(bool& value) {
+        if (_matchLiteral("true")) {
+            value = true;
+            return true;
+        }
+        if (_matchLiteral("false")) {
+            value = false;
+            return true;
+        }
+        return false;
+    }
+    
+    // Unescapes into `out` (NUL-terminated), truncating at capacity - 1 bytes
+    bool readString(char* out, size_t capacity, size_t& length) {
+        if (!peekIs('"')) return false;
+        _p++;
+        length = 0;
+        
+        while (_p < _end && *_p != '"') {
+            char c = *_p++;
+            if (c != '\\') {
+                _append(out, capacity, length, c);
+                continue;
+            }
+            if (_p >= _end) break;
+            
+            char escape = *_p++;
+            switch (escape) {
+                case 'b': _append(out, capacity, length, '\b'); break;
+                case 'f': _append(out, capacity, length, '\f'); break;
+                case 'n': _append(out, capacity, length, '\n'); break;
+                case 'r': _append(out, capacity, length, '\r'); break;
+                case 't': _append(out, capacity, length, '\t'); break;
+                case 'u': {
+                    uint32_t codepoint;
+                    if (!_readHex4(codepoint)) return false;
+                    // Surrogate pair
+                    if (codepoint >= 0xD800 && codepoint <= 0xDBFF && _p + 1 < _end && _p[0] == '\\' && _p[1] == 'u') {
+                        _p += 2;
+                        uint32_t low;
+                        if (!_readHex4(low)) return false;
+                        codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    _appendUtf8(out, capacity, length, codepoint);
+                    break;
+                }
+                default:  // \" \\ \/
+                    _append(out, capacity, length, escape);
+                    break;
+            }
+        }
+        
+        if (_p >= _end) {
+            _failed = true;
+            return false;
+        }
+        _p++;
+        out[length] = '\0';
+        return true;
+    }
+    
+    bool skipValue(uint8_t depth = 0) {
+        if (_failed) return false;
+        if (depth > MAX_SKIP_DEPTH) {
+            _failed = true;
+            return false;
+        }
+        
+        _skipWhitespace();
+        if (_p >= _end) {
+            _failed = true;
+            return false;
+        }
+        
+        switch (*_p) {
+            case '{': {
+                _p++;
+                bool first = true;
+                const char* key;
+                size_t keyLength;
+                while (nextMember(first, key, keyLength)) {
+                    if (!skipValue(depth + 1)) return false;
+                }
+                return !_failed;
+            }
+            case '[': {
+                _p++;
+                bool first = true;
+                while (nextElement(first)) {
+                    if (!skipValue(depth + 1)) return false;
+                }
+                return !_failed;
+            }
+            case '"':
+                _p++;
+                if (!_skipStringBody()) return false;
+                return true;
+            default: {
+                int32_t number;
+                bool flag;
+                if (readInt(number) || readBool(flag) || _matchLiteral("null")) return true;
+                _failed = true;
+                return false;
+            }
+        }
+    }
+
+private:
+    const char* _p;
+    const char* _end;
+    bool _failed;
+    
+    void _skipWhitespace() {
+        while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r')) {
+            _p++;
+        }
+    }
+    
+    // Cursor is just past the opening quote; leaves it just past the closing one
+    bool _skipStringBody() {
+        while (_p < _end && *_p != '"') {
+            if (*_p == '\\') _p++;
+            _p++;
+        }
+        if (_p >= _end) {
+            _failed = true;
+            return false;
+        }
+        _p++;
+        return true;
+    }
+    
+    bool _matchLiteral(const char* literal) {
+        _skipWhitespace();
+        size_t length = strlen(literal);
+        if ((size_t)(_end - _p) < length || memcmp(_p, literal, length) != 0) return false;
+        _p += length;
+        return true;
+    }
+    
+    bool _readHex4(uint32_t& value) {
+        if (_end - _p < 4) {
+            _failed = true;
+            return false;
+        }
+        value = 0;
+        for (uint8_t i = 0; i < 4; i++) {
+            char c = *_p++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else {
+                _failed = true;
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    static void _append(char* out, size_t capacity, size_t& length, char c) {
+        if (length + 1 < capacity) {
+            out[length++] = c;
+        }
+    }
+    
+    static void _appendUtf8(char* out, size_t capacity, size_t& length, uint32_t codepoint) {
+        if (codepoint < 0x80) {
+            _append(out, capacity, length, codepoint);
+        } else if (codepoint < 0x800) {
+            _append(out, capacity, length, 0xC0 | (codepoint >> 6));
+            _append(out, capacity, length, 0x80 | (codepoint & 0x3F));
+        } else if (codepoint < 0x10000) {
+            _append(out, capacity, length, 0xE0 | (codepoint >> 12));
+            _append(out, capacity, length, 0x80 | ((codepoint >> 6) & 0x3F));
+            _append(out, capacity, length, 0x80 | (codepoint & 0x3F));
+        } else {
+            _append(out, capacity, length, 0xF0 | (codepoint >> 18));
+            _append(out, capacity, length, 0x80 | ((codepoint >> 12) & 0x3F));
+            _append(out, capacity, length, 0x80 | ((codepoint >> 6) & 0x3F));
+            _append(out, capacity, length, 0x80 | (codepoint & 0x3F));
+        }
+    }
+};
+
+// Same interface over MessagePack, so the decoders below read either encoding.
+// Containers carry element counts instead of closing brackets; the counts
+// still to read for the open ones are kept on a small stack.
+class MsgPackCursor {
+public:
+    MsgPackCursor(const uint8_t* data, size_t length) {
+        _p = data;
+        _end = data + length;
+        _failed = false;
+        _depth = 0;
+    }
+    
+    bool failed() const {
+        return _failed;
+    }
+    
+    // '{' is any map header, '[' any array header
+    bool peekIs(char c) {
+        if (_p >= _end) return false;
+        uint8_t b = *_p;
+        if (c == '{') return (b & 0xF0) == 0x80 || b == 0xDE || b == 0xDF;
+        if (c == '[') return (b & 0xF0) == 0x90 || b == 0xDC || b == 0xDD;
+        return false;
+    }
+    
+    bool consume(char c) {
+        uint32_t count;
+        if (!peekIs(c) || _depth >= MAX_SKIP_DEPTH || !_readContainerHeader(count)) {
+            _failed = true;
+            return false;
+        }
+        _remaining[_depth++] = count;
+        return true;
+    }
+    
+    bool nextMember(bool& first, const char*& key, size_t& keyLength) {
+        if (!_nextEntry(first)) return false;
+        uint32_t length;
+        if (!_readStringHeader(length)) {
+            _failed = true;  // Only string keys are part of the protocol
+            return false;
+        }
+        key = reinterpret_cast<const char*>(_p);
+        keyLength = length;
+        _p += length;
+        return true;
+    }
+    
+    bool nextElement(bool& first) {
+        return _nextEntry(first);
+    }
+    
+    bool readInt(int32_t& value) {
+        if (_p >= _end) return false;
+        uint8_t b = *_p;
+        
+        if (b <= 0x7F || b >= 0xE0) {  // Positive and negative fixint
+            value = static_cast<int8_t>(b);
+            _p++;
+            return true;
+        }
+        
+        int64_t result;
+        uint64_t raw;
+        switch (b) {
+            case 0xCC: if (!_readBigEndian(1, raw)) return false; result = raw; break;
+            case 0xCD: if (!_readBigEndian(2, raw)) return false; result = raw; break;
+            case 0xCE: if (!_readBigEndian(4, raw)) return false; result = raw; break;
+            case 0xCF: if (!_readBigEndian(8, raw)) return false; result = raw > 0x7FFFFFFF ? 0x7FFFFFFF : raw; break;
+            case 0xD0: if (!_readBigEndian(1, raw)) return false; result = static_cast<int8_t>(raw); break;
+            case 0xD1: if (!_readBigEndian(2, raw)) return false; result = static_cast<int16_t>(raw); break;
+            case 0xD2: if (!_readBigEndian(4, raw)) return false; result = static_cast<int32_t>(raw); break;
+            case 0xD3: if (!_readBigEndian(8, raw)) return false; result = static_cast<int64_t>(raw); break;
+            case 0xCA: {
+                // Fractions are truncated away, as with `obj[key] | 0`
+                if (!_readBigEndian(4, raw)) return false;
+                uint32_t bits = raw;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                result = _clampFloat(f);
+                break;
+            }
+            case 0xCB: {
+                if (!_readBigEndian(8, raw)) return false;
+                double d;
+                memcpy(&d, &raw, sizeof(d));
+                result = _clampFloat(d);
+                break;
+            }
+            default:
+                return false;
+        }
+        
+        if (result > 0x7FFFFFFF) result = 0x7FFFFFFF;
+        if (result < -0x7FFFFFFF) result = -0x7FFFFFFF;
+        value = static_cast<int32_t>(result);
+        return true;
+    }
+    
+    bool readBool(bool& value) {
+        if (_p >= _end || (*_p != 0xC2 && *_p != 0xC3)) return false;
+        value = *_p++ == 0xC3;
+        return true;
+    }
+    
+    // Copies into `out` (NUL-terminated), truncating at capacity - 1 bytes
+    bool readString(char* out, size_t capacity, size_t& length) {
+        uint32_t stored;
+        if (!_readStringHeader(stored)) return false;
+        length = stored < capacity - 1 ? stored : capacity - 1;
+        memcpy(out, _p, length);
+        out[length] = '\0';
+        _p += stored;
+        return true;
+    }
+    
+    bool skipValue(uint8_t depth = 0) {
+        if (_failed) return false;
+        if (depth > MAX_SKIP_DEPTH || _p >= _end) {
+            _failed = true;
+            return false;
+        }
+        
+        uint8_t b = *_p;
+        uint32_t count;
+        if (peekIs('{') || peekIs('[')) {
+            bool isMap = peekIs('{');
+            if (!_readContainerHeader(count)) {
+                _failed = true;
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (isMap && !skipValue(depth + 1)) return false;
+                if (!skipValue(depth + 1)) return false;
+            }
+            return true;
+        }
+        if (_readStringHeader(count)) {
+            _p += count;
+            return true;
+        }
+        if (_failed) return false;
+        
+        uint64_t length;
+        if (b <= 0x7F || b >= 0xE0 || b == 0xC0 || b == 0xC2 || b == 0xC3) return _skip(1);
+        switch (b) {
+            case 0xCC: case 0xD0: return _skip(2);
+            case 0xCD: case 0xD1: return _skip(3);
+            case 0xCA: case 0xCE: case 0xD2: return _skip(5);
+            case 0xCB: case 0xCF: case 0xD3: return _skip(9);
+            case 0xD4: return _skip(3);   // fixext 1: type byte, ext type, data
+            case 0xD5: return _skip(4);
+            case 0xD6: return _skip(6);
+            case 0xD7: return _skip(10);
+            case 0xD8: return _skip(18);
+            case 0xC4: return _readBigEndian(1, length) && _skip(length);      // bin 8/16/32
+            case 0xC5: return _readBigEndian(2, length) && _skip(length);
+            case 0xC6: return _readBigEndian(4, length) && _skip(length);
+            case 0xC7: return _readBigEndian(1, length) && _skip(length + 1);  // ext 8/16/32
+            case 0xC8: return _readBigEndian(2, length) && _skip(length + 1);
+            case 0xC9: return _readBigEndian(4, length) && _skip(length + 1);
+            default:  // 0xC1 is never used
+                _failed = true;
+                return false;
+        }
+    }
+
+private:
+    const uint8_t* _p;
+    const uint8_t* _end;
+    bool _failed;
+    uint8_t _depth;
+    uint32_t _remaining[MAX_SKIP_DEPTH];
+    
+    bool _nextEntry(bool& first) {
+        first = false;
+        if (_failed || _depth == 0) return false;
+        if (_remaining[_depth - 1] == 0) {
+            _depth--;
+            return false;
+        }
+        _remaining[_depth - 1]--;
+        return true;
+    }
+    
+    bool _skip(uint64_t count) {
+        if ((uint64_t)(_end - _p) < count) {
+            _failed = true;
+            return false;
+        }
+        _p += count;
+        return true;
+    }
+    
+    // Reads the `size`-byte integer after the type byte at _p and moves past both
+    bool _readBigEndian(uint8_t size, uint64_t& value) {
+        if (_end - _p < 1 + size) {
+            _failed = true;
+            return false;
+        }
+        _p++;
+        value = 0;
+        for (uint8_t i = 0; i < size; i++) {
+            value = (value << 8) | *_p++;
+        }
+        return true;
+    }
+    
+    bool _readContainerHeader(uint32_t& count) {
+        uint8_t b = *_p;
+        uint64_t value;
+        if ((b & 0xF0) == 0x80 || (b & 0xF0) == 0x90) {
+            count = b & 0x0F;
+            _p++;
+            return true;
+        }
+        if (!_readBigEndian((b == 0xDC || b == 0xDE) ? 2 : 4, value)) return false;
+        count = value;
+        return true;
+    }
+    
+    // Leaves the cursor untouched unless the next value is a string
+    bool _readStringHeader(uint32_t& length) {
+        if (_p >= _end) return false;
+        uint8_t b = *_p;
+        uint64_t value;
+        if ((b & 0xE0) == 0xA0) {
+            value = b & 0x1F;
+            _p++;
+        } else if (b == 0xD9 || b == 0xDA || b == 0xDB) {
+            if (!_readBigEndian(b == 0xD9 ? 1 : (b == 0xDA ? 2 : 4), value)) return false;
+        } else {
+            return false;
+        }
+        if ((uint64_t)(_end - _p) < value) {
+            _failed = true;
+            return false;
+        }
+        length = value;
+        return true;
+    }
+    
+    static int64_t _clampFloat(double value) {
+        if (!(value > -2147483647.0)) return value < 0 ? -0x7FFFFFFF : 0;  // Also NaN
+        if (value > 2147483647.0) return 0x7FFFFFFF;
+        return static_cast<int64_t>(value);
+    }
+};
+
+bool keyIs(const char* key, size_t keyLength, const char* name) {
+    return strlen(name) == keyLength && memcmp(key, name, keyLength) == 0;
+}
+
+// Integer value, or `fallback` (value skipped) for anything else, like `obj[key] | fallback`
+template <typename Cursor>
+int32_t readIntOr(Cursor& cursor, int32_t fallback) {
+    int32_t value;
+    if (cursor.readInt(value)) return value;
+    cursor.skipValue();
+    return fallback;
+}
+
+template <typename Cursor>
+bool readBoolOr(Cursor& cursor, bool fallback) {
+    bool value;
+    if (cursor.readBool(value)) return value;
+    cursor.skipValue();
+    return fallback;
+}
+
+void resetAction(Action& action) {
+    memset(&action, 0, sizeof(Action));
+    action.type = ACTION_NONE;
+}
+
+template <typename Cursor>
+ProfileDecodeResult decodeMacroSteps(Cursor& cursor, Action& action) {
+    memset(&action.config.macro, 0, sizeof(MacroConfig));
+    // Typed and counted as it goes so a pool compaction sees the steps already interned
+    action.type = ACTION_MACRO;
+    
+    if (!cursor.peekIs('[')) {
+        cursor.skipValue();
+        return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_OK;
+    }
+    cursor.consume('[');
+    
+    bool firstStep = true;
+    while (cursor.nextElement(firstStep)) {
+        if (action.config.macro.stepCount >= MAX_MACRO_STEPS || !cursor.peekIs('{')) {
+            cursor.skipValue();
+            if (action.config.macro.stepCount < MAX_MACRO_STEPS) {
+                action.config.macro.stepCount++;  // Non-object step: all defaults
+            }
+            continue;
+        }
+        cursor.consume('{');
+        
+        MacroStepConfig& step = action.config.macro.steps[action.config.macro.stepCount];
+        char text[MACRO_TEXT_MAX_LENGTH + 1];
+        size_t textLength = 0;
+        
+        bool first = true;
+        const char* key;
+        size_t keyLength;
+        while (cursor.nextMember(first, key, keyLength)) {
+            if (keyIs(key, keyLength, "stepType")) step.stepType = readIntOr(cursor, 0);
+            else if (keyIs(key, keyLength, "delayMs")) step.delayMs = readIntOr(cursor, 0);
+            else if (keyIs(key, keyLength, "key")) step.key = readIntOr(cursor, 0);
+            else if (keyIs(key, keyLength, "modifiers")) step.modifiers = readIntOr(cursor, 0);
+            else if (keyIs(key, keyLength, "mediaFunction")) step.mediaFunction = readIntOr(cursor, 0);
+            else if (keyIs(key, keyLength, "text")) {
+                if (!cursor.readString(text, sizeof(text), textLength)) {
+                    textLength = 0;
+                    cursor.skipValue();
+                }
+            }
+            else cursor.skipValue();
+        }
+        if (cursor.failed()) return PROFILE_DECODE_SYNTAX;
+        
+        if (!profileInternText(text, textLength, step.textRef)) {
+            return PROFILE_DECODE_TEXT_FULL;
+        }
+        action.config.macro.stepCount++;
+    }
+    return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_OK;
+}
+
+template <typename Cursor>
+ProfileDecodeResult decodeAction(Cursor& cursor, Action& action) {
+    resetAction(action);
+    if (!cursor.peekIs('{')) {
+        cursor.skipValue();
+        return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_OK;
+    }
+    cursor.consume('{');
+    
+    // Members may come in any order, so hold scalars until the type is known
+    int32_t type = ACTION_NONE;
+    int32_t modifiers = 0;
+    int32_t keyCode = 0;
+    int32_t function = 0;
+    int32_t mouseAction = 0;
+    int32_t value = 0;
+    int32_t profileId = 0;
+    char text[TEXT_ACTION_MAX_LENGTH + 1];
+    size_t textLength = 0;
+    
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    while (cursor.nextMember(first, key, keyLength)) {
+        if (keyIs(key, keyLength, "type")) type = readIntOr(cursor, ACTION_NONE);
+        else if (keyIs(key, keyLength, "modifiers")) modifiers = readIntOr(cursor, 0);
+        else if (keyIs(key, keyLength, "key")) keyCode = readIntOr(cursor, 0);
+        else if (keyIs(key, keyLength, "function")) function = readIntOr(cursor, 0);
+        else if (keyIs(key, keyLength, "action")) mouseAction = readIntOr(cursor, 0);
+        else if (keyIs(key, keyLength, "value")) value = readIntOr(cursor, 0);
+        else if (keyIs(key, keyLength, "profileId")) profileId = readIntOr(cursor, 0);
+        else if (keyIs(key, keyLength, "text")) {
+            if (!cursor.readString(text, sizeof(text), textLength)) {
+                textLength = 0;
+                cursor.skipValue();
+            }
+        }
+        else if (keyIs(key, keyLength, "macroSteps")) {
+            ProfileDecodeResult result = decodeMacroSteps(cursor, action);
+            if (result != PROFILE_DECODE_OK) return result;
+        }
+        else cursor.skipValue();
+    }
+    if (cursor.failed()) return PROFILE_DECODE_SYNTAX;
+    
+    if (type != ACTION_MACRO) {
+        resetAction(action);  // Drop steps sent alongside another type
+    }
+    
+    switch (type) {
+        case ACTION_NONE:
+            return PROFILE_DECODE_OK;
+        
+        case ACTION_HOTKEY:
+            action.config.hotkey.modifiers = modifiers;
+            action.config.hotkey.key = keyCode;
+            break;
+        
+        case ACTION_TEXT:
+            if (!profileInternText(text, textLength, action.config.text.textRef)) {
+                return PROFILE_DECODE_TEXT_FULL;
+            }
+            break;
+        
+        case ACTION_MEDIA:
+            if (function < 0 || function > MEDIA_FUNC_STOP) return PROFILE_DECODE_OK;
+            action.config.media.function = static_cast<MediaFunction>(function);
+            break;
+        
+        case ACTION_MOUSE:
+            if (mouseAction < 0 || mouseAction > MOUSE_ACTION_SCROLL_DOWN) return PROFILE_DECODE_OK;
+            action.config.mouse.action = static_cast<MouseAction>(mouseAction);
+            action.config.mouse.value = static_cast<int8_t>(value);
+            break;
+        
+        case ACTION_PROFILE:
+            if (profileId < 0 || profileId > PROFILE_ID_MAX) return PROFILE_DECODE_OK;
+            action.config.profile.profileId = profileId;
+            break;
+        
+        case ACTION_MACRO:
+            break;
+        
+        default:
+            // Unsupported types decode as ACTION_NONE
+            return PROFILE_DECODE_OK;
+    }
+    
+    action.type = static_cast<ActionType>(type);
+    return PROFILE_DECODE_OK;
+}
+
+template <typename Cursor>
+ProfileDecodeResult decodeEncoder(Cursor& cursor, EncoderConfig& encoder) {
+    if (!cursor.peekIs('{')) {
+        cursor.skipValue();
+        return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_OK;
+    }
+    cursor.consume('{');
+    
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    while (cursor.nextMember(first, key, keyLength)) {
+        ProfileDecodeResult result = PROFILE_DECODE_OK;
+        if (keyIs(key, keyLength, "cwAction")) result = decodeAction(cursor, encoder.cwAction);
+        else if (keyIs(key, keyLength, "ccwAction")) result = decodeAction(cursor, encoder.ccwAction);
+        else if (keyIs(key, keyLength, "pressAction")) result = decodeAction(cursor, encoder.pressAction);
+        else if (keyIs(key, keyLength, "acceleration")) encoder.acceleration = readBoolOr(cursor, true);
+        else if (keyIs(key, keyLength, "stepsPerDetent")) encoder.stepsPerDetent = readIntOr(cursor, 4);
+        else cursor.skipValue();
+        if (result != PROFILE_DECODE_OK) return result;
+    }
+    return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_OK;
+}
+
+template <typename Cursor>
+ProfileDecodeResult decodeProfile(Cursor& cursor, Profile& profile) {
+    memset(&profile, 0, sizeof(Profile));
+    profile.version = 1;
+    strlcpy(profile.name, "Unnamed", sizeof(profile.name));
+    for (uint8_t i = 0; i < 2; i++) {
+        profile.encoders[i].acceleration = true;
+        profile.encoders[i].stepsPerDetent = 4;
+    }
+    
+    if (!cursor.peekIs('{')) return PROFILE_DECODE_MISSING;
+    cursor.consume('{');
+    
+    bool haveId = false;
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    while (cursor.nextMember(first, key, keyLength)) {
+        ProfileDecodeResult result = PROFILE_DECODE_OK;
+        
+        if (keyIs(key, keyLength, "id")) {
+            int32_t id;
+            if (!cursor.readInt(id) || id < 0 || id > PROFILE_ID_MAX) return PROFILE_DECODE_BAD_ID;
+            profile.id = id;
+            haveId = true;
+        }
+        else if (keyIs(key, keyLength, "name")) {
+            size_t nameLength;
+            if (!cursor.readString(profile.name, sizeof(profile.name), nameLength)) cursor.skipValue();
+        }
+        else if (keyIs(key, keyLength, "version")) profile.version = readIntOr(cursor, 1);
+        else if (keyIs(key, keyLength, "keys") && cursor.peekIs('[')) {
+            cursor.consume('[');
+            bool firstKey = true;
+            uint8_t index = 0;
+            while (result == PROFILE_DECODE_OK && cursor.nextElement(firstKey)) {
+                if (index < MATRIX_KEYS) {
+                    result = decodeAction(cursor, profile.keys[index].action);
+                } else {
+                    cursor.skipValue();
+                }
+                index++;
+            }
+        }
+        else if (keyIs(key, keyLength, "encoders") && cursor.peekIs('[')) {
+            cursor.consume('[');
+            bool firstEncoder = true;
+            uint8_t index = 0;
+            while (result == PROFILE_DECODE_OK && cursor.nextElement(firstEncoder)) {
+                if (index < 2) {
+                    result = decodeEncoder(cursor, profile.encoders[index]);
+                } else {
+                    cursor.skipValue();
+                }
+                index++;
+            }
+        }
+        else cursor.skipValue();
+        
+        if (result != PROFILE_DECODE_OK) return result;
+    }
+    
+    if (cursor.failed()) return PROFILE_DECODE_SYNTAX;
+    return haveId ? PROFILE_DECODE_OK : PROFILE_DECODE_BAD_ID;
+}
+
+template <typename Cursor>
+ProfileDecodeResult decodeProfileMember(Cursor& cursor, const char* member, Profile& profile) {
+    if (!member) {
+        return decodeProfile(cursor, profile);
+    }
+    
+    if (!cursor.consume('{')) return PROFILE_DECODE_SYNTAX;
+    
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    while (cursor.nextMember(first, key, keyLength)) {
+        if (keyIs(key, keyLength, member)) {
+            return decodeProfile(cursor, profile);
+        }
+        cursor.skipValue();
+    }
+    return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_MISSING;
+}
+
+// Actions are decoded straight into their slot, never into a temporary: a text
+// pool compaction only fixes up references that live in the profile
+template <typename Cursor>
+ProfileDecodeResult decodeProfilePatch(Cursor& cursor, ProfilePatchKind kind, Profile& profile,
+                                       ProfileFieldMask& fields) {
+    memset(&fields, 0, sizeof(fields));
+    
+    // The index may follow the members it addresses, so look it up on a copy first
+    int32_t index = 0;
+    if (kind != PROFILE_PATCH_NAME) {
+        Cursor scan = cursor;
+        if (!scan.consume('{')) return PROFILE_DECODE_SYNTAX;
+        
+        index = -1;
+        bool first = true;
+        const char* key;
+        size_t keyLength;
+        while (scan.nextMember(first, key, keyLength)) {
+            if (keyIs(key, keyLength, "index")) index = readIntOr(scan, -1);
+            else scan.skipValue();
+        }
+        if (scan.failed()) return PROFILE_DECODE_SYNTAX;
+        if (index < 0 || index >= (kind == PROFILE_PATCH_KEY ? MATRIX_KEYS : 2)) return PROFILE_DECODE_BAD_INDEX;
+    }
+    
+    if (!cursor.consume('{')) return PROFILE_DECODE_SYNTAX;
+    
+    EncoderConfig& encoder = profile.encoders[kind == PROFILE_PATCH_ENCODER ? index : 0];
+    uint8_t encoderTarget = JOURNAL_TARGET_ENCODER_BASE + index * 3;
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    while (cursor.nextMember(first, key, keyLength)) {
+        ProfileDecodeResult result = PROFILE_DECODE_OK;
+        
+        if (kind == PROFILE_PATCH_KEY) {
+            if (keyIs(key, keyLength, "action")) {
+                result = decodeAction(cursor, profile.keys[index].action);
+                fields.actions |= 1UL << index;
+            }
+            else cursor.skipValue();
+        }
+        else if (kind == PROFILE_PATCH_ENCODER) {
+            if (keyIs(key, keyLength, "cwAction")) {
+                result = decodeAction(cursor, encoder.cwAction);
+                fields.actions |= 1UL << encoderTarget;
+            }
+            else if (keyIs(key, keyLength, "ccwAction")) {
+                result = decodeAction(cursor, encoder.ccwAction);
+                fields.actions |= 1UL << (encoderTarget + 1);
+            }
+            else if (keyIs(key, keyLength, "pressAction")) {
+                result = decodeAction(cursor, encoder.pressAction);
+                fields.actions |= 1UL << (encoderTarget + 2);
+            }
+            else if (keyIs(key, keyLength, "acceleration")) {
+                encoder.acceleration = readBoolOr(cursor, true);
+                fields.encoders |= 1 << index;
+            }
+            else if (keyIs(key, keyLength, "stepsPerDetent")) {
+                encoder.stepsPerDetent = readIntOr(cursor, 4);
+                fields.encoders |= 1 << index;
+            }
+            else cursor.skipValue();
+        }
+        else if (keyIs(key, keyLength, "name")) {
+            char name[sizeof(profile.name)];
+            size_t nameLength;
+            if (cursor.readString(name, sizeof(name), nameLength)) {
+                memset(profile.name, 0, sizeof(profile.name));
+                memcpy(profile.name, name, nameLength);
+                fields.name = true;
+            } else {
+                cursor.skipValue();
+            }
+        }
+        else cursor.skipValue();
+        
+        if (result != PROFILE_DECODE_OK) return result;
+    }
+    
+    if (cursor.failed()) return PROFILE_DECODE_SYNTAX;
+    if (fields.actions == 0 && fields.encoders == 0 && !fields.name) return PROFILE_DECODE_NO_FIELDS;
+    return PROFILE_DECODE_OK;
+}
+
+// One {"crc", "profile"} entry; the checksum covers the profile's text as sent
+ProfileDecodeResult decodeArchiveEntry(JsonCursor& cursor, Profile& profile) {
+    if (!cursor.consume('{')) return PROFILE_DECODE_SYNTAX;
+    
+    bool haveCrc = false;
+    bool haveProfile = false;
+    uint32_t crc = 0;
+    uint32_t actual = 0;
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    while (cursor.nextMember(first, key, keyLength)) {
+        if (keyIs(key, keyLength, "crc")) {
+            haveCrc = cursor.readUint32(crc);
+            if (!haveCrc) cursor.skipValue();
+        }
+        else if (keyIs(key, keyLength, "profile")) {
+            cursor.peekIs('{');
+            const char* start = cursor.position();
+            ProfileDecodeResult result = decodeProfile(cursor, profile);
+            if (result != PROFILE_DECODE_OK) return result;
+            actual = crc32Update(0, reinterpret_cast<const uint8_t*>(start), cursor.position() - start);
+            haveProfile = true;
+        }
+        else cursor.skipValue();
+    }
+    
+    if (cursor.failed()) return PROFILE_DECODE_SYNTAX;
+    if (!haveProfile) return PROFILE_DECODE_MISSING;
+    return haveCrc && crc == actual ? PROFILE_DECODE_OK : PROFILE_DECODE_CHECKSUM;
+}
+}
+
+ProfileDecodeResult decodeProfileJson(const char* json, size_t length, const char* member, Profile& profile) {
+    JsonCursor cursor(json, length);
+    return decodeProfileMember(cursor, member, profile);
+}
+
+ProfileDecodeResult decodeProfileMsgPack(const uint8_t* data, size_t length, const char* member, Profile& profile) {
+    MsgPackCursor cursor(data, length);
+    return decodeProfileMember(cursor, member, profile);
+}
+
+ProfileDecodeResult decodeProfilePatchJson(const char* json, size_t length, ProfilePatchKind kind,
+                                           Profile& profile, ProfileFieldMask& fields) {
+    JsonCursor cursor(json, length);
+    return decodeProfilePatch(cursor, kind, profile, fields);
+}
+
+ProfileDecodeResult decodeProfilePatchMsgPack(const uint8_t* data, size_t length, ProfilePatchKind kind,
+                                              Profile& profile, ProfileFieldMask& fields) {
+    MsgPackCursor cursor(data, length);
+    return decodeProfilePatch(cursor, kind, profile, fields);
+}
+
+ProfileDecodeResult decodeProfileArchiveJson(const char* json, size_t length, const char* member, Profile& profile,
+                                             ProfileArchiveInfo& info, ProfileArchiveVisitor visit, void* context) {
+    info.activeProfileId = PROFILE_ARCHIVE_NO_ID;
+    info.profileCount = 0;
+    
+    JsonCursor cursor(json, length);
+    if (!cursor.consume('{')) return PROFILE_DECODE_SYNTAX;
+    bool first = true;
+    const char* key;
+    size_t keyLength;
+    bool found = false;
+    while (!found && cursor.nextMember(first, key, keyLength)) {
+        if (keyIs(key, keyLength, member)) found = true;
+        else cursor.skipValue();
+    }
+    if (!found) return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_MISSING;
+    
+    // The header may follow the profiles, so check it on a copy first
+    JsonCursor scan = cursor;
+    if (!scan.consume('{')) return PROFILE_DECODE_MISSING;
+    char format[24] = "";
+    int32_t version = 0;
+    first = true;
+    while (scan.nextMember(first, key, keyLength)) {
+        if (keyIs(key, keyLength, "format")) {
+            size_t formatLength;
+            if (!scan.readString(format, sizeof(format), formatLength)) scan.skipValue();
+        }
+        else if (keyIs(key, keyLength, "version")) version = readIntOr(scan, 0);
+        else if (keyIs(key, keyLength, "activeProfileId")) {
+            int32_t id = readIntOr(scan, -1);
+            if (id >= 0 && id <= PROFILE_ID_MAX) info.activeProfileId = id;
+        }
+        else scan.skipValue();
+    }
+    if (scan.failed()) return PROFILE_DECODE_SYNTAX;
+    if (strcmp(format, PROFILE_ARCHIVE_FORMAT) != 0 || version != PROFILE_ARCHIVE_VERSION) {
+        return PROFILE_DECODE_BAD_ARCHIVE;
+    }
+    
+    cursor.consume('{');
+    first = true;
+    while (cursor.nextMember(first, key, keyLength)) {
+        if (!keyIs(key, keyLength, "profiles") || !cursor.peekIs('[')) {
+            cursor.skipValue();
+            continue;
+        }
+        cursor.consume('[');
+        bool firstEntry = true;
+        while (cursor.nextElement(firstEntry)) {
+            ProfileDecodeResult result = decodeArchiveEntry(cursor, profile);
+            if (result != PROFILE_DECODE_OK) return result;
+            info.profileCount++;
+            if (!visit(profile, context)) return PROFILE_DECODE_STOPPED;
+        }
+    }
+    return cursor.failed() ? PROFILE_DECODE_SYNTAX : PROFILE_DECODE_OK;
+}
+
+const char* profileDecodeError(ProfileDecodeResult result) {
+    switch (result) {
+        case PROFILE_DECODE_OK:          return "";
+        case PROFILE_DECODE_MISSING:     return "Missing profile";
+        case PROFILE_DECODE_BAD_ID:      return "Profile ID exceeds device limit";
+        case PROFILE_DECODE_TEXT_FULL:   return "Profile text exceeds device limit";
+        case PROFILE_DECODE_BAD_INDEX:   return "Key or encoder index out of range";
+        case PROFILE_DECODE_NO_FIELDS:   return "Nothing to change";
+        case PROFILE_DECODE_BAD_ARCHIVE: return "Invalid or unsupported archive";
+        case PROFILE_DECODE_CHECKSUM:    return "Archive checksum mismatch";
+        case PROFILE_DECODE_STOPPED:     return "Archive rejected";
+        default:                         return "Invalid profile JSON";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef PROFILE_JSON_READER_H
+#define PROFILE_JSON_READER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "profile.h"
+#include "profile_journal.h"
+
+enum ProfileDecodeResult : uint8_t {
+    PROFILE_DECODE_OK = 0,
+    PROFILE_DECODE_MISSING,      // No profile object where one was expected
+    PROFILE_DECODE_SYNTAX,       // Malformed JSON
+    PROFILE_DECODE_BAD_ID,       // Missing id, or above PROFILE_ID_MAX
+    PROFILE_DECODE_TEXT_FULL,    // Texts don't fit the device's text pool
+    PROFILE_DECODE_BAD_INDEX,    // Edit addresses a key or encoder that doesn't exist
+    PROFILE_DECODE_NO_FIELDS,    // Edit carries none of the fields it may change
+    PROFILE_DECODE_BAD_ARCHIVE,  // Not an archive of a format version this firmware reads
+    PROFILE_DECODE_CHECKSUM,     // Archive entry doesn't match its crc
+    PROFILE_DECODE_STOPPED       // Archive walk ended by its visitor
+};
+
+// Wire encodings of protocol messages (see getCaps "encodings")
+enum MessageEncoding : uint8_t {
+    MESSAGE_ENCODING_JSON = 0,
+    MESSAGE_ENCODING_MSGPACK
+};
+
+// Single-pass decoder for the profile JSON the app sends. Walks the text once
+// and writes fields straight into `profile`, so an upload needs no JsonDocument
+// and no heap beyond the message itself. With `member` set, the profile is
+// read from that member of the top-level object (e.g. "profile" of a
+// setProfile request) and everything else in the envelope is skipped.
+// Same field rules as ProfileStorage's document-based decoder.
+ProfileDecodeResult decodeProfileJson(const char* json, size_t length, const char* member, Profile& profile);
+// Same decoder over a MessagePack message (same keys and value types)
+ProfileDecodeResult decodeProfileMsgPack(const uint8_t* data, size_t length, const char* member, Profile& profile);
+
+// Field-level edits: which members of the request's top-level object are read
+enum ProfilePatchKind : uint8_t {
+    PROFILE_PATCH_KEY = 0,   // setKey: "index", "action"
+    PROFILE_PATCH_ENCODER,   // setEncoder: "index", then any of the encoder object's members
+    PROFILE_PATCH_NAME       // setName: "name"
+};
+
+// Decode a setKey/setEncoder/setName request over `profile`, which holds the
+// stored profile being edited, and report what it changed in `fields`. Values
+// use the same form and rules as in a full profile.
+ProfileDecodeResult decodeProfilePatchJson(const char* json, size_t length, ProfilePatchKind kind,
+                                           Profile& profile, ProfileFieldMask& fields);
+ProfileDecodeResult decodeProfilePatchMsgPack(const uint8_t* data, size_t length, ProfilePatchKind kind,
+                                              Profile& profile, ProfileFieldMask& fields);
+
+// Full-device archive (exportAll/importAll), always JSON:
+// {"format": PROFILE_ARCHIVE_FORMAT, "version": PROFILE_ARCHIVE_VERSION, "activeProfileId": N,
+//  "profiles": [{"crc": C, "profile": {...}}, ...]}
+// where C is the CRC32 of the entry's "profile" value exactly as it appears in the text.
+struct ProfileArchiveInfo {
+    uint16_t activeProfileId;   // PROFILE_ARCHIVE_NO_ID when missing or out of range
+    uint16_t profileCount;      // Entries visited
+};
+
+#define PROFILE_ARCHIVE_NO_ID 0xFFFF
+
+// Called with each entry once it has decoded and matched its crc; false stops the walk
+typedef bool (*ProfileArchiveVisitor)(const Profile& profile, void* context);
+
+// Walk the archive in `member` of the top-level object, decoding entry after
+// entry into `profile`. The header is checked before any entry is visited.
+ProfileDecodeResult decodeProfileArchiveJson(const char* json, size_t length, const char* member, Profile& profile,
+                                             ProfileArchiveInfo& info, ProfileArchiveVisitor visit, void* context);
+
+const char* profileDecodeError(ProfileDecodeResult result);
+
+#endif // PROFILE_JSON_READER_H
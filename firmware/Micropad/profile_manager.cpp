@@ -1,13 +1,58 @@
 #include "profile_manager.h"
-#include "default_profile.h"
-#include "profile_templates.h"
+#include "profile_text.h"
+
+namespace {
+// Keep only the text the double buffer refers to
+void collectText(Profile* buffers) {
+    Profile* roots[2] = { &buffers[0], &buffers[1] };
+    profileTextCollect(roots, 2);
+}
+
+// State of one walk over an archive; `storage` is set on the staging pass
+struct ArchiveWalk {
+    ProfileStorage* storage;
+    Profile* buffers;             // The manager's double buffer, whose text outlives each entry
+    uint16_t ids[MAX_PROFILES];
+    uint16_t count;
+    ProfileDecodeResult reason;   // Why the walk was stopped
+    
+    bool contains(uint16_t id) const {
+        for (uint16_t i = 0; i < count; i++) {
+            if (ids[i] == id) return true;
+        }
+        return false;
+    }
+};
+
+bool visitArchiveEntry(const Profile& profile, void* context) {
+    ArchiveWalk& walk = *static_cast<ArchiveWalk*>(context);
+    if (walk.contains(profile.id) || walk.count >= MAX_PROFILES) {
+        walk.reason = PROFILE_DECODE_BAD_ARCHIVE;
+        return false;
+    }
+    walk.ids[walk.count++] = profile.id;
+    if (walk.storage && !walk.storage->stageProfile(profile)) {
+        walk.reason = PROFILE_DECODE_STOPPED;
+        return false;
+    }
+    // The next entry decodes over this one
+    collectText(walk.buffers);
+    return true;
+}
+}
 
 ProfileManager::ProfileManager() {
+    _activeProfile.store(&_buffers[0]);
+    _generation.store(0);
     _activeProfileId = 0;
+    _persistence = nullptr;
     _initialized = false;
+    _previewActive = false;
+    _previewReturnId = DEFAULT_PROFILE;
+    _previewTouchedAt = 0;
 }
 
-bool ProfileManager::init() {
+bool ProfileManager::init(PersistenceService* persistence) {
     if (_initialized) {
         return true;
     }
@@ -20,27 +65,20 @@ bool ProfileManager::init() {
         return false;
     }
     
-    // Initialize preferences
-    _prefs.begin(PREFS_NAMESPACE, false);
+    _persistence = persistence;
     
     // Load last active profile ID
     _loadActiveProfile();
     
-    // Check if any profiles exist
-    if (_storage.getProfileCount() == 0 || !_storage.profileExists(0)) {
-        DEBUG_PRINTLN("Profiles missing, creating defaults...");
-        initializeDefaultProfiles();
-    }
-    
     // Load the active profile
     if (!loadProfile(_activeProfileId)) {
         DEBUG_PRINTLN("Failed to load active profile, loading default...");
-        if (!loadProfile(0)) {
-            DEBUG_PRINTLN("Default profile missing or corrupt. Rebuilding defaults...");
-            _storage.format();
-            initializeDefaultProfiles();
-            if (!loadProfile(0)) {
-                DEBUG_PRINTLN("ERROR: Failed to rebuild default profile!");
+        if (!loadProfile(DEFAULT_PROFILE)) {
+            // Profile 0 was deleted or its stored copy is unusable: fall back to the
+            // ROM built-in and leave every other (user) profile untouched.
+            DEBUG_PRINTLN("Default profile missing or corrupt. Restoring it...");
+            if (!_storage.restoreBuiltinProfile(DEFAULT_PROFILE) || !loadProfile(DEFAULT_PROFILE)) {
+                DEBUG_PRINTLN("ERROR: Failed to restore default profile!");
                 return false;
             }
         }
@@ -53,50 +91,125 @@ bool ProfileManager::init() {
     return true;
 }
 
-bool ProfileManager::loadProfile(uint8_t id) {
-    if (id >= MAX_PROFILES) {
+void ProfileManager::update() {
+    _storage.update();
+}
+
+bool ProfileManager::loadProfile(uint16_t id) {
+    if (id > PROFILE_ID_MAX) {
         DEBUG_PRINTF("ERROR: Invalid profile ID: %d\n", id);
         return false;
     }
 
-    if (!_storage.loadProfile(id, _currentProfile)) {
+    collectText(_buffers);
+    Profile& work = _workBuffer();
+    if (!_storage.loadProfile(id, work)) {
         return false;
     }
 
-    _activeProfileId = id;
+    _activateWorkBuffer(id);
     
-    DEBUG_PRINTF("Loaded profile %d: %s\n", id, _currentProfile.name);
+    DEBUG_PRINTF("Loaded profile %d: %s\n", id, work.name);
     
     return true;
 }
 
-bool ProfileManager::saveProfile(uint8_t id, const Profile& profile) {
-    if (id >= MAX_PROFILES) {
+bool ProfileManager::saveProfile(uint16_t id, const Profile& profile) {
+    if (id > PROFILE_ID_MAX) {
         DEBUG_PRINTF("ERROR: Invalid profile ID: %d\n", id);
         return false;
     }
 
-    if (profile.id == id) {
-        return _storage.saveProfile(profile);
+    Profile& work = _workBuffer();
+    if (&profile != &work) {
+        work = profile;
+    }
+    work.id = id;
+    if (!_storage.saveProfile(work)) {
+        return false;
+    }
+    
+    // Hot-apply edits to the active profile straight from RAM
+    if (id == _activeProfileId) {
+        bool wasPreview = _previewActive;
+        _activateWorkBuffer(id);
+        if (wasPreview) {
+            _saveActiveProfile();  // Saving the previewed profile commits it
+        }
+    }
+    return true;
+}
+
+ProfileDecodeResult ProfileManager::decodeProfileRequest(const char* data, size_t length, MessageEncoding encoding) {
+    collectText(_buffers);
+    if (encoding == MESSAGE_ENCODING_MSGPACK) {
+        return decodeProfileMsgPack(reinterpret_cast<const uint8_t*>(data), length, "profile", _workBuffer());
+    }
+    return decodeProfileJson(data, length, "profile", _workBuffer());
+}
+
+bool ProfileManager::saveWorkProfile() {
+    Profile& work = _workBuffer();
+    if (work.id > PROFILE_ID_MAX) {
+        return false;
+    }
+    if (!_storage.saveProfileIncremental(work)) {
+        return false;
     }
+    
+    _applySavedWorkBuffer();
+    return true;
+}
 
-    _workProfile = profile;
-    _workProfile.id = id;
-    return _storage.saveProfile(_workProfile);
+ProfileDecodeResult ProfileManager::decodePatchRequest(uint16_t id, const char* data, size_t length,
+                                                       MessageEncoding encoding, ProfilePatchKind kind,
+                                                       ProfileFieldMask& fields) {
+    if (id > PROFILE_ID_MAX) {
+        return PROFILE_DECODE_BAD_ID;
+    }
+    
+    // Unless it is a preview, the active profile is what is stored: copy it
+    // instead of reading flash
+    collectText(_buffers);
+    Profile& work = _workBuffer();
+    if (id == _activeProfileId && !_previewActive) {
+        work = *getCurrentProfile();
+    } else if (!_storage.loadProfile(id, work)) {
+        return PROFILE_DECODE_MISSING;
+    }
+    
+    if (encoding == MESSAGE_ENCODING_MSGPACK) {
+        return decodeProfilePatchMsgPack(reinterpret_cast<const uint8_t*>(data), length, kind, work, fields);
+    }
+    return decodeProfilePatchJson(data, length, kind, work, fields);
 }
 
-bool ProfileManager::saveProfileFromJson(JsonObjectConst obj) {
-    if (!_storage.deserializeProfileFromObject(obj, _workProfile)) {
+bool ProfileManager::saveWorkProfileFields(const ProfileFieldMask& fields) {
+    Profile& work = _workBuffer();
+    if (work.id > PROFILE_ID_MAX) {
         return false;
     }
-    if (_workProfile.id >= MAX_PROFILES) {
+    if (!_storage.saveProfileFields(work, fields)) {
         return false;
     }
-    return _storage.saveProfile(_workProfile);
+    
+    _applySavedWorkBuffer();
+    return true;
 }
 
-bool ProfileManager::deleteProfile(uint8_t id) {
-    if (id >= MAX_PROFILES) {
+bool ProfileManager::undoLastEdit(uint16_t id) {
+    if (!_storage.undoLastEdit(id)) {
+        return false;
+    }
+    
+    if (id == _activeProfileId) {
+        loadProfile(id);
+    }
+    return true;
+}
+
+bool ProfileManager::deleteProfile(uint16_t id) {
+    if (id > PROFILE_ID_MAX) {
         return false;
     }
     
@@ -106,8 +219,8 @@ bool ProfileManager::deleteProfile(uint8_t id) {
         return false;
     }
     
-    // Don't delete if it's currently active
-    if (id == _activeProfileId) {
+    // Don't delete if it's currently active (or is what a preview returns to)
+    if (id == _activeProfileId || (_previewActive && id == _previewReturnId)) {
         DEBUG_PRINTLN("Cannot delete active profile");
         return false;
     }
@@ -115,8 +228,8 @@ bool ProfileManager::deleteProfile(uint8_t id) {
     return _storage.deleteProfile(id);
 }
 
-bool ProfileManager::setActiveProfile(uint8_t id) {
-    if (id >= MAX_PROFILES) {
+bool ProfileManager::setActiveProfile(uint16_t id) {
+    if (id > PROFILE_ID_MAX) {
         return false;
     }
     
@@ -132,41 +245,128 @@ bool ProfileManager::setActiveProfile(uint8_t id) {
     _activeProfileId = id;
     _saveActiveProfile();
     
-    DEBUG_PRINTF("Switched to profile %d: %s\n", id, _currentProfile.name);
+    DEBUG_PRINTF("Switched to profile %d: %s\n", id, getCurrentProfile()->name);
     
     return true;
 }
 
-Profile* ProfileManager::getCurrentProfile() {
-    return &_currentProfile;
+bool ProfileManager::previewWorkProfile() {
+    Profile& work = _workBuffer();
+    if (work.id > PROFILE_ID_MAX) {
+        return false;
+    }
+    
+    // Successive previews keep the profile that was active before the first one
+    uint16_t returnId = _previewActive ? _previewReturnId : _activeProfileId;
+    _activateWorkBuffer(work.id);
+    _previewActive = true;
+    _previewReturnId = returnId;
+    _previewTouchedAt = millis();
+    
+    DEBUG_PRINTF("Previewing profile %d: %s\n", work.id, work.name);
+    return true;
 }
 
-uint8_t ProfileManager::getActiveProfileId() {
+bool ProfileManager::commitPreview() {
+    if (!_previewActive) {
+        return false;
+    }
+    
+    Profile& work = _workBuffer();
+    work = *getCurrentProfile();
+    if (!_storage.saveProfileIncremental(work)) {
+        return false;
+    }
+    
+    // Same contents as the preview; swapping just ends the preview
+    _activateWorkBuffer(work.id);
+    _saveActiveProfile();
+    
+    DEBUG_PRINTF("Committed preview of profile %d\n", work.id);
+    return true;
+}
+
+bool ProfileManager::discardPreview() {
+    if (!_previewActive) {
+        return false;
+    }
+    
+    if (!loadProfile(_previewReturnId) && !loadProfile(DEFAULT_PROFILE)) {
+        DEBUG_PRINTLN("ERROR: Failed to restore profile after preview");
+        return false;
+    }
+    
+    DEBUG_PRINTF("Discarded preview, back on profile %d\n", _activeProfileId);
+    return true;
+}
+
+bool ProfileManager::isPreviewActive() const {
+    return _previewActive;
+}
+
+uint32_t ProfileManager::getPreviewIdleMs() const {
+    return _previewActive ? millis() - _previewTouchedAt : 0;
+}
+
+const Profile* ProfileManager::getCurrentProfile() {
+    return _activeProfile.load();
+}
+
+uint16_t ProfileManager::getActiveProfileId() {
     return _activeProfileId;
 }
 
-bool ProfileManager::profileExists(uint8_t id) {
+uint32_t ProfileManager::getProfileGeneration() const {
+    return _generation.load();
+}
+
+bool ProfileManager::profileExists(uint16_t id) {
     return _storage.profileExists(id);
 }
 
-uint8_t ProfileManager::getProfileCount() {
+uint16_t ProfileManager::getProfileCount() {
     return _storage.getProfileCount();
 }
 
-bool ProfileManager::getProfileInfo(uint8_t id, char* name, size_t* size) {
+bool ProfileManager::getProfileInfo(uint16_t id, char* name, size_t* size) {
     return _storage.getProfileInfo(id, name, size);
 }
 
-bool ProfileManager::loadProfileById(uint8_t id, Profile& profile) {
+const ProfileManifestEntry* ProfileManager::getManifestEntry(uint16_t id) const {
+    return _storage.getManifestEntry(id);
+}
+
+uint16_t ProfileManager::findManifestIndex(uint16_t firstId) const {
+    return _storage.findManifestIndex(firstId);
+}
+
+const ProfileManifestEntry* ProfileManager::getManifestEntryAt(uint16_t index) const {
+    return _storage.getManifestEntryAt(index);
+}
+
+bool ProfileManager::getStoredProfileBody(uint16_t id, String& path, uint32_t& offset, uint32_t& length) {
+    return _storage.getStoredProfileBody(id, path, offset, length);
+}
+
+void ProfileManager::setSlotReaderCheck(ProfileSlotReaderCheck check, void* context) {
+    _storage.setSlotReaderCheck(check, context);
+}
+
+uint32_t ProfileManager::getManifestGeneration() const {
+    return _storage.getManifestGeneration();
+}
+
+bool ProfileManager::loadProfileById(uint16_t id, Profile& profile) {
     return _storage.loadProfile(id, profile);
 }
 
-bool ProfileManager::loadProfileIntoWorkBuffer(uint8_t id) {
-    return _storage.loadProfile(id, _workProfile);
+bool ProfileManager::loadProfileIntoWorkBuffer(uint16_t id) {
+    collectText(_buffers);
+    return _storage.loadProfile(id, _workBuffer());
 }
 
 const Profile* ProfileManager::getWorkProfile() const {
-    return &_workProfile;
+    return _activeProfile.load() == &_buffers[0] ? &_buffers[1] : &_buffers[0];
 }
 
 size_t ProfileManager::getFreeSpace() {
@@ -177,85 +377,120 @@ size_t ProfileManager::getTotalSpace() {
     return _storage.getTotalSpace();
 }
 
+bool ProfileManager::exportArchive(uint32_t& length) {
+    // A preview isn't stored: the archive names the profile it returns to
+    uint16_t activeId = _previewActive ? _previewReturnId : _activeProfileId;
+    return _storage.writeArchive(PROFILE_ARCHIVE_PATH, activeId, length);
+}
+
+ProfileDecodeResult ProfileManager::checkArchive(const char* data, size_t length, ProfileArchiveInfo& info) {
+    ArchiveWalk walk = {};
+    walk.buffers = _buffers;
+    
+    // Entries decode into the work buffer; the active profile is left alone
+    ProfileDecodeResult result = decodeProfileArchiveJson(data, length, "archive", _workBuffer(), info,
+                                                          visitArchiveEntry, &walk);
+    if (result == PROFILE_DECODE_STOPPED) {
+        result = walk.reason;
+    } else if (result == PROFILE_DECODE_OK && walk.count == 0) {
+        result = PROFILE_DECODE_MISSING;  // The device can't be left without profiles
+    } else if (result == PROFILE_DECODE_OK && !walk.contains(info.activeProfileId)) {
+        info.activeProfileId = walk.ids[0];
+    }
+    return result;
+}
+
+bool ProfileManager::importArchive(const char* data, size_t length, const ProfileArchiveInfo& info) {
+    // Ids first (a walk that writes nothing). The stored profiles stay until
+    // the archive's are all staged, so there must be flash for both at once.
+    ArchiveWalk walk = {};
+    walk.buffers = _buffers;
+    ProfileArchiveInfo walked;
+    if (decodeProfileArchiveJson(data, length, "archive", _workBuffer(), walked, visitArchiveEntry, &walk) !=
+        PROFILE_DECODE_OK) {
+        return false;
+    }
+    // The archive text bounds the bytes of its profiles
+    size_t needed = length + (size_t)walk.count * PROFILE_FILE_OVERHEAD_BYTES;
+    if (needed > _storage.getFreeSpace()) {
+        DEBUG_PRINTF("ERROR: Import needs %u bytes, %u free\n", (unsigned)needed, (unsigned)_storage.getFreeSpace());
+        return false;
+    }
+    
+    DEBUG_PRINTF("Importing archive of %d profiles\n", walk.count);
+    walk.count = 0;
+    walk.storage = &_storage;
+    if (decodeProfileArchiveJson(data, length, "archive", _workBuffer(), walked, visitArchiveEntry, &walk) !=
+        PROFILE_DECODE_OK) {
+        _storage.discardImport();
+        return false;
+    }
+    if (!_storage.commitImport(walk.ids, walk.count)) {
+        return false;
+    }
+    
+    // Also ends a preview, and picks up a rewrite of the profile that was active
+    if (!setActiveProfile(info.activeProfileId) && !setActiveProfile(DEFAULT_PROFILE)) {
+        DEBUG_PRINTLN("ERROR: No profile to activate after import");
+        return false;
+    }
+    return true;
+}
+
 void ProfileManager::factoryReset() {
     DEBUG_PRINTLN("Factory reset initiated...");
     
-    // Clear all profiles
-    _storage.format();
+    // Built-ins live in ROM, so this only removes user copies and deletion markers
+    _storage.clearUserProfiles();
     
     // Clear preferences
-    _prefs.clear();
-    
-    // Recreate default profiles
-    initializeDefaultProfiles();
+    _persistence->clear();
     
     // Load default profile
-    loadProfile(0);
-    _activeProfileId = 0;
+    loadProfile(DEFAULT_PROFILE);
+    _activeProfileId = DEFAULT_PROFILE;
     _saveActiveProfile();
     
     DEBUG_PRINTLN("Factory reset complete");
 }
 
-void ProfileManager::initializeDefaultProfiles() {
-    DEBUG_PRINTLN("Creating default profiles...");
-
-    // --- Profile 0: General ---
-    populateDefaultProfile(_workProfile);
-    _storage.saveProfile(_workProfile);
-    DEBUG_PRINTLN("  - Profile 0: General");
-
-    _encoderScratch[0] = _workProfile.encoders[0];
-    _encoderScratch[1] = _workProfile.encoders[1];
-
-    // --- Profile 1: Media ---
-    memset(&_workProfile, 0, sizeof(Profile));
-    _workProfile.id = 1;
-    strcpy(_workProfile.name, "Media");
-    _workProfile.version = 1;
-    _workProfile.keys[0].action.type = ACTION_MEDIA;
-    _workProfile.keys[0].action.config.media.function = MEDIA_FUNC_PREV;
-    _workProfile.keys[1].action.type = ACTION_MEDIA;
-    _workProfile.keys[1].action.config.media.function = MEDIA_FUNC_PLAY_PAUSE;
-    _workProfile.keys[2].action.type = ACTION_MEDIA;
-    _workProfile.keys[2].action.config.media.function = MEDIA_FUNC_NEXT;
-    _workProfile.keys[3].action.type = ACTION_MEDIA;
-    _workProfile.keys[3].action.config.media.function = MEDIA_FUNC_STOP;
-    _workProfile.keys[4].action.type = ACTION_MEDIA;
-    _workProfile.keys[4].action.config.media.function = MEDIA_FUNC_VOLUME_DOWN;
-    _workProfile.keys[5].action.type = ACTION_MEDIA;
-    _workProfile.keys[5].action.config.media.function = MEDIA_FUNC_MUTE;
-    _workProfile.keys[6].action.type = ACTION_MEDIA;
-    _workProfile.keys[6].action.config.media.function = MEDIA_FUNC_VOLUME_UP;
-    _workProfile.keys[11].action.type = ACTION_PROFILE;
-    _workProfile.keys[11].action.config.profile.profileId = 0;
-    _workProfile.encoders[0] = _encoderScratch[0];
-    _workProfile.encoders[1] = _encoderScratch[1];
-    _storage.saveProfile(_workProfile);
-    DEBUG_PRINTLN("  - Profile 1: Media");
-
-    // --- Profile 2: VS Code ---
-    populateVSCodeProfile(_workProfile);
-    _storage.saveProfile(_workProfile);
-    DEBUG_PRINTLN("  - Profile 2: VS Code");
-
-    // --- Profile 3: Creative ---
-    populateCreativeProfile(_workProfile);
-    _storage.saveProfile(_workProfile);
-    DEBUG_PRINTLN("  - Profile 3: Creative");
-
-    DEBUG_PRINTF("Created %d default profiles\n", _storage.getProfileCount());
+Profile& ProfileManager::_workBuffer() {
+    return _activeProfile.load() == &_buffers[0] ? _buffers[1] : _buffers[0];
+}
+
+void ProfileManager::_activateWorkBuffer(uint16_t id) {
+    _activeProfile.store(&_workBuffer());
+    _generation.fetch_add(1);
+    _activeProfileId = id;
+    // Whatever replaced the active profile supersedes an open preview
+    _previewActive = false;
+}
+
+// Hot-apply a saved edit of the active profile straight from RAM
+void ProfileManager::_applySavedWorkBuffer() {
+    uint16_t id = _workBuffer().id;
+    if (id != _activeProfileId) {
+        return;
+    }
+    
+    bool wasPreview = _previewActive;
+    _activateWorkBuffer(id);
+    if (wasPreview) {
+        _saveActiveProfile();  // Saving the previewed profile commits it
+    }
+    DEBUG_PRINTF("Applied edits to active profile %d\n", id);
 }
 
 void ProfileManager::_saveActiveProfile() {
-    _prefs.putUChar("activeProfile", _activeProfileId);
+    // Write-behind: quick profile flipping reaches NVS as one write
+    _persistence->setActiveProfileId(_activeProfileId);
 }
 
 void ProfileManager::_loadActiveProfile() {
-    _activeProfileId = _prefs.getUChar("activeProfile", DEFAULT_PROFILE);
+    _activeProfileId = _persistence->getActiveProfileId();
     
     // Validate
-    if (_activeProfileId >= MAX_PROFILES) {
+    if (_activeProfileId > PROFILE_ID_MAX) {
         _activeProfileId = DEFAULT_PROFILE;
     }
 }
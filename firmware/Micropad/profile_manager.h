@@ -2,57 +2,108 @@
 #define PROFILE_MANAGER_H
 
 #include <Arduino.h>
-#include <Preferences.h>
 #include <ArduinoJson.h>
+#include <atomic>
 #include "config.h"
 #include "profile.h"
 #include "profile_storage.h"
+#include "profile_json_reader.h"
+#include "persistence_service.h"
 
 class ProfileManager {
 public:
     ProfileManager();
     
     // Initialize
-    bool init();
+    bool init(PersistenceService* persistence);
+    
+    // Background storage maintenance (call from loop)
+    void update();
     
     // Profile management
-    bool loadProfile(uint8_t id);
-    bool saveProfile(uint8_t id, const Profile& profile);
-    bool saveProfileFromJson(JsonObjectConst obj);
-    bool deleteProfile(uint8_t id);
-    bool setActiveProfile(uint8_t id);
+    bool loadProfile(uint16_t id);
+    bool saveProfile(uint16_t id, const Profile& profile);
+    // Decode the "profile" member of a request straight into the work buffer;
+    // saveWorkProfile()/previewWorkProfile() then act on it
+    ProfileDecodeResult decodeProfileRequest(const char* data, size_t length, MessageEncoding encoding);
+    bool saveWorkProfile();
+    // Field-level edits (setKey/setEncoder/setName): decode the request over a
+    // copy of profile `id` in the work buffer; saveWorkProfileFields() then
+    // journals only the fields it touched and hot-applies them like a save
+    ProfileDecodeResult decodePatchRequest(uint16_t id, const char* data, size_t length, MessageEncoding encoding,
+                                           ProfilePatchKind kind, ProfileFieldMask& fields);
+    bool saveWorkProfileFields(const ProfileFieldMask& fields);
+    bool undoLastEdit(uint16_t id);
+    bool deleteProfile(uint16_t id);
+    bool setActiveProfile(uint16_t id);
+    
+    // RAM-only preview: the decoded profile becomes active without any flash write.
+    // Any other profile switch or save of the active profile ends the preview.
+    bool previewWorkProfile();
+    bool commitPreview();
+    bool discardPreview();
+    bool isPreviewActive() const;
+    uint32_t getPreviewIdleMs() const;
     
-    // Get current profile
-    Profile* getCurrentProfile();
-    uint8_t getActiveProfileId();
+    // Get current profile (stays valid and unchanged until the next profile switch)
+    const Profile* getCurrentProfile();
+    uint16_t getActiveProfileId();
+    // Bumped every time a different buffer becomes active (switch, hot-apply, preview)
+    uint32_t getProfileGeneration() const;
     
     // Profile queries
-    bool profileExists(uint8_t id);
-    uint8_t getProfileCount();
-    bool getProfileInfo(uint8_t id, char* name, size_t* size);
-    bool loadProfileById(uint8_t id, Profile& profile);
-    bool loadProfileIntoWorkBuffer(uint8_t id);
+    bool profileExists(uint16_t id);
+    uint16_t getProfileCount();
+    bool getProfileInfo(uint16_t id, char* name, size_t* size);
+    const ProfileManifestEntry* getManifestEntry(uint16_t id) const;
+    uint16_t findManifestIndex(uint16_t firstId) const;
+    const ProfileManifestEntry* getManifestEntryAt(uint16_t index) const;
+    bool getStoredProfileBody(uint16_t id, String& path, uint32_t& offset, uint32_t& length);
+    void setSlotReaderCheck(ProfileSlotReaderCheck check, void* context);
+    uint32_t getManifestGeneration() const;
+    // `profile`'s text lasts until the next load or decode into the work buffer
+    bool loadProfileById(uint16_t id, Profile& profile);
+    bool loadProfileIntoWorkBuffer(uint16_t id);
     const Profile* getWorkProfile() const;
     
     // Storage capacity (for GET_CAPS)
     size_t getFreeSpace();
     size_t getTotalSpace();
     
+    // Full-device backup: every profile and the active id, written to
+    // PROFILE_ARCHIVE_PATH (see decodeProfileArchiveJson for the format)
+    bool exportArchive(uint32_t& length);
+    // Restore, in two passes over the request's "archive" member. checkArchive()
+    // decodes and verifies every entry without writing anything, and settles
+    // info.activeProfileId. importArchive() then checks there is room, stages
+    // every archive profile, and commits them all at once (see
+    // ProfileStorage::commitImport), deleting the profiles not in the archive.
+    ProfileDecodeResult checkArchive(const char* data, size_t length, ProfileArchiveInfo& info);
+    bool importArchive(const char* data, size_t length, const ProfileArchiveInfo& info);
+    
     // Factory reset
     void factoryReset();
     
-    // Initialize with default profiles
-    void initializeDefaultProfiles();
-    
 private:
     ProfileStorage _storage;
-    Preferences _prefs;
-    Profile _currentProfile;
-    Profile _workProfile;
-    EncoderConfig _encoderScratch[2];
-    uint8_t _activeProfileId;
+    PersistenceService* _persistence;
+    // Double buffer: the active one is what key handling reads; the other is the
+    // work buffer that loads and edits decode into. A successful decode is made
+    // live by swapping the pointer, so a failed one never touches the active profile.
+    // Each load or decode first drops pool text neither buffer refers to.
+    Profile _buffers[2];
+    std::atomic<Profile*> _activeProfile;
+    std::atomic<uint32_t> _generation;
+    uint16_t _activeProfileId;
     bool _initialized;
     
+    bool _previewActive;
+    uint16_t _previewReturnId;    // Profile to restore when the preview is discarded
+    uint32_t _previewTouchedAt;   // millis() of the last previewWorkProfile
+    
+    Profile& _workBuffer();
+    void _activateWorkBuffer(uint16_t id);
+    void _applySavedWorkBuffer();
     void _saveActiveProfile();
     void _loadActiveProfile();
 };
@@ -1,6 +1,75 @@
 #include "profile_storage.h"
+#include "profile_text.h"
+#include "crc32.h"
+#include <new>
 
 namespace {
+const uint32_t MANIFEST_MAGIC = 0x464D504D;  // "MPMF"
+const uint16_t MANIFEST_FORMAT_VERSION = 5;
+const uint32_t SLOT_MAGIC = 0x4C53504D;      // "MPSL"
+
+// Profiles tracked during a directory scan (ids with files on flash)
+const uint16_t PROFILE_SCAN_CAPACITY = MAX_PROFILES + 16;
+
+// importAll's commit marker (the imported ids), written beside it and renamed
+const char* const IMPORT_COMMIT_PATH = PROFILE_IMPORT_PATH "/commit";
+const char* const IMPORT_COMMIT_TEMP_PATH = PROFILE_IMPORT_PATH "/commit.tmp";
+
+enum : uint8_t {
+    FILE_KIND_DATA = 0x01,       // Slot, legacy or journal file
+    FILE_KIND_TOMBSTONE = 0x02   // Deletion marker for a built-in
+};
+
+enum : uint8_t {
+    SLOT_A = 0,
+    SLOT_B = 1,
+    SLOT_LEGACY = 2  // Single profile_N.json written by firmware before A/B slots
+};
+
+struct ManifestHeader {
+    uint32_t magic;
+    uint16_t formatVersion;
+    uint16_t entryCount;
+    uint32_t revisionCounter;
+    uint32_t crc;  // CRC32 of the entry array that follows
+};
+
+// ArduinoJson writer that only measures and checksums the output
+struct CrcWriter {
+    uint32_t crc;
+
+    CrcWriter() : crc(0) {}
+
+    size_t write(uint8_t c) {
+        crc = crc32Update(crc, &c, 1);
+        return 1;
+    }
+
+    size_t write(const uint8_t* s, size_t n) {
+        crc = crc32Update(crc, s, n);
+        return n;
+    }
+};
+
+// Older cores return the full path from File::name()
+const char* baseName(const char* name) {
+    const char* base = strrchr(name, '/');
+    return base ? base + 1 : name;
+}
+
+// Stream the next `length` bytes of a file through CRC32
+uint32_t crcFileRange(File& file, uint32_t length) {
+    uint32_t crc = 0;
+    uint8_t buf[128];
+    while (length > 0) {
+        size_t n = file.read(buf, length < sizeof(buf) ? length : sizeof(buf));
+        if (n == 0) break;
+        crc = crc32Update(crc, buf, n);
+        length -= n;
+    }
+    return length == 0 ? crc : ~crc;
+}
+
 template <size_t N>
 void copySafeString(char (&dest)[N], const char* src) {
     memset(dest, 0, N);
@@ -49,6 +118,13 @@ void resetProfile(Profile& profile) {
 
 ProfileStorage::ProfileStorage() {
     _initialized = false;
+    memset(_manifest, 0, sizeof(_manifest));
+    _profileCount = 0;
+    _revisionCounter = 0;
+    _pendingCompactions = 0;
+    _manifestGeneration = 0;
+    _slotReaderCheck = nullptr;
+    _slotReaderContext = nullptr;
 }
 
 bool ProfileStorage::init() {
@@ -73,6 +149,26 @@ bool ProfileStorage::init() {
         LittleFS.mkdir(PROFILES_PATH);
         DEBUG_PRINTLN("Created profiles directory");
     }
+    // An export that was still going out when the device went down
+    if (LittleFS.exists(PROFILE_ARCHIVE_PATH)) {
+        LittleFS.remove(PROFILE_ARCHIVE_PATH);
+    }
+    
+    // An import cut short by a power loss: finished if it was committed
+    if (LittleFS.exists(IMPORT_COMMIT_PATH)) {
+        _finishImport();
+    } else {
+        discardImport();
+    }
+    
+    if (!_loadManifest()) {
+        memset(_manifest, 0, sizeof(_manifest));
+        _profileCount = 0;
+        _pendingCompactions = 0;
+    }
+    // Cheap header check against the slot files; only profiles whose files moved on
+    // since the manifest was written (e.g. power cut between the two) are re-read.
+    _reconcileManifest();
     
     return true;
 }
@@ -83,61 +179,174 @@ bool ProfileStorage::saveProfile(const Profile& profile) {
         return false;
     }
     
-    DEBUG_PRINTF("Saving profile %d: %s\n", profile.id, profile.name);
+    if (profile.id > PROFILE_ID_MAX) {
+        DEBUG_PRINTF("ERROR: Invalid profile ID: %d\n", profile.id);
+        return false;
+    }
     
-    // Create JSON document (allocate enough space)
-    DynamicJsonDocument doc(8192);
+    const ProfileManifestEntry* entry = _findEntry(profile.id);
+    if (!entry && _profileCount >= MAX_PROFILES) {
+        DEBUG_PRINTF("ERROR: Profile storage full (%d profiles)\n", MAX_PROFILES);
+        return false;
+    }
     
-    if (!_serializeProfile(profile, doc)) {
-        DEBUG_PRINTLN("ERROR: Failed to serialize profile");
+    DEBUG_PRINTF("Saving profile %d: %s\n", profile.id, profile.name);
+    
+    bool wasLegacy = entry && entry->source == PROFILE_SOURCE_FLASH && entry->slot == SLOT_LEGACY;
+    uint8_t targetSlot;
+    ProfileSlotHeader header;
+    if (!_writeSlot(profile, PROFILES_PATH, targetSlot, header)) {
         return false;
     }
     
-    // Write to temporary file first (atomic write)
-    String tempPath = _getProfilePath(profile.id) + ".tmp";
-    File file = LittleFS.open(tempPath, "w");
+    if (wasLegacy) {
+        LittleFS.remove(_getLegacyPath(profile.id));
+    }
+    if (findBuiltinProfile(profile.id) && LittleFS.exists(_getTombstonePath(profile.id))) {
+        LittleFS.remove(_getTombstonePath(profile.id));
+    }
+    // The new snapshot already contains every journaled edit
+    _journal.remove(profile.id);
     
-    if (!file) {
-        DEBUG_PRINTLN("ERROR: Failed to open file for writing");
+    char safeName[sizeof(profile.name)];
+    copyBoundedBuffer(profile.name, safeName);
+    _setManifestEntry(profile.id, safeName, profile.version, targetSlot, header);
+    _saveManifest();
+    
+    DEBUG_PRINTF("Profile saved successfully (%u bytes, slot %c, seq %u)\n",
+                 header.length, 'a' + targetSlot, header.sequence);
+    return true;
+}
+
+bool ProfileStorage::saveProfileIncremental(const Profile& profile) {
+    const ProfileManifestEntry* entry = _initialized ? _findEntry(profile.id) : nullptr;
+    if (!entry || entry->source != PROFILE_SOURCE_FLASH || entry->slot == SLOT_LEGACY ||
+        entry->journalLength >= PROFILE_JOURNAL_COMPACT_BYTES) {
+        return saveProfile(profile);
+    }
+    
+    // Diff against what is stored now (snapshot + journal)
+    Profile* previous = new (std::nothrow) Profile;
+    if (!previous) {
+        return saveProfile(profile);
+    }
+    
+    uint32_t sequence = entry->sequence;
+    uint32_t previousLength = entry->journalLength;
+    uint32_t journalLength = previousLength;
+    uint16_t textMark = profileTextMark();
+    bool appended = loadProfile(profile.id, *previous) &&
+                    !(_findEntry(profile.id)->flags & MANIFEST_FLAG_COMPACT_PENDING) &&
+                    _journal.appendDiff(profile.id, sequence, journalLength, *previous, profile);
+    delete previous;
+    profileTextRewind(textMark);
+    
+    if (!appended) {
+        return saveProfile(profile);
+    }
+    
+    if (journalLength == previousLength) {
+        DEBUG_PRINTF("Profile %d unchanged\n", profile.id);
+        return true;
+    }
+    
+    _setJournaledManifestEntry(profile, journalLength);
+    if (journalLength >= PROFILE_JOURNAL_COMPACT_BYTES) {
+        _markCompactPending(profile.id);
+    }
+    
+    DEBUG_PRINTF("Profile %d journaled (%u bytes of edits)\n", profile.id, journalLength);
+    return true;
+}
+
+bool ProfileStorage::saveProfileFields(const Profile& profile, const ProfileFieldMask& fields) {
+    const ProfileManifestEntry* entry = _initialized ? _findEntry(profile.id) : nullptr;
+    if (!entry || entry->source != PROFILE_SOURCE_FLASH || entry->slot == SLOT_LEGACY ||
+        entry->journalLength >= PROFILE_JOURNAL_COMPACT_BYTES || (entry->flags & MANIFEST_FLAG_COMPACT_PENDING)) {
+        return saveProfile(profile);
+    }
+    
+    uint32_t journalLength = entry->journalLength;
+    if (!_journal.appendFields(profile.id, entry->sequence, journalLength, profile, fields)) {
+        return saveProfile(profile);
+    }
+    
+    _setJournaledManifestEntry(profile, journalLength);
+    if (journalLength >= PROFILE_JOURNAL_COMPACT_BYTES) {
+        _markCompactPending(profile.id);
+    }
+    
+    DEBUG_PRINTF("Profile %d field edit journaled (%u bytes of edits)\n", profile.id, journalLength);
+    return true;
+}
+
+bool ProfileStorage::undoLastEdit(uint16_t id) {
+    ProfileManifestEntry* entry = _initialized ? _findEntry(id) : nullptr;
+    if (!entry || entry->journalLength == 0) {
         return false;
     }
     
-    size_t bytesWritten = serializeJson(doc, file);
-    file.close();
+    uint32_t sequence = entry->sequence;
+    JournalState state = _journal.replay(id, sequence, nullptr);
+    if (state.stale || state.torn || state.ungrouped || state.undoable == 0) {
+        DEBUG_PRINTF("Profile %d has nothing to undo\n", id);
+        return false;
+    }
     
-    if (bytesWritten == 0) {
-        DEBUG_PRINTLN("ERROR: Failed to write JSON");
-        LittleFS.remove(tempPath);
+    uint32_t journalLength = state.length;
+    if (!_journal.appendUndo(id, sequence, journalLength)) {
+        DEBUG_PRINTLN("ERROR: Failed to append undo marker");
         return false;
     }
     
-    // Rename temp file to actual file (atomic operation)
-    String actualPath = _getProfilePath(profile.id);
-    LittleFS.remove(actualPath);  // Remove old file if exists
-    LittleFS.rename(tempPath, actualPath);
+    entry->journalLength = journalLength;
+    Profile* effective = new (std::nothrow) Profile;
+    uint16_t textMark = profileTextMark();
+    if (effective && loadProfile(id, *effective)) {
+        _setJournaledManifestEntry(*effective, journalLength);
+    } else {
+        // Manifest summary refreshes once the journal is compacted. Until then
+        // the content is unknown, so no client-held hash may match it.
+        entry->hash = 0;
+        entry->revision = ++_revisionCounter;
+        _markCompactPending(id);
+        _saveManifest();
+    }
+    delete effective;
+    profileTextRewind(textMark);
     
-    DEBUG_PRINTF("Profile saved successfully (%d bytes)\n", bytesWritten);
+    if (journalLength >= PROFILE_JOURNAL_COMPACT_BYTES) {
+        _markCompactPending(id);
+    }
     return true;
 }
 
-bool ProfileStorage::loadProfile(uint8_t id, Profile& profile) {
+bool ProfileStorage::loadProfile(uint16_t id, Profile& profile) {
     if (!_initialized) {
         DEBUG_PRINTLN("ERROR: Storage not initialized");
         return false;
     }
     
-    String path = _getProfilePath(id);
-    
-    if (!LittleFS.exists(path)) {
+    const ProfileManifestEntry* entry = _findEntry(id);
+    if (!entry) {
         DEBUG_PRINTF("Profile %d does not exist\n", id);
         return false;
     }
     
     DEBUG_PRINTF("Loading profile %d...\n", id);
     
-    File file = LittleFS.open(path, "r");
-    if (!file) {
-        DEBUG_PRINTLN("ERROR: Failed to open file for reading");
+    if (entry->source == PROFILE_SOURCE_ROM) {
+        const BuiltinProfile* builtin = findBuiltinProfile(id);
+        if (!builtin || !expandBuiltinProfile(*builtin, profile)) return false;
+        DEBUG_PRINTF("Profile loaded from ROM: %s\n", profile.name);
+        return true;
+    }
+    
+    File file;
+    uint8_t slot;
+    ProfileSlotHeader header;
+    if (!_openNewestValidSlot(id, file, slot, header)) {
+        DEBUG_PRINTLN("ERROR: No valid copy of profile on flash");
         return false;
     }
     
@@ -156,77 +365,284 @@ bool ProfileStorage::loadProfile(uint8_t id, Profile& profile) {
         DEBUG_PRINTLN("ERROR: Failed to deserialize profile");
         return false;
     }
+    profile.id = id;
+    
+    if (entry->journalLength > 0) {
+        JournalState state = _journal.replay(id, header.sequence, &profile);
+        if (state.incomplete) {
+            // Not compacted either: that would store the profile without its later edits
+            DEBUG_PRINTF("ERROR: Profile %d edits don't fit the text pool\n", id);
+            return false;
+        }
+        if (state.stale || state.torn || state.ungrouped) {
+            // Fold whatever survived into a fresh snapshot from the loop task
+            DEBUG_PRINTF("Profile %d journal %s\n", id, state.stale ? "stale" : state.torn ? "torn" : "ungrouped");
+            _markCompactPending(id);
+        }
+    }
     
     DEBUG_PRINTF("Profile loaded: %s\n", profile.name);
     return true;
 }
 
-bool ProfileStorage::deleteProfile(uint8_t id) {
-    if (!_initialized) return false;
+bool ProfileStorage::deleteProfile(uint16_t id) {
+    if (!profileExists(id)) return false;
     
-    String path = _getProfilePath(id);
-    if (LittleFS.exists(path)) {
-        return LittleFS.remove(path);
+    // A deleted built-in needs a marker on flash, otherwise it reappears from ROM.
+    // Written first: if power fails before the copies go, the copies still win.
+    if (findBuiltinProfile(id)) {
+        File marker = LittleFS.open(_getTombstonePath(id), "w");
+        if (!marker) {
+            DEBUG_PRINTLN("ERROR: Failed to write deletion marker");
+            return false;
+        }
+        marker.close();
     }
-    return false;
+    
+    if (!_removeProfileFiles(id)) {
+        return false;
+    }
+    
+    _clearManifestEntry(id);
+    _saveManifest();
+    return true;
 }
 
-bool ProfileStorage::profileExists(uint8_t id) {
-    if (!_initialized) return false;
-    return LittleFS.exists(_getProfilePath(id));
+bool ProfileStorage::profileExists(uint16_t id) {
+    return getManifestEntry(id) != nullptr;
 }
 
-uint8_t ProfileStorage::getProfileCount() {
+uint16_t ProfileStorage::getProfileCount() {
     if (!_initialized) return 0;
+    return _profileCount;
+}
+
+bool ProfileStorage::getProfileInfo(uint16_t id, char* name, size_t* size) {
+    const ProfileManifestEntry* entry = getManifestEntry(id);
+    if (!entry) return false;
     
-    uint8_t count = 0;
-    for (uint8_t i = 0; i < MAX_PROFILES; i++) {
-        if (profileExists(i)) {
-            count++;
+    if (size) {
+        *size = entry->size;
+    }
+    if (name) {
+        strlcpy(name, entry->name, sizeof(entry->name));
+    }
+    return true;
+}
+
+const ProfileManifestEntry* ProfileStorage::getManifestEntry(uint16_t id) const {
+    if (!_initialized) return nullptr;
+    return const_cast<ProfileStorage*>(this)->_findEntry(id);
+}
+
+bool ProfileStorage::getStoredProfileBody(uint16_t id, String& path, uint32_t& offset, uint32_t& length) {
+    const ProfileManifestEntry* entry = getManifestEntry(id);
+    if (!entry || entry->source != PROFILE_SOURCE_FLASH || entry->slot == SLOT_LEGACY) {
+        return false;
+    }
+    if (entry->journalLength != 0 || (entry->flags & MANIFEST_FLAG_COMPACT_PENDING) || entry->hash == 0) {
+        return false;
+    }
+    path = _getSlotPath(id, entry->slot);
+    offset = sizeof(ProfileSlotHeader);
+    length = entry->size;
+    return true;
+}
+
+void ProfileStorage::setSlotReaderCheck(ProfileSlotReaderCheck check, void* context) {
+    _slotReaderCheck = check;
+    _slotReaderContext = context;
+}
+
+uint32_t ProfileStorage::getManifestGeneration() const {
+    return _manifestGeneration;
+}
+
+uint16_t ProfileStorage::findManifestIndex(uint16_t firstId) const {
+    uint16_t lo = 0;
+    uint16_t hi = _profileCount;
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (_manifest[mid].id < firstId) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    return count;
+    return lo;
+}
+
+const ProfileManifestEntry* ProfileStorage::getManifestEntryAt(uint16_t index) const {
+    if (!_initialized || index >= _profileCount) return nullptr;
+    return &_manifest[index];
 }
 
-bool ProfileStorage::getProfileInfo(uint8_t id, char* name, size_t* size) {
+bool ProfileStorage::clearUserProfiles() {
     if (!_initialized) return false;
     
-    String path = _getProfilePath(id);
-    if (!LittleFS.exists(path)) return false;
+    DEBUG_PRINTLN("Removing user profiles...");
+    uint16_t* ids = new (std::nothrow) uint16_t[PROFILE_SCAN_CAPACITY];
+    uint8_t* kinds = new (std::nothrow) uint8_t[PROFILE_SCAN_CAPACITY];
+    bool ok = ids && kinds;
+    if (ok) {
+        uint16_t count = _scanProfileFiles(ids, kinds, PROFILE_SCAN_CAPACITY);
+        for (uint16_t i = 0; i < count; i++) {
+            if (kinds[i] & FILE_KIND_TOMBSTONE) {
+                LittleFS.remove(_getTombstonePath(ids[i]));
+            }
+            if (kinds[i] & FILE_KIND_DATA) {
+                ok = _removeProfileFiles(ids[i]) && ok;
+            }
+        }
+    }
+    delete[] ids;
+    delete[] kinds;
     
-    File file = LittleFS.open(path, "r");
-    if (!file) return false;
+    memset(_manifest, 0, sizeof(_manifest));
+    _profileCount = 0;
+    _pendingCompactions = 0;
+    _reconcileManifest();
     
-    if (size) {
-        *size = file.size();
+    return ok;
+}
+
+bool ProfileStorage::restoreBuiltinProfile(uint16_t id) {
+    const BuiltinProfile* builtin = findBuiltinProfile(id);
+    if (!_initialized || !builtin) return false;
+    
+    if (LittleFS.exists(_getTombstonePath(id))) {
+        LittleFS.remove(_getTombstonePath(id));
+    }
+    if (!_removeProfileFiles(id)) {
+        return false;
     }
     
-    if (name) {
-        // Quick read just to get the name
-        DynamicJsonDocument doc(512);
-        DeserializationError error = deserializeJson(doc, file);
-        if (error) {
-            strlcpy(name, "Unknown", 32);
-        } else {
-            strlcpy(name, doc["name"] | "Unknown", 32);
-        }
+    _clearManifestEntry(id);
+    _setBuiltinManifestEntry(*builtin);
+    _saveManifest();
+    return profileExists(id);
+}
+
+bool ProfileStorage::writeArchive(const char* path, uint16_t activeId, uint32_t& length) {
+    if (!_initialized) return false;
+    
+    Profile* profile = new (std::nothrow) Profile;
+    if (!profile) {
+        DEBUG_PRINTLN("ERROR: No memory to export profiles");
+        return false;
+    }
+    File file = LittleFS.open(path, "w");
+    if (!file) {
+        DEBUG_PRINTLN("ERROR: Failed to open archive for writing");
+        delete profile;
+        return false;
     }
     
+    char head[128];
+    size_t expected = snprintf(head, sizeof(head), "{\"format\":\"%s\",\"version\":%u,\"activeProfileId\":%u,\"profiles\":[",
+                               PROFILE_ARCHIVE_FORMAT, PROFILE_ARCHIVE_VERSION, activeId);
+    size_t written = file.write((const uint8_t*)head, expected);
+    
+    DynamicJsonDocument doc(8192);
+    bool ok = true;
+    uint16_t textMark = profileTextMark();
+    for (uint16_t i = 0; ok && i < _profileCount; i++) {
+        profileTextRewind(textMark);  // The previous profile's text
+        if (!loadProfile(_manifest[i].id, *profile)) {
+            DEBUG_PRINTF("ERROR: Profile %d unreadable, export abandoned\n", _manifest[i].id);
+            ok = false;
+            break;
+        }
+        doc.clear();
+        _serializeProfile(*profile, doc);
+        
+        // The entry's crc covers the profile text, so it goes out ahead of it
+        CrcWriter measure;
+        size_t profileLength = serializeJson(doc, measure);
+        size_t entryLength = snprintf(head, sizeof(head), "%s{\"crc\":%u,\"profile\":", i > 0 ? "," : "",
+                                      (unsigned)measure.crc);
+        written += file.write((const uint8_t*)head, entryLength);
+        written += serializeJson(doc, file);
+        written += file.write('}');
+        expected += entryLength + profileLength + 1;
+        ok = written == expected;
+    }
+    written += file.write((const uint8_t*)"]}", 2);
+    expected += 2;
     file.close();
+    delete profile;
+    
+    if (!ok || written != expected) {
+        DEBUG_PRINTLN("ERROR: Failed to write archive");
+        LittleFS.remove(path);
+        return false;
+    }
+    length = written;
     return true;
 }
 
-bool ProfileStorage::format() {
-    if (!_initialized) return false;
+bool ProfileStorage::stageProfile(const Profile& profile) {
+    if (!_initialized || profile.id > PROFILE_ID_MAX) return false;
     
-    DEBUG_PRINTLN("Formatting LittleFS...");
-    LittleFS.end();
-    LittleFS.begin(true);
-    _initialized = true;
+    if (!LittleFS.exists(PROFILE_IMPORT_PATH)) {
+        LittleFS.mkdir(PROFILE_IMPORT_PATH);
+    }
+    uint8_t slot;
+    ProfileSlotHeader header;
+    return _writeSlot(profile, PROFILE_IMPORT_PATH, slot, header);
+}
+
+bool ProfileStorage::commitImport(const uint16_t* ids, uint16_t count) {
+    if (!_initialized || count == 0 || count > MAX_PROFILES) return false;
+    
+    // The id list is written beside the staged profiles, then renamed into place
+    File file = LittleFS.open(IMPORT_COMMIT_TEMP_PATH, "w");
+    if (!file) {
+        DEBUG_PRINTLN("ERROR: Failed to open import marker");
+        discardImport();
+        return false;
+    }
+    size_t length = count * sizeof(uint16_t);
+    size_t written = file.write((const uint8_t*)ids, length);
+    file.close();
+    if (written != length || !LittleFS.rename(IMPORT_COMMIT_TEMP_PATH, IMPORT_COMMIT_PATH)) {
+        DEBUG_PRINTLN("ERROR: Failed to commit import");
+        discardImport();
+        return false;
+    }
     
+    _finishImport();
+    _reconcileManifest();
     return true;
 }
 
+void ProfileStorage::discardImport() {
+    // Reopened after each remove rather than walked while it changes
+    while (true) {
+        File dir = LittleFS.open(PROFILE_IMPORT_PATH);
+        File entry = dir && dir.isDirectory() ? dir.openNextFile() : File();
+        if (!entry) return;
+        String path = String(PROFILE_IMPORT_PATH) + "/" + baseName(entry.name());
+        entry.close();
+        dir.close();
+        if (!LittleFS.remove(path)) return;
+    }
+}
+
+void ProfileStorage::update() {
+    if (!_initialized || _pendingCompactions == 0) return;
+    
+    for (uint16_t i = 0; i < _profileCount; i++) {
+        if (_manifest[i].flags & MANIFEST_FLAG_COMPACT_PENDING) {
+            _manifest[i].flags &= ~MANIFEST_FLAG_COMPACT_PENDING;
+            _pendingCompactions--;
+            _compactProfile(_manifest[i].id);
+            return;
+        }
+    }
+    _pendingCompactions = 0;
+}
+
 size_t ProfileStorage::getTotalSpace() {
     if (!_initialized) return 0;
     return LittleFS.totalBytes();
@@ -241,12 +657,648 @@ size_t ProfileStorage::getFreeSpace() {
     return getTotalSpace() - getUsedSpace();
 }
 
-String ProfileStorage::_getProfilePath(uint8_t id) {
+ProfileManifestEntry* ProfileStorage::_findEntry(uint16_t id) {
+    uint16_t index = findManifestIndex(id);
+    if (index < _profileCount && _manifest[index].id == id) {
+        return &_manifest[index];
+    }
+    return nullptr;
+}
+
+ProfileManifestEntry* ProfileStorage::_insertEntry(uint16_t id) {
+    uint16_t index = findManifestIndex(id);
+    if (index < _profileCount && _manifest[index].id == id) {
+        return &_manifest[index];
+    }
+    if (_profileCount >= MAX_PROFILES) {
+        DEBUG_PRINTF("Profile manifest full, dropping profile %d\n", id);
+        return nullptr;
+    }
+    
+    memmove(&_manifest[index + 1], &_manifest[index], (_profileCount - index) * sizeof(ProfileManifestEntry));
+    _profileCount++;
+    memset(&_manifest[index], 0, sizeof(ProfileManifestEntry));
+    _manifest[index].id = id;
+    return &_manifest[index];
+}
+
+void ProfileStorage::_markCompactPending(uint16_t id) {
+    ProfileManifestEntry* entry = _findEntry(id);
+    if (entry && !(entry->flags & MANIFEST_FLAG_COMPACT_PENDING)) {
+        entry->flags |= MANIFEST_FLAG_COMPACT_PENDING;
+        _pendingCompactions++;
+    }
+}
+
+bool ProfileStorage::_loadManifest() {
+    File file = LittleFS.open(PROFILE_MANIFEST_PATH, "r");
+    if (!file) {
+        DEBUG_PRINTLN("No profile manifest found");
+        return false;
+    }
+    
+    ManifestHeader header;
+    size_t entryBytes = 0;
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              header.magic == MANIFEST_MAGIC &&
+              header.formatVersion == MANIFEST_FORMAT_VERSION &&
+              header.entryCount <= MAX_PROFILES;
+    if (ok) {
+        entryBytes = header.entryCount * sizeof(ProfileManifestEntry);
+        ok = file.read((uint8_t*)_manifest, entryBytes) == entryBytes &&
+             crc32Update(0, (const uint8_t*)_manifest, entryBytes) == header.crc;
+    }
+    file.close();
+    
+    // Binary search relies on strictly ascending ids
+    for (uint16_t i = 1; ok && i < header.entryCount; i++) {
+        ok = _manifest[i - 1].id < _manifest[i].id;
+    }
+    
+    if (!ok) {
+        DEBUG_PRINTLN("Profile manifest invalid");
+        memset(_manifest, 0, sizeof(_manifest));
+        return false;
+    }
+    
+    _revisionCounter = header.revisionCounter;
+    _profileCount = header.entryCount;
+    _pendingCompactions = 0;
+    for (uint16_t i = 0; i < _profileCount; i++) {
+        if (_manifest[i].flags & MANIFEST_FLAG_COMPACT_PENDING) {
+            _pendingCompactions++;
+        }
+    }
+    
+    DEBUG_PRINTF("Profile manifest loaded (%d profiles)\n", _profileCount);
+    return true;
+}
+
+bool ProfileStorage::_saveManifest() {
+    _manifestGeneration++;
+    size_t entryBytes = _profileCount * sizeof(ProfileManifestEntry);
+    
+    ManifestHeader header;
+    header.magic = MANIFEST_MAGIC;
+    header.formatVersion = MANIFEST_FORMAT_VERSION;
+    header.entryCount = _profileCount;
+    header.revisionCounter = _revisionCounter;
+    header.crc = crc32Update(0, (const uint8_t*)_manifest, entryBytes);
+    
+    // Write to temporary file, then rename over the old manifest (LittleFS rename is atomic)
+    String tempPath = String(PROFILE_MANIFEST_PATH) + ".tmp";
+    File file = LittleFS.open(tempPath, "w");
+    if (!file) {
+        DEBUG_PRINTLN("ERROR: Failed to open manifest for writing");
+        return false;
+    }
+    
+    size_t written = file.write((const uint8_t*)&header, sizeof(header));
+    if (entryBytes > 0) {
+        written += file.write((const uint8_t*)_manifest, entryBytes);
+    }
+    file.close();
+    
+    if (written != sizeof(header) + entryBytes) {
+        DEBUG_PRINTLN("ERROR: Failed to write manifest");
+        LittleFS.remove(tempPath);
+        return false;
+    }
+    
+    return LittleFS.rename(tempPath, PROFILE_MANIFEST_PATH);
+}
+
+// Collect the ids that have files under PROFILES_PATH, sorted ascending, with the
+// kinds of file seen for each
+uint16_t ProfileStorage::_scanProfileFiles(uint16_t* ids, uint8_t* kinds, uint16_t capacity) {
+    uint16_t count = 0;
+    
+    File dir = LittleFS.open(PROFILES_PATH);
+    if (!dir || !dir.isDirectory()) {
+        return 0;
+    }
+    
+    File entry = dir.openNextFile();
+    while (entry) {
+        const char* base = baseName(entry.name());
+        
+        unsigned int id;
+        char ext[8];
+        if (sscanf(base, "profile_%u.%7s", &id, ext) == 2 && id <= PROFILE_ID_MAX) {
+            uint8_t kind = strcmp(ext, "del") == 0 ? FILE_KIND_TOMBSTONE : FILE_KIND_DATA;
+            
+            uint16_t lo = 0;
+            uint16_t hi = count;
+            while (lo < hi) {
+                uint16_t mid = lo + (hi - lo) / 2;
+                if (ids[mid] < id) lo = mid + 1; else hi = mid;
+            }
+            
+            if (lo < count && ids[lo] == id) {
+                kinds[lo] |= kind;
+            } else if (count < capacity) {
+                memmove(&ids[lo + 1], &ids[lo], (count - lo) * sizeof(uint16_t));
+                memmove(&kinds[lo + 1], &kinds[lo], count - lo);
+                ids[lo] = id;
+                kinds[lo] = kind;
+                count++;
+            } else {
+                DEBUG_PRINTF("Too many profile files, ignoring profile %u\n", id);
+            }
+        }
+        entry = dir.openNextFile();
+    }
+    return count;
+}
+
+void ProfileStorage::_reconcileManifest() {
+    uint16_t* ids = new (std::nothrow) uint16_t[PROFILE_SCAN_CAPACITY];
+    uint8_t* kinds = new (std::nothrow) uint8_t[PROFILE_SCAN_CAPACITY];
+    if (!ids || !kinds) {
+        // Keep serving whatever manifest was loaded
+        DEBUG_PRINTLN("ERROR: No memory to reconcile profile manifest");
+        delete[] ids;
+        delete[] kinds;
+        return;
+    }
+    uint16_t fileCount = _scanProfileFiles(ids, kinds, PROFILE_SCAN_CAPACITY);
+    
+    // Binary search in the sorted scan result
+    struct Lookup {
+        const uint16_t* ids;
+        const uint8_t* kinds;
+        uint16_t count;
+        uint8_t kindsOf(uint16_t id) const {
+            uint16_t lo = 0;
+            uint16_t hi = count;
+            while (lo < hi) {
+                uint16_t mid = lo + (hi - lo) / 2;
+                if (ids[mid] < id) lo = mid + 1; else hi = mid;
+            }
+            return lo < count && ids[lo] == id ? kinds[lo] : 0;
+        }
+    } files = { ids, kinds, fileCount };
+    
+    bool changed = false;
+    
+    // Entries with neither a copy on flash nor a visible built-in behind them. A
+    // flash entry whose files are gone is dropped too (a restore cut short before
+    // the manifest write); the built-in pass below serves it from ROM again.
+    for (int i = _profileCount - 1; i >= 0; i--) {
+        uint16_t id = _manifest[i].id;
+        uint8_t kind = files.kindsOf(id);
+        if (!(kind & FILE_KIND_DATA) && (_manifest[i].source == PROFILE_SOURCE_FLASH ||
+                                         (kind & FILE_KIND_TOMBSTONE) || !findBuiltinProfile(id))) {
+            _clearManifestEntry(id);
+            changed = true;
+        }
+    }
+    
+    for (uint16_t i = 0; i < fileCount; i++) {
+        if (kinds[i] & FILE_KIND_DATA) {
+            _reconcileFlashEntry(ids[i], changed);
+        }
+    }
+    
+    // Built-ins without a usable copy on flash are served from ROM unless the user deleted them
+    for (uint8_t i = 0; i < getBuiltinProfileCount(); i++) {
+        const BuiltinProfile& builtin = getBuiltinProfile(i);
+        const ProfileManifestEntry* entry = _findEntry(builtin.id);
+        if ((entry && entry->source == PROFILE_SOURCE_FLASH) || (files.kindsOf(builtin.id) & FILE_KIND_TOMBSTONE)) {
+            continue;
+        }
+        changed = _setBuiltinManifestEntry(builtin) || changed;
+    }
+    
+    delete[] ids;
+    delete[] kinds;
+    
+    if (changed) {
+        _saveManifest();
+    }
+    DEBUG_PRINTF("Profile manifest ready (%d profiles)\n", _profileCount);
+}
+
+// True if `id` has a usable copy on flash; re-reads it only when the manifest is out of date
+bool ProfileStorage::_reconcileFlashEntry(uint16_t id, bool& changed) {
+    const ProfileManifestEntry* entry = _findEntry(id);
+    
+    ProfileSlotHeader headers[2];
+    bool valid[2] = {
+        _readSlotHeader(id, SLOT_A, headers[SLOT_A]),
+        _readSlotHeader(id, SLOT_B, headers[SLOT_B])
+    };
+    
+    if (entry && entry->source == PROFILE_SOURCE_FLASH) {
+        uint32_t newest = 0;
+        for (uint8_t i = 0; i < 2; i++) {
+            if (valid[i] && headers[i].sequence > newest) newest = headers[i].sequence;
+        }
+        
+        bool consistent;
+        if (entry->slot == SLOT_LEGACY) {
+            consistent = newest == 0;
+        } else {
+            consistent = entry->slot < 2 && valid[entry->slot] &&
+                         headers[entry->slot].sequence == entry->sequence &&
+                         newest == entry->sequence &&
+                         _journal.fileSize(id) == entry->journalLength;
+        }
+        if (consistent) return true;
+    }
+    
+    changed = true;
+    return _refreshManifestEntry(id);
+}
+
+bool ProfileStorage::_refreshManifestEntry(uint16_t id) {
+    File file;
+    uint8_t slot;
+    ProfileSlotHeader header;
+    if (!_openNewestValidSlot(id, file, slot, header)) {
+        DEBUG_PRINTF("Profile %d has no valid copy\n", id);
+        _clearManifestEntry(id);
+        _journal.remove(id);
+        return false;
+    }
+    
+    // Only pull the fields the manifest needs; the rest of the profile is skipped by the parser
+    DynamicJsonDocument filter(64);
+    filter["name"] = true;
+    filter["version"] = true;
+    
+    DynamicJsonDocument doc(128);
+    DeserializationError error = deserializeJson(doc, file, DeserializationOption::Filter(filter));
+    file.close();
+    
+    if (error) {
+        DEBUG_PRINTF("Profile %d unreadable: %s\n", id, error.c_str());
+        _clearManifestEntry(id);
+        return false;
+    }
+    
+    if (!_setManifestEntry(id, doc["name"] | "Unnamed", doc["version"] | 1, slot, header)) {
+        return false;
+    }
+    
+    // Name and hash above describe the snapshot only; a live journal is folded in by
+    // compaction, and until then the hash is unknown (0) so no client copy matches
+    JournalState state = _journal.replay(id, header.sequence, nullptr);
+    if (state.stale || state.length == 0 || slot == SLOT_LEGACY) {
+        _journal.remove(id);
+    } else {
+        ProfileManifestEntry* entry = _findEntry(id);
+        entry->journalLength = state.length;
+        entry->hash = 0;
+        _markCompactPending(id);
+    }
+    return true;
+}
+
+bool ProfileStorage::_setManifestEntry(uint16_t id, const char* name, uint8_t version, uint8_t slot,
+                                       const ProfileSlotHeader& header) {
+    ProfileManifestEntry* entry = _insertEntry(id);
+    if (!entry) return false;
+    
+    if (entry->flags & MANIFEST_FLAG_COMPACT_PENDING) {
+        _pendingCompactions--;
+    }
+    memset(entry, 0, sizeof(ProfileManifestEntry));
+    entry->id = id;
+    entry->version = version;
+    entry->slot = slot;
+    copySafeString(entry->name, name);
+    entry->size = header.length;
+    entry->hash = header.crc;
+    entry->revision = ++_revisionCounter;
+    entry->sequence = header.sequence;
+    return true;
+}
+
+void ProfileStorage::_setJournaledManifestEntry(const Profile& profile, uint32_t journalLength) {
+    ProfileManifestEntry* entry = _findEntry(profile.id);
+    if (!entry) return;
+    
+    DynamicJsonDocument doc(8192);
+    CrcWriter measure;
+    _serializeProfile(profile, doc);
+    serializeJson(doc, measure);
+    
+    char safeName[sizeof(profile.name)];
+    copyBoundedBuffer(profile.name, safeName);
+    copySafeString(entry->name, safeName);
+    entry->hash = measure.crc;
+    entry->revision = ++_revisionCounter;
+    entry->journalLength = journalLength;
+    _saveManifest();
+}
+
+void ProfileStorage::_compactProfile(uint16_t id) {
+    const ProfileManifestEntry* entry = _findEntry(id);
+    if (!entry) return;
+    if (entry->slot != SLOT_LEGACY && _isSlotBeingRead(id, entry->slot == SLOT_A ? SLOT_B : SLOT_A)) {
+        _markCompactPending(id);  // Try again once the transfer is over
+        return;
+    }
+    
+    Profile* profile = new (std::nothrow) Profile;
+    if (!profile) {
+        DEBUG_PRINTLN("ERROR: No memory to compact profile journal");
+        return;
+    }
+    
+    DEBUG_PRINTF("Compacting profile %d journal (%u bytes)\n", id, entry->journalLength);
+    uint16_t textMark = profileTextMark();
+    if (loadProfile(id, *profile)) {
+        saveProfile(*profile);
+    }
+    delete profile;
+    profileTextRewind(textMark);
+}
+
+// Every step can run again: a power cut part way through repeats it from the
+// start on the next boot, until the marker is gone
+void ProfileStorage::_finishImport() {
+    uint16_t* ids = new (std::nothrow) uint16_t[MAX_PROFILES];
+    uint16_t* stored = new (std::nothrow) uint16_t[PROFILE_SCAN_CAPACITY];
+    uint8_t* kinds = new (std::nothrow) uint8_t[PROFILE_SCAN_CAPACITY];
+    File marker = LittleFS.open(IMPORT_COMMIT_PATH, "r");
+    if (!ids || !stored || !kinds || !marker) {
+        // The marker stays, so the next boot tries again
+        DEBUG_PRINTLN("ERROR: Can't finish import");
+        delete[] ids;
+        delete[] stored;
+        delete[] kinds;
+        return;
+    }
+    uint16_t count = marker.read((uint8_t*)ids, MAX_PROFILES * sizeof(uint16_t)) / sizeof(uint16_t);
+    marker.close();
+    DEBUG_PRINTF("Finishing import of %d profiles\n", count);
+    
+    // Each staged copy goes over the slot it was written for; the newer
+    // sequence makes it the current copy
+    for (uint16_t i = 0; i < count; i++) {
+        for (uint8_t slot = SLOT_A; slot <= SLOT_B; slot++) {
+            String staged = _getSlotPath(ids[i], slot, PROFILE_IMPORT_PATH);
+            if (LittleFS.exists(staged)) {
+                LittleFS.rename(staged, _getSlotPath(ids[i], slot));
+            }
+        }
+        if (LittleFS.exists(_getLegacyPath(ids[i]))) {
+            LittleFS.remove(_getLegacyPath(ids[i]));
+        }
+        if (LittleFS.exists(_getTombstonePath(ids[i]))) {
+            LittleFS.remove(_getTombstonePath(ids[i]));
+        }
+        _journal.remove(ids[i]);
+    }
+    
+    auto imported = [&](uint16_t id) {
+        for (uint16_t i = 0; i < count; i++) {
+            if (ids[i] == id) return true;
+        }
+        return false;
+    };
+    uint16_t fileCount = _scanProfileFiles(stored, kinds, PROFILE_SCAN_CAPACITY);
+    for (uint16_t i = 0; i < fileCount; i++) {
+        if ((kinds[i] & FILE_KIND_DATA) && !imported(stored[i])) {
+            _removeProfileFiles(stored[i]);
+        }
+    }
+    // Built-ins the archive left out stay deleted
+    for (uint8_t i = 0; i < getBuiltinProfileCount(); i++) {
+        uint16_t id = getBuiltinProfile(i).id;
+        if (!imported(id) && !LittleFS.exists(_getTombstonePath(id))) {
+            File tombstone = LittleFS.open(_getTombstonePath(id), "w");
+            tombstone.close();
+        }
+    }
+    delete[] ids;
+    delete[] stored;
+    delete[] kinds;
+    
+    // The manifest is rebuilt from the files by the caller
+    LittleFS.remove(IMPORT_COMMIT_PATH);
+    discardImport();
+}
+
+bool ProfileStorage::_setBuiltinManifestEntry(const BuiltinProfile& builtin) {
+    Profile* profile = new (std::nothrow) Profile;
+    if (!profile) {
+        DEBUG_PRINTLN("ERROR: No memory to index built-in profile");
+        return false;
+    }
+    
+    // Size and hash describe the JSON a client would receive, same as for stored profiles
+    uint16_t textMark = profileTextMark();
+    bool expanded = expandBuiltinProfile(builtin, *profile);
+    DynamicJsonDocument doc(8192);
+    CrcWriter measure;
+    _serializeProfile(*profile, doc);
+    size_t length = serializeJson(doc, measure);
+    delete profile;
+    profileTextRewind(textMark);
+    if (!expanded) {
+        DEBUG_PRINTLN("ERROR: No room to index built-in profile");
+        return false;
+    }
+    
+    const ProfileManifestEntry* existing = _findEntry(builtin.id);
+    if (existing && existing->source == PROFILE_SOURCE_ROM && existing->hash == measure.crc) {
+        return false;
+    }
+    
+    ProfileManifestEntry* entry = _insertEntry(builtin.id);
+    if (!entry) return false;
+    
+    if (entry->flags & MANIFEST_FLAG_COMPACT_PENDING) {
+        _pendingCompactions--;
+    }
+    memset(entry, 0, sizeof(ProfileManifestEntry));
+    entry->id = builtin.id;
+    entry->source = PROFILE_SOURCE_ROM;
+    entry->version = builtin.version;
+    copySafeString(entry->name, builtin.name);
+    entry->size = length;
+    entry->hash = measure.crc;
+    entry->revision = ++_revisionCounter;
+    return true;
+}
+
+void ProfileStorage::_clearManifestEntry(uint16_t id) {
+    ProfileManifestEntry* entry = _findEntry(id);
+    if (!entry) return;
+    
+    if (entry->flags & MANIFEST_FLAG_COMPACT_PENDING) {
+        _pendingCompactions--;
+    }
+    uint16_t index = entry - _manifest;
+    memmove(&_manifest[index], &_manifest[index + 1], (_profileCount - index - 1) * sizeof(ProfileManifestEntry));
+    _profileCount--;
+    memset(&_manifest[_profileCount], 0, sizeof(ProfileManifestEntry));
+}
+
+bool ProfileStorage::_readSlotHeader(uint16_t id, uint8_t slot, ProfileSlotHeader& header) {
+    File file = LittleFS.open(_getSlotPath(id, slot), "r");
+    if (!file) return false;
+    
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              header.magic == SLOT_MAGIC &&
+              file.size() == sizeof(header) + header.length;
+    file.close();
+    return ok;
+}
+
+bool ProfileStorage::_openNewestValidSlot(uint16_t id, File& file, uint8_t& slot, ProfileSlotHeader& header) {
+    ProfileSlotHeader headers[2];
+    bool valid[2] = {
+        _readSlotHeader(id, SLOT_A, headers[SLOT_A]),
+        _readSlotHeader(id, SLOT_B, headers[SLOT_B])
+    };
+    
+    // Newest first; fall back to the older slot if the newer body fails its CRC (torn write)
+    uint8_t order[2] = { SLOT_A, SLOT_B };
+    if (valid[SLOT_B] && (!valid[SLOT_A] || headers[SLOT_B].sequence > headers[SLOT_A].sequence)) {
+        order[0] = SLOT_B;
+        order[1] = SLOT_A;
+    }
+    
+    for (uint8_t i = 0; i < 2; i++) {
+        uint8_t candidate = order[i];
+        if (!valid[candidate]) continue;
+        
+        file = LittleFS.open(_getSlotPath(id, candidate), "r");
+        if (!file) continue;
+        
+        file.seek(sizeof(ProfileSlotHeader));
+        if (crcFileRange(file, headers[candidate].length) == headers[candidate].crc) {
+            file.seek(sizeof(ProfileSlotHeader));
+            slot = candidate;
+            header = headers[candidate];
+            return true;
+        }
+        
+        DEBUG_PRINTF("Profile %d slot %c failed CRC\n", id, 'a' + candidate);
+        file.close();
+    }
+    
+    // Profiles written before A/B slots existed: accept as-is, migrated on next save
+    file = LittleFS.open(_getLegacyPath(id), "r");
+    if (file) {
+        header.magic = SLOT_MAGIC;
+        header.sequence = 0;
+        header.length = file.size();
+        header.crc = crcFileRange(file, header.length);
+        file.seek(0);
+        slot = SLOT_LEGACY;
+        return true;
+    }
+    
+    return false;
+}
+
+bool ProfileStorage::_isSlotBeingRead(uint16_t id, uint8_t slot) {
+    return _slotReaderCheck && _slotReaderCheck(_getSlotPath(id, slot), _slotReaderContext);
+}
+
+bool ProfileStorage::_writeSlot(const Profile& profile, const char* dir, uint8_t& slot,
+                                ProfileSlotHeader& header) {
+    // Create JSON document (allocate enough space)
+    DynamicJsonDocument doc(8192);
+    
+    if (!_serializeProfile(profile, doc)) {
+        DEBUG_PRINTLN("ERROR: Failed to serialize profile");
+        return false;
+    }
+    
+    // Measure and checksum the body first so the header can be written ahead of it
+    CrcWriter measure;
+    size_t length = serializeJson(doc, measure);
+    if (length == 0) {
+        DEBUG_PRINTLN("ERROR: Failed to serialize profile");
+        return false;
+    }
+    
+    // Target the slot that does not hold the current copy, and out-number anything
+    // already on disk so the new copy wins once it is complete.
+    ProfileSlotHeader existing[2];
+    bool existingValid[2] = {
+        _readSlotHeader(profile.id, SLOT_A, existing[SLOT_A]),
+        _readSlotHeader(profile.id, SLOT_B, existing[SLOT_B])
+    };
+    
+    const ProfileManifestEntry* entry = _findEntry(profile.id);
+    bool onFlash = entry && entry->source == PROFILE_SOURCE_FLASH;
+    if (onFlash && entry->slot != SLOT_LEGACY) {
+        slot = entry->slot == SLOT_A ? SLOT_B : SLOT_A;
+    } else if (existingValid[SLOT_A] && (!existingValid[SLOT_B] || existing[SLOT_A].sequence > existing[SLOT_B].sequence)) {
+        slot = SLOT_B;
+    } else {
+        slot = SLOT_A;
+    }
+    if (_isSlotBeingRead(profile.id, slot)) {
+        DEBUG_PRINTF("ERROR: Profile %d slot %c is still being sent, save refused\n", profile.id, 'a' + slot);
+        return false;
+    }
+    
+    uint32_t sequence = onFlash ? entry->sequence : 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        if (existingValid[i] && existing[i].sequence > sequence) {
+            sequence = existing[i].sequence;
+        }
+    }
+    
+    header.magic = SLOT_MAGIC;
+    header.sequence = sequence + 1;
+    header.length = length;
+    header.crc = measure.crc;
+    
+    File file = LittleFS.open(_getSlotPath(profile.id, slot, dir), "w");
+    if (!file) {
+        DEBUG_PRINTLN("ERROR: Failed to open file for writing");
+        return false;
+    }
+    
+    size_t bytesWritten = file.write((const uint8_t*)&header, sizeof(header));
+    bytesWritten += serializeJson(doc, file);
+    file.close();
+    
+    if (bytesWritten != sizeof(header) + length) {
+        // The other slot still holds the previous copy and stays authoritative
+        DEBUG_PRINTLN("ERROR: Failed to write profile slot");
+        return false;
+    }
+    return true;
+}
+
+String ProfileStorage::_getSlotPath(uint16_t id, uint8_t slot, const char* dir) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "%s/profile_%d.%c", dir, id, 'a' + slot);
+    return String(filename);
+}
+
+String ProfileStorage::_getLegacyPath(uint16_t id) {
     char filename[64];
     snprintf(filename, sizeof(filename), "%s/profile_%d.json", PROFILES_PATH, id);
     return String(filename);
 }
 
+String ProfileStorage::_getTombstonePath(uint16_t id) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "%s/profile_%d.del", PROFILES_PATH, id);
+    return String(filename);
+}
+
+bool ProfileStorage::_removeProfileFiles(uint16_t id) {
+    String paths[3] = { _getSlotPath(id, SLOT_A), _getSlotPath(id, SLOT_B), _getLegacyPath(id) };
+    for (uint8_t i = 0; i < 3; i++) {
+        if (LittleFS.exists(paths[i]) && !LittleFS.remove(paths[i])) {
+            return false;
+        }
+    }
+    return _journal.remove(id);
+}
+
 bool ProfileStorage::_serializeProfile(const Profile& profile, JsonDocument& doc) {
     doc["id"] = profile.id;
     char safeName[sizeof(profile.name)];
@@ -294,7 +1346,7 @@ bool ProfileStorage::_deserializeProfile(const JsonDocument& doc, Profile& profi
     JsonArrayConst keysArray = doc["keys"].as<JsonArrayConst>();
     for (uint8_t i = 0; i < MATRIX_KEYS && i < keysArray.size(); i++) {
         JsonObjectConst keyObj = keysArray[i].as<JsonObjectConst>();
-        _deserializeAction(keyObj, profile.keys[i].action);
+        if (!_deserializeAction(keyObj, profile.keys[i].action)) return false;
     }
     
     for (size_t i = keysArray.size(); i < MATRIX_KEYS; i++) {
@@ -306,9 +1358,9 @@ bool ProfileStorage::_deserializeProfile(const JsonDocument& doc, Profile& profi
     for (uint8_t i = 0; i < 2 && i < encodersArray.size(); i++) {
         JsonObjectConst encObj = encodersArray[i].as<JsonObjectConst>();
         
-        _deserializeAction(encObj["cwAction"].as<JsonObjectConst>(), profile.encoders[i].cwAction);
-        _deserializeAction(encObj["ccwAction"].as<JsonObjectConst>(), profile.encoders[i].ccwAction);
-        _deserializeAction(encObj["pressAction"].as<JsonObjectConst>(), profile.encoders[i].pressAction);
+        if (!_deserializeAction(encObj["cwAction"].as<JsonObjectConst>(), profile.encoders[i].cwAction)) return false;
+        if (!_deserializeAction(encObj["ccwAction"].as<JsonObjectConst>(), profile.encoders[i].ccwAction)) return false;
+        if (!_deserializeAction(encObj["pressAction"].as<JsonObjectConst>(), profile.encoders[i].pressAction)) return false;
         
         profile.encoders[i].acceleration = encObj["acceleration"] | true;
         profile.encoders[i].stepsPerDetent = encObj["stepsPerDetent"] | 4;
@@ -328,12 +1380,8 @@ void ProfileStorage::_serializeAction(const Action& action, JsonObject obj) {
             break;
             
         case ACTION_TEXT:
-        {
-            char safeText[sizeof(action.config.text.text)];
-            copyBoundedBuffer(action.config.text.text, safeText);
-            obj["text"] = safeText;
+            obj["text"] = profileText(action.config.text.textRef);
             break;
-        }
             
         case ACTION_MEDIA:
             obj["function"] = static_cast<int>(action.config.media.function);
@@ -356,10 +1404,8 @@ void ProfileStorage::_serializeAction(const Action& action, JsonObject obj) {
                 step["delayMs"] = action.config.macro.steps[i].delayMs;
                 step["key"] = action.config.macro.steps[i].key;
                 step["modifiers"] = action.config.macro.steps[i].modifiers;
-                char safeStepText[sizeof(action.config.macro.steps[i].text)];
-                copyBoundedBuffer(action.config.macro.steps[i].text, safeStepText);
-                if (safeStepText[0] != '\0') {
-                    step["text"] = safeStepText;
+                if (action.config.macro.steps[i].textRef != TEXT_REF_NONE) {
+                    step["text"] = profileText(action.config.macro.steps[i].textRef);
                 }
                 step["mediaFunction"] = action.config.macro.steps[i].mediaFunction;
             }
@@ -371,15 +1417,15 @@ void ProfileStorage::_serializeAction(const Action& action, JsonObject obj) {
     }
 }
 
-void ProfileStorage::_deserializeAction(JsonObjectConst obj, Action& action) {
+bool ProfileStorage::_deserializeAction(JsonObjectConst obj, Action& action) {
     resetAction(action);
     if (obj.isNull()) {
-        return;
+        return true;
     }
 
     uint8_t rawType = obj["type"] | ACTION_NONE;
     if (!isSupportedActionType(rawType)) {
-        return;
+        return true;
     }
 
     action.type = static_cast<ActionType>(rawType);
@@ -391,15 +1437,20 @@ void ProfileStorage::_deserializeAction(JsonObjectConst obj, Action& action) {
             break;
             
         case ACTION_TEXT:
-            copySafeString(action.config.text.text, obj["text"] | "");
+        {
+            const char* text = obj["text"] | "";
+            if (!profileInternText(text, strnlen(text, TEXT_ACTION_MAX_LENGTH), action.config.text.textRef)) {
+                return false;
+            }
             break;
+        }
             
         case ACTION_MEDIA:
         {
             uint8_t mediaFunction = obj["function"] | 0;
             if (mediaFunction > MEDIA_FUNC_STOP) {
                 resetAction(action);
-                return;
+                return true;
             }
             action.config.media.function = static_cast<MediaFunction>(mediaFunction);
             break;
@@ -410,7 +1461,7 @@ void ProfileStorage::_deserializeAction(JsonObjectConst obj, Action& action) {
             uint8_t mouseAction = obj["action"] | 0;
             if (mouseAction > MOUSE_ACTION_SCROLL_DOWN) {
                 resetAction(action);
-                return;
+                return true;
             }
             action.config.mouse.action = static_cast<MouseAction>(mouseAction);
             action.config.mouse.value = obj["value"] | 0;
@@ -419,10 +1470,10 @@ void ProfileStorage::_deserializeAction(JsonObjectConst obj, Action& action) {
             
         case ACTION_PROFILE:
         {
-            uint8_t profileId = obj["profileId"] | 0;
-            if (profileId >= MAX_PROFILES) {
+            uint32_t profileId = obj["profileId"] | 0;
+            if (profileId > PROFILE_ID_MAX) {
                 resetAction(action);
-                return;
+                return true;
             }
             action.config.profile.profileId = profileId;
             break;
@@ -438,61 +1489,19 @@ void ProfileStorage::_deserializeAction(JsonObjectConst obj, Action& action) {
                 action.config.macro.steps[count].delayMs = stepObj["delayMs"] | 0;
                 action.config.macro.steps[count].key = stepObj["key"] | 0;
                 action.config.macro.steps[count].modifiers = stepObj["modifiers"] | 0;
-                copySafeString(action.config.macro.steps[count].text, stepObj["text"] | "");
                 action.config.macro.steps[count].mediaFunction = stepObj["mediaFunction"] | 0;
-                count++;
+                const char* text = stepObj["text"] | "";
+                if (!profileInternText(text, strnlen(text, MACRO_TEXT_MAX_LENGTH),
+                                       action.config.macro.steps[count].textRef)) {
+                    return false;
+                }
+                action.config.macro.stepCount = ++count;
             }
-            action.config.macro.stepCount = count;
             break;
         }
             
         default:
             break;
     }
-}
-
-bool ProfileStorage::deserializeProfileFromObject(JsonObjectConst obj, Profile& profile) {
-    if (!_initialized) return false;
-    resetProfile(profile);
-
-    profile.id = obj["id"] | 0;
-    copySafeString(profile.name, obj["name"] | "Unnamed");
-    profile.version = obj["version"] | 1;
-    
-    JsonArrayConst keysArray = obj["keys"].as<JsonArrayConst>();
-    for (uint8_t i = 0; i < MATRIX_KEYS && i < keysArray.size(); i++) {
-        JsonObjectConst keyObj = keysArray[i].as<JsonObjectConst>();
-        _deserializeAction(keyObj, profile.keys[i].action);
-    }
-    for (size_t i = keysArray.size(); i < MATRIX_KEYS; i++) {
-        profile.keys[i].action.type = ACTION_NONE;
-    }
-    
-    for (uint8_t i = 0; i < 2; i++) {
-        profile.encoders[i].cwAction.type = ACTION_NONE;
-        profile.encoders[i].ccwAction.type = ACTION_NONE;
-        profile.encoders[i].pressAction.type = ACTION_NONE;
-        profile.encoders[i].acceleration = true;
-        profile.encoders[i].stepsPerDetent = 4;
-    }
-    
-    JsonArrayConst encodersArray = obj["encoders"].as<JsonArrayConst>();
-    for (uint8_t i = 0; i < 2 && i < encodersArray.size(); i++) {
-        JsonObjectConst encObj = encodersArray[i].as<JsonObjectConst>();
-        
-        if (!encObj["cwAction"].isNull()) {
-            _deserializeAction(encObj["cwAction"].as<JsonObjectConst>(), profile.encoders[i].cwAction);
-        }
-        if (!encObj["ccwAction"].isNull()) {
-            _deserializeAction(encObj["ccwAction"].as<JsonObjectConst>(), profile.encoders[i].ccwAction);
-        }
-        if (!encObj["pressAction"].isNull()) {
-            _deserializeAction(encObj["pressAction"].as<JsonObjectConst>(), profile.encoders[i].pressAction);
-        }
-        
-        profile.encoders[i].acceleration = encObj["acceleration"] | true;
-        profile.encoders[i].stepsPerDetent = encObj["stepsPerDetent"] | 4;
-    }
-    
     return true;
 }
@@ -6,6 +6,48 @@
 #include <ArduinoJson.h>
 #include "config.h"
 #include "profile.h"
+#include "profile_journal.h"
+#include "builtin_profiles.h"
+
+// Each profile is stored in two alternating slot files (profile_N.a / profile_N.b).
+// A save always goes to the slot not holding the current copy, so a power cut
+// mid-write leaves the previous copy intact. Load picks the newest slot whose
+// body passes its CRC.
+struct ProfileSlotHeader {
+    uint32_t magic;
+    uint32_t sequence;  // Incremented on every save; newest valid slot wins
+    uint32_t length;    // Bytes of JSON body following the header
+    uint32_t crc;       // CRC32 of the JSON body
+};
+
+enum ProfileSource : uint8_t {
+    PROFILE_SOURCE_FLASH = 0,  // Stored on LittleFS (user profile or edited built-in)
+    PROFILE_SOURCE_ROM         // Unmodified built-in, served from the firmware tables
+};
+
+#define MANIFEST_FLAG_COMPACT_PENDING 0x01  // Journal should be folded into a new snapshot
+
+// True while something outside storage is still reading the slot file at `path`
+typedef bool (*ProfileSlotReaderCheck)(const String& path, void* context);
+
+// Per-profile summary kept in RAM (and mirrored to PROFILE_MANIFEST_PATH) so that
+// listing and existence checks never touch the filesystem. Entries are kept
+// sorted by id in a fixed array of MAX_PROFILES, so lookups are a binary search
+// and RAM use does not depend on how many profiles are stored. Profile bodies
+// are only paged in by loadProfile().
+struct ProfileManifestEntry {
+    uint16_t id;
+    uint8_t version;
+    uint8_t source;     // ProfileSource
+    uint8_t slot;       // Slot file holding the current copy (A, B, or pre-slot legacy JSON)
+    uint8_t flags;      // MANIFEST_FLAG_*
+    char name[32];
+    uint32_t size;      // Bytes of the base snapshot JSON
+    uint32_t hash;      // CRC32 of the profile JSON with journaled edits applied
+    uint32_t revision;  // Value of the modification counter at last save
+    uint32_t sequence;  // Slot sequence number of the current copy
+    uint32_t journalLength;  // Bytes of edit journal on top of the snapshot (0 = none)
+};
 
 class ProfileStorage {
 public:
@@ -16,34 +58,111 @@ public:
     
     // Profile operations
     bool saveProfile(const Profile& profile);
-    bool loadProfile(uint8_t id, Profile& profile);
-    bool deleteProfile(uint8_t id);
-    bool profileExists(uint8_t id);
+    // Append only the fields that changed to the profile's journal; falls back
+    // to a full snapshot save when the journal can't take it
+    bool saveProfileIncremental(const Profile& profile);
+    // Journal exactly `fields` of `profile` (field-level edit commands). Nothing
+    // is read back: the other fields must match what is stored.
+    bool saveProfileFields(const Profile& profile, const ProfileFieldMask& fields);
+    // Cancel the most recent journaled save, every field it changed (back to the
+    // last compaction)
+    bool undoLastEdit(uint16_t id);
+    bool loadProfile(uint16_t id, Profile& profile);
+    bool deleteProfile(uint16_t id);
+    bool profileExists(uint16_t id);
     
-    // List profiles
-    uint8_t getProfileCount();
-    bool getProfileInfo(uint8_t id, char* name, size_t* size);
+    // List profiles (served from the in-RAM manifest)
+    uint16_t getProfileCount();
+    bool getProfileInfo(uint16_t id, char* name, size_t* size);
+    const ProfileManifestEntry* getManifestEntry(uint16_t id) const;
+    // Paging: entries are ordered by id; index of the first entry with id >= firstId
+    uint16_t findManifestIndex(uint16_t firstId) const;
+    const ProfileManifestEntry* getManifestEntryAt(uint16_t index) const;
+    // Where the JSON body of `id` sits on flash, when that body is the whole
+    // profile (a snapshot with no journal on top). Saves write the other slot,
+    // and one that would overwrite a slot the reader check reports busy is
+    // refused, so the range stays intact for as long as it is being read.
+    bool getStoredProfileBody(uint16_t id, String& path, uint32_t& offset, uint32_t& length);
+    void setSlotReaderCheck(ProfileSlotReaderCheck check, void* context);
+    // Bumped whenever the manifest is written: any save, delete, compaction or
+    // reset. Caches of listings and free space compare against it.
+    uint32_t getManifestGeneration() const;
     
-    // Format storage
-    bool format();
+    // Remove every stored profile and deletion marker; built-ins come back from ROM
+    bool clearUserProfiles();
+    // Drop any stored copy of built-in `id` and serve it from ROM again
+    bool restoreBuiltinProfile(uint16_t id);
+    
+    // Write every profile (journaled edits applied, built-ins included) to `path`
+    // as an exportAll archive (see decodeProfileArchiveJson)
+    bool writeArchive(const char* path, uint16_t activeId, uint32_t& length);
+    // importAll: stageProfile() writes a profile under PROFILE_IMPORT_PATH and
+    // leaves the stored ones alone. commitImport() then makes the staged profiles
+    // the device's contents and deletes every profile not in `ids`. The commit
+    // point is a single rename. A power cut before it leaves the old profiles,
+    // and init() discards the staged ones. After it, init() finishes the import.
+    bool stageProfile(const Profile& profile);
+    bool commitImport(const uint16_t* ids, uint16_t count);
+    void discardImport();
+    
+    // Background work: folds at most one oversized/damaged journal into a new snapshot
+    void update();
     
     // Storage info
     size_t getTotalSpace();
     size_t getUsedSpace();
     size_t getFreeSpace();
     
-    // Deserialize profile from JSON object (e.g. from protocol request)
-    bool deserializeProfileFromObject(JsonObjectConst obj, Profile& profile);
-    
 private:
     bool _initialized;
     
-    String _getProfilePath(uint8_t id);
+    ProfileManifestEntry _manifest[MAX_PROFILES];
+    uint16_t _profileCount;
+    uint32_t _revisionCounter;
+    uint16_t _pendingCompactions;  // Upper bound on entries flagged COMPACT_PENDING
+    uint32_t _manifestGeneration;
+    ProfileSlotReaderCheck _slotReaderCheck;
+    void* _slotReaderContext;
+    
+    ProfileJournal _journal;
+    
+    ProfileManifestEntry* _findEntry(uint16_t id);
+    ProfileManifestEntry* _insertEntry(uint16_t id);
+    void _markCompactPending(uint16_t id);
+    
+    bool _loadManifest();
+    bool _saveManifest();
+    void _reconcileManifest();
+    uint16_t _scanProfileFiles(uint16_t* ids, uint8_t* kinds, uint16_t capacity);
+    bool _reconcileFlashEntry(uint16_t id, bool& changed);
+    bool _refreshManifestEntry(uint16_t id);
+    bool _setManifestEntry(uint16_t id, const char* name, uint8_t version, uint8_t slot,
+                           const ProfileSlotHeader& header);
+    bool _setBuiltinManifestEntry(const BuiltinProfile& builtin);
+    void _clearManifestEntry(uint16_t id);
+    void _setJournaledManifestEntry(const Profile& profile, uint32_t journalLength);
+    void _compactProfile(uint16_t id);
+    // Install the staged profiles of a committed import and delete the rest
+    void _finishImport();
+    
+    // Slot files
+    bool _readSlotHeader(uint16_t id, uint8_t slot, ProfileSlotHeader& header);
+    bool _openNewestValidSlot(uint16_t id, File& file, uint8_t& slot, ProfileSlotHeader& header);
+    bool _isSlotBeingRead(uint16_t id, uint8_t slot);
+    // Write `profile` to the slot not holding its current copy, as that slot's
+    // file under `dir`
+    bool _writeSlot(const Profile& profile, const char* dir, uint8_t& slot, ProfileSlotHeader& header);
+    
+    String _getSlotPath(uint16_t id, uint8_t slot, const char* dir = PROFILES_PATH);
+    String _getLegacyPath(uint16_t id);
+    String _getTombstonePath(uint16_t id);
+    bool _removeProfileFiles(uint16_t id);
     bool _serializeProfile(const Profile& profile, JsonDocument& doc);
     bool _deserializeProfile(const JsonDocument& doc, Profile& profile);
     
     void _serializeAction(const Action& action, JsonObject obj);
-    void _deserializeAction(JsonObjectConst obj, Action& action);
+    // False only when the action's text doesn't fit the profile's text pool
+    bool _deserializeAction(JsonObjectConst obj, Action& action);
 };
 
 #endif // PROFILE_STORAGE_H
@@ -0,0 +1,199 @@
+#include "profile_text.h"
+
+namespace {
+// Entry layout: length byte, the characters, then a NUL so it can be sent as-is.
+// Entries never straddle blocks; a zero length byte pads out the rest of one.
+const uint16_t ENTRY_OVERHEAD = 2;
+const uint16_t BLOCK_BYTES = PROFILE_TEXT_BLOCK_BYTES;
+const uint16_t POOL_BLOCKS = PROFILE_TEXT_POOL_BYTES / PROFILE_TEXT_BLOCK_BYTES;
+
+static_assert(PROFILE_TEXT_POOL_BYTES < 0xFFFF, "references are 16-bit positions + 1");
+static_assert(TEXT_ACTION_MAX_LENGTH + ENTRY_OVERHEAD <= PROFILE_TEXT_BLOCK_BYTES, "an entry fits a block");
+
+char* blocks[POOL_BLOCKS];  // Allocated as the pool grows
+uint16_t used = 0;          // Position after the last entry
+
+char* at(uint16_t position) {
+    return blocks[position / BLOCK_BYTES] + position % BLOCK_BYTES;
+}
+
+uint16_t nextBlock(uint16_t position) {
+    return (position / BLOCK_BYTES + 1) * BLOCK_BYTES;
+}
+
+// Where an entry of `size` bytes goes if the pool ends at `position`
+uint16_t placeEntry(uint16_t position, uint16_t size) {
+    if (position % BLOCK_BYTES != 0 && position % BLOCK_BYTES + size > BLOCK_BYTES) {
+        return nextBlock(position);
+    }
+    return position;
+}
+
+void releaseBlocksAfter(uint16_t end) {
+    for (uint16_t block = (end + BLOCK_BYTES - 1) / BLOCK_BYTES; block < POOL_BLOCKS; block++) {
+        free(blocks[block]);
+        blocks[block] = nullptr;
+    }
+}
+
+template <typename Fn>
+void forEachActionTextRef(Action& action, Fn& fn) {
+    if (action.type == ACTION_TEXT) {
+        fn(action.config.text.textRef);
+    } else if (action.type == ACTION_MACRO) {
+        for (uint8_t i = 0; i < action.config.macro.stepCount && i < MAX_MACRO_STEPS; i++) {
+            fn(action.config.macro.steps[i].textRef);
+        }
+    }
+}
+
+// Calls fn on every text reference held by the profile's actions
+template <typename Fn>
+void forEachTextRef(Profile& profile, Fn& fn) {
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        forEachActionTextRef(profile.keys[i].action, fn);
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+        forEachActionTextRef(profile.encoders[i].cwAction, fn);
+        forEachActionTextRef(profile.encoders[i].ccwAction, fn);
+        forEachActionTextRef(profile.encoders[i].pressAction, fn);
+    }
+}
+
+bool findText(const char* text, size_t length, uint16_t& ref) {
+    uint16_t position = 0;
+    while (position < used) {
+        uint8_t entryLength = static_cast<uint8_t>(*at(position));
+        if (entryLength == 0) {
+            position = nextBlock(position);
+            continue;
+        }
+        if (entryLength == length && memcmp(at(position) + 1, text, length) == 0) {
+            ref = position + 1;
+            return true;
+        }
+        position += entryLength + ENTRY_OVERHEAD;
+    }
+    return false;
+}
+}
+
+const char* profileText(uint16_t ref) {
+    if (ref == TEXT_REF_NONE || ref > used) {
+        return "";
+    }
+    uint16_t position = ref - 1;
+    uint8_t length = static_cast<uint8_t>(*at(position));
+    if (length == 0 || position % BLOCK_BYTES + length + ENTRY_OVERHEAD > BLOCK_BYTES ||
+        position + length + ENTRY_OVERHEAD > used) {
+        return "";
+    }
+    return at(position) + 1;
+}
+
+size_t profileTextLength(uint16_t ref) {
+    const char* text = profileText(ref);
+    return text[0] == '\0' ? 0 : static_cast<uint8_t>(text[-1]);
+}
+
+bool profileInternText(const char* text, size_t length, uint16_t& ref) {
+    ref = TEXT_REF_NONE;
+    if (length == 0) {
+        return true;
+    }
+    if (length > TEXT_ACTION_MAX_LENGTH) {
+        return false;
+    }
+    if (findText(text, length, ref)) {
+        return true;
+    }
+    
+    uint16_t size = length + ENTRY_OVERHEAD;
+    uint16_t position = placeEntry(used, size);
+    uint16_t block = position / BLOCK_BYTES;
+    if (block >= POOL_BLOCKS) {
+        DEBUG_PRINTLN("ERROR: Text pool is full");
+        return false;
+    }
+    if (!blocks[block]) {
+        blocks[block] = static_cast<char*>(malloc(BLOCK_BYTES));
+        if (!blocks[block]) {
+            DEBUG_PRINTLN("ERROR: No memory to grow the text pool");
+            return false;
+        }
+    }
+    if (position != used) {
+        *at(used) = 0;  // Rest of the block is padding
+    }
+    
+    char* entry = at(position);
+    entry[0] = static_cast<char>(length);
+    memcpy(entry + 1, text, length);
+    entry[1 + length] = '\0';
+    used = position + size;
+    ref = position + 1;
+    return true;
+}
+
+uint16_t profileTextMark() {
+    return used;
+}
+
+void profileTextRewind(uint16_t mark) {
+    if (mark >= used) {
+        return;
+    }
+    used = mark;
+    releaseBlocksAfter(used);
+}
+
+void profileTextCollect(Profile* const* roots, size_t count) {
+    uint16_t readPosition = 0;
+    uint16_t writePosition = 0;
+    
+    // Slide live entries down. References only ever move to lower positions,
+    // so a rewritten one can't match an entry further on.
+    while (readPosition < used) {
+        uint8_t length = static_cast<uint8_t>(*at(readPosition));
+        if (length == 0) {
+            readPosition = nextBlock(readPosition);
+            continue;
+        }
+        uint16_t size = length + ENTRY_OVERHEAD;
+        uint16_t target = placeEntry(writePosition, size);
+        
+        uint16_t oldRef = readPosition + 1;
+        uint16_t newRef = target + 1;
+        bool live = false;
+        auto rewrite = [&](uint16_t& ref) {
+            if (ref == oldRef) {
+                ref = newRef;
+                live = true;
+            }
+        };
+        for (size_t i = 0; i < count; i++) {
+            forEachTextRef(*roots[i], rewrite);
+        }
+        
+        if (live) {
+            if (target != writePosition) {
+                *at(writePosition) = 0;
+            }
+            if (target != readPosition) {
+                memmove(at(target), at(readPosition), size);
+            }
+            writePosition = target + size;
+        }
+        readPosition += size;
+    }
+    
+    if (writePosition != used) {
+        DEBUG_PRINTF("Text pool collected: %u of %u bytes kept\n", writePosition, used);
+    }
+    used = writePosition;
+    releaseBlocksAfter(used);
+}
+
+size_t profileTextBytes() {
+    return used;
+}
@@ -0,0 +1,39 @@
+#ifndef PROFILE_TEXT_H
+#define PROFILE_TEXT_H
+
+#include <Arduino.h>
+#include "profile.h"
+
+// Strings of ACTION_TEXT and macro text steps are interned into one pool for
+// the whole device, so a snippet shared by the active profile, the work buffer
+// and any copy being saved is stored once, and each string costs only its own
+// length. Blocks are allocated as text is loaded, up to PROFILE_TEXT_POOL_BYTES.
+// A reference is the entry's position + 1, which keeps a zeroed action equal
+// to "". Copying a Profile copies its references, not the text.
+//
+// Entries stay put until profileTextCollect() keeps only what its roots use
+// (the profile manager runs it with its two buffers before loading into one)
+// or profileTextRewind() drops what was interned after a mark (storage uses it
+// for the temporary profiles it reads). A Profile held across either must be
+// passed as a root or interned before the mark.
+
+// Returns "" for TEXT_REF_NONE or an invalid reference
+const char* profileText(uint16_t ref);
+size_t profileTextLength(uint16_t ref);
+
+// Intern `length` bytes of `text` (not NUL-terminated). False when the pool
+// has no room or no memory left; `ref` is then TEXT_REF_NONE.
+bool profileInternText(const char* text, size_t length, uint16_t& ref);
+
+// Everything interned after profileTextMark() is dropped by profileTextRewind()
+uint16_t profileTextMark();
+void profileTextRewind(uint16_t mark);
+
+// Drop entries no root references, move the rest together, and fix up the
+// roots' references. Releases the blocks left empty.
+void profileTextCollect(Profile* const* roots, size_t count);
+
+// Bytes of text the pool holds, padding included
+size_t profileTextBytes();
+
+#endif // PROFILE_TEXT_H
@@ -2,14 +2,179 @@
 #include "ble_config.h"
 #include "ble_hid.h"
 #include "profile_manager.h"
+#include "persistence_service.h"
+#include "profile_text.h"
+#include "input_telemetry.h"
+#include <LittleFS.h>
 
 namespace {
+const uint16_t LIST_PROFILES_PAGE_MAX = 16;
+
 template <size_t N>
 void copyBoundedBuffer(const char* src, char (&dest)[N]) {
     memcpy(dest, src, N);
     dest[N - 1] = '\0';
 }
 
+// MessagePack requests are maps; JSON ones start with '{'
+bool isMsgPackMessage(const String& message) {
+    if (message.length() == 0) return false;
+    uint8_t first = static_cast<uint8_t>(message[0]);
+    return (first & 0xF0) == 0x80 || first == 0xDE || first == 0xDF;
+}
+
+// Saves must not rewrite a slot file that getProfile is still streaming out
+bool isSlotBeingSent(const String& path, void* context) {
+    return static_cast<BLEConfigService*>(context)->isSendingFile(path);
+}
+
+// Command table, indexed by Command (which is also the numeric "op" a client
+// may send instead of "cmd"). Names are found through COMMAND_SLOTS: a
+// perfect hash built at compile time, so lookup is one hash and one strcmp
+// however many commands there are.
+enum CommandFlags : uint8_t {
+    COMMAND_QUERY = 0x01,       // Read-only: may overtake queued writes, allowed in a batch
+    COMMAND_BODY = 0x02,        // Handler decodes the request body, so the message is kept
+    COMMAND_PROFILE_ID = 0x04   // "profileId" is required
+};
+
+struct CommandSpec {
+    const char* name;
+    ProtocolHandler::Command command;
+    uint8_t flags;
+};
+
+constexpr CommandSpec COMMAND_TABLE[] = {
+    {"", ProtocolHandler::CMD_UNKNOWN, 0},
+    {"getDeviceInfo", ProtocolHandler::CMD_GET_DEVICE_INFO, COMMAND_QUERY},
+    {"getCaps", ProtocolHandler::CMD_GET_CAPS, COMMAND_QUERY},
+    {"listProfiles", ProtocolHandler::CMD_LIST_PROFILES, COMMAND_QUERY},
+    {"getProfile", ProtocolHandler::CMD_GET_PROFILE, COMMAND_QUERY | COMMAND_PROFILE_ID},
+    {"syncManifest", ProtocolHandler::CMD_SYNC_MANIFEST, COMMAND_QUERY},
+    {"setProfile", ProtocolHandler::CMD_SET_PROFILE, COMMAND_BODY},
+    {"setKey", ProtocolHandler::CMD_SET_KEY, COMMAND_BODY | COMMAND_PROFILE_ID},
+    {"setEncoder", ProtocolHandler::CMD_SET_ENCODER, COMMAND_BODY | COMMAND_PROFILE_ID},
+    {"setName", ProtocolHandler::CMD_SET_NAME, COMMAND_BODY | COMMAND_PROFILE_ID},
+    {"setActiveProfile", ProtocolHandler::CMD_SET_ACTIVE_PROFILE, COMMAND_PROFILE_ID},
+    {"getActiveProfile", ProtocolHandler::CMD_GET_ACTIVE_PROFILE, COMMAND_QUERY},
+    {"deleteProfile", ProtocolHandler::CMD_DELETE_PROFILE, COMMAND_PROFILE_ID},
+    {"undoProfileEdit", ProtocolHandler::CMD_UNDO_PROFILE_EDIT, COMMAND_PROFILE_ID},
+    {"previewProfile", ProtocolHandler::CMD_PREVIEW_PROFILE, COMMAND_BODY},
+    {"commitPreview", ProtocolHandler::CMD_COMMIT_PREVIEW, 0},
+    {"discardPreview", ProtocolHandler::CMD_DISCARD_PREVIEW, 0},
+    {"getStats", ProtocolHandler::CMD_GET_STATS, COMMAND_QUERY},
+    {"getConnectionStatus", ProtocolHandler::CMD_GET_CONNECTION_STATUS, COMMAND_QUERY},
+    {"factoryReset", ProtocolHandler::CMD_FACTORY_RESET, 0},
+    {"reboot", ProtocolHandler::CMD_REBOOT, 0},
+    {"batch", ProtocolHandler::CMD_BATCH, COMMAND_QUERY | COMMAND_BODY},  // Holds only queries
+    {"exportAll", ProtocolHandler::CMD_EXPORT_ALL, 0},
+    {"importAll", ProtocolHandler::CMD_IMPORT_ALL, COMMAND_BODY},
+    {"subscribeEvents", ProtocolHandler::CMD_SUBSCRIBE_EVENTS, COMMAND_BODY},
+};
+constexpr uint8_t COMMAND_COUNT = sizeof(COMMAND_TABLE) / sizeof(COMMAND_TABLE[0]);
+
+// FNV-1a with a chosen offset basis; the top COMMAND_SLOT_BITS bits pick the slot
+constexpr uint32_t COMMAND_HASH_SEED = 145;
+constexpr uint8_t COMMAND_SLOT_BITS = 6;
+
+constexpr uint32_t hashCommandName(const char* name, uint32_t hash = COMMAND_HASH_SEED) {
+    return *name ? hashCommandName(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+
+constexpr uint8_t commandSlot(const char* name) {
+    return hashCommandName(name) >> (32 - COMMAND_SLOT_BITS);
+}
+
+constexpr uint8_t commandAtSlot(uint8_t slot, uint8_t index = 1) {
+    return index >= COMMAND_COUNT ? 0
+         : commandSlot(COMMAND_TABLE[index].name) == slot ? index
+         : commandAtSlot(slot, index + 1);
+}
+
+constexpr bool slotIsUnique(uint8_t index, uint8_t other) {
+    return other >= COMMAND_COUNT ||
+           (commandSlot(COMMAND_TABLE[index].name) != commandSlot(COMMAND_TABLE[other].name) &&
+            slotIsUnique(index, other + 1));
+}
+
+constexpr bool commandTableIsValid(uint8_t index = 0) {
+    return index >= COMMAND_COUNT ||
+           (COMMAND_TABLE[index].command == index &&
+            (index == 0 || slotIsUnique(index, index + 1)) &&
+            commandTableIsValid(index + 1));
+}
+
+static_assert(COMMAND_COUNT == ProtocolHandler::CMD_COUNT, "COMMAND_TABLE needs one entry per Command");
+static_assert(commandTableIsValid(), "COMMAND_TABLE out of order, or two names share a slot (change COMMAND_HASH_SEED)");
+
+#define COMMAND_SLOT_ROW(n) \
+    commandAtSlot(n), commandAtSlot(n + 1), commandAtSlot(n + 2), commandAtSlot(n + 3), \
+    commandAtSlot(n + 4), commandAtSlot(n + 5), commandAtSlot(n + 6), commandAtSlot(n + 7)
+
+constexpr uint8_t COMMAND_SLOTS[1 << COMMAND_SLOT_BITS] = {
+    COMMAND_SLOT_ROW(0), COMMAND_SLOT_ROW(8), COMMAND_SLOT_ROW(16), COMMAND_SLOT_ROW(24),
+    COMMAND_SLOT_ROW(32), COMMAND_SLOT_ROW(40), COMMAND_SLOT_ROW(48), COMMAND_SLOT_ROW(56)
+};
+
+#undef COMMAND_SLOT_ROW
+
+ProtocolHandler::Command lookupCommand(const char* name) {
+    uint8_t index = COMMAND_SLOTS[commandSlot(name)];
+    return strcmp(COMMAND_TABLE[index].name, name) == 0 ? COMMAND_TABLE[index].command : ProtocolHandler::CMD_UNKNOWN;
+}
+
+ProtocolHandler::Command commandFromOpcode(uint32_t opcode) {
+    return opcode < COMMAND_COUNT ? COMMAND_TABLE[opcode].command : ProtocolHandler::CMD_UNKNOWN;
+}
+
+// "op" when present, otherwise "cmd" (or the old payload.cmd)
+ProtocolHandler::Command requestCommand(JsonVariantConst request) {
+    if (!request["op"].isNull()) {
+        return commandFromOpcode(request["op"] | 0u);
+    }
+    const char* name = request["cmd"] | "";
+    if (name[0] == '\0') {
+        name = request["payload"]["cmd"] | "";
+    }
+    return lookupCommand(name);
+}
+
+// Declared arguments present and in range; the error to reply with otherwise
+const char* validateRequest(JsonVariantConst request, ProtocolHandler::Command command) {
+    uint8_t flags = COMMAND_TABLE[command].flags;
+    if (flags & COMMAND_PROFILE_ID) {
+        JsonVariantConst profileId = request["profileId"];
+        if (!profileId.is<uint16_t>() || profileId.as<uint16_t>() > PROFILE_ID_MAX) {
+            return "Missing or invalid profileId";
+        }
+    }
+    return nullptr;
+}
+
+// Response envelope up to the payload value, as sendResponse writes it
+size_t formatJsonEnvelope(char* out, size_t size, uint32_t requestId) {
+    int n = snprintf(out, size, "{\"v\":1,\"type\":\"response\",\"id\":%u,\"ts\":%lu,\"payload\":",
+                     (unsigned)requestId, (unsigned long)(millis() / 1000));
+    return n < 0 ? 0 : min((size_t)n, size - 1);
+}
+
+// The members sendResponse puts ahead of the payload
+void addResponseHeader(JsonDocument& doc, uint32_t requestId) {
+    doc["v"] = 1;
+    doc["type"] = "response";
+    doc["id"] = requestId;
+    doc["ts"] = millis() / 1000;
+}
+
+uint8_t* writeMsgPackUint32(uint8_t* out, uint32_t value) {
+    *out++ = 0xCE;
+    *out++ = (uint8_t)(value >> 24);
+    *out++ = (uint8_t)(value >> 16);
+    *out++ = (uint8_t)(value >> 8);
+    *out++ = (uint8_t)value;
+    return out;
+}
+
 bool isSupportedActionType(uint8_t rawType) {
     switch (rawType) {
         case ACTION_NONE:
@@ -35,12 +200,8 @@ static void _serializeAction(const Action& action, JsonObject obj) {
             obj["key"] = action.config.hotkey.key;
             break;
         case ACTION_TEXT:
-        {
-            char safeText[sizeof(action.config.text.text)];
-            copyBoundedBuffer(action.config.text.text, safeText);
-            obj["text"] = safeText;
+            obj["text"] = profileText(action.config.text.textRef);
             break;
-        }
         case ACTION_MEDIA:
             obj["function"] = static_cast<int>(action.config.media.function);
             break;
@@ -59,10 +220,8 @@ static void _serializeAction(const Action& action, JsonObject obj) {
                 step["delayMs"] = action.config.macro.steps[i].delayMs;
                 step["key"] = action.config.macro.steps[i].key;
                 step["modifiers"] = action.config.macro.steps[i].modifiers;
-                char safeStepText[sizeof(action.config.macro.steps[i].text)];
-                copyBoundedBuffer(action.config.macro.steps[i].text, safeStepText);
-                if (safeStepText[0] != '\0') {
-                    step["text"] = safeStepText;
+                if (action.config.macro.steps[i].textRef != TEXT_REF_NONE) {
+                    step["text"] = profileText(action.config.macro.steps[i].textRef);
                 }
                 step["mediaFunction"] = action.config.macro.steps[i].mediaFunction;
             }
@@ -77,7 +236,19 @@ ProtocolHandler::ProtocolHandler() {
     _profileManager = nullptr;
     _bleService = nullptr;
     _bleKeyboard = nullptr;
-    _processingDeferred = false;
+    _persistence = nullptr;
+    _telemetry = nullptr;
+    for (uint8_t i = 0; i < PROTOCOL_QUEUE_DEPTH; i++) {
+        _queue[i].used = false;
+    }
+    _queueCount = 0;
+    _queueBytes = 0;
+    _queueOrder = 0;
+    _batchResults = nullptr;
+    _batchCount = 0;
+    _archivePending = false;
+    _encoding = MESSAGE_ENCODING_JSON;
+    _previewClientCount = 0;
 }
 
 void ProtocolHandler::init(ProfileManager* profileManager) {
@@ -87,133 +258,337 @@ void ProtocolHandler::init(ProfileManager* profileManager) {
 
 void ProtocolHandler::setBLEService(BLEConfigService* bleService) {
     _bleService = bleService;
+    if (_profileManager) {
+        _profileManager->setSlotReaderCheck(bleService ? isSlotBeingSent : nullptr, bleService);
+    }
 }
 
 void ProtocolHandler::setBLEKeyboard(BLEKeyboard* bleKeyboard) {
     _bleKeyboard = bleKeyboard;
 }
 
-void ProtocolHandler::handleMessage(const String& json) {
-    DEBUG_PRINTF("Protocol RX: %s\n", json.substring(0, 200).c_str());
+void ProtocolHandler::setPersistence(PersistenceService* persistence) {
+    _persistence = persistence;
+}
+
+void ProtocolHandler::setTelemetry(InputTelemetry* telemetry) {
+    _telemetry = telemetry;
+}
+
+void ProtocolHandler::handleMessage(String&& message) {
+    // Replies (and events) follow the encoding of the client's latest request;
+    // processDeferred() switches to it when the request runs
+    MessageEncoding encoding = isMsgPackMessage(message) ? MESSAGE_ENCODING_MSGPACK : MESSAGE_ENCODING_JSON;
     
-    // Parse JSON - use larger buffer for setProfile (full profile can be 6KB+)
-    DynamicJsonDocument doc(10240);
-    DeserializationError error = deserializeJson(doc, json);
+    if (encoding == MESSAGE_ENCODING_MSGPACK) {
+        DEBUG_PRINTF("Protocol RX: MessagePack (%d bytes)\n", message.length());
+    } else {
+        DEBUG_PRINTF("Protocol RX: %s\n", message.substring(0, 200).c_str());
+    }
+    
+    // Only the envelope goes into the document; a setProfile body is skipped here
+    // and decoded once, straight into the work buffer, by decodeProfileRequest()
+    StaticJsonDocument<128> filter;
+    filter["v"] = true;
+    filter["type"] = true;
+    filter["id"] = true;
+    filter["cmd"] = true;
+    filter["op"] = true;
+    filter["payload"]["cmd"] = true;
+    filter["profileId"] = true;
+    filter["cursor"] = true;
+    filter["limit"] = true;
+    filter["ifNoneMatch"] = true;
+    filter["compression"] = true;
+    
+    DynamicJsonDocument doc(512);
+    DeserializationError error;
+    if (encoding == MESSAGE_ENCODING_MSGPACK) {
+        error = deserializeMsgPack(doc, message.c_str(), message.length(), DeserializationOption::Filter(filter));
+    } else {
+        error = deserializeJson(doc, message.c_str(), message.length(), DeserializationOption::Filter(filter));
+    }
     
     if (error) {
-        DEBUG_PRINTF("JSON parse error: %s (len=%d)\n", error.c_str(), json.length());
+        DEBUG_PRINTF("Message parse error: %s (len=%d)\n", error.c_str(), message.length());
         uint32_t reqId = 0;
-        int idPos = json.indexOf("\"id\":");
+        int idPos = encoding == MESSAGE_ENCODING_JSON ? message.indexOf("\"id\":") : -1;
         if (idPos >= 0) {
             idPos += 5;
             int endPos = idPos;
-            while (endPos < (int)json.length() && (isDigit(json.charAt(endPos)) || json.charAt(endPos) == '-')) endPos++;
-            reqId = (uint32_t)json.substring(idPos, endPos).toInt();
+            while (endPos < (int)message.length() && (isDigit(message.charAt(endPos)) || message.charAt(endPos) == '-')) endPos++;
+            reqId = (uint32_t)message.substring(idPos, endPos).toInt();
         }
-        if (reqId != 0) sendResponse(reqId, false, String("JSON error: ") + error.c_str());
+        if (reqId != 0) _sendRefusal(reqId, String("JSON error: ") + error.c_str(), encoding);
         return;
     }
     
     // Extract envelope fields
     uint8_t version = doc["v"] | 1;
-    String type = doc["type"] | "request";
+    const char* type = doc["type"] | "request";
     uint32_t id = doc["id"] | 0;
     
-    if (type != "request") {
+    if (strcmp(type, "request") != 0) {
         DEBUG_PRINTLN("Ignoring non-request message");
         return;
     }
     
-    // Get command from payload
-    String cmd = doc["cmd"] | "";
-    
-    if (cmd == "") {
-        // Try old format
-        cmd = doc["payload"]["cmd"] | "";
-    }
-    
-    DEBUG_PRINTF("Command: %s (id=%d)\n", cmd.c_str(), id);
-    
-    // Route to appropriate handler
-    if (cmd == "getDeviceInfo") {
-        handleGetDeviceInfo(id);
-    }
-    else if (cmd == "getCaps") {
-        handleGetCaps(id);
-    }
-    else if (cmd == "listProfiles") {
-        handleListProfiles(id);
-    }
-    else if (cmd == "getProfile") {
-        uint8_t profileId = doc["profileId"] | 0;
-        handleGetProfile(id, profileId);
-    }
-    else if (cmd == "setProfile") {
-        // Defer to main loop so BLE callback returns immediately (prevents disconnect)
-        _deferredMessage = json;
+    PendingRequest request;
+    request.command = requestCommand(doc.as<JsonVariantConst>());
+    DEBUG_PRINTF("Command: %s (id=%d)\n", COMMAND_TABLE[request.command].name, id);
+    if (request.command == CMD_UNKNOWN) {
+        DEBUG_PRINTLN("Unknown command");
+        _sendRefusal(id, "Unknown command", encoding);
         return;
     }
-    else if (cmd == "setActiveProfile") {
-        uint8_t profileId = doc["profileId"] | 0;
-        handleSetActiveProfile(id, profileId);
-    }
-    else if (cmd == "getActiveProfile") {
-        handleGetActiveProfile(id);
-    }
-    else if (cmd == "deleteProfile") {
-        uint8_t profileId = doc["profileId"] | 0;
-        handleDeleteProfile(id, profileId);
+    const char* invalid = validateRequest(doc.as<JsonVariantConst>(), request.command);
+    if (invalid) {
+        _sendRefusal(id, invalid, encoding);
+        return;
     }
-    else if (cmd == "getStats") {
-        handleGetStats(id);
+    request.encoding = encoding;
+    request.priority = (COMMAND_TABLE[request.command].flags & COMMAND_QUERY) ? REQUEST_PRIORITY_QUERY
+                                                                              : REQUEST_PRIORITY_WRITE;
+    request.requestId = id;
+    _readRequestFields(doc.as<JsonVariantConst>(), request);
+    if (COMMAND_TABLE[request.command].flags & COMMAND_BODY) {
+        // The body is decoded later, straight from the received buffer.
+        // Moved, not copied: it can be most of a 20 KB upload.
+        request.message = std::move(message);
     }
-    else if (cmd == "getConnectionStatus") {
-        handleGetConnectionStatus(id);
+    
+    if (!_enqueueRequest(request)) {
+        DEBUG_PRINTF("Request queue full, %s (id=%d) refused\n", COMMAND_TABLE[request.command].name, id);
+        _sendRefusal(id, "Busy", encoding, true);
     }
-    else if (cmd == "factoryReset") {
-        handleFactoryReset(id);
+}
+
+void ProtocolHandler::_readRequestFields(JsonVariantConst source, PendingRequest& request) {
+    request.profileId = source["profileId"] | 0;
+    request.cursor = source["cursor"] | 0;
+    request.limit = source["limit"] | LIST_PROFILES_PAGE_MAX;
+    request.ifNoneMatch = source["ifNoneMatch"] | 0;
+    const char* compression = source["compression"] | "";
+    request.compression = strcmp(compression, "lzss") == 0;
+}
+
+bool ProtocolHandler::_enqueueRequest(PendingRequest& request) {
+    std::lock_guard<std::mutex> lock(_queueLock);
+    size_t length = request.message.length();
+    if (_queueCount >= PROTOCOL_QUEUE_DEPTH || (_queueCount > 0 && _queueBytes + length > PROTOCOL_QUEUE_BYTES)) {
+        return false;
     }
-    else if (cmd == "reboot") {
-        handleReboot(id);
+    for (uint8_t i = 0; i < PROTOCOL_QUEUE_DEPTH; i++) {
+        PendingRequest& slot = _queue[i];
+        if (slot.used) continue;
+        slot.command = request.command;
+        slot.encoding = request.encoding;
+        slot.priority = request.priority;
+        slot.order = _queueOrder++;
+        slot.requestId = request.requestId;
+        slot.profileId = request.profileId;
+        slot.cursor = request.cursor;
+        slot.limit = request.limit;
+        slot.ifNoneMatch = request.ifNoneMatch;
+        slot.compression = request.compression;
+        slot.message = std::move(request.message);
+        slot.used = true;
+        _queueCount++;
+        _queueBytes += length;
+        return true;
     }
-    else {
-        DEBUG_PRINTF("Unknown command: %s\n", cmd.c_str());
-        sendResponse(id, false, "Unknown command");
+    return false;
+}
+
+void ProtocolHandler::_sendRefusal(uint32_t requestId, const String& error, MessageEncoding encoding, bool busy) {
+    DynamicJsonDocument payload(128);
+    payload["success"] = false;
+    payload["error"] = error;
+    if (busy) {
+        payload["busy"] = true;
     }
+    _sendEnvelope(requestId, payload, encoding);
+}
+
+void ProtocolHandler::_sendBusy(uint32_t requestId) {
+    DynamicJsonDocument payload(128);
+    payload["success"] = false;
+    payload["error"] = "Busy";
+    payload["busy"] = true;
+    sendResponse(requestId, payload);
 }
 
 void ProtocolHandler::processDeferred() {
-    if (_deferredMessage.length() == 0) return;
+    // A request waits in the queue until the transport can take its replies
+    if (_bleService && !_bleService->hasTxRoom()) return;
     
-    yield();  // Let BLE and other tasks run before heavy work
-    
-    String json = _deferredMessage;
-    _deferredMessage = "";
-    _processingDeferred = true;
+    PendingRequest request;
+    {
+        std::lock_guard<std::mutex> lock(_queueLock);
+        if (_queueCount == 0) return;
+        
+        PendingRequest* next = nullptr;
+        for (uint8_t i = 0; i < PROTOCOL_QUEUE_DEPTH; i++) {
+            PendingRequest& slot = _queue[i];
+            if (!slot.used) continue;
+            if (!next || slot.priority < next->priority ||
+                (slot.priority == next->priority && (int32_t)(slot.order - next->order) < 0)) {
+                next = &slot;
+            }
+        }
+        request.command = next->command;
+        request.encoding = next->encoding;
+        request.requestId = next->requestId;
+        request.profileId = next->profileId;
+        request.cursor = next->cursor;
+        request.limit = next->limit;
+        request.ifNoneMatch = next->ifNoneMatch;
+        request.compression = next->compression;
+        request.message = std::move(next->message);
+        next->message = "";
+        next->used = false;
+        _queueCount--;
+        _queueBytes -= request.message.length();
+    }
     
-    DynamicJsonDocument doc(10240);
-    DeserializationError error = deserializeJson(doc, json);
-    if (error) {
-        _processingDeferred = false;
-        uint32_t reqId = 0;
-        int idPos = json.indexOf("\"id\":");
-        if (idPos >= 0) {
-            idPos += 5;
-            int endPos = idPos;
-            while (endPos < (int)json.length() && (isDigit(json.charAt(endPos)) || json.charAt(endPos) == '-')) endPos++;
-            reqId = (uint32_t)json.substring(idPos, endPos).toInt();
+    // Replies follow the encoding of the request they answer
+    _encoding = request.encoding;
+    _runRequest(request);
+    yield();  // Let BLE process notifications/connection after heavy work
+}
+
+// The slot is free again before the handler runs, so a request that arrives
+// meanwhile is queued rather than refused
+void ProtocolHandler::_runRequest(PendingRequest& request) {
+    uint32_t id = request.requestId;
+    switch (request.command) {
+        case CMD_GET_DEVICE_INFO:
+            handleGetDeviceInfo(id);
+            break;
+        case CMD_GET_CAPS:
+            handleGetCaps(id, request.compression);
+            break;
+        case CMD_LIST_PROFILES:
+            handleListProfiles(id, request.cursor, request.limit);
+            break;
+        case CMD_GET_PROFILE:
+            handleGetProfile(id, request.profileId, request.ifNoneMatch);
+            break;
+        case CMD_SYNC_MANIFEST:
+            handleSyncManifest(id);
+            break;
+        case CMD_SET_PROFILE:
+            handleSetProfile(id, request.message, request.encoding);
+            break;
+        case CMD_SET_KEY:
+            handlePatchProfile(id, request.profileId, PROFILE_PATCH_KEY, request.message, request.encoding);
+            break;
+        case CMD_SET_ENCODER:
+            handlePatchProfile(id, request.profileId, PROFILE_PATCH_ENCODER, request.message, request.encoding);
+            break;
+        case CMD_SET_NAME:
+            handlePatchProfile(id, request.profileId, PROFILE_PATCH_NAME, request.message, request.encoding);
+            break;
+        case CMD_SET_ACTIVE_PROFILE:
+            handleSetActiveProfile(id, request.profileId);
+            break;
+        case CMD_GET_ACTIVE_PROFILE:
+            handleGetActiveProfile(id);
+            break;
+        case CMD_DELETE_PROFILE:
+            handleDeleteProfile(id, request.profileId);
+            break;
+        case CMD_UNDO_PROFILE_EDIT:
+            handleUndoProfileEdit(id, request.profileId);
+            break;
+        case CMD_PREVIEW_PROFILE:
+            handlePreviewProfile(id, request.message, request.encoding);
+            break;
+        case CMD_COMMIT_PREVIEW:
+            handleCommitPreview(id);
+            break;
+        case CMD_DISCARD_PREVIEW:
+            handleDiscardPreview(id);
+            break;
+        case CMD_GET_STATS:
+            handleGetStats(id);
+            break;
+        case CMD_GET_CONNECTION_STATUS:
+            handleGetConnectionStatus(id);
+            break;
+        case CMD_FACTORY_RESET:
+            handleFactoryReset(id);
+            break;
+        case CMD_REBOOT:
+            handleReboot(id);
+            break;
+        case CMD_BATCH:
+            handleBatch(id, request.message, request.encoding);
+            break;
+        case CMD_EXPORT_ALL:
+            handleExportAll(id);
+            break;
+        case CMD_IMPORT_ALL:
+            handleImportAll(id, request.message, request.encoding);
+            break;
+        case CMD_SUBSCRIBE_EVENTS:
+            handleSubscribeEvents(id, request.message, request.encoding);
+            break;
+        default:
+            sendResponse(id, false, "Unknown command");
+            break;
+    }
+}
+
+bool ProtocolHandler::isRequestQueueFull() const {
+    std::lock_guard<std::mutex> lock(_queueLock);
+    return _queueCount >= PROTOCOL_QUEUE_DEPTH || _queueBytes >= PROTOCOL_QUEUE_BYTES;
+}
+
+void ProtocolHandler::update() {
+    processDeferred();
+    if (_archivePending && (!_bleService || _bleService->isTransmitIdle())) {
+        LittleFS.remove(PROFILE_ARCHIVE_PATH);
+        _archivePending = false;
+    }
+    // A new connection starts in JSON until its client sends something else
+    if (_bleService && _bleService->getClientCount() == 0) {
+        _encoding = MESSAGE_ENCODING_JSON;
+        // ...and without a subscription
+        if (_telemetry && _telemetry->isEnabled()) {
+            _telemetry->setEnabled(false);
         }
-        if (reqId != 0) sendResponse(reqId, false, String("JSON error: ") + error.c_str());
-        return;
     }
+    checkPreviewExpiry();
+}
+
+void ProtocolHandler::checkPreviewExpiry() {
+    if (!_profileManager || !_profileManager->isPreviewActive()) return;
+    
+    const char* reason = nullptr;
+    if (_bleService && _bleService->getClientCount() < _previewClientCount) {
+        reason = "disconnect";
+    } else if (_profileManager->getPreviewIdleMs() >= PROFILE_PREVIEW_TIMEOUT_MS) {
+        reason = "timeout";
+    }
+    if (!reason) return;
+    if (_bleService && !_bleService->hasTxRoom()) return;  // Ended once previewEnded can go out
     
-    uint32_t id = doc["id"] | 0;
-    handleSetProfile(id, doc);
-    _processingDeferred = false;
-    yield();  // Let BLE process notifications/connection after save
+    _profileManager->discardPreview();
+    
+    DynamicJsonDocument eventPayload(128);
+    eventPayload["reason"] = reason;
+    eventPayload["profileId"] = _profileManager->getActiveProfileId();
+    sendEvent("previewEnded", eventPayload);
 }
 
+// Only uptime and freeHeap change, so a poll within a second gets the cached copy
 void ProtocolHandler::handleGetDeviceInfo(uint32_t requestId) {
+    if (_isCacheHit(_deviceInfoCache) && millis() - _deviceInfoCache.builtAt < RESPONSE_CACHE_STATUS_MS) {
+        _sendEncodedResponse(requestId, _deviceInfoCache.payload);
+        return;
+    }
+    
     DynamicJsonDocument payload(512);
     
     payload["deviceId"] = String("ESP32-") + String((uint32_t)ESP.getEfuseMac(), HEX);
@@ -229,19 +604,56 @@ void ProtocolHandler::handleGetDeviceInfo(uint32_t requestId) {
     payload["uptime"] = millis() / 1000;
     payload["freeHeap"] = ESP.getFreeHeap();
     
-    sendResponse(requestId, payload);
+    _sendCacheable(requestId, _deviceInfoCache, payload);
 }
 
-void ProtocolHandler::handleGetCaps(uint32_t requestId) {
+void ProtocolHandler::handleGetCaps(uint32_t requestId, bool compression) {
+    // freeBytes moves with the manifest generation, framePayload with the client's MTU
+    uint16_t framePayload = _bleService ? _bleService->getFramePayloadSize() : 0;
+    if (_isCacheHit(_capsCache) && _capsCache.framePayload == framePayload) {
+        _sendEncodedResponse(requestId, _capsCache.payload);
+    } else {
+        _sendCaps(requestId, framePayload);
+    }
+    
+    // Compression starts with the message after this reply, for the rest of the connection
+    if (compression && _bleService && _bleService->isFramedClient()) {
+        _bleService->setTxCompression(true);
+    }
+}
+
+void ProtocolHandler::_sendCaps(uint32_t requestId, uint16_t framePayload) {
+    
     DynamicJsonDocument payload(1024);
     
     payload["maxProfiles"] = MAX_PROFILES;
+    payload["maxProfileId"] = PROFILE_ID_MAX;
     payload["freeBytes"] = _profileManager->getFreeSpace();
     payload["supportsLayers"] = false;
     payload["supportsMacros"] = true;
     payload["supportsEncoders"] = true;
     payload["maxKeys"] = MATRIX_KEYS;
     payload["maxEncoders"] = 2;
+    payload["maxTextLength"] = TEXT_ACTION_MAX_LENGTH;
+    payload["maxMacroTextLength"] = MACRO_TEXT_MAX_LENGTH;
+    payload["textPoolBytes"] = PROFILE_TEXT_POOL_BYTES;
+    payload["fieldEdits"] = true;  // setKey / setEncoder / setName
+    payload["syncManifest"] = true;  // syncManifest, getProfile ifNoneMatch
+    payload["requestQueue"] = PROTOCOL_QUEUE_DEPTH;  // Requests a client may keep in flight
+    payload["batchMax"] = PROTOCOL_BATCH_MAX;  // Queries per batch request
+    
+    // Wire encodings; a client switches by sending its requests in another one
+    JsonArray encodings = payload.createNestedArray("encodings");
+    encodings.add("json");
+    encodings.add("msgpack");
+    // Binary transport frames (see BLEConfigService); payload size follows the MTU
+    payload["binaryFrames"] = true;
+    payload["framePayload"] = framePayload;
+    // Frame payload codecs a client may ask for with getCaps "compression"
+    JsonArray compression = payload.createNestedArray("compression");
+    compression.add("lzss");
+    payload["archiveVersion"] = PROFILE_ARCHIVE_VERSION;  // exportAll / importAll
+    payload["inputEvents"] = true;  // subscribeEvents
     
     // Report supported action types so UI can hide unsupported ones
     JsonArray actions = payload.createNestedArray("supportedActions");
@@ -254,36 +666,114 @@ void ProtocolHandler::handleGetCaps(uint32_t requestId) {
     actions.add(7); // ACTION_PROFILE
     // ACTION_LAYER (6), ACTION_APP (8), ACTION_URL (9) not supported
     
-    sendResponse(requestId, payload);
+    _capsCache.framePayload = framePayload;
+    _sendCacheable(requestId, _capsCache, payload);
 }
 
-void ProtocolHandler::handleListProfiles(uint32_t requestId) {
+void ProtocolHandler::handleListProfiles(uint32_t requestId, uint16_t cursor, uint16_t limit) {
+    if (limit == 0 || limit > LIST_PROFILES_PAGE_MAX) {
+        limit = LIST_PROFILES_PAGE_MAX;
+    }
+    // Apps poll the first page; that one is kept until the manifest changes
+    bool firstPage = cursor == 0 && limit == LIST_PROFILES_PAGE_MAX;
+    if (firstPage && _isCacheHit(_profileListCache)) {
+        _sendEncodedResponse(requestId, _profileListCache.payload);
+        return;
+    }
+    
     DynamicJsonDocument payload(2048);
     JsonArray profiles = payload.createNestedArray("profiles");
     
-    for (uint8_t i = 0; i < MAX_PROFILES; i++) {
-        if (_profileManager->profileExists(i)) {
-            JsonObject profile = profiles.createNestedObject();
-            profile["id"] = i;
-            
-            char name[32];
-            size_t size;
-            if (_profileManager->getProfileInfo(i, name, &size)) {
-                profile["name"] = name;
-                profile["size"] = size;
-            }
+    // Cursor is an id, not a position, so pages stay stable while profiles are added or removed
+    uint16_t count = _profileManager->getProfileCount();
+    uint16_t index = _profileManager->findManifestIndex(cursor);
+    for (uint16_t n = 0; index < count && n < limit; index++, n++) {
+        const ProfileManifestEntry* entry = _profileManager->getManifestEntryAt(index);
+        
+        JsonObject profile = profiles.createNestedObject();
+        profile["id"] = entry->id;
+        profile["name"] = entry->name;
+        profile["size"] = entry->size;
+        profile["hash"] = entry->hash;
+        profile["revision"] = entry->revision;
+        if (entry->source == PROFILE_SOURCE_ROM) {
+            profile["builtin"] = true;
         }
     }
     
+    payload["total"] = count;
+    if (index < count) {
+        payload["nextCursor"] = _profileManager->getManifestEntryAt(index)->id;
+    }
+    
+    if (firstPage) {
+        _sendCacheable(requestId, _profileListCache, payload);
+    } else {
+        sendResponse(requestId, payload);
+    }
+}
+
+// Every profile as [id, hash, revision] in one reply. A client compares hashes
+// with its cache and fetches only the profiles that differ.
+void ProtocolHandler::handleSyncManifest(uint32_t requestId) {
+    uint16_t count = _profileManager->getProfileCount();
+    DynamicJsonDocument payload(256 + count * 64);
+    JsonArray profiles = payload.createNestedArray("profiles");
+    
+    for (uint16_t index = 0; index < count; index++) {
+        const ProfileManifestEntry* entry = _profileManager->getManifestEntryAt(index);
+        JsonArray profile = profiles.createNestedArray();
+        profile.add(entry->id);
+        profile.add(entry->hash);
+        profile.add(entry->revision);
+    }
+    payload["activeProfileId"] = _profileManager->getActiveProfileId();
+    
     sendResponse(requestId, payload);
 }
 
-void ProtocolHandler::handleGetProfile(uint32_t requestId, uint8_t profileId) {
-    if (!_profileManager->loadProfileIntoWorkBuffer(profileId)) {
+void ProtocolHandler::handleGetProfile(uint32_t requestId, uint16_t profileId, uint32_t ifNoneMatch) {
+    // The client's copy is current: answer from the manifest without touching flash
+    const ProfileManifestEntry* entry = _profileManager->getManifestEntry(profileId);
+    if (entry && ifNoneMatch != 0 && entry->hash == ifNoneMatch) {
+        DynamicJsonDocument payload(128);
+        payload["id"] = profileId;
+        payload["notModified"] = true;
+        payload["hash"] = entry->hash;
+        payload["revision"] = entry->revision;
+        sendResponse(requestId, payload);
+        return;
+    }
+    
+    if (!entry) {
         sendResponse(requestId, false, "Profile not found");
         return;
     }
-
+    
+    // A stored snapshot already is the payload: frame it straight off flash
+    // with the envelope around it (body minus its closing brace, then the validator).
+    // Not for a compressing client: its stream is built from the whole message.
+    String path;
+    uint32_t offset;
+    uint32_t length;
+    if (!_batchResults && _encoding == MESSAGE_ENCODING_JSON && _bleService && _bleService->isFramedClient() &&
+        !_bleService->isTxCompressed() &&
+        _profileManager->getStoredProfileBody(profileId, path, offset, length) && length > 2) {
+        char prefix[96];
+        formatJsonEnvelope(prefix, sizeof(prefix), requestId);
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ",\"hash\":%u,\"revision\":%u}}",
+                 (unsigned)entry->hash, (unsigned)entry->revision);
+        if (_bleService->sendFramedFile(prefix, path, offset, length - 1, suffix)) {
+            return;
+        }
+    }
+    
+    if (!_profileManager->loadProfileIntoWorkBuffer(profileId)) {
+        sendResponse(requestId, false, "Profile could not be loaded");
+        return;
+    }
+    
     const Profile& profile = *(_profileManager->getWorkProfile());
     
     // Serialize profile to JSON
@@ -300,7 +790,7 @@ void ProtocolHandler::handleGetProfile(uint32_t requestId, uint8_t profileId) {
     for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
         JsonObject key = keys.createNestedObject();
         key["index"] = i;
-
+        
         _serializeAction(profile.keys[i].action, key);
     }
     
@@ -323,21 +813,28 @@ void ProtocolHandler::handleGetProfile(uint32_t requestId, uint8_t profileId) {
         enc["stepsPerDetent"] = profile.encoders[i].stepsPerDetent;
     }
     
+    // Validator for the next ifNoneMatch
+    entry = _profileManager->getManifestEntry(profileId);
+    if (entry) {
+        payload["hash"] = entry->hash;
+        payload["revision"] = entry->revision;
+    }
+    
     sendResponse(requestId, payload);
 }
 
-void ProtocolHandler::handleSetProfile(uint32_t requestId, const JsonDocument& doc) {
-    JsonObjectConst profileObj = doc["profile"].as<JsonObjectConst>();
-    if (profileObj.isNull()) {
-        sendResponse(requestId, false, "Missing profile");
+void ProtocolHandler::handleSetProfile(uint32_t requestId, const String& message, MessageEncoding encoding) {
+    ProfileDecodeResult result = _profileManager->decodeProfileRequest(message.c_str(), message.length(), encoding);
+    if (result != PROFILE_DECODE_OK) {
+        sendResponse(requestId, false, profileDecodeError(result));
         return;
     }
-    uint8_t profileId = profileObj["id"] | 255;
-    if (profileId >= MAX_PROFILES) {
-        sendResponse(requestId, false, "Profile ID exceeds device limit");
+    uint16_t profileId = _profileManager->getWorkProfile()->id;
+    if (!_profileManager->profileExists(profileId) && _profileManager->getProfileCount() >= MAX_PROFILES) {
+        sendResponse(requestId, false, "Profile storage full");
         return;
     }
-    if (_profileManager->saveProfileFromJson(profileObj)) {
+    if (_profileManager->saveWorkProfile()) {
         DynamicJsonDocument payload(64);
         payload["success"] = true;
         sendResponse(requestId, payload);
@@ -346,7 +843,26 @@ void ProtocolHandler::handleSetProfile(uint32_t requestId, const JsonDocument& d
     }
 }
 
-void ProtocolHandler::handleSetActiveProfile(uint32_t requestId, uint8_t profileId) {
+void ProtocolHandler::handlePatchProfile(uint32_t requestId, uint16_t profileId, ProfilePatchKind kind,
+                                         const String& message, MessageEncoding encoding) {
+    ProfileFieldMask fields;
+    ProfileDecodeResult result = _profileManager->decodePatchRequest(profileId, message.c_str(), message.length(),
+                                                                     encoding, kind, fields);
+    if (result != PROFILE_DECODE_OK) {
+        sendResponse(requestId, false, profileDecodeError(result));
+        return;
+    }
+    if (_profileManager->saveWorkProfileFields(fields)) {
+        DynamicJsonDocument payload(128);
+        payload["profileId"] = profileId;
+        payload["success"] = true;
+        sendResponse(requestId, payload);
+    } else {
+        sendResponse(requestId, false, "Save failed");
+    }
+}
+
+void ProtocolHandler::handleSetActiveProfile(uint32_t requestId, uint16_t profileId) {
     if (_profileManager->setActiveProfile(profileId)) {
         DynamicJsonDocument payload(128);
         payload["profileId"] = profileId;
@@ -363,13 +879,68 @@ void ProtocolHandler::handleSetActiveProfile(uint32_t requestId, uint8_t profile
 }
 
 void ProtocolHandler::handleGetActiveProfile(uint32_t requestId) {
-    uint8_t id = _profileManager->getActiveProfileId();
+    uint16_t id = _profileManager->getActiveProfileId();
     DynamicJsonDocument payload(128);
     payload["profileId"] = id;
+    payload["preview"] = _profileManager->isPreviewActive();
     sendResponse(requestId, payload);
 }
 
-void ProtocolHandler::handleDeleteProfile(uint32_t requestId, uint8_t profileId) {
+void ProtocolHandler::handlePreviewProfile(uint32_t requestId, const String& message, MessageEncoding encoding) {
+    ProfileDecodeResult result = _profileManager->decodeProfileRequest(message.c_str(), message.length(), encoding);
+    if (result != PROFILE_DECODE_OK) {
+        sendResponse(requestId, false, profileDecodeError(result));
+        return;
+    }
+    uint16_t profileId = _profileManager->getWorkProfile()->id;
+    if (!_profileManager->previewWorkProfile()) {
+        sendResponse(requestId, false, "Invalid profile");
+        return;
+    }
+    _previewClientCount = _bleService ? _bleService->getClientCount() : 0;
+    
+    DynamicJsonDocument payload(128);
+    payload["profileId"] = profileId;
+    payload["timeoutMs"] = PROFILE_PREVIEW_TIMEOUT_MS;
+    sendResponse(requestId, payload);
+}
+
+void ProtocolHandler::handleCommitPreview(uint32_t requestId) {
+    if (!_profileManager->isPreviewActive()) {
+        sendResponse(requestId, false, "No preview active");
+        return;
+    }
+    uint16_t profileId = _profileManager->getActiveProfileId();
+    if (!_profileManager->profileExists(profileId) && _profileManager->getProfileCount() >= MAX_PROFILES) {
+        sendResponse(requestId, false, "Profile storage full");
+        return;
+    }
+    if (_profileManager->commitPreview()) {
+        DynamicJsonDocument payload(64);
+        payload["profileId"] = profileId;
+        payload["success"] = true;
+        sendResponse(requestId, payload);
+    } else {
+        sendResponse(requestId, false, "Save failed");
+    }
+}
+
+void ProtocolHandler::handleDiscardPreview(uint32_t requestId) {
+    if (!_profileManager->isPreviewActive()) {
+        sendResponse(requestId, false, "No preview active");
+        return;
+    }
+    if (_profileManager->discardPreview()) {
+        DynamicJsonDocument payload(64);
+        payload["profileId"] = _profileManager->getActiveProfileId();
+        payload["success"] = true;
+        sendResponse(requestId, payload);
+    } else {
+        sendResponse(requestId, false, "Failed to restore profile");
+    }
+}
+
+void ProtocolHandler::handleDeleteProfile(uint32_t requestId, uint16_t profileId) {
     if (_profileManager->deleteProfile(profileId)) {
         DynamicJsonDocument payload(64);
         payload["success"] = true;
@@ -379,17 +950,44 @@ void ProtocolHandler::handleDeleteProfile(uint32_t requestId, uint8_t profileId)
     }
 }
 
+void ProtocolHandler::handleUndoProfileEdit(uint32_t requestId, uint16_t profileId) {
+    if (_profileManager->undoLastEdit(profileId)) {
+        DynamicJsonDocument payload(128);
+        payload["profileId"] = profileId;
+        payload["success"] = true;
+        sendResponse(requestId, payload);
+    } else {
+        sendResponse(requestId, false, "Nothing to undo");
+    }
+}
+
 void ProtocolHandler::handleGetStats(uint32_t requestId) {
     DynamicJsonDocument payload(512);
     
-    JsonArray keyPresses = payload.createNestedArray("keyPresses");
-    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
-        keyPresses.add(keyPressCount[i]);
+    if (_persistence) {
+        const PersistentStats& stats = _persistence->getStats();
+        JsonArray keyPresses = payload.createNestedArray("keyPresses");
+        for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+            keyPresses.add(stats.keyPresses[i]);
+        }
+        
+        JsonArray encoderTurns = payload.createNestedArray("encoderTurns");
+        encoderTurns.add(stats.encoderTurns[0]);
+        encoderTurns.add(stats.encoderTurns[1]);
+        
+        JsonObject persist = payload.createNestedObject("persistence");
+        persist["writes"] = _persistence->getWriteCount();
+        persist["flushes"] = _persistence->getFlushCount();
+        persist["lastFlushUs"] = _persistence->getLastFlushMicros();
+        persist["maxFlushUs"] = _persistence->getMaxFlushMicros();
+        persist["pending"] = _persistence->isDirty();
     }
     
-    JsonArray encoderTurns = payload.createNestedArray("encoderTurns");
-    encoderTurns.add(encoderTurnCount[0]);
-    encoderTurns.add(encoderTurnCount[1]);
+    if (_bleService) {
+        JsonObject transport = payload.createNestedObject("transport");
+        transport["rxTransfers"] = _bleService->getRxTransferCount();
+        transport["rxAllocations"] = _bleService->getRxTransferAllocations();
+    }
     
     payload["uptime"] = millis() / 1000;
     payload["freeHeap"] = ESP.getFreeHeap();
@@ -399,6 +997,7 @@ void ProtocolHandler::handleGetStats(uint32_t requestId) {
 
 void ProtocolHandler::handleFactoryReset(uint32_t requestId) {
     _profileManager->factoryReset();
+    if (_persistence) _persistence->flush();
     
     DynamicJsonDocument payload(64);
     payload["success"] = true;
@@ -410,6 +1009,17 @@ void ProtocolHandler::handleReboot(uint32_t requestId) {
     payload["success"] = true;
     sendResponse(requestId, payload);
     
+    // Don't lose settled-but-unwritten state
+    if (_persistence) _persistence->flush();
+    
+    // A framed reply is paced out by update() and resent until acked, so keep
+    // the link going until the client has it rather than restarting under it
+    uint32_t flushStart = millis();
+    while (_bleService && !_bleService->isTransmitIdle() && millis() - flushStart < BLE_REBOOT_FLUSH_MS) {
+        _bleService->update();
+        delay(1);
+    }
+    
     delay(100);
     ESP.restart();
 }
@@ -447,6 +1057,228 @@ void ProtocolHandler::handleGetConnectionStatus(uint32_t requestId) {
     sendResponse(requestId, payload);
 }
 
+// Several queries answered in one response: {"results": [payload, ...]} in
+// request order. A sub-request that is not a query gets an error in its place.
+void ProtocolHandler::handleBatch(uint32_t requestId, const String& message, MessageEncoding encoding) {
+    StaticJsonDocument<256> filter;
+    JsonVariant item = filter["requests"][0];
+    item["cmd"] = true;
+    item["op"] = true;
+    item["profileId"] = true;
+    item["cursor"] = true;
+    item["limit"] = true;
+    item["ifNoneMatch"] = true;
+    
+    DynamicJsonDocument doc(1024);
+    DeserializationError error;
+    if (encoding == MESSAGE_ENCODING_MSGPACK) {
+        error = deserializeMsgPack(doc, message.c_str(), message.length(), DeserializationOption::Filter(filter));
+    } else {
+        error = deserializeJson(doc, message.c_str(), message.length(), DeserializationOption::Filter(filter));
+    }
+    JsonArrayConst requests = doc["requests"].as<JsonArrayConst>();
+    if (error || requests.size() == 0 || requests.size() > PROTOCOL_BATCH_MAX) {
+        sendResponse(requestId, false, "Invalid batch");
+        return;
+    }
+    
+    // Each result is encoded as it comes; the reply is then put together from
+    // those bytes, so it is exactly as large as they are and never truncated
+    String results[PROTOCOL_BATCH_MAX];
+    _batchResults = results;
+    _batchCount = 0;
+    for (JsonVariantConst entry : requests) {
+        PendingRequest request;
+        request.command = requestCommand(entry);
+        request.encoding = encoding;
+        request.requestId = requestId;
+        _readRequestFields(entry, request);
+        request.compression = false;  // Would compress the batch reply itself
+        if (request.command == CMD_BATCH || !(COMMAND_TABLE[request.command].flags & COMMAND_QUERY)) {
+            sendResponse(requestId, false, "Not allowed in batch");
+            continue;
+        }
+        const char* invalid = validateRequest(entry, request.command);
+        if (invalid) {
+            sendResponse(requestId, false, invalid);
+            continue;
+        }
+        _runRequest(request);
+    }
+    _batchResults = nullptr;
+    
+    String reply;
+    size_t length = 16;
+    for (uint8_t i = 0; i < _batchCount; i++) {
+        length += results[i].length() + 1;
+    }
+    if (!reply.reserve(length)) {
+        sendResponse(requestId, false, "Out of memory");
+        return;
+    }
+    if (_encoding == MESSAGE_ENCODING_JSON) {
+        reply.concat("{\"results\":[");
+        for (uint8_t i = 0; i < _batchCount; i++) {
+            if (i > 0) reply.concat(',');
+            reply.concat(results[i]);
+        }
+        reply.concat("]}");
+    } else {
+        static_assert(PROTOCOL_BATCH_MAX < 16, "batch results are sent as a MessagePack fixarray");
+        static const uint8_t MSGPACK_RESULTS[] = {0x81, 0xA7, 'r', 'e', 's', 'u', 'l', 't', 's'};
+        reply.concat((const char*)MSGPACK_RESULTS, sizeof(MSGPACK_RESULTS));
+        reply.concat((char)(0x90 | _batchCount));
+        for (uint8_t i = 0; i < _batchCount; i++) {
+            reply.concat(results[i].c_str(), results[i].length());
+        }
+    }
+    _sendEncodedResponse(requestId, reply);
+}
+
+// The whole device as one archive (format in profile_json_reader.h). It is
+// built on flash and, for a framed client, read from there a frame at a time.
+void ProtocolHandler::handleExportAll(uint32_t requestId) {
+    if (_encoding != MESSAGE_ENCODING_JSON) {
+        sendResponse(requestId, false, "Archives are JSON only");
+        return;
+    }
+    if (_archivePending) {
+        _sendBusy(requestId);  // The previous export is still going out of the file
+        return;
+    }
+    
+    uint32_t length;
+    if (!_bleService || !_profileManager->exportArchive(length)) {
+        sendResponse(requestId, false, "Export failed");
+        return;
+    }
+    // A backup that can't be restored is no backup
+    if (length > PROTOCOL_ARCHIVE_MAX_BYTES) {
+        LittleFS.remove(PROFILE_ARCHIVE_PATH);
+        sendResponse(requestId, false, "Archive too large to import");
+        return;
+    }
+    
+    // A compressing client needs the whole message to build its stream, and a
+    // chunked one can't take a file; both get a copy from RAM
+    if (!_bleService->isTxCompressed()) {
+        char prefix[96];
+        formatJsonEnvelope(prefix, sizeof(prefix), requestId);
+        if (_bleService->sendFramedFile(prefix, PROFILE_ARCHIVE_PATH, 0, length, "}")) {
+            _archivePending = true;
+            return;
+        }
+    }
+    String archive;
+    bool loaded = length <= PROTOCOL_ARCHIVE_INLINE_BYTES && _readArchive(archive, length);
+    LittleFS.remove(PROFILE_ARCHIVE_PATH);
+    if (loaded) {
+        _sendEncodedResponse(requestId, archive);
+    } else {
+        sendResponse(requestId, false, "Archive too large for this connection");
+    }
+}
+
+bool ProtocolHandler::_readArchive(String& out, uint32_t length) {
+    File file = LittleFS.open(PROFILE_ARCHIVE_PATH, "r");
+    if (!file || !out.reserve(length)) {
+        return false;
+    }
+    char buffer[256];
+    size_t total = 0;
+    while (total < length) {
+        size_t n = file.read((uint8_t*)buffer, min(sizeof(buffer), (size_t)(length - total)));
+        if (n == 0) break;
+        out.concat(buffer, n);
+        total += n;
+    }
+    file.close();
+    return total == length;
+}
+
+// Every entry is checked before the first write, so a damaged or foreign
+// archive leaves the device as it was
+void ProtocolHandler::handleImportAll(uint32_t requestId, const String& message, MessageEncoding encoding) {
+    if (encoding != MESSAGE_ENCODING_JSON) {
+        sendResponse(requestId, false, "Archives are JSON only");
+        return;
+    }
+    
+    ProfileArchiveInfo info;
+    ProfileDecodeResult result = _profileManager->checkArchive(message.c_str(), message.length(), info);
+    if (result != PROFILE_DECODE_OK) {
+        sendResponse(requestId, false, profileDecodeError(result));
+        return;
+    }
+    if (!_profileManager->importArchive(message.c_str(), message.length(), info)) {
+        sendResponse(requestId, false, "Import failed");
+        return;
+    }
+    
+    uint16_t activeId = _profileManager->getActiveProfileId();
+    DynamicJsonDocument payload(128);
+    payload["success"] = true;
+    payload["profiles"] = info.profileCount;
+    payload["activeProfileId"] = activeId;
+    sendResponse(requestId, payload);
+    
+    DynamicJsonDocument eventPayload(128);
+    eventPayload["profileId"] = activeId;
+    sendEvent("profileChanged", eventPayload);
+}
+
+void ProtocolHandler::handleSubscribeEvents(uint32_t requestId, const String& message, MessageEncoding encoding) {
+    if (!_telemetry) {
+        sendResponse(requestId, false, "Telemetry not available");
+        return;
+    }
+    
+    StaticJsonDocument<64> filter;
+    filter["input"] = true;
+    filter["intervalMs"] = true;
+    
+    StaticJsonDocument<128> doc;
+    DeserializationError error;
+    if (encoding == MESSAGE_ENCODING_MSGPACK) {
+        error = deserializeMsgPack(doc, message.c_str(), message.length(), DeserializationOption::Filter(filter));
+    } else {
+        error = deserializeJson(doc, message.c_str(), message.length(), DeserializationOption::Filter(filter));
+    }
+    if (error || !doc["input"].is<bool>()) {
+        sendResponse(requestId, false, "Missing input");
+        return;
+    }
+    
+    bool enable = doc["input"];
+    _telemetry->setEnabled(enable, doc["intervalMs"] | 0);
+    // The first event tells a new subscriber which profile is active
+    if (enable) {
+        _telemetry->recordProfile(_profileManager->getActiveProfileId());
+    }
+    
+    DynamicJsonDocument payload(128);
+    payload["success"] = true;
+    payload["input"] = enable;
+    payload["intervalMs"] = _telemetry->getIntervalMs();
+    sendResponse(requestId, payload);
+}
+
+void ProtocolHandler::flushTelemetry() {
+    if (!_telemetry || !_telemetry->isEnabled()) return;
+    
+    // Profile switches come from keys, the config client and previews alike
+    _telemetry->recordProfile(_profileManager->getActiveProfileId());
+    
+    // Under backpressure the items wait (encoder turns keep summing) rather
+    // than queueing behind, or ahead of, replies the client is waiting for
+    uint32_t now = millis();
+    if (!_telemetry->isDue(now) || !_bleService || !_bleService->isTransmitIdle()) return;
+    
+    DynamicJsonDocument payload(1536);
+    _telemetry->drain(payload, now);
+    sendEvent("input", payload);
+}
+
 void ProtocolHandler::sendResponse(uint32_t requestId, bool success, const String& error) {
     DynamicJsonDocument payload(128);
     payload["success"] = success;
@@ -457,11 +1289,124 @@ void ProtocolHandler::sendResponse(uint32_t requestId, bool success, const Strin
 }
 
 void ProtocolHandler::sendResponse(uint32_t requestId, const JsonDocument& payload) {
-    String message = createMessage("response", requestId, payload);
+    if (_batchResults) {
+        String encoded;
+        if (payload.overflowed() || !_encodePayload(payload, encoded)) {
+            DynamicJsonDocument error(128);
+            error["success"] = false;
+            error["error"] = "Reply too large";
+            encoded = "";
+            _encodePayload(error, encoded);
+        }
+        _addBatchResult(encoded);
+        return;
+    }
+    _sendEnvelope(requestId, payload, _encoding);
+}
+
+void ProtocolHandler::_addBatchResult(const String& payload) {
+    if (_batchCount < PROTOCOL_BATCH_MAX) {
+        _batchResults[_batchCount++] = payload;
+    }
+}
+
+void ProtocolHandler::_sendEnvelope(uint32_t requestId, const JsonDocument& payload, MessageEncoding encoding) {
+    DynamicJsonDocument doc(10240);
+    addResponseHeader(doc, requestId);
+    doc["payload"] = payload;
     
-    if (_bleService) {
+    // The heap ran out while the reply was built: an error rather than part of it
+    if (payload.overflowed() || doc.overflowed()) {
+        DEBUG_PRINTF("Reply to %u incomplete (out of memory)\n", (unsigned)requestId);
+        doc.clear();
+        addResponseHeader(doc, requestId);
+        JsonObject error = doc.createNestedObject("payload");
+        error["success"] = false;
+        error["error"] = "Reply too large";
+    }
+    
+    _sendMessage(doc, encoding);
+}
+
+bool ProtocolHandler::_isCacheHit(const CachedResponse& cache) const {
+    return cache.payload.length() > 0 && cache.encoding == _encoding &&
+           cache.generation == _profileManager->getManifestGeneration();
+}
+
+// Encode `payload` into `cache` and send it from there; a plain response if encoding fails
+void ProtocolHandler::_sendCacheable(uint32_t requestId, CachedResponse& cache, const JsonDocument& payload) {
+    cache.payload = "";
+    if (!_encodePayload(payload, cache.payload)) {
+        sendResponse(requestId, payload);
+        return;
+    }
+    cache.encoding = _encoding;
+    cache.generation = _profileManager->getManifestGeneration();
+    cache.builtAt = millis();
+    _sendEncodedResponse(requestId, cache.payload);
+}
+
+// `payload` in the current encoding, appended to `out`. False if nothing was written.
+bool ProtocolHandler::_encodePayload(const JsonDocument& payload, String& out) const {
+    size_t before = out.length();
+    if (_encoding == MESSAGE_ENCODING_JSON) {
+        serializeJson(payload, out);
+    } else {
+        // Binary may contain NUL bytes: serialize into a buffer, then copy by length
+        size_t length = measureMsgPack(payload);
+        uint8_t* buffer = (uint8_t*)malloc(length);
+        if (buffer) {
+            serializeMsgPack(payload, buffer, length);
+            out.concat((const char*)buffer, length);
+            free(buffer);
+        }
+    }
+    return out.length() > before;
+}
+
+// A response around an already encoded payload. Same envelope as sendResponse;
+// only id and ts are written per call.
+void ProtocolHandler::_sendEncodedResponse(uint32_t requestId, const String& payload) {
+    if (_batchResults) {
+        _addBatchResult(payload);
+        return;
+    }
+    if (!_bleService) return;
+    
+    if (_encoding == MESSAGE_ENCODING_JSON) {
+        char prefix[96];
+        size_t prefixLength = formatJsonEnvelope(prefix, sizeof(prefix), requestId);
+        String message;
+        message.reserve(prefixLength + payload.length() + 1);
+        message.concat(prefix, prefixLength);
+        message.concat(payload);
+        message.concat('}');
         _bleService->sendEvent(message);
+        return;
     }
+    
+    static const uint8_t MSGPACK_HEAD[] = {
+        0x85, 0xA1, 'v', 0x01, 0xA4, 't', 'y', 'p', 'e',
+        0xA8, 'r', 'e', 's', 'p', 'o', 'n', 's', 'e', 0xA2, 'i', 'd'
+    };
+    static const uint8_t MSGPACK_TS[] = {0xA2, 't', 's'};
+    static const uint8_t MSGPACK_PAYLOAD[] = {0xA7, 'p', 'a', 'y', 'l', 'o', 'a', 'd'};
+    size_t headerLength = sizeof(MSGPACK_HEAD) + 5 + sizeof(MSGPACK_TS) + 5 + sizeof(MSGPACK_PAYLOAD);
+    uint8_t* buffer = (uint8_t*)malloc(headerLength + payload.length());
+    if (!buffer) {
+        DEBUG_PRINTLN("ERROR: malloc failed for MessagePack message");
+        return;
+    }
+    uint8_t* out = buffer;
+    memcpy(out, MSGPACK_HEAD, sizeof(MSGPACK_HEAD));
+    out = writeMsgPackUint32(out + sizeof(MSGPACK_HEAD), requestId);
+    memcpy(out, MSGPACK_TS, sizeof(MSGPACK_TS));
+    out = writeMsgPackUint32(out + sizeof(MSGPACK_TS), millis() / 1000);
+    memcpy(out, MSGPACK_PAYLOAD, sizeof(MSGPACK_PAYLOAD));
+    out += sizeof(MSGPACK_PAYLOAD);
+    memcpy(out, payload.c_str(), payload.length());
+    _bleService->sendBinary(buffer, headerLength + payload.length());
+    free(buffer);
 }
 
 void ProtocolHandler::sendEvent(const String& eventName, const JsonDocument& payload) {
@@ -472,24 +1417,31 @@ void ProtocolHandler::sendEvent(const String& eventName, const JsonDocument& pay
     doc["ts"] = millis() / 1000;
     doc["payload"] = payload;
     
-    String message;
-    serializeJson(doc, message);
-    
-    if (_bleService) {
-        _bleService->sendEvent(message);
-    }
+    sendMessage(doc);
 }
 
-String ProtocolHandler::createMessage(const String& type, uint32_t id, const JsonDocument& payload) {
-    DynamicJsonDocument doc(10240);
-    doc["v"] = 1;
-    doc["type"] = type;
-    doc["id"] = id;
-    doc["ts"] = millis() / 1000;
-    doc["payload"] = payload;
+void ProtocolHandler::sendMessage(const JsonDocument& doc) {
+    _sendMessage(doc, _encoding);
+}
+
+void ProtocolHandler::_sendMessage(const JsonDocument& doc, MessageEncoding encoding) {
+    if (!_bleService) return;
     
-    String message;
-    serializeJson(doc, message);
+    if (encoding == MESSAGE_ENCODING_JSON) {
+        String message;
+        serializeJson(doc, message);
+        _bleService->sendEvent(message);
+        return;
+    }
     
-    return message;
+    // Binary: may contain NUL bytes, so it goes through a byte buffer, not a String
+    size_t length = measureMsgPack(doc);
+    uint8_t* buffer = (uint8_t*)malloc(length);
+    if (!buffer) {
+        DEBUG_PRINTLN("ERROR: malloc failed for MessagePack message");
+        return;
+    }
+    serializeMsgPack(doc, buffer, length);
+    _bleService->sendBinary(buffer, length);
+    free(buffer);
 }
@@ -3,26 +3,75 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <mutex>
+#include <utility>
 #include "config.h"
+#include "profile_json_reader.h"
 
 // Forward declarations
 class ProfileManager;
 class BLEConfigService;
+class PersistenceService;
+class InputTelemetry;
 
 class ProtocolHandler {
 public:
+    // Request commands. The value is the command's opcode: a client may send
+    // "op": <value> instead of "cmd": <name>. Append only.
+    enum Command : uint8_t {
+        CMD_UNKNOWN = 0,
+        CMD_GET_DEVICE_INFO,
+        CMD_GET_CAPS,
+        CMD_LIST_PROFILES,
+        CMD_GET_PROFILE,
+        CMD_SYNC_MANIFEST,
+        CMD_SET_PROFILE,
+        CMD_SET_KEY,
+        CMD_SET_ENCODER,
+        CMD_SET_NAME,
+        CMD_SET_ACTIVE_PROFILE,
+        CMD_GET_ACTIVE_PROFILE,
+        CMD_DELETE_PROFILE,
+        CMD_UNDO_PROFILE_EDIT,
+        CMD_PREVIEW_PROFILE,
+        CMD_COMMIT_PREVIEW,
+        CMD_DISCARD_PREVIEW,
+        CMD_GET_STATS,
+        CMD_GET_CONNECTION_STATUS,
+        CMD_FACTORY_RESET,
+        CMD_REBOOT,
+        CMD_BATCH,
+        CMD_EXPORT_ALL,
+        CMD_IMPORT_ALL,
+        CMD_SUBSCRIBE_EVENTS,
+        CMD_COUNT
+    };
+    
     ProtocolHandler();
     
     void init(ProfileManager* profileManager);
     void setBLEService(BLEConfigService* bleService);
     void setBLEKeyboard(class BLEKeyboard* bleKeyboard);
+    void setPersistence(PersistenceService* persistence);
+    void setTelemetry(InputTelemetry* telemetry);
     
-    // Handle incoming messages
-    void handleMessage(const String& json);
+    // Handle incoming messages, JSON or MessagePack. Called from the BLE task:
+    // only the envelope is parsed here and the request is queued (taking
+    // ownership, so a large setProfile is queued without a copy)
+    void handleMessage(String&& message);
     
-    // Process deferred (heavy) messages from main loop to avoid blocking BLE callback
+    // Run the next queued request from the main loop: queries first, then
+    // everything else in arrival order
     void processDeferred();
     
+    // Main-loop work: queued requests, then preview timeout/disconnect revert
+    void update();
+    // Send the subscribed client what the loop recorded this pass. Call after
+    // the HID reports are out; holds the items back while the link is busy.
+    void flushTelemetry();
+    // No room for another request (transport holds further requests back)
+    bool isRequestQueueFull() const;
+    
     // Send responses
     void sendResponse(uint32_t requestId, bool success, const String& error = "");
     void sendResponse(uint32_t requestId, const JsonDocument& payload);
@@ -34,32 +83,111 @@ private:
     ProfileManager* _profileManager;
     BLEConfigService* _bleService;
     class BLEKeyboard* _bleKeyboard;
+    PersistenceService* _persistence;
+    InputTelemetry* _telemetry;
     
     // Command handlers
     void handleGetDeviceInfo(uint32_t requestId);
-    void handleGetCaps(uint32_t requestId);
-    void handleListProfiles(uint32_t requestId);
-    void handleGetProfile(uint32_t requestId, uint8_t profileId);
-    void handleSetProfile(uint32_t requestId, const JsonDocument& doc);
-    void handleSetActiveProfile(uint32_t requestId, uint8_t profileId);
+    void handleGetCaps(uint32_t requestId, bool compression);
+    void handleListProfiles(uint32_t requestId, uint16_t cursor, uint16_t limit);
+    void handleGetProfile(uint32_t requestId, uint16_t profileId, uint32_t ifNoneMatch);
+    void handleSyncManifest(uint32_t requestId);
+    void handleSetProfile(uint32_t requestId, const String& message, MessageEncoding encoding);
+    void handlePatchProfile(uint32_t requestId, uint16_t profileId, ProfilePatchKind kind,
+                            const String& message, MessageEncoding encoding);
+    void handleSetActiveProfile(uint32_t requestId, uint16_t profileId);
     void handleGetActiveProfile(uint32_t requestId);
-    void handleDeleteProfile(uint32_t requestId, uint8_t profileId);
+    void handleDeleteProfile(uint32_t requestId, uint16_t profileId);
+    void handleUndoProfileEdit(uint32_t requestId, uint16_t profileId);
+    void handlePreviewProfile(uint32_t requestId, const String& message, MessageEncoding encoding);
+    void handleCommitPreview(uint32_t requestId);
+    void handleDiscardPreview(uint32_t requestId);
     void handleGetStats(uint32_t requestId);
     void handleFactoryReset(uint32_t requestId);
     void handleReboot(uint32_t requestId);
     void handleGetConnectionStatus(uint32_t requestId);
+    void handleBatch(uint32_t requestId, const String& message, MessageEncoding encoding);
+    void handleExportAll(uint32_t requestId);
+    void handleImportAll(uint32_t requestId, const String& message, MessageEncoding encoding);
+    void handleSubscribeEvents(uint32_t requestId, const String& message, MessageEncoding encoding);
+    
+    // Queries only read, so they may overtake writes; writes keep their order
+    enum RequestPriority : uint8_t {
+        REQUEST_PRIORITY_QUERY = 0,
+        REQUEST_PRIORITY_WRITE
+    };
+    
+    // Requests wait here for the main loop so the BLE callback returns quickly
+    // (avoids disconnects) and no handler runs concurrently with the loop
+    struct PendingRequest {
+        bool used;
+        Command command;
+        MessageEncoding encoding;
+        RequestPriority priority;
+        uint32_t order;           // Arrival counter, FIFO within a priority
+        uint32_t requestId;
+        uint16_t profileId;
+        uint16_t cursor;
+        uint16_t limit;
+        uint32_t ifNoneMatch;
+        bool compression;         // getCaps asked for "compression": "lzss"
+        String message;           // Kept only for commands that decode a body
+    };
+    PendingRequest _queue[PROTOCOL_QUEUE_DEPTH];
+    uint8_t _queueCount;
+    size_t _queueBytes;           // Message bytes held by queued requests
+    uint32_t _queueOrder;
+    mutable std::mutex _queueLock;  // Filled from the BLE task, drained by the loop
+    
+    // While a batch runs, responses are collected here (encoded, one per
+    // sub-request) instead of being sent
+    String* _batchResults;
+    uint8_t _batchCount;
+    void _addBatchResult(const String& payload);
+    
+    // Encoded payloads of replies that rarely change. A hit sends the stored
+    // bytes in a fresh envelope without building a document.
+    struct CachedResponse {
+        String payload;           // In `encoding`; empty until first built
+        MessageEncoding encoding;
+        uint32_t generation;      // Manifest generation it was built at
+        uint32_t builtAt;         // millis()
+        uint16_t framePayload;    // getCaps only
+    };
+    CachedResponse _deviceInfoCache;
+    CachedResponse _capsCache;
+    CachedResponse _profileListCache;   // First page, default limit
     
-    // Defer setProfile to main loop so BLE callback returns quickly (avoids disconnect)
-    String _deferredMessage;
-    bool _processingDeferred;
+    bool _isCacheHit(const CachedResponse& cache) const;
+    bool _encodePayload(const JsonDocument& payload, String& out) const;
+    void _sendCacheable(uint32_t requestId, CachedResponse& cache, const JsonDocument& payload);
+    void _sendEncodedResponse(uint32_t requestId, const String& payload);
+    void _sendCaps(uint32_t requestId, uint16_t framePayload);
+    
+    static void _readRequestFields(JsonVariantConst source, PendingRequest& request);
+    bool _enqueueRequest(PendingRequest& request);
+    void _runRequest(PendingRequest& request);
+    // Refusals sent from handleMessage, on the BLE task: in the request's own
+    // encoding, and never into a batch the loop may be collecting
+    void _sendRefusal(uint32_t requestId, const String& error, MessageEncoding encoding, bool busy = false);
+    void _sendBusy(uint32_t requestId);
+    
+    // An exportAll reply is being read from PROFILE_ARCHIVE_PATH; removed once sent
+    bool _archivePending;
+    bool _readArchive(String& out, uint32_t length);
+    
+    // BLE clients connected when the preview was last updated; fewer means its editor left
+    uint32_t _previewClientCount;
+    void checkPreviewExpiry();
+    
+    // Encoding of the latest request the loop ran; replies and events use it.
+    // Loop only: handleMessage passes the encoding along in PendingRequest.
+    MessageEncoding _encoding;
     
     // Helper
-    String createMessage(const String& type, uint32_t id, const JsonDocument& payload);
-
-public:
-    // Stats counters (updated from main loop)
-    uint32_t keyPressCount[12] = {0};
-    uint32_t encoderTurnCount[2] = {0};
+    void sendMessage(const JsonDocument& doc);
+    void _sendEnvelope(uint32_t requestId, const JsonDocument& payload, MessageEncoding encoding);
+    void _sendMessage(const JsonDocument& doc, MessageEncoding encoding);
 };
 
 #endif // PROTOCOL_HANDLER_H
@@ -0,0 +1,240 @@
+// Press-to-report micro-benchmark for ActionExecutor.
+//
+// "Before" is the per-press path the firmware used until the dispatch table:
+// processKeys() branches on action.type, execute() switches on it again and
+// media functions are mapped to usages on every press. "After" is the real
+// action_executor.cpp: an inline generation check, then a switch on the kind
+// each input was resolved to when the profile was bound.
+// Both end in the same BLEKeyboard stand-in, which only fills the report
+// buffer, so the numbers are the firmware-side cost of a press. Calls that
+// cross translation units on the device (the .ino into the executor, the
+// executor into ble_hid.cpp) are kept out of line here as well.
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+#include "action_executor.h"
+#include "builtin_profiles.h"
+#include "profile_text.h"
+
+// ---- BLEKeyboard stand-in: press and release land in the report buffers
+
+#define OUT_OF_LINE __attribute__((noinline))
+
+static uint8_t reportLog[64];
+static size_t reportCount = 0;
+
+static void logReport(const uint8_t* report, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        reportLog[(reportCount + i) & 63] ^= report[i];
+    }
+    reportCount++;
+}
+
+BLEKeyboard::BLEKeyboard() {
+    memset(_keyReport, 0, sizeof(_keyReport));
+    memset(_mouseReport, 0, sizeof(_mouseReport));
+}
+OUT_OF_LINE bool BLEKeyboard::isHidReady() const { return true; }
+OUT_OF_LINE void BLEKeyboard::sendKeyPress(uint8_t key, uint8_t modifiers) {
+    _keyReport[0] = modifiers;
+    _keyReport[2] = key;
+    logReport(_keyReport, 8);
+    memset(_keyReport, 0, sizeof(_keyReport));
+    logReport(_keyReport, 8);
+}
+OUT_OF_LINE void BLEKeyboard::sendText(const char* text) {
+    while (*text) sendKeyPress((uint8_t)*text++, 0);
+}
+OUT_OF_LINE void BLEKeyboard::sendMediaKey(uint16_t key) {
+    uint8_t report[2] = { (uint8_t)(key & 0xFF), (uint8_t)(key >> 8) };
+    logReport(report, 2);
+    report[0] = report[1] = 0;
+    logReport(report, 2);
+}
+OUT_OF_LINE void BLEKeyboard::sendMouseClick(uint8_t button) {
+    _mouseReport[0] = button;
+    logReport(_mouseReport, 4);
+    _mouseReport[0] = 0;
+    logReport(_mouseReport, 4);
+}
+OUT_OF_LINE void BLEKeyboard::sendMouseScroll(int8_t wheel) {
+    _mouseReport[3] = (uint8_t)wheel;
+    logReport(_mouseReport, 4);
+}
+
+namespace {
+
+// ---- Reference: the switch-based executor this replaced (text via the pool)
+
+class LegacyExecutor {
+public:
+    explicit LegacyExecutor(BLEKeyboard* keyboard) : _keyboard(keyboard) {}
+
+    OUT_OF_LINE void execute(const Profile& profile, const Action& action) {
+        if (!_keyboard || !_keyboard->isHidReady()) return;
+        switch (action.type) {
+            case ACTION_HOTKEY:
+                _keyboard->sendKeyPress(action.config.hotkey.key, action.config.hotkey.modifiers);
+                break;
+            case ACTION_TEXT:
+                _keyboard->sendText(profileText(action.config.text.textRef));
+                break;
+            case ACTION_MEDIA:
+                _executeMedia(action.config.media);
+                break;
+            case ACTION_MOUSE:
+                _executeMouse(action.config.mouse);
+                break;
+            default:
+                break;
+        }
+    }
+
+private:
+    BLEKeyboard* _keyboard;
+
+    void _executeMedia(const MediaConfig& config) {
+        uint16_t mediaKey = 0;
+        switch (config.function) {
+            case MEDIA_FUNC_VOLUME_UP: mediaKey = MEDIA_VOLUME_UP; break;
+            case MEDIA_FUNC_VOLUME_DOWN: mediaKey = MEDIA_VOLUME_DOWN; break;
+            case MEDIA_FUNC_MUTE: mediaKey = MEDIA_MUTE; break;
+            case MEDIA_FUNC_PLAY_PAUSE: mediaKey = MEDIA_PLAY_PAUSE; break;
+            case MEDIA_FUNC_NEXT: mediaKey = MEDIA_NEXT_TRACK; break;
+            case MEDIA_FUNC_PREV: mediaKey = MEDIA_PREV_TRACK; break;
+            case MEDIA_FUNC_STOP: mediaKey = MEDIA_STOP; break;
+        }
+        if (mediaKey != 0) _keyboard->sendMediaKey(mediaKey);
+    }
+
+    void _executeMouse(const MouseConfig& config) {
+        switch (config.action) {
+            case MOUSE_ACTION_CLICK: _keyboard->sendMouseClick(MOUSE_LEFT); break;
+            case MOUSE_ACTION_RIGHT_CLICK: _keyboard->sendMouseClick(MOUSE_RIGHT); break;
+            case MOUSE_ACTION_MIDDLE_CLICK: _keyboard->sendMouseClick(MOUSE_MIDDLE); break;
+            case MOUSE_ACTION_SCROLL_UP: _keyboard->sendMouseScroll(config.value); break;
+            case MOUSE_ACTION_SCROLL_DOWN: _keyboard->sendMouseScroll(-config.value); break;
+        }
+    }
+};
+
+const Action& slotAction(const Profile& profile, uint8_t slot) {
+    if (slot < MATRIX_KEYS) return profile.keys[slot].action;
+    const EncoderConfig& encoder = profile.encoders[(slot - MATRIX_KEYS) / 3];
+    switch ((slot - MATRIX_KEYS) % 3) {
+        case ENCODER_INPUT_CW: return encoder.cwAction;
+        case ENCODER_INPUT_CCW: return encoder.ccwAction;
+        default: return encoder.pressAction;
+    }
+}
+
+// Old processKeys()/processEncoders(): look at the action, then execute it
+void legacyPress(LegacyExecutor& executor, const Profile* current, uint8_t slot, volatile uint16_t& switchTo) {
+    const Action& action = slotAction(*current, slot);
+    if (action.type == ACTION_PROFILE) {
+        switchTo = action.config.profile.profileId;
+    } else if (action.type != ACTION_NONE) {
+        executor.execute(*current, action);
+    }
+}
+
+// Current processKeys()/processEncoders()
+void tablePress(ActionExecutor& executor, const Profile* current, uint32_t generation, uint8_t slot,
+                volatile uint16_t& switchTo) {
+    executor.bindProfile(*current, generation);
+    uint16_t target = executor.getProfileSwitch(slot);
+    if (target != PROFILE_ID_NONE) {
+        switchTo = target;
+    } else {
+        executor.dispatch(slot);
+    }
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double nsPerPress(Clock::time_point start, Clock::time_point end, size_t presses) {
+    return std::chrono::duration<double, std::nano>(end - start).count() / presses;
+}
+
+// Slots whose cost is the action itself (typed text), not dispatch, are left out
+std::vector<uint8_t> dispatchSlots(const Profile& profile) {
+    std::vector<uint8_t> slots;
+    for (uint8_t slot = 0; slot < DISPATCH_SLOT_COUNT; slot++) {
+        ActionType type = slotAction(profile, slot).type;
+        if (type != ACTION_TEXT && type != ACTION_MACRO) slots.push_back(slot);
+    }
+    return slots;
+}
+
+void run(const char* name, const Profile& profile) {
+    const size_t ROUNDS = 100000;
+    const int TRIALS = 7;  // Interleaved; the fastest trial of each path is reported
+    std::vector<uint8_t> slots = dispatchSlots(profile);
+    size_t presses = ROUNDS * slots.size();
+    volatile uint16_t switchTo = 0;
+    BLEKeyboard keyboard;
+    LegacyExecutor legacy(&keyboard);
+    ActionExecutor table;
+    table.init(&keyboard);
+
+    double before = 1e9;
+    double after = 1e9;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        Clock::time_point start = Clock::now();
+        for (size_t r = 0; r < ROUNDS; r++) {
+            for (uint8_t slot : slots) legacyPress(legacy, &profile, slot, switchTo);
+        }
+        before = std::min(before, nsPerPress(start, Clock::now(), presses));
+
+        start = Clock::now();
+        for (size_t r = 0; r < ROUNDS; r++) {
+            for (uint8_t slot : slots) tablePress(table, &profile, 1, slot, switchTo);
+        }
+        after = std::min(after, nsPerPress(start, Clock::now(), presses));
+    }
+
+    printf("%-12s %5zu inputs  before %6.1f ns  after %6.1f ns  (%+.0f%%)\n", name, slots.size(), before, after,
+           (after - before) / before * 100);
+}
+
+}  // namespace
+
+int main() {
+    printf("Press to report buffer, per press (host CPU, -O2)\n");
+    Profile* profile = new Profile;
+    for (uint8_t i = 0; i < getBuiltinProfileCount(); i++) {
+        expandBuiltinProfile(getBuiltinProfile(i), *profile);
+        run(profile->name, *profile);
+    }
+
+    // Every key and encoder input a different kind of action
+    memset(profile, 0, sizeof(Profile));
+    strlcpy(profile->name, "Mixed", sizeof(profile->name));
+    for (uint8_t slot = 0; slot < DISPATCH_SLOT_COUNT; slot++) {
+        Action& action = const_cast<Action&>(slotAction(*profile, slot));
+        switch (slot % 4) {
+            case 0:
+                action.type = ACTION_HOTKEY;
+                action.config.hotkey.modifiers = MODIFIER_LEFT_CTRL;
+                action.config.hotkey.key = KEY_A + slot;
+                break;
+            case 1:
+                action.type = ACTION_MEDIA;
+                action.config.media.function = static_cast<MediaFunction>(slot % 7);
+                break;
+            case 2:
+                action.type = ACTION_MOUSE;
+                action.config.mouse.action = static_cast<MouseAction>(slot % 5);
+                action.config.mouse.value = 3;
+                break;
+            default:
+                action.type = ACTION_NONE;
+                break;
+        }
+    }
+    run(profile->name, *profile);
+    delete profile;
+
+    printf("(%zu reports built)\n", reportCount);
+    return 0;
+}
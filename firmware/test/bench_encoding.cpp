@@ -0,0 +1,187 @@
+// setProfile as JSON vs MessagePack: message size and decode time on the
+// built-in profiles and the largest profile a Profile can hold. The
+// MessagePack form is transcoded from the stored JSON with the smallest
+// encodings, as ArduinoJson's serializeMsgPack writes them. Both decodes
+// must produce the same Profile, and every cut-short MessagePack message
+// must be refused.
+#include <Arduino.h>
+#include <chrono>
+#include "bench_profiles.h"
+#include "profile_json_reader.h"
+
+namespace {
+
+// ---- JSON to MessagePack, for the compact JSON the firmware writes
+
+class Transcoder {
+public:
+    explicit Transcoder(const std::string& json) : _json(json), _pos(0) {}
+
+    std::string run() {
+        _value();
+        return _out;
+    }
+
+private:
+    const std::string& _json;
+    size_t _pos;
+    std::string _out;
+
+    void _byte(uint8_t b) { _out += (char)b; }
+    void _be(uint32_t v, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) _byte((uint8_t)(v >> (8 * i)));
+    }
+    void _header(uint8_t fix, uint8_t fixMax, uint8_t b16, uint8_t b32, size_t n) {
+        if (n <= fixMax) _byte(fix | (uint8_t)n);
+        else if (n <= 0xFFFF) { _byte(b16); _be(n, 2); }
+        else { _byte(b32); _be(n, 4); }
+    }
+
+    void _value() {
+        char c = _json[_pos];
+        if (c == '{') _object();
+        else if (c == '[') _array();
+        else if (c == '"') _string();
+        else if (c == 't') { _byte(0xC3); _pos += 4; }
+        else if (c == 'f') { _byte(0xC2); _pos += 5; }
+        else if (c == 'n') { _byte(0xC0); _pos += 4; }
+        else _number();
+    }
+
+    // Items are counted first, since the header comes before them
+    size_t _count() {
+        size_t items = 0;
+        int depth = 0;
+        bool inString = false;
+        for (size_t i = _pos + 1; i < _json.size(); i++) {
+            char c = _json[i];
+            if (inString) {
+                if (c == '\\') i++;
+                else if (c == '"') inString = false;
+                continue;
+            }
+            if (depth == 0 && items == 0 && c != '}' && c != ']') items = 1;
+            if (c == '"') inString = true;
+            else if (c == '{' || c == '[') depth++;
+            else if (c == '}' || c == ']') {
+                if (depth-- == 0) break;
+            }
+            else if (c == ',' && depth == 0) items++;
+        }
+        return items;
+    }
+
+    void _object() {
+        _header(0x80, 15, 0xDE, 0xDF, _count());
+        _pos++;
+        while (_json[_pos] != '}') {
+            _string();
+            _pos++;  // ':'
+            _value();
+            if (_json[_pos] == ',') _pos++;
+        }
+        _pos++;
+    }
+
+    void _array() {
+        _header(0x90, 15, 0xDC, 0xDD, _count());
+        _pos++;
+        while (_json[_pos] != ']') {
+            _value();
+            if (_json[_pos] == ',') _pos++;
+        }
+        _pos++;
+    }
+
+    void _string() {
+        std::string s;
+        for (_pos++; _json[_pos] != '"'; _pos++) {
+            char c = _json[_pos];
+            if (c == '\\') {
+                c = _json[++_pos];
+                if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+                else if (c == 'r') c = '\r';
+            }
+            s += c;
+        }
+        _pos++;
+        if (s.size() <= 31) _byte(0xA0 | (uint8_t)s.size());
+        else if (s.size() <= 0xFF) { _byte(0xD9); _be(s.size(), 1); }
+        else { _byte(0xDA); _be(s.size(), 2); }
+        _out += s;
+    }
+
+    void _number() {
+        size_t end = _pos;
+        long long v = strtoll(_json.c_str() + _pos, nullptr, 10);
+        while (end < _json.size() && (isdigit((unsigned char)_json[end]) || _json[end] == '-')) end++;
+        _pos = end;
+        if (v >= 0 && v <= 0x7F) _byte((uint8_t)v);
+        else if (v >= 0 && v <= 0xFF) { _byte(0xCC); _be(v, 1); }
+        else if (v >= 0 && v <= 0xFFFF) { _byte(0xCD); _be(v, 2); }
+        else if (v >= 0) { _byte(0xCE); _be(v, 4); }
+        else if (v >= -32) _byte((uint8_t)(int8_t)v);
+        else if (v >= -128) { _byte(0xD0); _be((uint8_t)(int8_t)v, 1); }
+        else { _byte(0xD1); _be((uint16_t)(int16_t)v, 2); }
+    }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+template <typename Decode>
+double microsPerDecode(Decode decode) {
+    const int ROUNDS = 2000;
+    const int TRIALS = 5;  // The fastest trial is reported
+    double best = 1e12;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < ROUNDS; r++) decode();
+        best = std::min(best, std::chrono::duration<double, std::micro>(Clock::now() - start).count() / ROUNDS);
+    }
+    return best;
+}
+
+bool run(const BenchProfile& bench, Profile& fromJson, Profile& fromMsgPack) {
+    std::string json = "{\"id\":7,\"cmd\":\"setProfile\",\"profile\":" + bench.json + "}";
+    std::string msgpack = Transcoder(json).run();
+    const uint8_t* packed = (const uint8_t*)msgpack.data();
+
+    memset(&fromJson, 0, sizeof(Profile));
+    memset(&fromMsgPack, 0, sizeof(Profile));
+    if (decodeProfileJson(json.data(), json.size(), "profile", fromJson) != PROFILE_DECODE_OK ||
+        decodeProfileMsgPack(packed, msgpack.size(), "profile", fromMsgPack) != PROFILE_DECODE_OK) {
+        printf("%-10s decode failed\n", bench.name.c_str());
+        return false;
+    }
+    bool same = memcmp(&fromJson, &fromMsgPack, sizeof(Profile)) == 0;
+
+    size_t accepted = 0;
+    for (size_t cut = 0; cut < msgpack.size(); cut++) {
+        if (decodeProfileMsgPack(packed, cut, "profile", fromMsgPack) == PROFILE_DECODE_OK) accepted++;
+    }
+
+    double jsonTime = microsPerDecode([&] { decodeProfileJson(json.data(), json.size(), "profile", fromJson); });
+    double packTime = microsPerDecode([&] { decodeProfileMsgPack(packed, msgpack.size(), "profile", fromMsgPack); });
+
+    printf("%-10s json %6zu bytes %7.2f us   msgpack %6zu bytes (%3.0f%%) %7.2f us   %s, %zu cut messages accepted\n",
+           bench.name.c_str(), json.size(), jsonTime, msgpack.size(), 100.0 * msgpack.size() / json.size(), packTime,
+           same ? "same Profile" : "PROFILES DIFFER", accepted);
+    return same && accepted == 0;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<BenchProfile> profiles = benchProfiles();
+    Profile* fromJson = new Profile;
+    Profile* fromMsgPack = new Profile;
+    printf("setProfile message and decode, JSON vs MessagePack (host CPU, -O2)\n");
+    bool ok = true;
+    for (const BenchProfile& bench : profiles) {
+        ok = run(bench, *fromJson, *fromMsgPack) && ok;
+    }
+    delete fromJson;
+    delete fromMsgPack;
+    return ok ? 0 : 1;
+}
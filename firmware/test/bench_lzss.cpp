@@ -0,0 +1,127 @@
+// LZSS on getProfile replies: compressed size, compress time, and decode
+// throughput with the stream fed a frame (506 bytes) at a time, as the
+// transport does. Runs on the built-in profiles and the largest profile a
+// Profile can hold. The heap figure is the peak the compressor holds through
+// malloc (linked with --wrap=malloc); the decoder allocates nothing.
+#include <Arduino.h>
+#include <chrono>
+#include "bench_profiles.h"
+#include "lzss.h"
+
+static bool counting = false;
+static size_t allocations = 0;
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+// Blocks handed out while counting, so free() knows their size
+static struct {
+    void* block;
+    size_t size;
+} counted[16];
+
+extern "C" {
+void* __real_malloc(size_t size);
+void __real_free(void* block);
+
+void* __wrap_malloc(size_t size) {
+    void* block = __real_malloc(size);
+    if (!counting || !block) return block;
+    allocations++;
+    for (auto& entry : counted) {
+        if (!entry.block) {
+            entry.block = block;
+            entry.size = size;
+            liveBytes += size;
+            peakBytes = std::max(peakBytes, liveBytes);
+            break;
+        }
+    }
+    return block;
+}
+
+void __wrap_free(void* block) {
+    for (auto& entry : counted) {
+        if (block && entry.block == block) {
+            liveBytes -= entry.size;
+            entry.block = nullptr;
+        }
+    }
+    __real_free(block);
+}
+}
+
+namespace {
+
+const size_t FRAME_PAYLOAD = 512 - 6;
+
+typedef std::chrono::steady_clock Clock;
+
+template <typename Work>
+double microsPer(Work work) {
+    const int ROUNDS = 500;
+    const int TRIALS = 5;  // The fastest trial is reported
+    double best = 1e12;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < ROUNDS; r++) work();
+        best = std::min(best, std::chrono::duration<double, std::micro>(Clock::now() - start).count() / ROUNDS);
+    }
+    return best;
+}
+
+bool decodeFramed(const std::vector<uint8_t>& stream, std::vector<uint8_t>& out) {
+    LzssDecoder decoder;
+    decoder.begin(out.data(), out.size());
+    for (size_t offset = LZSS_HEADER_SIZE; offset < stream.size(); offset += FRAME_PAYLOAD) {
+        size_t length = std::min(FRAME_PAYLOAD, stream.size() - offset);
+        if (!decoder.feed(stream.data() + offset, length)) return false;
+    }
+    return decoder.finished();
+}
+
+bool run(const BenchProfile& bench) {
+    std::string reply = "{\"v\":1,\"type\":\"response\",\"id\":7,\"ts\":120,\"payload\":" + bench.json + "}";
+    const uint8_t* in = (const uint8_t*)reply.data();
+    std::vector<uint8_t> stream(reply.size() + LZSS_HEADER_SIZE);
+
+    counting = true;
+    peakBytes = 0;
+    size_t compressed = lzssCompress(in, reply.size(), stream.data(), stream.size());
+    counting = false;
+    if (compressed == 0) {
+        printf("%-10s %6zu bytes  does not compress\n", bench.name.c_str(), reply.size());
+        return false;
+    }
+    stream.resize(compressed);
+    size_t compressPeak = peakBytes;
+
+    std::vector<uint8_t> out(lzssOriginalLength(stream.data()));
+    counting = true;
+    allocations = 0;
+    bool intact = decodeFramed(stream, out) && out.size() == reply.size() && memcmp(out.data(), in, out.size()) == 0;
+    counting = false;
+    size_t decodeAllocations = allocations;
+
+    std::vector<uint8_t> scratch(stream.size() + 64);
+    double compressTime = microsPer([&] { lzssCompress(in, reply.size(), scratch.data(), scratch.size()); });
+    double decodeTime = microsPer([&] { decodeFramed(stream, out); });
+
+    printf("%-10s %6zu -> %6zu bytes (%5.2fx)  compress %7.1f us, heap %zu bytes  "
+           "decode %6.1f us (%5.0f MB/s), %zu allocations  %s\n",
+           bench.name.c_str(), reply.size(), compressed, (double)reply.size() / compressed, compressTime,
+           compressPeak, decodeTime, reply.size() / decodeTime, decodeAllocations,
+           intact ? "round trip ok" : "ROUND TRIP FAILED");
+    return intact;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<BenchProfile> profiles = benchProfiles();
+    printf("LZSS on getProfile replies, decoded %zu bytes per feed (host CPU, -O2)\n", FRAME_PAYLOAD);
+    bool ok = true;
+    for (const BenchProfile& bench : profiles) {
+        ok = run(bench) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+// Cost of decoding a setProfile upload with profile_json_reader: time per
+// decode and heap taken while decoding, on the built-in profiles and on the
+// largest profile a Profile can hold. The heap count covers operator new,
+// which is all the host String and the containers here allocate with; the
+// decoder itself calls neither new nor malloc. Text goes to the text pool,
+// whose blocks are shown as pool bytes.
+#include <Arduino.h>
+#include <chrono>
+#include <new>
+#include "bench_profiles.h"
+#include "profile_json_reader.h"
+#include "profile_text.h"
+
+static bool counting = false;
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+static void* countedAlloc(size_t size) {
+    if (counting) {
+        allocations++;
+        allocatedBytes += size;
+    }
+    void* block = malloc(size ? size : 1);
+    if (!block) throw std::bad_alloc();
+    return block;
+}
+
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* block) noexcept { free(block); }
+void operator delete[](void* block) noexcept { free(block); }
+void operator delete(void* block, size_t) noexcept { free(block); }
+void operator delete[](void* block, size_t) noexcept { free(block); }
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+void run(const BenchProfile& bench, Profile& profile) {
+    const int ROUNDS = 2000;
+    const int TRIALS = 5;  // The fastest trial is reported
+    std::string request = "{\"id\":7,\"cmd\":\"setProfile\",\"profile\":" + bench.json + "}";
+    profileTextCollect(nullptr, 0);  // Only this profile's text in the pool
+
+    counting = true;
+    ProfileDecodeResult result = decodeProfileJson(request.data(), request.size(), "profile", profile);
+    counting = false;
+    if (result != PROFILE_DECODE_OK) {
+        printf("%-10s decode failed: %s\n", bench.name.c_str(), profileDecodeError(result));
+        return;
+    }
+
+    double best = 1e12;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < ROUNDS; r++) {
+            decodeProfileJson(request.data(), request.size(), "profile", profile);
+        }
+        best = std::min(best, std::chrono::duration<double, std::micro>(Clock::now() - start).count() / ROUNDS);
+    }
+
+    printf("%-10s %7zu bytes  %8.2f us  %5.1f MB/s  heap %zu allocations, %zu bytes  pool %zu bytes\n",
+           bench.name.c_str(), request.size(), best, request.size() / best, allocations, allocatedBytes,
+           profileTextBytes());
+    allocations = 0;
+    allocatedBytes = 0;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<BenchProfile> profiles = benchProfiles();
+    Profile* profile = new Profile;
+    printf("setProfile decode into the work Profile (%zu bytes), host CPU, -O2\n", sizeof(Profile));
+    for (const BenchProfile& bench : profiles) {
+        run(bench, *profile);
+    }
+    delete profile;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "bench_profiles.h"
+#include <LittleFS.h>
+#include "builtin_profiles.h"
+#include "profile_storage.h"
+#include "profile_text.h"
+
+namespace {
+
+void fillMacro(Action& action, unsigned input) {
+    action.type = ACTION_MACRO;
+    action.config.macro.stepCount = MAX_MACRO_STEPS;
+    for (unsigned s = 0; s < MAX_MACRO_STEPS; s++) {
+        MacroStepConfig& step = action.config.macro.steps[s];
+        unsigned n = input * MAX_MACRO_STEPS + s;
+        step.stepType = 1 + n % 4;
+        step.delayMs = 250 + n;
+        step.key = 0x04 + n % 26;
+        step.modifiers = n % 16;
+        step.mediaFunction = n % 7;
+        // 64 distinct full-length texts, so no two inputs are identical
+        char text[MACRO_TEXT_MAX_LENGTH + 1];
+        snprintf(text, sizeof(text), "step %03u of a long macro text..", n % 64);
+        profileInternText(text, MACRO_TEXT_MAX_LENGTH, step.textRef);
+    }
+}
+
+std::string storedJson(ProfileStorage& storage, const Profile& profile) {
+    String path;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    if (!storage.saveProfile(profile) || !storage.getStoredProfileBody(profile.id, path, offset, length)) {
+        fprintf(stderr, "could not store profile %u\n", profile.id);
+        abort();
+    }
+    File file = LittleFS.open(path.c_str(), "r");
+    std::string json(length, '\0');
+    file.seek(offset);
+    file.read((uint8_t*)&json[0], length);
+    return json;
+}
+
+}  // namespace
+
+void buildMaximalProfile(Profile& profile) {
+    memset(&profile, 0, sizeof(Profile));
+    profile.id = 99;
+    profile.version = 1;
+    strlcpy(profile.name, "Maximal profile name", sizeof(profile.name));
+    unsigned input = 0;
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        fillMacro(profile.keys[i].action, input++);
+    }
+    for (uint8_t e = 0; e < 2; e++) {
+        fillMacro(profile.encoders[e].cwAction, input++);
+        fillMacro(profile.encoders[e].ccwAction, input++);
+        fillMacro(profile.encoders[e].pressAction, input++);
+        profile.encoders[e].acceleration = true;
+        profile.encoders[e].stepsPerDetent = 4;
+    }
+}
+
+std::vector<BenchProfile> benchProfiles() {
+    hostFsFormat();
+    ProfileStorage storage;
+    storage.init();
+
+    std::vector<BenchProfile> profiles;
+    Profile* profile = new Profile;
+    for (uint8_t i = 0; i < getBuiltinProfileCount(); i++) {
+        expandBuiltinProfile(getBuiltinProfile(i), *profile);
+        profiles.push_back({ profile->name, storedJson(storage, *profile) });
+    }
+    buildMaximalProfile(*profile);
+    profiles.push_back({ "Maximal", storedJson(storage, *profile) });
+    delete profile;
+    return profiles;
+}
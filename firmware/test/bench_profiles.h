@@ -0,0 +1,22 @@
+// Profiles the measurement tools run on, as the firmware stores and sends them
+#ifndef BENCH_PROFILES_H
+#define BENCH_PROFILES_H
+
+#include <string>
+#include <vector>
+#include "profile.h"
+
+struct BenchProfile {
+    std::string name;
+    std::string json;  // Stored slot body, which is also what getProfile sends
+};
+
+// The shipped built-in profiles, then the largest profile a Profile can hold:
+// every input a macro of MAX_MACRO_STEPS steps, each with a full-length text.
+// Formats a fresh host flash to produce them.
+std::vector<BenchProfile> benchProfiles();
+
+// Fill `profile` with that largest profile
+void buildMaximalProfile(Profile& profile);
+
+#endif // BENCH_PROFILES_H
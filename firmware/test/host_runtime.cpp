@@ -0,0 +1,131 @@
+// Definitions behind the host stubs: the in-memory filesystem, the BLE peer,
+// the clock and the few ESP-IDF helpers the firmware modules call.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <NimBLEDevice.h>
+#include <Preferences.h>
+#include <mbedtls/base64.h>
+#include <chrono>
+
+HardwareSerial Serial;
+EspClass ESP;
+LittleFSFS LittleFS;
+
+namespace fs {
+HostFsState& hostFs() {
+    static HostFsState state;
+    static bool formatted = false;
+    if (!formatted) {
+        formatted = true;
+        state.dirs.insert("/");
+    }
+    return state;
+}
+}
+
+HostBleState& hostBle() {
+    static HostBleState state;
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+        state.connected = 1;
+        state.connHandle = 1;
+        state.mtu = 23;
+        state.notify = nullptr;
+    }
+    return state;
+}
+
+void hostBleReset() {
+    HostBleState& ble = hostBle();
+    ble.server.clear();
+    ble.connected = 1;
+    ble.connHandle = 1;
+    ble.mtu = 23;
+}
+
+bool hostBleWrite(const char* uuid, const uint8_t* data, size_t length) {
+    HostBleState& ble = hostBle();
+    for (NimBLEService* service : ble.server.services()) {
+        for (NimBLECharacteristic* characteristic : service->characteristics()) {
+            if (characteristic->uuid() != uuid) continue;
+            characteristic->setValue(data, length);
+            NimBLEConnInfo connInfo(ble.connHandle, ble.mtu);
+            if (characteristic->callbacks()) characteristic->callbacks()->onWrite(characteristic, connInfo);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NimBLECharacteristic::notify(const uint8_t* data, size_t length, uint16_t connHandle) const {
+    HostBleState& ble = hostBle();
+    if (!ble.connected || length > (size_t)ble.mtu - 3) return false;
+    return ble.notify ? ble.notify(data, length) : true;
+}
+
+uint32_t NimBLEServer::getConnectedCount() {
+    return hostBle().connected;
+}
+
+std::vector<uint16_t> NimBLEServer::getPeerDevices() const {
+    return std::vector<uint16_t>(hostBle().connected, hostBle().connHandle);
+}
+
+NimBLEServer* NimBLEDevice::getServer() {
+    return &hostBle().server;
+}
+
+static uint64_t hostClock = 0;
+
+uint64_t hostNowMicros() { return hostClock; }
+void hostAdvanceMicros(uint64_t us) { hostClock += us; }
+
+uint32_t EspClass::getCycleCount() {
+    using namespace std::chrono;
+    return (uint32_t)(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() * 240 / 1000);
+}
+
+void EspClass::restart() {
+    fprintf(stderr, "ESP.restart() called on host\n");
+    abort();
+}
+
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen) {
+    size_t need = (slen + 2) / 3 * 4;
+    *olen = need + 1;
+    if (!dst || dlen < need + 1) return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    size_t n = 0;
+    for (size_t i = 0; i < slen; i += 3) {
+        uint32_t v = src[i] << 16 | (i + 1 < slen ? src[i + 1] << 8 : 0) | (i + 2 < slen ? src[i + 2] : 0);
+        dst[n++] = BASE64_ALPHABET[(v >> 18) & 63];
+        dst[n++] = BASE64_ALPHABET[(v >> 12) & 63];
+        dst[n++] = i + 1 < slen ? BASE64_ALPHABET[(v >> 6) & 63] : '=';
+        dst[n++] = i + 2 < slen ? BASE64_ALPHABET[v & 63] : '=';
+    }
+    dst[n] = 0;
+    *olen = n;
+    return 0;
+}
+
+int mbedtls_base64_decode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen) {
+    uint32_t v = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < slen; i++) {
+        if (src[i] == '=') break;
+        const char* at = strchr(BASE64_ALPHABET, src[i]);
+        if (!at || !src[i]) return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+        v = v << 6 | (uint32_t)(at - BASE64_ALPHABET);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (dst && n < dlen) dst[n] = (uint8_t)(v >> bits);
+            n++;
+        }
+    }
+    *olen = n;
+    return !dst || n > dlen ? MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL : 0;
+}
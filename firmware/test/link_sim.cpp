@@ -0,0 +1,342 @@
+// Framed transport over a simulated BLE link. The real ble_config.cpp runs
+// against a peer that speaks the same frame protocol (PROTOCOL_SPEC.md,
+// "Binary frames"). Each run uploads a message and times the device's reply,
+// across ATT MTU, connection interval and packet loss.
+//
+// Link model: once per connection interval, up to PACKETS_PER_EVENT queued
+// packets cross in each direction, each lost with the given probability. The
+// device may hold NOTIFY_BUFFERS notifications not yet sent; notify() fails
+// beyond that, as NimBLE does when its mbufs run out. The device loop, which
+// calls BLEConfigService::update(), runs every 0.5 ms.
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include "ble_config.h"
+#include "protocol_handler.h"
+
+namespace {
+
+const int PACKETS_PER_EVENT = 6;
+const size_t NOTIFY_BUFFERS = 12;
+const uint64_t LOOP_STEP_US = 500;
+const double PROCESSING_MS = 20;     // Device time between taking the upload and replying
+const double GIVE_UP_MS = 120000;
+
+// Frame layout and flags, as in ble_config.cpp
+const uint8_t FRAME_MARKER = 0xC1;
+const uint8_t FLAG_FIRST = 0x01;
+const uint8_t FLAG_LAST = 0x02;
+const uint8_t FLAG_ACK = 0x04;
+const size_t HEADER = 6;
+const uint16_t CLIENT_WINDOW = 8;
+
+double nowMs() { return hostNowMicros() / 1000.0; }
+
+struct Air {
+    std::deque<std::string> toDevice;
+    std::deque<std::string> toClient;
+    double loss;
+    std::mt19937 random;
+
+    bool lost() { return std::uniform_real_distribution<double>(0, 1)(random) < loss; }
+};
+
+Air air;
+
+bool notifyToAir(const uint8_t* data, size_t length) {
+    if (air.toClient.size() >= NOTIFY_BUFFERS) return false;
+    air.toClient.push_back(std::string((const char*)data, length));
+    return true;
+}
+
+std::string frame(uint8_t flags, uint16_t sequence, const std::string& payload) {
+    std::string out;
+    out += (char)FRAME_MARKER;
+    out += (char)flags;
+    out += (char)(sequence & 0xFF);
+    out += (char)(sequence >> 8);
+    out += (char)(payload.size() & 0xFF);
+    out += (char)(payload.size() >> 8);
+    return out + payload;
+}
+
+// ---- The app: same protocol, same rules as the device
+
+class Client {
+public:
+    explicit Client(uint16_t mtu) : _payload(std::min<int>(mtu - 3, 512) - HEADER) {}
+
+    std::string received;
+    double receivedAt = -1;
+
+    void send(const std::string& message) {
+        _tx = message;
+        _txFrames = (message.size() + _payload - 1) / _payload;
+        _txBase = _txNext;
+    }
+
+    // Packets for the air, produced since the last call
+    std::deque<std::string> writes;
+
+    void onNotify(const std::string& packet) {
+        uint8_t flags = packet[1];
+        uint16_t sequence = (uint8_t)packet[2] | ((uint8_t)packet[3] << 8);
+        std::string payload = packet.substr(HEADER);
+        if (flags & FLAG_ACK) {
+            _onAck(sequence, payload);
+            return;
+        }
+
+        int16_t ahead = (int16_t)(sequence - _rxNext);
+        if (ahead < 0 || ahead >= CLIENT_WINDOW) {
+            _sendAck();
+            return;
+        }
+        if (ahead > 0) {
+            _rxWaiting[sequence] = std::string(1, (char)flags) + payload;
+            _sendAck();
+            return;
+        }
+        bool delivered = flags & FLAG_LAST;
+        _lastFrameAt = nowMs();
+        _accept(flags, payload);
+        _rxNext++;
+        while (_rxWaiting.count(_rxNext)) {
+            std::string waiting = _rxWaiting[_rxNext];
+            _rxWaiting.erase(_rxNext);
+            delivered |= waiting[0] & FLAG_LAST;
+            _accept(waiting[0], waiting.substr(1));
+            _rxNext++;
+        }
+        if (delivered || ++_sinceAck >= CLIENT_WINDOW / 2) _sendAck();
+    }
+
+    void pump() {
+        if (_sinceAck > 0 && nowMs() - _lastFrameAt >= 5) _sendAck();
+        if (_txFrames == 0) return;
+        if ((uint16_t)(_acked - _txBase) >= _txFrames) {
+            _txFrames = 0;
+            return;
+        }
+
+        // SACK holes at once, anything else once its RTO has passed
+        int highestSacked = 0;
+        for (int bit = 0; bit < 32; bit++) {
+            if (_sacked & (1u << bit)) highestSacked = bit + 1;
+        }
+        bool timedOut = false;
+        for (uint16_t i = 0; i < (uint16_t)(_txNext - _acked); i++) {
+            if (i > 0 && (_sacked & (1u << (i - 1)))) continue;
+            uint16_t sequence = _acked + i;
+            bool hole = i < highestSacked && !_retransmitted[sequence];
+            bool expired = nowMs() - _sentAt[sequence] > _rtoMs;
+            if (!hole && !expired) continue;
+            _sendData(sequence);
+            _retransmitted[sequence] = true;
+            timedOut |= expired;
+        }
+        if (timedOut) {
+            _congestionWindow = std::max(1, _congestionWindow / 2);
+            _rtoMs = std::min(_rtoMs * 2, 2000.0);
+        }
+
+        while ((uint16_t)(_txNext - _acked) < std::min<int>(_congestionWindow, _peerWindow) &&
+               (uint16_t)(_txNext - _txBase) < _txFrames) {
+            _retransmitted[_txNext] = false;
+            _sendData(_txNext++);
+        }
+    }
+
+private:
+    int _payload;
+
+    // Receiver
+    uint16_t _rxNext = 0;
+    std::map<uint16_t, std::string> _rxWaiting;
+    std::string _message;
+    bool _assembling = false;
+    int _sinceAck = 0;
+    double _lastFrameAt = 0;
+
+    // Sender
+    std::string _tx;
+    uint16_t _txFrames = 0;
+    uint16_t _txBase = 0;
+    uint16_t _txNext = 0;
+    uint16_t _acked = 0;
+    uint32_t _sacked = 0;
+    uint16_t _peerWindow = CLIENT_WINDOW;
+    int _congestionWindow = 2;
+    double _srttMs = 100;
+    double _rtoMs = 300;
+    std::map<uint16_t, double> _sentAt;
+    std::map<uint16_t, bool> _retransmitted;
+
+    void _accept(uint8_t flags, const std::string& payload) {
+        if (flags & FLAG_FIRST) {
+            _message.clear();
+            _assembling = true;
+        } else if (!_assembling) {
+            return;
+        }
+        _message += payload;
+        if (flags & FLAG_LAST) {
+            received = _message;
+            receivedAt = nowMs();
+            _assembling = false;
+        }
+    }
+
+    void _sendAck() {
+        uint32_t sack = 0;
+        for (int i = 1; i < CLIENT_WINDOW; i++) {
+            if (_rxWaiting.count((uint16_t)(_rxNext + i))) sack |= 1u << (i - 1);
+        }
+        std::string payload(6, '\0');
+        payload[0] = (char)CLIENT_WINDOW;
+        for (int i = 0; i < 4; i++) payload[2 + i] = (char)(sack >> (8 * i));
+        writes.push_back(frame(FLAG_ACK, _rxNext, payload));
+        _sinceAck = 0;
+    }
+
+    void _onAck(uint16_t ack, const std::string& payload) {
+        uint16_t advance = ack - _acked;
+        if (advance > (uint16_t)(_txNext - _acked)) return;  // Stale
+        _peerWindow = (uint8_t)payload[0] | ((uint8_t)payload[1] << 8);
+        _sacked = 0;
+        for (int i = 0; i < 4; i++) _sacked |= (uint32_t)(uint8_t)payload[2 + i] << (8 * i);
+        if (advance == 0) return;
+        uint16_t newest = ack - 1;
+        if (!_retransmitted[newest]) {
+            _srttMs = (7 * _srttMs + (nowMs() - _sentAt[newest])) / 8;
+            _rtoMs = std::max(40.0, std::min(2000.0, 2 * _srttMs));
+        }
+        _acked = ack;
+        if (_congestionWindow < 16) _congestionWindow++;
+    }
+
+    void _sendData(uint16_t sequence) {
+        int index = sequence - _txBase;
+        uint8_t flags = (index == 0 ? FLAG_FIRST : 0) | (index == _txFrames - 1 ? FLAG_LAST : 0);
+        writes.push_back(frame(flags, sequence, _tx.substr(index * _payload, _payload)));
+        _sentAt[sequence] = nowMs();
+    }
+};
+
+// ---- The device's protocol handler: takes the upload, replies after a while
+
+std::string deviceReceived;
+double deviceReceivedAt = -1;
+
+}  // namespace
+
+ProtocolHandler::ProtocolHandler() {}
+
+void ProtocolHandler::handleMessage(String&& message) {
+    deviceReceived.assign(message.c_str(), message.length());
+    deviceReceivedAt = nowMs();
+}
+
+bool ProtocolHandler::isRequestQueueFull() const {
+    return deviceReceivedAt >= 0 && nowMs() < deviceReceivedAt + PROCESSING_MS;
+}
+
+namespace {
+
+struct Result {
+    double uploadMs;
+    double replyMs;
+    bool intact;
+};
+
+Result run(uint16_t mtu, double intervalMs, double loss, const std::string& upload, const std::string& reply) {
+    hostBleReset();
+    hostBle().mtu = mtu;
+    hostBle().notify = notifyToAir;
+    air.toDevice.clear();
+    air.toClient.clear();
+    air.loss = loss;
+    air.random.seed(7);
+    deviceReceived.clear();
+    deviceReceivedAt = -1;
+    double start = nowMs();
+
+    ProtocolHandler handler;
+    BLEConfigService service;
+    service.begin(&handler);
+    Client client(mtu);
+    client.send(upload);
+
+    bool replied = false;
+    double replyStart = 0;
+    double nextEvent = start + intervalMs;
+    while (client.receivedAt < 0 && nowMs() - start < GIVE_UP_MS) {
+        client.pump();
+        while (!client.writes.empty()) {
+            air.toDevice.push_back(client.writes.front());
+            client.writes.pop_front();
+        }
+        if (nowMs() >= nextEvent) {
+            nextEvent += intervalMs;
+            for (int i = 0; i < PACKETS_PER_EVENT && !air.toDevice.empty(); i++) {
+                std::string packet = air.toDevice.front();
+                air.toDevice.pop_front();
+                if (!air.lost()) hostBleWrite(CMD_CHAR_UUID, (const uint8_t*)packet.data(), packet.size());
+            }
+            for (int i = 0; i < PACKETS_PER_EVENT && !air.toClient.empty(); i++) {
+                std::string packet = air.toClient.front();
+                air.toClient.pop_front();
+                if (!air.lost()) client.onNotify(packet);
+            }
+        }
+
+        // The device loop
+        if (!replied && deviceReceivedAt >= 0 && nowMs() >= deviceReceivedAt + PROCESSING_MS) {
+            replied = true;
+            replyStart = nowMs();
+            service.sendEvent(String(reply.c_str()));
+        }
+        service.update();
+        hostAdvanceMicros(LOOP_STEP_US);
+    }
+
+    Result result;
+    result.uploadMs = deviceReceivedAt - start;
+    result.replyMs = client.receivedAt - replyStart;
+    result.intact = deviceReceived == upload && client.received == reply;
+    return result;
+}
+
+}  // namespace
+
+int main() {
+    // About 6 KB each way, like a profile upload and a reply that echoes it
+    std::string upload = "{\"cmd\":\"setProfile\",\"keys\":[";
+    for (int i = 0; i < 200; i++) {
+        upload += "{\"type\":1,\"modifiers\":" + std::to_string(i % 9) + ",\"key\":" + std::to_string(i) + "},";
+    }
+    upload += "{}]}";
+    std::string reply = upload;
+    reply.replace(0, 19, "{\"event\":\"profile\"");
+
+    const uint16_t mtus[] = { 23, 185, 247, 517 };
+    const double intervals[] = { 7.5, 15, 30 };
+    const double losses[] = { 0, 0.01, 0.05, 0.2 };
+    printf("Framed transfer of %zu bytes up, %zu back (%d packets per event each way)\n", upload.size(),
+           reply.size(), PACKETS_PER_EVENT);
+    printf("%5s %6s %6s  %10s %10s\n", "MTU", "CI ms", "loss", "upload s", "reply s");
+    bool ok = true;
+    for (uint16_t mtu : mtus) {
+        for (double interval : intervals) {
+            for (double loss : losses) {
+                Result result = run(mtu, interval, loss, upload, reply);
+                printf("%5u %6.1f %5.0f%%  %10.3f %10.3f  %s\n", mtu, interval, loss * 100, result.uploadMs / 1000,
+                       result.replyMs / 1000, result.intact ? "" : "INCOMPLETE OR CORRUPT");
+                ok &= result.intact;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
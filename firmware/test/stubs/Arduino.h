@@ -0,0 +1,185 @@
+// Host stand-in for the parts of the Arduino core the firmware modules use.
+// Only what the host tests and tools compile is here; it is not a port.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define ESP32 1
+#define IRAM_ATTR
+#define PROGMEM
+#define DEC 10
+#define HEX 16
+
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class String {
+public:
+    String() {}
+    String(const char* s) : _s(s ? s : "") {}
+    String(const char* s, size_t n) : _s(s, n) {}
+    String(const String& other) : _s(other._s) {}
+    String(String&& other) : _s(std::move(other._s)) { other._s.clear(); }
+    explicit String(char c) : _s(1, c) {}
+    explicit String(int v) : _s(std::to_string(v)) {}
+    explicit String(unsigned int v) : _s(std::to_string(v)) {}
+    explicit String(long v) : _s(std::to_string(v)) {}
+    explicit String(unsigned long v) : _s(std::to_string(v)) {}
+    String(unsigned long v, int base) {
+        char text[40];
+        snprintf(text, sizeof(text), base == 16 ? "%lx" : "%lu", v);
+        _s = text;
+    }
+    String(unsigned int v, int base) : String((unsigned long)v, base) {}
+
+    String& operator=(const String& other) { _s = other._s; return *this; }
+    String& operator=(String&& other) { _s = std::move(other._s); other._s.clear(); return *this; }
+    String& operator=(const char* s) { _s = s ? s : ""; return *this; }
+
+    String& operator+=(const String& other) { _s += other._s; return *this; }
+    String& operator+=(const char* s) { _s += s; return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+    friend String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+    friend String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+    friend String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+    bool operator==(const String& other) const { return _s == other._s; }
+    bool operator==(const char* s) const { return _s == s; }
+    bool operator!=(const String& other) const { return _s != other._s; }
+    bool operator!=(const char* s) const { return _s != s; }
+
+    unsigned int length() const { return _s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    const char* c_str() const { return _s.c_str(); }
+    char* begin() { return &_s[0]; }
+    char* end() { return &_s[0] + _s.size(); }
+    char charAt(unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char& operator[](unsigned int i) { return _s[i]; }
+    bool reserve(unsigned int size) { _s.reserve(size); return true; }
+    bool concat(const char* s, unsigned int n) { _s.append(s, n); return true; }
+    bool concat(const String& other) { _s += other._s; return true; }
+    bool concat(const char* s) { _s += s; return true; }
+    bool concat(char c) { _s += c; return true; }
+    void remove(unsigned int index) { if (index < _s.size()) _s.resize(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+    void clear() { _s.clear(); }
+    bool startsWith(const char* prefix) const { return _s.compare(0, strlen(prefix), prefix) == 0; }
+    int indexOf(char c, unsigned int from = 0) const { return _find(_s.find(c, from)); }
+    int indexOf(const char* s, unsigned int from = 0) const { return _find(_s.find(s, from)); }
+    int indexOf(const String& s, unsigned int from = 0) const { return _find(_s.find(s._s, from)); }
+    int lastIndexOf(char c) const { return _find(_s.rfind(c)); }
+    int lastIndexOf(const char* s) const { return _find(_s.rfind(s)); }
+    String substring(unsigned int from, unsigned int to) const {
+        from = std::min<size_t>(from, _s.size());
+        to = std::min<size_t>(std::max(from, to), _s.size());
+        return String(_s.data() + from, to - from);
+    }
+    String substring(unsigned int from) const { return substring(from, _s.size()); }
+    long toInt() const { return atol(_s.c_str()); }
+
+private:
+    std::string _s;
+
+    static int _find(size_t position) { return position == std::string::npos ? -1 : (int)position; }
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buffer++)) n++;
+        return n;
+    }
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t println(const char* s = "") { return print(s) + write("\n"); }
+    size_t println(const String& s) { return println(s.c_str()); }
+    size_t println(int v) { return print(v) + write("\n"); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        return n > 0 ? write((const uint8_t*)buffer, std::min((size_t)n, sizeof(buffer) - 1)) : 0;
+    }
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// Serial output is dropped unless a test turns it on
+class HardwareSerial : public Stream {
+public:
+    bool echo = false;
+    void begin(unsigned long) {}
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t c) override { if (echo) fputc(c, stdout); return 1; }
+    using Print::write;
+};
+extern HardwareSerial Serial;
+
+struct EspClass {
+    uint32_t getFreeHeap() { return 200 * 1024; }
+    uint32_t getMinFreeHeap() { return 180 * 1024; }
+    uint32_t getMaxAllocHeap() { return 110 * 1024; }
+    uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ull; }
+    uint32_t getCycleCount();
+    void restart();
+};
+extern EspClass ESP;
+
+// Time is driven by the test: millis() and micros() return hostNowMicros()
+uint64_t hostNowMicros();
+void hostAdvanceMicros(uint64_t us);
+inline unsigned long millis() { return (unsigned long)(hostNowMicros() / 1000); }
+inline unsigned long micros() { return (unsigned long)hostNowMicros(); }
+inline void delay(unsigned long ms) { hostAdvanceMicros((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { hostAdvanceMicros(us); }
+inline void yield() {}
+inline void setCpuFrequencyMhz(uint32_t) {}
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define HIGH 1
+#define LOW 0
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char* dest, const char* src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dest, src, n);
+        dest[n] = '\0';
+    }
+    return length;
+}
+#endif
@@ -0,0 +1,1172 @@
+// Minimal stand-in for the ArduinoJson API the firmware uses: documents,
+// variants, nested objects/arrays, `|` defaults, compact serializeJson and
+// deserializeJson with filters, and their MessagePack counterparts.
+//
+// Memory follows ArduinoJson 7, which the firmware builds against: documents
+// grow as they fill and the capacity they are created with is ignored. What
+// bounds them is the heap, modelled here as hostJsonHeapLimit() bytes the live
+// documents share: every member or element takes 16 bytes, every copied string
+// (char*, String, anything parsed) its length + 1, stored once however often
+// it appears; `const char*` values and keys are only pointed at. What does not
+// fit is left out and overflowed() turns true; parsing stops with NoMemory.
+// Build the tests with ARDUINOJSON_DIR=<library>/src to use the real library.
+#pragma once
+
+#include <Arduino.h>
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace hostjson {
+
+struct Node {
+    enum Type { NUL, BOOL, INT, FLOAT, STR, ARR, OBJ } type = NUL;
+    bool b = false;
+    long long i = 0;
+    double f = 0;
+    std::string s;
+    bool linked = false;             // STR: points at the caller's const char*
+    std::vector<std::string> keys;   // OBJ: parallel to items
+    std::vector<bool> keysLinked;
+    std::vector<Node*> items;
+
+    Node* member(const char* key) const {
+        if (type != OBJ) return nullptr;
+        for (size_t n = 0; n < keys.size(); n++) {
+            if (keys[n] == key) return items[n];
+        }
+        return nullptr;
+    }
+};
+
+const size_t SLOT_BYTES = 16;  // A member or element, with its list links, on a 32-bit target
+
+// Bytes the live documents hold between them
+inline size_t& heapUsed() {
+    static size_t used = 0;
+    return used;
+}
+
+}  // namespace hostjson
+
+// ---- Host controls
+
+// Heap the documents share; the stub's ESP.getFreeHeap() by default
+inline size_t& hostJsonHeapLimit() {
+    static size_t limit = 200 * 1024;
+    return limit;
+}
+
+namespace hostjson {
+
+struct Pool {
+    std::deque<Node> nodes;
+    std::set<std::string> strings;   // Copied strings
+    size_t used = 0;
+    bool overflowed = false;
+
+    Pool() {}
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+    ~Pool() { heapUsed() -= used; }
+
+    // The root lives in the document itself and takes no slot
+    Node* make() {
+        nodes.emplace_back();
+        return &nodes.back();
+    }
+    bool take(size_t bytes) {
+        if (heapUsed() > hostJsonHeapLimit() || bytes > hostJsonHeapLimit() - heapUsed()) {
+            overflowed = true;
+            return false;
+        }
+        used += bytes;
+        heapUsed() += bytes;
+        return true;
+    }
+    Node* slot() { return take(SLOT_BYTES) ? make() : nullptr; }
+    bool copy(const std::string& s) {
+        if (strings.count(s)) return true;
+        if (!take(s.size() + 1)) return false;
+        strings.insert(s);
+        return true;
+    }
+    void clear() {
+        nodes.clear();
+        strings.clear();
+        heapUsed() -= used;
+        used = 0;
+        overflowed = false;
+    }
+};
+
+inline bool setString(Pool* pool, Node* node, const std::string& s, bool linked) {
+    *node = Node();
+    if (!linked && !pool->copy(s)) return false;
+    node->type = Node::STR;
+    node->s = s;
+    node->linked = linked;
+    return true;
+}
+
+template <typename T>
+typename std::enable_if<std::is_same<T, bool>::value>::type setValue(Pool*, Node* node, T v) {
+    *node = Node();
+    node->type = Node::BOOL;
+    node->b = v;
+}
+template <typename T>
+typename std::enable_if<(std::is_integral<T>::value && !std::is_same<T, bool>::value) || std::is_enum<T>::value>::type
+setValue(Pool*, Node* node, T v) {
+    *node = Node();
+    node->type = Node::INT;
+    node->i = (long long)v;
+}
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type setValue(Pool*, Node* node, T v) {
+    *node = Node();
+    node->type = Node::FLOAT;
+    node->f = v;
+}
+inline void setValue(Pool* pool, Node* node, const char* v) { setString(pool, node, v ? v : "", true); }
+inline void setValue(Pool* pool, Node* node, char* v) { setString(pool, node, v ? v : "", false); }
+inline void setValue(Pool* pool, Node* node, const String& v) {
+    setString(pool, node, std::string(v.c_str(), v.length()), false);
+}
+template <size_t N>
+void setValue(Pool* pool, Node* node, const char (&v)[N]) { setString(pool, node, v, true); }
+template <size_t N>
+void setValue(Pool* pool, Node* node, char (&v)[N]) { setString(pool, node, v, false); }
+
+// Deep copy into `pool`: linked strings stay linked, copied ones are copied again
+inline bool copyTree(Pool* pool, Node* to, const Node* from) {
+    *to = Node();
+    if (!from) return true;
+    if (from->type == Node::STR) return setString(pool, to, from->s, from->linked);
+    to->type = from->type;
+    to->b = from->b;
+    to->i = from->i;
+    to->f = from->f;
+    for (size_t n = 0; n < from->items.size(); n++) {
+        bool keyed = from->type == Node::OBJ;
+        if (keyed && !from->keysLinked[n] && !pool->copy(from->keys[n])) return false;
+        Node* copy = pool->slot();
+        if (!copy) return false;
+        if (keyed) {
+            to->keys.push_back(from->keys[n]);
+            to->keysLinked.push_back(from->keysLinked[n]);
+        }
+        to->items.push_back(copy);
+        if (!copyTree(pool, copy, from->items[n])) return false;
+    }
+    return true;
+}
+
+// `variant | fallback` and as<T>() for scalars
+template <typename T>
+typename std::enable_if<std::is_same<T, bool>::value, T>::type readOr(const Node* node, T fallback) {
+    return node && node->type == Node::BOOL ? node->b : fallback;
+}
+template <typename T>
+typename std::enable_if<(std::is_integral<T>::value && !std::is_same<T, bool>::value) || std::is_enum<T>::value, T>::type
+readOr(const Node* node, T fallback) {
+    if (node && node->type == Node::INT) return (T)node->i;
+    if (node && node->type == Node::FLOAT) return (T)(long long)node->f;
+    return fallback;
+}
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, T>::type readOr(const Node* node, T fallback) {
+    if (node && node->type == Node::FLOAT) return (T)node->f;
+    if (node && node->type == Node::INT) return (T)node->i;
+    return fallback;
+}
+inline const char* readOr(const Node* node, const char* fallback) {
+    return node && node->type == Node::STR ? node->s.c_str() : fallback;
+}
+
+}  // namespace hostjson
+
+class JsonVariantConst;
+class JsonObjectConst;
+class JsonArrayConst;
+class JsonVariant;
+class JsonObject;
+class JsonArray;
+class JsonDocument;
+
+class JsonVariantConst {
+public:
+    JsonVariantConst(const hostjson::Node* node = nullptr) : _node(node) {}
+
+    bool isNull() const { return !_node || _node->type == hostjson::Node::NUL; }
+    size_t size() const { return _node ? _node->items.size() : 0; }
+    JsonVariantConst operator[](const char* key) const { return JsonVariantConst(_node ? _node->member(key) : nullptr); }
+    JsonVariantConst operator[](const String& key) const { return (*this)[key.c_str()]; }
+    JsonVariantConst operator[](size_t index) const {
+        return JsonVariantConst(_node && _node->type == hostjson::Node::ARR && index < _node->items.size()
+                                    ? _node->items[index] : nullptr);
+    }
+    JsonVariantConst operator[](int index) const { return (*this)[(size_t)index]; }
+    bool containsKey(const char* key) const { return _node && _node->member(key); }
+
+    template <typename T>
+    T operator|(T fallback) const { return hostjson::readOr(_node, fallback); }
+
+    template <typename T>
+    T as() const;
+    template <typename T>
+    bool is() const;
+
+    const hostjson::Node* _node;
+};
+
+class JsonObjectConst : public JsonVariantConst {
+public:
+    JsonObjectConst() {}
+    JsonObjectConst(const JsonVariantConst& v)
+        : JsonVariantConst(v._node && v._node->type == hostjson::Node::OBJ ? v._node : nullptr) {}
+};
+
+class JsonArrayConst : public JsonVariantConst {
+public:
+    class iterator {
+    public:
+        iterator(const hostjson::Node* const* at) : _at(at) {}
+        JsonVariantConst operator*() const { return JsonVariantConst(*_at); }
+        iterator& operator++() { ++_at; return *this; }
+        bool operator!=(const iterator& other) const { return _at != other._at; }
+    private:
+        const hostjson::Node* const* _at;
+    };
+
+    JsonArrayConst() {}
+    JsonArrayConst(const JsonVariantConst& v)
+        : JsonVariantConst(v._node && v._node->type == hostjson::Node::ARR ? v._node : nullptr) {}
+    iterator begin() const { return iterator(_node ? _node->items.data() : nullptr); }
+    iterator end() const { return iterator(_node ? _node->items.data() + _node->items.size() : nullptr); }
+};
+
+template <typename T>
+T JsonVariantConst::as() const {
+    return hostjson::readOr(_node, T());
+}
+template <>
+inline JsonVariantConst JsonVariantConst::as<JsonVariantConst>() const { return *this; }
+template <>
+inline JsonObjectConst JsonVariantConst::as<JsonObjectConst>() const { return JsonObjectConst(*this); }
+template <>
+inline JsonArrayConst JsonVariantConst::as<JsonArrayConst>() const { return JsonArrayConst(*this); }
+template <>
+inline const char* JsonVariantConst::as<const char*>() const { return hostjson::readOr(_node, (const char*)nullptr); }
+
+template <typename T>
+bool JsonVariantConst::is() const {
+    using hostjson::Node;
+    if (!_node) return false;
+    if (std::is_same<T, bool>::value) return _node->type == Node::BOOL;
+    if (std::is_integral<T>::value) return _node->type == Node::INT;
+    if (std::is_floating_point<T>::value) return _node->type == Node::INT || _node->type == Node::FLOAT;
+    return false;
+}
+template <>
+inline bool JsonVariantConst::is<const char*>() const { return _node && _node->type == hostjson::Node::STR; }
+template <>
+inline bool JsonVariantConst::is<JsonObjectConst>() const { return _node && _node->type == hostjson::Node::OBJ; }
+template <>
+inline bool JsonVariantConst::is<JsonArrayConst>() const { return _node && _node->type == hostjson::Node::ARR; }
+
+// A mutable variant. Like ArduinoJson's member and element proxies, one for a
+// member or element that doesn't exist yet only adds it when written to.
+class JsonVariant {
+public:
+    JsonVariant() : _pool(nullptr), _node(nullptr), _index(0), _byIndex(false), _keyLinked(true) {}
+    JsonVariant(hostjson::Pool* pool, hostjson::Node* node)
+        : _pool(pool), _node(node), _index(0), _byIndex(false), _keyLinked(true) {}
+    JsonVariant(const JsonVariant& other) = default;
+
+    // Assigning writes the value, as it does through ArduinoJson's proxies
+    template <typename T>
+    typename std::enable_if<!std::is_convertible<const T&, JsonVariantConst>::value, JsonVariant&>::type
+    operator=(const T& value) {
+        hostjson::Node* node = _materialize();
+        if (node) hostjson::setValue(_pool, node, value);
+        return *this;
+    }
+    JsonVariant& operator=(const JsonVariant& other) { return *this = JsonVariantConst(other); }
+    JsonVariant& operator=(const JsonVariantConst& other) {
+        hostjson::Node* node = _materialize();
+        if (node && node != other._node) hostjson::copyTree(_pool, node, other._node);
+        return *this;
+    }
+
+    JsonVariant operator[](const char* key) const { return _child(key, true); }
+    JsonVariant operator[](const String& key) const { return _child(key.c_str(), false); }
+    JsonVariant operator[](size_t index) const {
+        JsonVariant child(_pool, nullptr);
+        child._parent = std::make_shared<JsonVariant>(*this);
+        child._index = index;
+        child._byIndex = true;
+        return child;
+    }
+    JsonVariant operator[](int index) const { return (*this)[(size_t)index]; }
+
+    operator JsonVariantConst() const { return JsonVariantConst(_resolve()); }
+    template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    operator T() const { return as<T>(); }
+    bool isNull() const { return JsonVariantConst(_resolve()).isNull(); }
+    size_t size() const { return JsonVariantConst(_resolve()).size(); }
+    template <typename T>
+    T operator|(T fallback) const { return hostjson::readOr(_resolve(), fallback); }
+    template <typename T>
+    T as() const { return JsonVariantConst(_resolve()).as<T>(); }
+    template <typename T>
+    bool is() const { return JsonVariantConst(_resolve()).is<T>(); }
+
+    JsonArray createNestedArray(const char* key) const;
+    JsonObject createNestedObject(const char* key) const;
+    JsonArray createNestedArray() const;
+    JsonObject createNestedObject() const;
+    template <typename T>
+    bool add(const T& value) const;
+
+    hostjson::Pool* _pool;
+
+    // The node, adding the missing member or element (and its parents) first;
+    // nullptr when there is no room or the parent is of another type
+    hostjson::Node* _materialize() const {
+        using hostjson::Node;
+        if (_resolve() || !_parent) return _node;
+        Node* parent = _parent->_materialize();
+        if (!parent) return nullptr;
+        if (_byIndex) {
+            if (parent->type == Node::NUL) parent->type = Node::ARR;
+            if (parent->type != Node::ARR) return nullptr;
+            while (parent->items.size() <= _index) {
+                Node* item = _pool->slot();
+                if (!item) return nullptr;
+                parent->items.push_back(item);
+            }
+            _node = parent->items[_index];
+            return _node;
+        }
+        if (parent->type == Node::NUL) parent->type = Node::OBJ;
+        if (parent->type != Node::OBJ) return nullptr;
+        if (!_keyLinked && !_pool->copy(_key)) return nullptr;
+        Node* item = _pool->slot();
+        if (!item) return nullptr;
+        parent->keys.push_back(_key);
+        parent->keysLinked.push_back(_keyLinked);
+        parent->items.push_back(item);
+        _node = item;
+        return _node;
+    }
+
+    // The node if it exists, without adding anything
+    hostjson::Node* _resolve() const {
+        using hostjson::Node;
+        if (_node || !_parent) return _node;
+        Node* parent = _parent->_resolve();
+        if (!parent) return nullptr;
+        if (_byIndex) {
+            _node = parent->type == Node::ARR && _index < parent->items.size() ? parent->items[_index] : nullptr;
+        } else {
+            _node = parent->member(_key.c_str());
+        }
+        return _node;
+    }
+
+protected:
+    void _rebind(const JsonVariant& other) {
+        _pool = other._pool;
+        _node = other._node;
+        _parent = other._parent;
+        _key = other._key;
+        _index = other._index;
+        _byIndex = other._byIndex;
+        _keyLinked = other._keyLinked;
+    }
+
+private:
+    mutable hostjson::Node* _node;
+    std::shared_ptr<JsonVariant> _parent;   // Set until the member or element is found
+    std::string _key;
+    size_t _index;
+    bool _byIndex;
+    bool _keyLinked;
+
+    JsonVariant _child(const char* key, bool linked) const {
+        JsonVariant child(_pool, nullptr);
+        child._parent = std::make_shared<JsonVariant>(*this);
+        child._key = key;
+        child._keyLinked = linked;
+        return child;
+    }
+};
+
+class JsonObject : public JsonVariant {
+public:
+    JsonObject() {}
+    JsonObject(const JsonVariant& v) : JsonVariant(v) {}
+    JsonObject(const JsonObject& other) = default;
+    JsonObject& operator=(const JsonObject& other) {  // Rebinds, as ArduinoJson's does
+        _rebind(other);
+        return *this;
+    }
+    operator JsonObjectConst() const { return JsonObjectConst(JsonVariantConst(_resolve())); }
+};
+
+class JsonArray : public JsonVariant {
+public:
+    JsonArray() {}
+    JsonArray(const JsonVariant& v) : JsonVariant(v) {}
+    JsonArray(const JsonArray& other) = default;
+    JsonArray& operator=(const JsonArray& other) {
+        _rebind(other);
+        return *this;
+    }
+    operator JsonArrayConst() const { return JsonArrayConst(JsonVariantConst(_resolve())); }
+};
+
+namespace hostjson {
+
+inline JsonVariant makeContainer(Pool* pool, Node* node, Node::Type type) {
+    if (!node) return JsonVariant();
+    *node = Node();
+    node->type = type;
+    return JsonVariant(pool, node);
+}
+
+// A new element at the end of the array `node` (made an array if null)
+inline Node* appendItem(Pool* pool, Node* node) {
+    if (!node) return nullptr;
+    if (node->type == Node::NUL) node->type = Node::ARR;
+    if (node->type != Node::ARR) return nullptr;
+    Node* item = pool->slot();
+    if (item) node->items.push_back(item);
+    return item;
+}
+
+}  // namespace hostjson
+
+inline JsonArray JsonVariant::createNestedArray(const char* key) const {
+    return JsonArray(hostjson::makeContainer(_pool, (*this)[key]._materialize(), hostjson::Node::ARR));
+}
+inline JsonObject JsonVariant::createNestedObject(const char* key) const {
+    return JsonObject(hostjson::makeContainer(_pool, (*this)[key]._materialize(), hostjson::Node::OBJ));
+}
+inline JsonArray JsonVariant::createNestedArray() const {
+    return JsonArray(hostjson::makeContainer(_pool, hostjson::appendItem(_pool, _materialize()), hostjson::Node::ARR));
+}
+inline JsonObject JsonVariant::createNestedObject() const {
+    return JsonObject(hostjson::makeContainer(_pool, hostjson::appendItem(_pool, _materialize()), hostjson::Node::OBJ));
+}
+template <typename T>
+bool JsonVariant::add(const T& value) const {
+    hostjson::Node* item = hostjson::appendItem(_pool, _materialize());
+    if (!item) return false;
+    JsonVariant(_pool, item) = value;
+    return true;
+}
+
+class JsonDocument {
+public:
+    explicit JsonDocument(size_t capacity = 0) { _root = _pool.make(); }  // Capacity ignored, as in v7
+    JsonDocument(const JsonDocument& other) {
+        _root = _pool.make();
+        hostjson::copyTree(&_pool, _root, other._root);
+    }
+    JsonDocument& operator=(const JsonDocument& other) {
+        if (this != &other) {
+            clear();
+            hostjson::copyTree(&_pool, _root, other._root);
+        }
+        return *this;
+    }
+
+    void clear() {
+        _pool.clear();
+        _root = _pool.make();
+    }
+    JsonVariant as_variant() { return JsonVariant(&_pool, _root); }
+    JsonVariant operator[](const char* key) { return as_variant()[key]; }
+    JsonVariant operator[](const String& key) { return as_variant()[key]; }
+    JsonVariant operator[](size_t index) { return as_variant()[index]; }
+    JsonVariant operator[](int index) { return as_variant()[(size_t)index]; }
+    JsonVariantConst operator[](const char* key) const { return JsonVariantConst(_root)[key]; }
+    JsonVariantConst operator[](const String& key) const { return JsonVariantConst(_root)[key.c_str()]; }
+    JsonVariantConst operator[](size_t index) const { return JsonVariantConst(_root)[index]; }
+    JsonVariantConst operator[](int index) const { return JsonVariantConst(_root)[(size_t)index]; }
+    JsonArray createNestedArray(const char* key) { return as_variant().createNestedArray(key); }
+    JsonObject createNestedObject(const char* key) { return as_variant().createNestedObject(key); }
+    JsonArray createNestedArray() { return as_variant().createNestedArray(); }
+    JsonObject createNestedObject() { return as_variant().createNestedObject(); }
+    template <typename T>
+    bool add(const T& value) { return as_variant().add(value); }
+    template <typename T>
+    T as() const { return JsonVariantConst(_root).as<T>(); }
+    template <typename T>
+    T to() {
+        clear();
+        return T(as_variant());
+    }
+    bool isNull() const { return JsonVariantConst(_root).isNull(); }
+    size_t size() const { return JsonVariantConst(_root).size(); }
+    bool overflowed() const { return _pool.overflowed; }
+    size_t memoryUsage() const { return _pool.used; }
+    operator JsonVariantConst() const { return JsonVariantConst(_root); }
+
+    const hostjson::Node* _rootNode() const { return _root; }
+    hostjson::Node* _rootNode() { return _root; }
+    hostjson::Pool* _poolPtr() { return &_pool; }
+
+private:
+    hostjson::Pool _pool;
+    hostjson::Node* _root;
+};
+
+class DynamicJsonDocument : public JsonDocument {
+public:
+    explicit DynamicJsonDocument(size_t capacity) : JsonDocument(capacity) {}
+};
+
+template <size_t N>
+class StaticJsonDocument : public JsonDocument {
+public:
+    StaticJsonDocument() : JsonDocument(N) {}
+};
+
+// ---- Serialization
+
+namespace hostjson {
+
+struct Output {
+    virtual ~Output() {}
+    virtual size_t put(const char* s, size_t n) = 0;
+    size_t put(const char* s) { return put(s, strlen(s)); }
+};
+
+template <typename Writer>
+struct WriterOutput : Output {
+    Writer& writer;
+    explicit WriterOutput(Writer& w) : writer(w) {}
+    size_t put(const char* s, size_t n) override { return writer.write((const uint8_t*)s, n); }
+};
+
+struct StringOutput : Output {
+    String& out;
+    explicit StringOutput(String& s) : out(s) {}
+    size_t put(const char* s, size_t n) override { out.concat(s, n); return n; }
+};
+
+// Writes what fits; the count is what was written
+struct BufferOutput : Output {
+    uint8_t* at;
+    size_t left;
+    BufferOutput(uint8_t* buffer, size_t size) : at(buffer), left(size) {}
+    size_t put(const char* s, size_t n) override {
+        n = std::min(n, left);
+        memcpy(at, s, n);
+        at += n;
+        left -= n;
+        return n;
+    }
+};
+
+struct CountOutput : Output {
+    size_t put(const char*, size_t n) override { return n; }
+};
+
+inline size_t writeString(Output& out, const std::string& s) {
+    size_t n = out.put("\"", 1);
+    for (unsigned char c : s) {
+        char escaped[8];
+        switch (c) {
+            case '"': n += out.put("\\\""); break;
+            case '\\': n += out.put("\\\\"); break;
+            case '\b': n += out.put("\\b"); break;
+            case '\f': n += out.put("\\f"); break;
+            case '\n': n += out.put("\\n"); break;
+            case '\r': n += out.put("\\r"); break;
+            case '\t': n += out.put("\\t"); break;
+            default:
+                if (c < 0x20) {
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    n += out.put(escaped);
+                } else {
+                    n += out.put((const char*)&c, 1);
+                }
+        }
+    }
+    return n + out.put("\"", 1);
+}
+
+inline size_t writeNode(Output& out, const Node* node) {
+    char number[32];
+    if (!node) return out.put("null");
+    switch (node->type) {
+        case Node::NUL: return out.put("null");
+        case Node::BOOL: return out.put(node->b ? "true" : "false");
+        case Node::INT: snprintf(number, sizeof(number), "%lld", node->i); return out.put(number);
+        case Node::FLOAT: snprintf(number, sizeof(number), "%.9g", node->f); return out.put(number);
+        case Node::STR: return writeString(out, node->s);
+        case Node::ARR: {
+            size_t n = out.put("[");
+            for (size_t i = 0; i < node->items.size(); i++) {
+                if (i) n += out.put(",");
+                n += writeNode(out, node->items[i]);
+            }
+            return n + out.put("]");
+        }
+        case Node::OBJ: {
+            size_t n = out.put("{");
+            for (size_t i = 0; i < node->items.size(); i++) {
+                if (i) n += out.put(",");
+                n += writeString(out, node->keys[i]);
+                n += out.put(":");
+                n += writeNode(out, node->items[i]);
+            }
+            return n + out.put("}");
+        }
+    }
+    return 0;
+}
+
+// MessagePack in its smallest encodings, as ArduinoJson writes it
+inline size_t packBytes(Output& out, uint8_t head, uint64_t value, int bytes) {
+    char buffer[9];
+    buffer[0] = (char)head;
+    for (int i = 0; i < bytes; i++) buffer[1 + i] = (char)(value >> (8 * (bytes - 1 - i)));
+    return out.put(buffer, 1 + bytes);
+}
+
+inline size_t packHeader(Output& out, uint8_t fix, size_t fixMax, uint8_t head8, uint8_t head16, uint8_t head32,
+                         size_t n) {
+    if (n <= fixMax) return packBytes(out, (uint8_t)(fix | n), 0, 0);
+    if (head8 && n <= 0xFF) return packBytes(out, head8, n, 1);
+    if (n <= 0xFFFF) return packBytes(out, head16, n, 2);
+    return packBytes(out, head32, n, 4);
+}
+
+inline size_t packString(Output& out, const std::string& s) {
+    return packHeader(out, 0xA0, 31, 0xD9, 0xDA, 0xDB, s.size()) + out.put(s.data(), s.size());
+}
+
+inline size_t packNode(Output& out, const Node* node) {
+    if (!node) return packBytes(out, 0xC0, 0, 0);
+    switch (node->type) {
+        case Node::NUL: return packBytes(out, 0xC0, 0, 0);
+        case Node::BOOL: return packBytes(out, node->b ? 0xC3 : 0xC2, 0, 0);
+        case Node::INT: {
+            long long v = node->i;
+            if (v >= 0) {
+                if (v <= 0x7F) return packBytes(out, (uint8_t)v, 0, 0);
+                if (v <= 0xFF) return packBytes(out, 0xCC, v, 1);
+                if (v <= 0xFFFF) return packBytes(out, 0xCD, v, 2);
+                if (v <= 0xFFFFFFFFLL) return packBytes(out, 0xCE, v, 4);
+                return packBytes(out, 0xCF, v, 8);
+            }
+            if (v >= -32) return packBytes(out, (uint8_t)(int8_t)v, 0, 0);
+            if (v >= -128) return packBytes(out, 0xD0, (uint8_t)(int8_t)v, 1);
+            if (v >= -32768) return packBytes(out, 0xD1, (uint16_t)(int16_t)v, 2);
+            if (v >= -2147483648LL) return packBytes(out, 0xD2, (uint32_t)(int32_t)v, 4);
+            return packBytes(out, 0xD3, (uint64_t)v, 8);
+        }
+        case Node::FLOAT: {
+            float single = (float)node->f;
+            if ((double)single == node->f) {
+                uint32_t bits;
+                memcpy(&bits, &single, 4);
+                return packBytes(out, 0xCA, bits, 4);
+            }
+            uint64_t bits;
+            memcpy(&bits, &node->f, 8);
+            return packBytes(out, 0xCB, bits, 8);
+        }
+        case Node::STR: return packString(out, node->s);
+        case Node::ARR: {
+            size_t n = packHeader(out, 0x90, 15, 0, 0xDC, 0xDD, node->items.size());
+            for (const Node* item : node->items) n += packNode(out, item);
+            return n;
+        }
+        case Node::OBJ: {
+            size_t n = packHeader(out, 0x80, 15, 0, 0xDE, 0xDF, node->items.size());
+            for (size_t i = 0; i < node->items.size(); i++) {
+                n += packString(out, node->keys[i]);
+                n += packNode(out, node->items[i]);
+            }
+            return n;
+        }
+    }
+    return 0;
+}
+
+}  // namespace hostjson
+
+template <typename Writer>
+size_t serializeJson(JsonVariantConst source, Writer& writer) {
+    hostjson::WriterOutput<Writer> out(writer);
+    return hostjson::writeNode(out, source._node);
+}
+inline size_t serializeJson(JsonVariantConst source, String& output) {
+    hostjson::StringOutput out(output);
+    return hostjson::writeNode(out, source._node);
+}
+inline size_t serializeJson(JsonVariantConst source, char* buffer, size_t size) {
+    String text;
+    serializeJson(source, text);
+    size_t n = std::min((size_t)text.length(), size ? size - 1 : 0);
+    memcpy(buffer, text.c_str(), n);
+    if (size) buffer[n] = '\0';
+    return n;
+}
+template <typename Writer>
+size_t serializeJson(const JsonDocument& doc, Writer& writer) { return serializeJson(JsonVariantConst(doc), writer); }
+inline size_t serializeJson(const JsonDocument& doc, String& output) { return serializeJson(JsonVariantConst(doc), output); }
+inline size_t measureJson(const JsonDocument& doc) {
+    hostjson::CountOutput out;
+    return hostjson::writeNode(out, JsonVariantConst(doc)._node);
+}
+
+inline size_t serializeMsgPack(JsonVariantConst source, void* buffer, size_t size) {
+    hostjson::BufferOutput out((uint8_t*)buffer, size);
+    return hostjson::packNode(out, source._node);
+}
+inline size_t serializeMsgPack(JsonVariantConst source, String& output) {
+    hostjson::StringOutput out(output);
+    return hostjson::packNode(out, source._node);
+}
+inline size_t measureMsgPack(JsonVariantConst source) {
+    hostjson::CountOutput out;
+    return hostjson::packNode(out, source._node);
+}
+
+// ---- Deserialization
+
+class DeserializationError {
+public:
+    enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+    DeserializationError(Code code = Ok) : _code(code) {}
+    explicit operator bool() const { return _code != Ok; }
+    bool operator==(Code code) const { return _code == code; }
+    bool operator!=(Code code) const { return _code != code; }
+    Code code() const { return _code; }
+    const char* c_str() const {
+        static const char* names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+        return names[_code];
+    }
+
+private:
+    Code _code;
+};
+
+namespace DeserializationOption {
+struct Filter {
+    explicit Filter(const JsonDocument& doc) : node(doc._rootNode()) {}
+    const hostjson::Node* node;
+};
+}
+
+namespace hostjson {
+
+// Filter node: nullptr = keep everything, BOOL true = keep, OBJ = keep listed members
+inline bool filterKeeps(const Node* filter) {
+    return !filter || (filter->type == Node::BOOL && filter->b) || filter->type == Node::OBJ || filter->type == Node::ARR;
+}
+inline const Node* memberFilter(const Node* filter, const std::string& key) {
+    if (!filter || filter->type == Node::BOOL) return filter;
+    if (filter->type != Node::OBJ) return nullptr;
+    const Node* rule = filter->member(key.c_str());
+    return rule ? rule : filter->member("*");
+}
+inline const Node* itemFilter(const Node* filter) {
+    if (!filter || filter->type == Node::BOOL) return filter;
+    return filter->type == Node::ARR && !filter->items.empty() ? filter->items[0] : nullptr;
+}
+
+// The member of `out` that `key` is parsed into: nullptr when the filter drops
+// it. Sets `error` to NoMemory when it is kept but doesn't fit.
+inline Node* addMember(Pool* pool, Node* out, const Node* filter, const std::string& key, const Node* rule,
+                       DeserializationError& error) {
+    if (!out || !filterKeeps(rule) || (!rule && filter)) return nullptr;
+    Node* member = pool->copy(key) ? pool->slot() : nullptr;
+    if (!member) {
+        error = DeserializationError::NoMemory;
+        return nullptr;
+    }
+    out->keys.push_back(key);
+    out->keysLinked.push_back(false);
+    out->items.push_back(member);
+    return member;
+}
+
+class Parser {
+public:
+    Parser(Pool* pool, const char* text, size_t length) : _pool(pool), _p(text), _end(text + length) {}
+
+    DeserializationError parse(Node* root, const Node* filter) {
+        _skipSpace();
+        if (_p >= _end) return DeserializationError::EmptyInput;
+        return _value(root, filter, 0);
+    }
+
+private:
+    Pool* _pool;
+    const char* _p;
+    const char* _end;
+
+    void _skipSpace() {
+        while (_p < _end && (*_p == ' ' || *_p == '\n' || *_p == '\r' || *_p == '\t')) _p++;
+    }
+
+    DeserializationError _value(Node* out, const Node* filter, int depth) {
+        if (depth > 10) return DeserializationError::TooDeep;
+        _skipSpace();
+        if (_p >= _end) return DeserializationError::IncompleteInput;
+        char c = *_p;
+        if (c == '{') return _object(out, filter, depth);
+        if (c == '[') return _array(out, filter, depth);
+        if (c == '"') {
+            std::string s;
+            DeserializationError error = _string(s);
+            if (!error && out && !setString(_pool, out, s, false)) return DeserializationError::NoMemory;
+            return error;
+        }
+        if (c == 't' || c == 'f' || c == 'n') {
+            const char* word = c == 't' ? "true" : c == 'f' ? "false" : "null";
+            size_t n = strlen(word);
+            if ((size_t)(_end - _p) < n) return DeserializationError::IncompleteInput;
+            if (strncmp(_p, word, n) != 0) return DeserializationError::InvalidInput;
+            _p += n;
+            if (out && c != 'n') setValue(_pool, out, c == 't');
+            return DeserializationError::Ok;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            const char* start = _p;
+            bool real = false;
+            while (_p < _end && (strchr("+-.eE", *_p) || (*_p >= '0' && *_p <= '9'))) {
+                real |= *_p == '.' || *_p == 'e' || *_p == 'E';
+                _p++;
+            }
+            if (_p >= _end && start == _p) return DeserializationError::IncompleteInput;
+            std::string number(start, _p);
+            if (out) {
+                if (real) setValue(_pool, out, strtod(number.c_str(), nullptr));
+                else setValue(_pool, out, strtoll(number.c_str(), nullptr, 10));
+            }
+            return DeserializationError::Ok;
+        }
+        return DeserializationError::InvalidInput;
+    }
+
+    DeserializationError _string(std::string& s) {
+        _p++;
+        while (_p < _end && *_p != '"') {
+            if (*_p == '\\') {
+                if (++_p >= _end) return DeserializationError::IncompleteInput;
+                switch (*_p) {
+                    case 'n': s += '\n'; break;
+                    case 'r': s += '\r'; break;
+                    case 't': s += '\t'; break;
+                    case 'b': s += '\b'; break;
+                    case 'f': s += '\f'; break;
+                    case 'u': {
+                        if (_end - _p < 5) return DeserializationError::IncompleteInput;
+                        unsigned code = strtoul(std::string(_p + 1, 4).c_str(), nullptr, 16);
+                        if (code < 0x80) {
+                            s += (char)code;
+                        } else if (code < 0x800) {
+                            s += (char)(0xC0 | (code >> 6));
+                            s += (char)(0x80 | (code & 0x3F));
+                        } else {
+                            s += (char)(0xE0 | (code >> 12));
+                            s += (char)(0x80 | ((code >> 6) & 0x3F));
+                            s += (char)(0x80 | (code & 0x3F));
+                        }
+                        _p += 4;
+                        break;
+                    }
+                    default: s += *_p;
+                }
+                _p++;
+            } else {
+                s += *_p++;
+            }
+        }
+        if (_p >= _end) return DeserializationError::IncompleteInput;
+        _p++;
+        return DeserializationError::Ok;
+    }
+
+    DeserializationError _object(Node* out, const Node* filter, int depth) {
+        _p++;
+        if (out) {
+            *out = Node();
+            out->type = Node::OBJ;
+        }
+        _skipSpace();
+        if (_p < _end && *_p == '}') {
+            _p++;
+            return DeserializationError::Ok;
+        }
+        while (true) {
+            _skipSpace();
+            if (_p >= _end) return DeserializationError::IncompleteInput;
+            if (*_p != '"') return DeserializationError::InvalidInput;
+            std::string key;
+            DeserializationError error = _string(key);
+            if (error) return error;
+            _skipSpace();
+            if (_p >= _end) return DeserializationError::IncompleteInput;
+            if (*_p++ != ':') return DeserializationError::InvalidInput;
+            const Node* rule = out ? memberFilter(filter, key) : nullptr;
+            Node* member = addMember(_pool, out, filter, key, rule, error);
+            if (error) return error;
+            error = _value(member, rule, depth + 1);
+            if (error) return error;
+            _skipSpace();
+            if (_p >= _end) return DeserializationError::IncompleteInput;
+            if (*_p == ',') {
+                _p++;
+                continue;
+            }
+            if (*_p++ == '}') return DeserializationError::Ok;
+            return DeserializationError::InvalidInput;
+        }
+    }
+
+    DeserializationError _array(Node* out, const Node* filter, int depth) {
+        _p++;
+        if (out) {
+            *out = Node();
+            out->type = Node::ARR;
+        }
+        const Node* rule = out ? itemFilter(filter) : nullptr;
+        bool keep = out && (!filter || (rule && filterKeeps(rule)));
+        _skipSpace();
+        if (_p < _end && *_p == ']') {
+            _p++;
+            return DeserializationError::Ok;
+        }
+        while (true) {
+            Node* item = nullptr;
+            if (keep) {
+                item = _pool->slot();
+                if (!item) return DeserializationError::NoMemory;
+                out->items.push_back(item);
+            }
+            DeserializationError error = _value(item, rule, depth + 1);
+            if (error) return error;
+            _skipSpace();
+            if (_p >= _end) return DeserializationError::IncompleteInput;
+            if (*_p == ',') {
+                _p++;
+                continue;
+            }
+            if (*_p++ == ']') return DeserializationError::Ok;
+            return DeserializationError::InvalidInput;
+        }
+    }
+};
+
+class MsgPackParser {
+public:
+    MsgPackParser(Pool* pool, const uint8_t* data, size_t length) : _pool(pool), _p(data), _end(data + length) {}
+
+    DeserializationError parse(Node* root, const Node* filter) {
+        if (_p >= _end) return DeserializationError::EmptyInput;
+        return _value(root, filter, 0);
+    }
+
+private:
+    Pool* _pool;
+    const uint8_t* _p;
+    const uint8_t* _end;
+
+    bool _read(uint64_t& value, int bytes) {
+        if (_end - _p < bytes) return false;
+        value = 0;
+        for (int i = 0; i < bytes; i++) value = value << 8 | *_p++;
+        return true;
+    }
+
+    DeserializationError _value(Node* out, const Node* filter, int depth) {
+        if (depth > 10) return DeserializationError::TooDeep;
+        if (_p >= _end) return DeserializationError::IncompleteInput;
+        uint8_t head = *_p++;
+        uint64_t v = 0;
+        if (head <= 0x7F || head >= 0xE0) {
+            if (out) setValue(_pool, out, (long long)(int8_t)head);
+            return DeserializationError::Ok;
+        }
+        if ((head & 0xF0) == 0x80) return _object(out, filter, head & 0x0F, depth);
+        if ((head & 0xF0) == 0x90) return _array(out, filter, head & 0x0F, depth);
+        if ((head & 0xE0) == 0xA0) return _string(out, head & 0x1F);
+        switch (head) {
+            case 0xC0:
+                if (out) *out = Node();
+                return DeserializationError::Ok;
+            case 0xC2:
+            case 0xC3:
+                if (out) setValue(_pool, out, head == 0xC3);
+                return DeserializationError::Ok;
+            case 0xCA: case 0xCB: {
+                if (!_read(v, head == 0xCA ? 4 : 8)) return DeserializationError::IncompleteInput;
+                double f;
+                if (head == 0xCA) {
+                    uint32_t bits = (uint32_t)v;
+                    float single;
+                    memcpy(&single, &bits, 4);
+                    f = single;
+                } else {
+                    memcpy(&f, &v, 8);
+                }
+                if (out) setValue(_pool, out, f);
+                return DeserializationError::Ok;
+            }
+            case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+                if (!_read(v, 1 << (head - 0xCC))) return DeserializationError::IncompleteInput;
+                if (out) setValue(_pool, out, (long long)v);
+                return DeserializationError::Ok;
+            case 0xD0: case 0xD1: case 0xD2: case 0xD3: {
+                int bytes = 1 << (head - 0xD0);
+                if (!_read(v, bytes)) return DeserializationError::IncompleteInput;
+                long long s = bytes == 1 ? (int8_t)v : bytes == 2 ? (int16_t)v : bytes == 4 ? (int32_t)v : (int64_t)v;
+                if (out) setValue(_pool, out, s);
+                return DeserializationError::Ok;
+            }
+            case 0xD9: case 0xDA: case 0xDB:
+                if (!_read(v, 1 << (head - 0xD9))) return DeserializationError::IncompleteInput;
+                return _string(out, (size_t)v);
+            case 0xDC: case 0xDD:
+                if (!_read(v, head == 0xDC ? 2 : 4)) return DeserializationError::IncompleteInput;
+                return _array(out, filter, (size_t)v, depth);
+            case 0xDE: case 0xDF:
+                if (!_read(v, head == 0xDE ? 2 : 4)) return DeserializationError::IncompleteInput;
+                return _object(out, filter, (size_t)v, depth);
+            default:
+                return DeserializationError::InvalidInput;
+        }
+    }
+
+    DeserializationError _readString(std::string& s, size_t length) {
+        if ((size_t)(_end - _p) < length) return DeserializationError::IncompleteInput;
+        s.assign((const char*)_p, length);
+        _p += length;
+        return DeserializationError::Ok;
+    }
+
+    DeserializationError _string(Node* out, size_t length) {
+        std::string s;
+        DeserializationError error = _readString(s, length);
+        if (!error && out && !setString(_pool, out, s, false)) return DeserializationError::NoMemory;
+        return error;
+    }
+
+    DeserializationError _key(std::string& key) {
+        if (_p >= _end) return DeserializationError::IncompleteInput;
+        uint8_t head = *_p++;
+        uint64_t length = 0;
+        if ((head & 0xE0) == 0xA0) {
+            length = head & 0x1F;
+        } else if (head >= 0xD9 && head <= 0xDB) {
+            if (!_read(length, 1 << (head - 0xD9))) return DeserializationError::IncompleteInput;
+        } else {
+            return DeserializationError::InvalidInput;
+        }
+        return _readString(key, (size_t)length);
+    }
+
+    DeserializationError _object(Node* out, const Node* filter, size_t count, int depth) {
+        if (out) {
+            *out = Node();
+            out->type = Node::OBJ;
+        }
+        for (size_t n = 0; n < count; n++) {
+            std::string key;
+            DeserializationError error = _key(key);
+            if (error) return error;
+            const Node* rule = out ? memberFilter(filter, key) : nullptr;
+            Node* member = addMember(_pool, out, filter, key, rule, error);
+            if (error) return error;
+            error = _value(member, rule, depth + 1);
+            if (error) return error;
+        }
+        return DeserializationError::Ok;
+    }
+
+    DeserializationError _array(Node* out, const Node* filter, size_t count, int depth) {
+        if (out) {
+            *out = Node();
+            out->type = Node::ARR;
+        }
+        const Node* rule = out ? itemFilter(filter) : nullptr;
+        bool keep = out && (!filter || (rule && filterKeeps(rule)));
+        for (size_t n = 0; n < count; n++) {
+            Node* item = nullptr;
+            if (keep) {
+                item = _pool->slot();
+                if (!item) return DeserializationError::NoMemory;
+                out->items.push_back(item);
+            }
+            DeserializationError error = _value(item, rule, depth + 1);
+            if (error) return error;
+        }
+        return DeserializationError::Ok;
+    }
+};
+
+inline DeserializationError parseInto(JsonDocument& doc, const char* text, size_t length, const Node* filter) {
+    doc.clear();
+    Parser parser(doc._poolPtr(), text, length);
+    DeserializationError error = parser.parse(doc._rootNode(), filter);
+    if (error) doc.clear();
+    return error;
+}
+
+inline DeserializationError unpackInto(JsonDocument& doc, const char* data, size_t length, const Node* filter) {
+    doc.clear();
+    MsgPackParser parser(doc._poolPtr(), (const uint8_t*)data, length);
+    DeserializationError error = parser.parse(doc._rootNode(), filter);
+    if (error) doc.clear();
+    return error;
+}
+
+}  // namespace hostjson
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* text, size_t length) {
+    return hostjson::parseInto(doc, text, length, nullptr);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* text, size_t length,
+                                            DeserializationOption::Filter filter) {
+    return hostjson::parseInto(doc, text, length, filter.node);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* text) {
+    return deserializeJson(doc, text, strlen(text));
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& text) {
+    return deserializeJson(doc, text.c_str(), text.length());
+}
+// Streams are read to the end first (the slot bodies the firmware parses are small)
+inline DeserializationError deserializeJson(JsonDocument& doc, Stream& input, DeserializationOption::Filter filter) {
+    std::string text;
+    int c;
+    while ((c = input.read()) >= 0) text += (char)c;
+    return hostjson::parseInto(doc, text.data(), text.size(), filter.node);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, Stream& input) {
+    std::string text;
+    int c;
+    while ((c = input.read()) >= 0) text += (char)c;
+    return hostjson::parseInto(doc, text.data(), text.size(), nullptr);
+}
+
+inline DeserializationError deserializeMsgPack(JsonDocument& doc, const char* data, size_t length) {
+    return hostjson::unpackInto(doc, data, length, nullptr);
+}
+inline DeserializationError deserializeMsgPack(JsonDocument& doc, const char* data, size_t length,
+                                               DeserializationOption::Filter filter) {
+    return hostjson::unpackInto(doc, data, length, filter.node);
+}
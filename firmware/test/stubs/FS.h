@@ -0,0 +1,226 @@
+// In-memory stand-in for the ESP32 FS/File API, with power-cut injection.
+//
+// Writes land in the file immediately, byte by byte, so a cut can leave any
+// prefix of a write behind (stricter than LittleFS, which commits on close).
+// Every mutation costs units: one per byte written, one per create/truncate,
+// remove, rename or mkdir. Once the budget set by hostFsCutAfter() is spent,
+// further mutations are dropped, as if the device lost power at that point;
+// the code keeps running but nothing more reaches "flash".
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct HostFsState {
+    std::map<std::string, std::vector<uint8_t>> files;
+    std::set<std::string> dirs;
+    size_t capacity = 1536 * 1024;   // Bytes of file data the "partition" holds
+    long long budget = -1;           // Mutation units left before the cut; -1 = no cut
+    unsigned long long spent = 0;    // Units used since the last hostFsResetCounter()
+    std::string shortReadPath;       // Reads of this file come back short (hostFsShortReads)
+
+    // Take `units`; returns how many were granted before the cut
+    size_t take(size_t units) {
+        if (budget < 0) {
+            spent += units;
+            return units;
+        }
+        size_t granted = (long long)units <= budget ? units : (size_t)budget;
+        budget -= granted;
+        spent += granted;
+        return granted;
+    }
+    bool cut() const { return budget == 0; }
+    size_t used() const {
+        size_t total = 0;
+        for (const auto& file : files) total += file.second.size();
+        return total;
+    }
+};
+HostFsState& hostFs();
+
+class File : public Stream {
+public:
+    File() {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        if (!_handle || !_handle->writable) return 0;
+        HostFsState& state = hostFs();
+        auto it = state.files.find(_handle->path);
+        if (it == state.files.end()) return 0;
+        size_t room = state.capacity > state.used() ? state.capacity - state.used() : 0;
+        size_t grow = _handle->position + size > it->second.size() ? _handle->position + size - it->second.size() : 0;
+        if (grow > room) size -= grow - room;
+        size = state.take(size);
+        if (_handle->position + size > it->second.size()) it->second.resize(_handle->position + size);
+        if (size) memcpy(it->second.data() + _handle->position, buffer, size);
+        _handle->position += size;
+        return size;
+    }
+    using Print::write;
+
+    size_t read(uint8_t* buffer, size_t size) {
+        const std::vector<uint8_t>* data = _data();
+        if (!data || _handle->position >= data->size()) return 0;
+        size_t n = std::min(size, data->size() - _handle->position);
+        if (hostFs().shortReadPath == _handle->path) n = n > 1 ? n / 2 : 0;
+        memcpy(buffer, data->data() + _handle->position, n);
+        _handle->position += n;
+        return n;
+    }
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    int peek() override {
+        const std::vector<uint8_t>* data = _data();
+        return data && _handle->position < data->size() ? (*data)[_handle->position] : -1;
+    }
+    int available() override {
+        const std::vector<uint8_t>* data = _data();
+        return data && _handle->position < data->size() ? (int)(data->size() - _handle->position) : 0;
+    }
+    bool seek(uint32_t position, SeekMode mode = SeekSet) {
+        if (!_handle) return false;
+        size_t base = mode == SeekSet ? 0 : mode == SeekCur ? _handle->position : size();
+        _handle->position = base + position;
+        return _handle->position <= size();
+    }
+    size_t position() const { return _handle ? _handle->position : 0; }
+    size_t size() const {
+        const std::vector<uint8_t>* data = _data();
+        return data ? data->size() : 0;
+    }
+    void close() { _handle.reset(); }
+    void flush() override {}
+    operator bool() const { return (bool)_handle; }
+
+    const char* name() const {
+        if (!_handle) return "";
+        size_t slash = _handle->path.rfind('/');
+        return _handle->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+    }
+    const char* path() const { return _handle ? _handle->path.c_str() : ""; }
+    bool isDirectory() const { return _handle && _handle->directory; }
+    File openNextFile(const char* mode = "r") {
+        (void)mode;
+        if (!_handle || !_handle->directory || _handle->next >= _handle->listing.size()) return File();
+        return File::_open(_handle->listing[_handle->next++], false, false);
+    }
+
+    static File _open(const std::string& path, bool writable, bool directory) {
+        File file;
+        file._handle = std::make_shared<Handle>();
+        file._handle->path = path;
+        file._handle->writable = writable;
+        file._handle->directory = directory;
+        if (directory) {
+            std::string prefix = path == "/" ? "/" : path + "/";
+            for (const auto& entry : hostFs().files) {
+                if (entry.first.compare(0, prefix.size(), prefix) == 0 &&
+                    entry.first.find('/', prefix.size()) == std::string::npos) {
+                    file._handle->listing.push_back(entry.first);
+                }
+            }
+        }
+        return file;
+    }
+    void _setPosition(size_t position) { _handle->position = position; }
+
+private:
+    struct Handle {
+        std::string path;
+        bool writable = false;
+        bool directory = false;
+        size_t position = 0;
+        std::vector<std::string> listing;
+        size_t next = 0;
+    };
+    std::shared_ptr<Handle> _handle;
+
+    const std::vector<uint8_t>* _data() const {
+        if (!_handle || _handle->directory) return nullptr;
+        auto it = hostFs().files.find(_handle->path);
+        return it == hostFs().files.end() ? nullptr : &it->second;
+    }
+};
+
+class FS {
+public:
+    File open(const char* path, const char* mode = "r", bool create = false) {
+        (void)create;
+        HostFsState& state = hostFs();
+        std::string p(path);
+        if (state.dirs.count(p)) return File::_open(p, false, true);
+        auto it = state.files.find(p);
+        if (mode[0] == 'r') {
+            return it == state.files.end() ? File() : File::_open(p, mode[1] == '+', false);
+        }
+        if (mode[0] == 'w' || it == state.files.end()) {
+            // Create or truncate
+            if (state.take(1) == 0) return File();
+            state.files[p].clear();
+        }
+        File file = File::_open(p, true, false);
+        if (mode[0] == 'a') file._setPosition(state.files[p].size());
+        return file;
+    }
+    File open(const String& path, const char* mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char* path) { return hostFs().files.count(path) || hostFs().dirs.count(path); }
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path) {
+        HostFsState& state = hostFs();
+        if (!state.files.count(path)) return false;
+        if (state.take(1) == 0) return false;
+        state.files.erase(path);
+        return true;
+    }
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to) {
+        HostFsState& state = hostFs();
+        auto it = state.files.find(from);
+        if (it == state.files.end()) return false;
+        if (state.take(1) == 0) return false;
+        std::vector<uint8_t> data = std::move(it->second);
+        state.files.erase(it);
+        state.files[to] = std::move(data);
+        return true;
+    }
+    bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+    bool mkdir(const char* path) {
+        if (hostFs().take(1) == 0) return false;
+        hostFs().dirs.insert(path);
+        return true;
+    }
+    bool mkdir(const String& path) { return mkdir(path.c_str()); }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
+
+// Test controls
+inline void hostFsFormat() {
+    fs::hostFs() = fs::HostFsState();
+    fs::hostFs().dirs.insert("/");
+}
+inline void hostFsCutAfter(long long units) { fs::hostFs().budget = units; }
+inline void hostFsRestorePower() { fs::hostFs().budget = -1; }
+inline bool hostFsWasCut() { return fs::hostFs().cut(); }
+inline void hostFsResetCounter() { fs::hostFs().spent = 0; }
+inline unsigned long long hostFsUnitsSpent() { return fs::hostFs().spent; }
+inline void hostFsShortReads(const char* path) { fs::hostFs().shortReadPath = path ? path : ""; }
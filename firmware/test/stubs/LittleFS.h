@@ -0,0 +1,13 @@
+#pragma once
+
+#include <FS.h>
+
+class LittleFSFS : public fs::FS {
+public:
+    bool begin(bool formatOnFail = false) { (void)formatOnFail; return true; }
+    void end() {}
+    bool format() { hostFsFormat(); return true; }
+    size_t totalBytes() { return fs::hostFs().capacity; }
+    size_t usedBytes() { return fs::hostFs().used(); }
+};
+extern LittleFSFS LittleFS;
@@ -0,0 +1,116 @@
+// Host model of the NimBLE calls the config service makes: one peer, attribute
+// values kept in memory, notifications handed to hostBle().notify and client
+// writes delivered with hostBleWrite(). Everything else (HID, advertising,
+// security) is declared only, so code that actually calls it must not be linked.
+#pragma once
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#define BLE_HS_CONN_HANDLE_NONE 0xFFFF
+#define BLE_HS_IO_NO_INPUT_OUTPUT 3
+enum esp_power_level_t { ESP_PWR_LVL_P9 };
+namespace NIMBLE_PROPERTY { enum { READ=1, WRITE=2, WRITE_NR=4, NOTIFY=8, INDICATE=16, READ_ENC=32 }; }
+class NimBLEUUID { public: NimBLEUUID(uint16_t); NimBLEUUID(const char*); };
+
+class NimBLEAttValue {
+public:
+    NimBLEAttValue() {}
+    NimBLEAttValue(const uint8_t* data, size_t length) : _value((const char*)data, length) {}
+    const uint8_t* data() const { return (const uint8_t*)_value.data(); }
+    size_t size() const { return _value.size(); }
+    size_t length() const { return _value.size(); }
+    const char* c_str() const { return _value.c_str(); }
+private:
+    std::string _value;
+};
+
+class NimBLEConnInfo {
+public:
+    NimBLEConnInfo(uint16_t connHandle, uint16_t mtu) : _connHandle(connHandle), _mtu(mtu) {}
+    uint16_t getConnHandle() const { return _connHandle; }
+    uint16_t getMTU() const { return _mtu; }
+private:
+    uint16_t _connHandle;
+    uint16_t _mtu;
+};
+
+class NimBLECharacteristic;
+class NimBLECharacteristicCallbacks { public: virtual ~NimBLECharacteristicCallbacks(){} virtual void onWrite(NimBLECharacteristic*, NimBLEConnInfo&){} virtual void onSubscribe(NimBLECharacteristic*, NimBLEConnInfo&, uint16_t){} };
+
+class NimBLECharacteristic {
+public:
+    explicit NimBLECharacteristic(const char* uuid) : _uuid(uuid), _callbacks(nullptr) {}
+    ~NimBLECharacteristic() { delete _callbacks; }
+    void setCallbacks(NimBLECharacteristicCallbacks* callbacks) { delete _callbacks; _callbacks = callbacks; }
+    void setValue(const char* value) { _value = NimBLEAttValue((const uint8_t*)value, strlen(value)); }
+    void setValue(const uint8_t* data, size_t length) { _value = NimBLEAttValue(data, length); }
+    void setValue(const std::string& value) { setValue((const uint8_t*)value.data(), value.size()); }
+    NimBLEAttValue getValue() { return _value; }
+    bool notify(uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE) const { return notify(_value.data(), _value.size(), connHandle); }
+    bool notify(const uint8_t* data, size_t length, uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE) const;
+    // Host only
+    const std::string& uuid() const { return _uuid; }
+    NimBLECharacteristicCallbacks* callbacks() const { return _callbacks; }
+private:
+    std::string _uuid;
+    NimBLECharacteristicCallbacks* _callbacks;
+    NimBLEAttValue _value;
+};
+
+class NimBLEService {
+public:
+    ~NimBLEService() { for (size_t i = 0; i < _characteristics.size(); i++) delete _characteristics[i]; }
+    NimBLECharacteristic* createCharacteristic(const char* uuid, uint32_t properties) {
+        _characteristics.push_back(new NimBLECharacteristic(uuid));
+        return _characteristics.back();
+    }
+    NimBLECharacteristic* createCharacteristic(const NimBLEUUID&, uint32_t);
+    bool start() { return true; }
+    // Host only
+    const std::vector<NimBLECharacteristic*>& characteristics() const { return _characteristics; }
+private:
+    std::vector<NimBLECharacteristic*> _characteristics;
+};
+
+class NimBLEServer;
+class NimBLEServerCallbacks { public: virtual ~NimBLEServerCallbacks(){} virtual void onConnect(NimBLEServer*, NimBLEConnInfo&){} virtual void onDisconnect(NimBLEServer*, NimBLEConnInfo&, int){} virtual void onMTUChange(uint16_t, NimBLEConnInfo&){} };
+
+class NimBLEServer {
+public:
+    ~NimBLEServer() { clear(); }
+    NimBLEService* createService(const char* uuid) {
+        _services.push_back(new NimBLEService());
+        return _services.back();
+    }
+    uint32_t getConnectedCount();
+    std::vector<uint16_t> getPeerDevices() const;
+    void setCallbacks(NimBLEServerCallbacks*, bool del=true); uint16_t getPeerMTU(uint16_t); bool updateConnParams(uint16_t, uint16_t, uint16_t, uint16_t, uint16_t); void setDataLen(uint16_t, uint16_t);
+    // Host only
+    const std::vector<NimBLEService*>& services() const { return _services; }
+    void clear() {
+        for (size_t i = 0; i < _services.size(); i++) delete _services[i];
+        _services.clear();
+    }
+private:
+    std::vector<NimBLEService*> _services;
+};
+
+class NimBLEAdvertising { public: void setName(const std::string&); void setAppearance(uint16_t); void addServiceUUID(const NimBLEUUID&); void enableScanResponse(bool); };
+class NimBLEDevice { public: static void init(const std::string&); static NimBLEServer* createServer(); static NimBLEServer* getServer(); static void setSecurityAuth(bool,bool,bool); static void setSecurityIOCap(uint8_t); static void setPower(esp_power_level_t); static NimBLEAdvertising* getAdvertising(); static bool startAdvertising(); static void deinit(bool); static bool setMTU(uint16_t); static uint16_t getMTU(); };
+
+// ---- Host controls
+
+struct HostBleState {
+    NimBLEServer server;   // What NimBLEDevice::getServer() returns
+    uint32_t connected;    // Peers connected: 0 or 1
+    uint16_t connHandle;
+    uint16_t mtu;          // ATT MTU of the peer
+    // Every notification goes here; false means no buffer was free, as on the device
+    bool (*notify)(const uint8_t* data, size_t length);
+};
+
+HostBleState& hostBle();
+// Remove every service, and connect one peer with the default MTU
+void hostBleReset();
+// The peer writes `data` to the characteristic `uuid`, as the BLE task would deliver it
+bool hostBleWrite(const char* uuid, const uint8_t* data, size_t length);
@@ -0,0 +1,4 @@
+// Declarations only, see NimBLEDevice.h
+#pragma once
+#include <NimBLEDevice.h>
+class NimBLEHIDDevice { public: NimBLEHIDDevice(NimBLEServer*); void setManufacturer(const char*); void setPnp(uint8_t,uint16_t,uint16_t,uint16_t); void setHidInfo(uint8_t,uint8_t); void setReportMap(uint8_t*, uint16_t); NimBLECharacteristic* getInputReport(uint8_t); void setBatteryLevel(uint8_t); NimBLEService* getDeviceInfoService(); void startServices(); };
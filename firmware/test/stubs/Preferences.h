@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// NVS stand-in: one in-memory store shared by every Preferences object
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false) { _ns = name; (void)readOnly; return true; }
+    void end() {}
+    bool clear() { _store().erase(_ns); return true; }
+    bool remove(const char* key) { return _values().erase(key) > 0; }
+    bool isKey(const char* key) { return _values().count(key) > 0; }
+
+    size_t putUChar(const char* key, uint8_t v) { return _put(key, &v, sizeof(v)); }
+    uint8_t getUChar(const char* key, uint8_t d = 0) { return _get(key, d); }
+    size_t putUShort(const char* key, uint16_t v) { return _put(key, &v, sizeof(v)); }
+    uint16_t getUShort(const char* key, uint16_t d = 0) { return _get(key, d); }
+    size_t putUInt(const char* key, uint32_t v) { return _put(key, &v, sizeof(v)); }
+    uint32_t getUInt(const char* key, uint32_t d = 0) { return _get(key, d); }
+    size_t putBool(const char* key, bool v) { uint8_t b = v; return _put(key, &b, 1); }
+    bool getBool(const char* key, bool d = false) { return _get<uint8_t>(key, d) != 0; }
+    size_t putBytes(const char* key, const void* data, size_t length) { return _put(key, data, length); }
+    size_t getBytesLength(const char* key) { return isKey(key) ? _values()[key].size() : 0; }
+    size_t getBytes(const char* key, void* out, size_t length) {
+        if (!isKey(key)) return 0;
+        const std::vector<uint8_t>& value = _values()[key];
+        size_t n = std::min(length, value.size());
+        memcpy(out, value.data(), n);
+        return n;
+    }
+
+private:
+    std::string _ns;
+
+    static std::map<std::string, std::map<std::string, std::vector<uint8_t>>>& _store() {
+        static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> store;
+        return store;
+    }
+    std::map<std::string, std::vector<uint8_t>>& _values() { return _store()[_ns]; }
+    size_t _put(const char* key, const void* data, size_t length) {
+        _values()[key].assign((const uint8_t*)data, (const uint8_t*)data + length);
+        return length;
+    }
+    template <typename T>
+    T _get(const char* key, T fallback) {
+        if (!isKey(key) || _values()[key].size() != sizeof(T)) return fallback;
+        T value;
+        memcpy(&value, _values()[key].data(), sizeof(T));
+        return value;
+    }
+};
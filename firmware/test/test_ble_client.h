@@ -0,0 +1,98 @@
+// The config client's side of the framed transport, for tests that talk to a
+// BLEConfigService: requests go out as frames, the device's notifications are
+// put back together into messages and acked. Nothing is lost, so frames
+// arrive in order.
+#pragma once
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include <string>
+#include <vector>
+#include "ble_config.h"
+
+// Every notification since the client last looked
+inline std::vector<std::string>& hostNotified() {
+    static std::vector<std::string> notified;
+    return notified;
+}
+
+inline bool captureNotify(const uint8_t* data, size_t length) {
+    hostNotified().push_back(std::string((const char*)data, length));
+    return true;
+}
+
+const uint16_t CLIENT_MTU = 517;
+const size_t CLIENT_FRAME_PAYLOAD = 512 - 6;  // ATT writes stop at 512 bytes
+
+struct FramedClient {
+    std::vector<std::string> messages;  // Complete messages from the device, in order
+    int aborted = 0;
+    std::string partial;
+    bool receiving = false;
+    uint16_t expected = 0;   // Next device frame; what the ack says
+    uint16_t sequence = 0;   // Next frame of ours
+
+    // Connects the one host peer; notifications come here
+    FramedClient() {
+        hostBleReset();
+        hostBle().mtu = CLIENT_MTU;
+        hostBle().notify = captureNotify;
+        hostNotified().clear();
+    }
+
+    void send(const std::string& message) {
+        for (size_t offset = 0; offset < message.size(); offset += CLIENT_FRAME_PAYLOAD) {
+            size_t length = std::min(CLIENT_FRAME_PAYLOAD, message.size() - offset);
+            uint8_t flags = (offset == 0 ? 0x01 : 0) | (offset + length == message.size() ? 0x02 : 0);
+            std::string frame = { (char)0xC1, (char)flags, (char)(sequence & 0xFF), (char)(sequence >> 8),
+                                  (char)(length & 0xFF), (char)(length >> 8) };
+            frame += message.substr(offset, length);
+            hostBleWrite(CMD_CHAR_UUID, (const uint8_t*)frame.data(), frame.size());
+            sequence++;
+        }
+    }
+
+    // Take what the device notified, then ack it
+    void collect() {
+        std::vector<std::string>& notified = hostNotified();
+        for (const std::string& frame : notified) {
+            uint8_t flags = frame[1];
+            if (flags & 0x04) continue;
+            expected = (uint16_t)((uint8_t)frame[2] | ((uint8_t)frame[3] << 8)) + 1;
+            if (flags & 0x10) {
+                aborted++;
+                receiving = false;
+                continue;
+            }
+            if (flags & 0x01) {
+                partial.clear();
+                receiving = true;
+            }
+            if (!receiving) continue;
+            partial += frame.substr(6);
+            if (flags & 0x02) {
+                messages.push_back(partial);
+                receiving = false;
+            }
+        }
+        if (!notified.empty()) {
+            notified.clear();
+            uint8_t ack[12] = { 0xC1, 0x04, (uint8_t)(expected & 0xFF), (uint8_t)(expected >> 8),
+                                6, 0, 8, 0, 0, 0, 0, 0 };
+            hostBleWrite(CMD_CHAR_UUID, ack, sizeof(ack));
+        }
+    }
+
+    // Loop passes (`pass`, then collect) until the device has nothing left to send
+    template <typename Pass>
+    void receiveAll(BLEConfigService& service, Pass pass) {
+        for (int round = 0; round < 1000; round++) {
+            pass();
+            collect();
+            if (service.isTransmitIdle()) return;
+        }
+    }
+    void receiveAll(BLEConfigService& service) {
+        receiveAll(service, [&] { service.update(); });
+    }
+};
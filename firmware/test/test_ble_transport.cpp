@@ -0,0 +1,162 @@
+// Config service transport: inbound messages are bounded the same way on the
+// chunked and the framed path, and a refused message leaves the link usable.
+// Replies streamed from a profile slot end in an abort frame if the file goes
+// away, and saves leave the slot alone while it is being sent.
+#include <Arduino.h>
+#include <mbedtls/base64.h>
+#include <string>
+#include "ble_config.h"
+#include "profile_storage.h"
+#include "protocol_handler.h"
+#include "test_ble_client.h"
+#include "test_support.h"
+
+namespace {
+
+std::vector<std::string> delivered;
+
+}  // namespace
+
+// The service only hands messages over and asks whether to close its window
+ProtocolHandler::ProtocolHandler() {}
+void ProtocolHandler::handleMessage(String&& message) {
+    delivered.push_back(std::string(message.c_str(), message.length()));
+}
+bool ProtocolHandler::isRequestQueueFull() const { return false; }
+
+namespace {
+
+struct Link {
+    FramedClient client;
+    ProtocolHandler handler;
+    BLEConfigService service;
+
+    Link() {
+        delivered.clear();
+        service.begin(&handler);
+    }
+
+    void sendFramed(const std::string& message) { client.send(message); }
+    void receiveAll() { client.receiveAll(service); }
+
+    void sendChunked(const std::string& message, size_t stride) {
+        size_t total = (message.size() + stride - 1) / stride;
+        for (size_t chunk = 0; chunk < total; chunk++) {
+            std::string raw = message.substr(chunk * stride, stride);
+            unsigned char encoded[1024];
+            size_t encodedLength = 0;
+            mbedtls_base64_encode(encoded, sizeof(encoded), &encodedLength, (const unsigned char*)raw.data(),
+                                  raw.size());
+            std::string write = "{\"chunk\":" + std::to_string(chunk) + ",\"total\":" + std::to_string(total) +
+                                ",\"dataB64\":\"" + std::string((const char*)encoded, encodedLength) + "\"}";
+            hostBleWrite(CMD_CHAR_UUID, (const uint8_t*)write.data(), write.size());
+        }
+    }
+};
+
+std::string messageOf(size_t length) {
+    std::string message = "{\"cmd\":\"importAll\",\"pad\":\"";
+    message.resize(length - 2, 'x');
+    return message + "\"}";
+}
+
+void testFramedLimit() {
+    Link link;
+    std::string largest = messageOf(BLE_MAX_MESSAGE_BYTES);
+    link.sendFramed(largest);
+    CHECK(delivered.size() == 1 && delivered[0] == largest, "message at the limit is delivered");
+
+    link.sendFramed(messageOf(BLE_MAX_MESSAGE_BYTES + 1));
+    CHECK(delivered.size() == 1, "message over the limit is dropped");
+
+    std::string next = "{\"cmd\":\"getCaps\"}";
+    link.sendFramed(next);
+    CHECK(delivered.size() == 2 && delivered[1] == next, "the link carries on after a drop");
+}
+
+void testChunkedLimit() {
+    Link link;
+    std::string largest = messageOf(BLE_MAX_MESSAGE_BYTES);
+    link.sendChunked(largest, BLE_MAX_MESSAGE_BYTES / BLE_MAX_CHUNKS);
+    CHECK(delivered.size() == 1 && delivered[0] == largest, "chunked transfer at the limit is delivered");
+
+    // Fewer chunks than the most allowed, but each too large for the total to fit
+    link.sendChunked(messageOf(BLE_MAX_MESSAGE_BYTES + 100), BLE_MAX_MESSAGE_BYTES / 200);
+    CHECK(delivered.size() == 1, "chunked transfer over the limit is refused");
+
+    std::string next = messageOf(2000);
+    link.sendChunked(next, 300);
+    CHECK(delivered.size() == 2 && delivered[1] == next, "the next transfer goes through");
+}
+
+void testAbortWhenFileGoesAway() {
+    hostFsFormat();
+    Link link;
+    link.sendFramed("{\"cmd\":\"getCaps\"}");  // Makes this a framed client
+    std::string body(4000, 'b');
+    File file = LittleFS.open("/reply.json", "w");
+    file.write((const uint8_t*)body.data(), body.size());
+    file.close();
+
+    FramedClient& inbox = link.client;
+    link.receiveAll();
+    CHECK(link.service.sendFramedFile("{", "/reply.json", 0, body.size(), "}"), "file reply queued");
+    link.service.update();  // First frames go out
+    LittleFS.remove("/reply.json");
+    link.receiveAll();
+    CHECK(inbox.messages.empty(), "no message made of the wrong bytes (%zu)", inbox.messages.size());
+    CHECK(inbox.aborted > 0 && !inbox.receiving, "client told to drop the partial reply");
+
+    link.service.sendEvent("{\"type\":\"event\"}");
+    link.receiveAll();
+    CHECK(inbox.messages.size() == 1 && inbox.messages[0] == "{\"type\":\"event\"}", "next message is intact");
+}
+
+bool isSlotBeingSent(const String& path, void* context) {
+    return static_cast<BLEConfigService*>(context)->isSendingFile(path);
+}
+
+void testSaveLeavesSlotBeingSent() {
+    hostFsFormat();
+    ProfileStorage storage;
+    storage.init();
+    Profile* profile = makeTestProfile(20, "Streamed");
+    CHECK(storage.saveProfile(*profile), "first save");
+
+    Link link;
+    storage.setSlotReaderCheck(isSlotBeingSent, &link.service);
+    link.sendFramed("{\"cmd\":\"getCaps\"}");
+    FramedClient& inbox = link.client;
+    link.receiveAll();
+
+    String path;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    CHECK(storage.getStoredProfileBody(20, path, offset, length), "stored body");
+    File file = LittleFS.open(path, "r");
+    std::string body(length, '\0');
+    file.seek(offset);
+    file.read((uint8_t*)&body[0], length);
+    file.close();
+    CHECK(link.service.sendFramedFile("", path, offset, length, ""), "body reply queued");
+
+    strlcpy(profile->name, "Second", sizeof(profile->name));
+    CHECK(storage.saveProfile(*profile), "save to the other slot");
+    strlcpy(profile->name, "Third", sizeof(profile->name));
+    CHECK(!storage.saveProfile(*profile), "save over the slot being sent is refused");
+
+    link.receiveAll();
+    CHECK(inbox.messages.size() == 1 && inbox.messages[0] == body, "reply is the body as it was");
+    CHECK(storage.saveProfile(*profile), "save goes through once the reply is out");
+    delete profile;
+}
+
+}  // namespace
+
+int main() {
+    testFramedLimit();
+    testChunkedLimit();
+    testAbortWhenFileGoesAway();
+    testSaveLeavesSlotBeingSent();
+    return testResult("ble transport");
+}
@@ -0,0 +1,132 @@
+// importAll is all or nothing: the archive's profiles are staged beside the
+// stored ones and committed at once, so after a power cut at any point, or a
+// full partition, the device holds either its old profiles or the archive's.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <string>
+#include "profile_manager.h"
+#include "test_support.h"
+
+namespace {
+
+const uint16_t OLD_ID = 30;        // On the device, not in the archive
+const uint16_t NEW_IDS[] = { 40, 41 };  // In the archive only
+
+void saveUserProfile(ProfileStorage& storage, uint16_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "User %u", id);
+    Profile* profile = makeTestProfile(id, name);
+    CHECK(storage.saveProfile(*profile), "save profile %u", id);
+    delete profile;
+}
+
+// importAll request body exported from a device holding the built-ins and NEW_IDS
+std::string makeImportRequest() {
+    hostFsFormat();
+    ProfileStorage storage;
+    storage.init();
+    for (uint16_t id : NEW_IDS) saveUserProfile(storage, id);
+    uint32_t length = 0;
+    CHECK(storage.writeArchive(PROFILE_ARCHIVE_PATH, NEW_IDS[0], length), "export");
+    std::string archive(length, '\0');
+    File file = LittleFS.open(PROFILE_ARCHIVE_PATH, "r");
+    file.read((uint8_t*)&archive[0], length);
+    file.close();
+    return "{\"cmd\":\"importAll\",\"archive\":" + archive + "}";
+}
+
+// A device holding the built-ins and OLD_ID
+void prepareDevice() {
+    hostFsFormat();
+    ProfileStorage storage;
+    storage.init();
+    saveUserProfile(storage, OLD_ID);
+}
+
+bool import(const std::string& request) {
+    PersistenceService persistence;
+    ProfileManager manager;
+    if (!manager.init(&persistence)) return false;
+    ProfileArchiveInfo info;
+    return manager.checkArchive(request.data(), request.size(), info) == PROFILE_DECODE_OK &&
+           manager.importArchive(request.data(), request.size(), info);
+}
+
+bool loads(ProfileStorage& storage, uint16_t id) {
+    Profile* profile = new Profile;
+    bool ok = storage.loadProfile(id, *profile) && profile->id == id;
+    delete profile;
+    return ok;
+}
+
+bool stagedFilesLeft() {
+    for (const auto& file : fs::hostFs().files) {
+        if (file.first.compare(0, strlen(PROFILE_IMPORT_PATH "/"), PROFILE_IMPORT_PATH "/") == 0) return true;
+    }
+    return false;
+}
+
+void testImportReplacesProfiles() {
+    std::string request = makeImportRequest();
+    prepareDevice();
+    CHECK(import(request), "import");
+    ProfileStorage storage;
+    storage.init();
+    CHECK(!storage.profileExists(OLD_ID), "profile left out of the archive is gone");
+    for (uint16_t id : NEW_IDS) CHECK(loads(storage, id), "archive profile %u stored", id);
+}
+
+void testPowerCutIsAtomic() {
+    std::string request = makeImportRequest();
+    prepareDevice();
+    hostFsResetCounter();
+    CHECK(import(request), "uncut import");
+    unsigned long long units = fs::hostFs().spent;
+
+    // Cut at every point (in steps; writes cost one unit per byte)
+    int imported = 0;
+    int cuts = 0;
+    for (unsigned long long cut = 0; cut <= units; cut += cut < 64 ? 1 : 53) {
+        prepareDevice();
+        hostFsCutAfter(cut);
+        import(request);
+        hostFsRestorePower();
+        cuts++;
+
+        ProfileStorage storage;
+        storage.init();
+        bool anyNew = storage.profileExists(NEW_IDS[0]) || storage.profileExists(NEW_IDS[1]);
+        if (storage.profileExists(OLD_ID)) {
+            CHECK(loads(storage, OLD_ID), "cut %llu: old profile damaged", cut);
+            CHECK(!anyNew, "cut %llu: archive profiles next to the old ones", cut);
+        } else {
+            imported++;
+            CHECK(loads(storage, NEW_IDS[0]) && loads(storage, NEW_IDS[1]),
+                  "cut %llu: old profile deleted before the archive was in", cut);
+        }
+        CHECK(!stagedFilesLeft(), "cut %llu: staged files left behind", cut);
+    }
+    CHECK(imported > 0 && imported < cuts, "cuts on both sides of the commit (%d of %d imported)", imported, cuts);
+}
+
+void testNoRoomChangesNothing() {
+    std::string request = makeImportRequest();
+    prepareDevice();
+    fs::hostFs().capacity = fs::hostFs().used() + request.size();  // Less than the check asks for
+    CHECK(!import(request), "import refused");
+    fs::hostFs().capacity = 1536 * 1024;
+
+    ProfileStorage storage;
+    storage.init();
+    CHECK(loads(storage, OLD_ID), "stored profile kept");
+    for (uint16_t id : NEW_IDS) CHECK(!storage.profileExists(id), "nothing of the archive written (%u)", id);
+}
+
+}  // namespace
+
+int main() {
+    testImportReplacesProfiles();
+    testPowerCutIsAtomic();
+    testNoRoomChangesNothing();
+    return testResult("profile import");
+}
@@ -0,0 +1,149 @@
+// Edit journal semantics: one save is one edit for undo, a save torn before its
+// commit is dropped whole, and journals written before grouping still load.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "profile_storage.h"
+#include "profile_text.h"
+#include "crc32.h"
+#include "test_support.h"
+
+namespace {
+
+const uint16_t ID = 9;
+
+Profile* baseProfile() {
+    Profile* profile = makeTestProfile(ID, "Base");
+    for (uint8_t e = 0; e < 2; e++) {
+        profile->encoders[e].acceleration = true;
+        profile->encoders[e].stepsPerDetent = 4;
+    }
+    return profile;
+}
+
+uint8_t keyOf(const Profile& profile, uint8_t index) {
+    return profile.keys[index].action.config.hotkey.key;
+}
+
+void testUndoRevertsWholeSave() {
+    hostFsFormat();
+    ProfileStorage storage;
+    storage.init();
+    Profile* profile = baseProfile();
+    CHECK(storage.saveProfile(*profile), "base save");
+
+    // First save: one key. Second save: three keys, an encoder and the name.
+    setHotkey(profile->keys[0].action, 1, 0x30);
+    CHECK(storage.saveProfileIncremental(*profile), "first edit");
+    setHotkey(profile->keys[1].action, 2, 0x31);
+    setHotkey(profile->keys[2].action, 2, 0x32);
+    setHotkey(profile->keys[5].action, 2, 0x35);
+    profile->encoders[0].stepsPerDetent = 2;
+    strlcpy(profile->name, "Edited", sizeof(profile->name));
+    CHECK(storage.saveProfileIncremental(*profile), "second edit");
+    CHECK(storage.getManifestEntry(ID)->journalLength > 0, "edits should be journaled");
+
+    Profile* loaded = new Profile;
+    CHECK(storage.undoLastEdit(ID), "undo of second edit");
+    CHECK(storage.loadProfile(ID, *loaded), "load after undo");
+    CHECK(keyOf(*loaded, 0) == 0x30, "first edit must survive, got %#x", keyOf(*loaded, 0));
+    CHECK(keyOf(*loaded, 1) == 0x05 && keyOf(*loaded, 2) == 0x06 && keyOf(*loaded, 5) == 0x09,
+          "every key of the second edit reverts");
+    CHECK(loaded->encoders[0].stepsPerDetent == 4, "encoder reverts");
+    CHECK(strcmp(loaded->name, "Base") == 0, "name reverts, got '%s'", loaded->name);
+    CHECK(strcmp(storage.getManifestEntry(ID)->name, "Base") == 0, "manifest name follows the undo");
+
+    CHECK(storage.undoLastEdit(ID), "undo of first edit");
+    CHECK(storage.loadProfile(ID, *loaded) && keyOf(*loaded, 0) == 0x04, "first edit reverts");
+    CHECK(!storage.undoLastEdit(ID), "nothing left to undo");
+
+    // A reboot sees the same thing
+    ProfileStorage rebooted;
+    rebooted.init();
+    CHECK(rebooted.loadProfile(ID, *loaded) && keyOf(*loaded, 0) == 0x04 && keyOf(*loaded, 1) == 0x05 &&
+          strcmp(loaded->name, "Base") == 0, "state after reboot");
+    delete loaded;
+    delete profile;
+}
+
+void testTornSaveDroppedWhole() {
+    // Cut the save of two keys at every point: both keys change or neither does
+    for (long long cut = 0; cut < 80; cut++) {
+        hostFsFormat();
+        Profile* profile = baseProfile();
+        {
+            ProfileStorage storage;
+            storage.init();
+            CHECK(storage.saveProfile(*profile), "base save");
+            setHotkey(profile->keys[1].action, 2, 0x31);
+            setHotkey(profile->keys[2].action, 2, 0x32);
+            hostFsCutAfter(cut);
+            storage.saveProfileIncremental(*profile);
+            hostFsRestorePower();
+        }
+        ProfileStorage storage;
+        storage.init();
+        CHECK(storage.loadProfile(ID, *profile), "load after cut %lld", cut);
+        bool none = keyOf(*profile, 1) == 0x05 && keyOf(*profile, 2) == 0x06;
+        bool both = keyOf(*profile, 1) == 0x31 && keyOf(*profile, 2) == 0x32;
+        CHECK(none || both, "cut %lld applied half a save (%#x, %#x)", cut, keyOf(*profile, 1), keyOf(*profile, 2));
+        delete profile;
+    }
+}
+
+// Journal files from before saves were grouped: every record is its own edit
+void writeRecord(File& file, uint8_t op, uint8_t target, const uint8_t* payload, uint16_t length) {
+    uint8_t header[4] = { op, target, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8) };
+    uint32_t crc = crc32Update(crc32Update(0, header, sizeof(header)), payload, length);
+    file.write(header, sizeof(header));
+    file.write(payload, length);
+    file.write((const uint8_t*)&crc, sizeof(crc));
+}
+
+void testUngroupedJournalLoads() {
+    hostFsFormat();
+    Profile* profile = baseProfile();
+    {
+        ProfileStorage storage;
+        storage.init();
+        CHECK(storage.saveProfile(*profile), "base save");
+    }
+
+    // Hand-written old-format journal on top of slot sequence 1: two edits
+    File file = LittleFS.open(PROFILES_PATH "/profile_9.jnl", "w");
+    uint32_t head[2] = { 0x4C4A504D, 1 };  // "MPJL", base sequence
+    file.write((const uint8_t*)head, sizeof(head));
+    const uint8_t key1[] = { ACTION_HOTKEY, 0, 0x41 };
+    const uint8_t key2[] = { ACTION_HOTKEY, 0, 0x42 };
+    writeRecord(file, JOURNAL_OP_SET_ACTION, 1, key1, sizeof(key1));
+    writeRecord(file, JOURNAL_OP_SET_ACTION, 2, key2, sizeof(key2));
+    file.close();
+
+    ProfileStorage storage;
+    storage.init();
+    Profile* loaded = new Profile;
+    CHECK(storage.loadProfile(ID, *loaded) && keyOf(*loaded, 1) == 0x41 && keyOf(*loaded, 2) == 0x42,
+          "old journal replays");
+    CHECK(!storage.undoLastEdit(ID), "old journal is not undone record by record");
+
+    // Compaction folds it into a snapshot; after that edits group as usual
+    for (int i = 0; i < 4; i++) storage.update();
+    CHECK(storage.getManifestEntry(ID)->journalLength == 0, "old journal compacted");
+    CHECK(storage.loadProfile(ID, *loaded) && keyOf(*loaded, 1) == 0x41, "compacted content");
+    setHotkey(loaded->keys[3].action, 0, 0x43);
+    setHotkey(loaded->keys[4].action, 0, 0x44);
+    CHECK(storage.saveProfileIncremental(*loaded), "edit after compaction");
+    CHECK(storage.undoLastEdit(ID), "undo after compaction");
+    CHECK(storage.loadProfile(ID, *loaded) && keyOf(*loaded, 3) == 0x07 && keyOf(*loaded, 4) == 0x08,
+          "both keys revert");
+    delete loaded;
+    delete profile;
+}
+
+}  // namespace
+
+int main() {
+    testUndoRevertsWholeSave();
+    testTornSaveDroppedWhole();
+    testUngroupedJournalLoads();
+    return testResult("profile journal");
+}
@@ -0,0 +1,206 @@
+// Text pool limits: profiles stored before texts were pooled load whole, the
+// largest of them in the blocks profile.h budgets; profiles share the text
+// they have in common; and when the pool has no room a load or upload fails
+// rather than keeping shortened texts, with nothing rewritten on flash.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <string>
+#include "profile_storage.h"
+#include "profile_json_reader.h"
+#include "profile_text.h"
+#include "test_support.h"
+
+namespace {
+
+const uint16_t ID = 20;
+const size_t OLD_TEXT_MAX = 127;       // char text[128] before the pool
+const size_t OLD_MACRO_TEXT_MAX = 31;  // char text[32] per macro step
+const unsigned INPUTS = MATRIX_KEYS + 6;
+
+// Distinct text of `length` characters for `index`
+std::string textFor(unsigned index, size_t length) {
+    std::string text = "#" + std::to_string(index) + " ";
+    while (text.size() < length) text += (char)('a' + (index + text.size()) % 26);
+    return text;
+}
+
+std::string textAction(unsigned index) {
+    return "{\"type\":3,\"text\":\"" + textFor(index, OLD_TEXT_MAX) + "\"}";
+}
+
+std::string macroAction(unsigned index) {
+    std::string json = "{\"type\":2,\"macroSteps\":[";
+    for (unsigned s = 0; s < MAX_MACRO_STEPS; s++) {
+        if (s) json += ",";
+        json += "{\"stepType\":3,\"text\":\"" + textFor(index * MAX_MACRO_STEPS + s, OLD_MACRO_TEXT_MAX) + "\"}";
+    }
+    return json + "]}";
+}
+
+// Profile JSON as the firmware wrote it: every input a text action, or every
+// input a macro of full-length text steps (the most text a profile could hold)
+std::string profileJson(bool macros) {
+    std::string json = "{\"id\":" + std::to_string(ID) + ",\"name\":\"Maximal\",\"version\":1,\"keys\":[";
+    for (unsigned i = 0; i < MATRIX_KEYS; i++) {
+        if (i) json += ",";
+        json += macros ? macroAction(i) : textAction(i);
+    }
+    json += "],\"encoders\":[";
+    for (unsigned e = 0; e < 2; e++) {
+        unsigned base = MATRIX_KEYS + e * 3;
+        if (e) json += ",";
+        json += "{\"cwAction\":" + (macros ? macroAction(base) : textAction(base)) +
+                ",\"ccwAction\":" + (macros ? macroAction(base + 1) : textAction(base + 1)) +
+                ",\"pressAction\":" + (macros ? macroAction(base + 2) : textAction(base + 2)) +
+                ",\"acceleration\":true,\"stepsPerDetent\":4}";
+    }
+    return json + "]}";
+}
+
+void writeLegacySlot(const std::string& json) {
+    hostFsFormat();
+    LittleFS.mkdir(PROFILES_PATH);
+    File file = LittleFS.open(PROFILES_PATH "/profile_20.json", "w");
+    file.write((const uint8_t*)json.data(), json.size());
+    file.close();
+}
+
+const Action& inputAction(const Profile& profile, unsigned index) {
+    if (index < MATRIX_KEYS) return profile.keys[index].action;
+    const EncoderConfig& encoder = profile.encoders[(index - MATRIX_KEYS) / 3];
+    switch ((index - MATRIX_KEYS) % 3) {
+        case 0: return encoder.cwAction;
+        case 1: return encoder.ccwAction;
+        default: return encoder.pressAction;
+    }
+}
+
+// Every text of the profile profileJson(macros) describes, in full
+bool textsWhole(const Profile& profile, bool macros) {
+    for (unsigned i = 0; i < INPUTS; i++) {
+        const Action& action = inputAction(profile, i);
+        if (!macros) {
+            if (action.type != ACTION_TEXT || textFor(i, OLD_TEXT_MAX) != profileText(action.config.text.textRef)) {
+                return false;
+            }
+            continue;
+        }
+        if (action.type != ACTION_MACRO || action.config.macro.stepCount != MAX_MACRO_STEPS) return false;
+        for (unsigned s = 0; s < MAX_MACRO_STEPS; s++) {
+            if (textFor(i * MAX_MACRO_STEPS + s, OLD_MACRO_TEXT_MAX) !=
+                profileText(action.config.macro.steps[s].textRef)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Distinct full-length texts nothing refers to, until the pool takes no more
+void fillPool() {
+    uint16_t ref;
+    for (unsigned i = 0; i < 1000; i++) {
+        std::string text = "filler " + std::to_string(i);
+        text.resize(TEXT_ACTION_MAX_LENGTH, '.');
+        if (!profileInternText(text.data(), text.size(), ref)) return;
+    }
+    CHECK(false, "pool never filled");
+}
+
+void testLegacyProfilesLoadWhole() {
+    for (int macros = 0; macros < 2; macros++) {
+        writeLegacySlot(profileJson(macros));
+        ProfileStorage storage;
+        storage.init();
+        Profile* profile = new Profile;
+        CHECK(storage.loadProfile(ID, *profile), "legacy profile loads (macros %d)", macros);
+        CHECK(textsWhole(*profile, macros), "every text kept (macros %d)", macros);
+
+        Profile* roots[1] = { profile };
+        profileTextCollect(roots, 1);
+        CHECK(textsWhole(*profile, macros), "references follow a collection (macros %d)", macros);
+        CHECK(profileTextBytes() <= PROFILE_TEXT_POOL_BYTES / 4, "%zu bytes, within a quarter of the pool",
+              profileTextBytes());
+        delete profile;
+    }
+}
+
+void testProfilesShareText() {
+    profileTextCollect(nullptr, 0);
+    Profile* first = makeTestProfile(1, "First");
+    Profile* second = makeTestProfile(2, "Second");
+    std::string shared = "console.log();";
+    first->keys[0].action.type = ACTION_TEXT;
+    second->keys[5].action.type = ACTION_TEXT;
+    CHECK(profileInternText(shared.data(), shared.size(), first->keys[0].action.config.text.textRef) &&
+          profileInternText(shared.data(), shared.size(), second->keys[5].action.config.text.textRef),
+          "both interned");
+    CHECK(first->keys[0].action.config.text.textRef == second->keys[5].action.config.text.textRef,
+          "stored once for both profiles");
+
+    uint16_t dropped;
+    CHECK(profileInternText("gone", 4, dropped), "unreferenced text");
+    size_t before = profileTextBytes();
+    Profile* roots[2] = { first, second };
+    profileTextCollect(roots, 2);
+    CHECK(profileTextBytes() == shared.size() + 2 && profileTextBytes() < before, "only the shared text kept");
+    CHECK(shared == profileText(second->keys[5].action.config.text.textRef), "still readable");
+    delete first;
+    delete second;
+}
+
+void testFullPoolFailsLoad() {
+    writeLegacySlot(profileJson(true));
+    ProfileStorage storage;
+    storage.init();
+    profileTextCollect(nullptr, 0);
+    fillPool();
+
+    Profile* profile = new Profile;
+    CHECK(!storage.loadProfile(ID, *profile), "load fails when the text doesn't fit");
+    std::string request = "{\"profile\":" + profileJson(true) + "}";
+    CHECK(decodeProfileJson(request.data(), request.size(), "profile", *profile) == PROFILE_DECODE_TEXT_FULL,
+          "upload refused");
+    storage.update();
+
+    profileTextCollect(nullptr, 0);
+    CHECK(storage.loadProfile(ID, *profile) && textsWhole(*profile, true), "loads whole once there is room");
+    delete profile;
+}
+
+// A journaled text edit that doesn't fit fails the load: compacting what did
+// load would store the profile without it
+void testFullPoolKeepsJournal() {
+    hostFsFormat();
+    ProfileStorage storage;
+    storage.init();
+    Profile* profile = makeTestProfile(ID, "Journaled");
+    CHECK(storage.saveProfile(*profile), "snapshot");
+    std::string edit = textFor(7, TEXT_ACTION_MAX_LENGTH);
+    profile->keys[3].action.type = ACTION_TEXT;
+    CHECK(profileInternText(edit.data(), edit.size(), profile->keys[3].action.config.text.textRef), "edit text");
+    CHECK(storage.saveProfileIncremental(*profile), "edit journaled");
+    CHECK(storage.getManifestEntry(ID)->journalLength > 0, "held in the journal");
+
+    profileTextCollect(nullptr, 0);
+    fillPool();
+    CHECK(!storage.loadProfile(ID, *profile), "load fails when the edit's text doesn't fit");
+    storage.update();
+    CHECK(storage.getManifestEntry(ID)->journalLength > 0, "journal not folded into a snapshot");
+
+    profileTextCollect(nullptr, 0);
+    CHECK(storage.loadProfile(ID, *profile), "loads once there is room");
+    CHECK(profile->keys[3].action.type == ACTION_TEXT && edit == profileText(profile->keys[3].action.config.text.textRef),
+          "edit kept");
+    delete profile;
+}
+
+}  // namespace
+
+int main() {
+    testLegacyProfilesLoadWhole();
+    testProfilesShareText();
+    testFullPoolFailsLoad();
+    testFullPoolKeepsJournal();
+    return testResult("profile text pool");
+}
@@ -0,0 +1,306 @@
+// Request queue and replies, end to end over the framed transport: queries
+// overtake queued writes, a full queue answers busy, a batch reply is put
+// together from its encoded results in JSON and MessagePack, and the cached
+// first page of listProfiles follows the manifest. An export too large to
+// import again is refused.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <string>
+#include "ble_config.h"
+#include "ble_hid.h"
+#include "bench_profiles.h"
+#include "persistence_service.h"
+#include "profile_manager.h"
+#include "profile_text.h"
+#include "protocol_handler.h"
+#include "test_ble_client.h"
+#include "test_support.h"
+
+// getConnectionStatus asks the keyboard; no keyboard is attached here
+bool BLEKeyboard::isConnected() { return false; }
+bool BLEKeyboard::isHidReady() const { return false; }
+
+namespace {
+
+struct Device {
+    FramedClient client;
+    PersistenceService persistence;
+    ProfileManager profiles;
+    ProtocolHandler handler;
+    BLEConfigService service;
+
+    // `prepare` fills the freshly formatted flash before the device starts
+    explicit Device(void (*prepare)() = nullptr) {
+        hostFsFormat();
+        if (prepare) prepare();
+        persistence.init();
+        CHECK(profiles.init(&persistence), "profile manager");
+        handler.init(&profiles);
+        service.begin(&handler);
+        handler.setBLEService(&service);
+    }
+
+    // Loop passes, as Micropad.ino runs them, until every reply is out
+    void run() {
+        client.receiveAll(service, [&] {
+            service.update();
+            handler.update();
+        });
+    }
+
+    void send(const std::string& request) { client.send(request); }
+};
+
+// The replies among the client's messages: their ids in order, payloads by id
+struct Replies {
+    std::vector<uint32_t> ids;
+    std::vector<std::string> payloads;
+
+    explicit Replies(const FramedClient& client) {
+        for (const std::string& message : client.messages) {
+            DynamicJsonDocument doc(16384);
+            bool json = message[0] == '{';
+            DeserializationError error = json ? deserializeJson(doc, message.data(), message.size())
+                                              : deserializeMsgPack(doc, message.data(), message.size());
+            CHECK(!error, "reply parses (%s)", error.c_str());
+            if (strcmp(doc["type"] | "", "response") != 0) continue;
+            ids.push_back(doc["id"] | 0u);
+            String payload;
+            serializeJson(doc["payload"], payload);
+            payloads.push_back(payload.c_str());
+        }
+    }
+
+    // Payload of the reply to `id`, parsed into `doc`; false if none came
+    bool payload(uint32_t id, JsonDocument& doc) const {
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (ids[i] == id) return !deserializeJson(doc, payloads[i].c_str());
+        }
+        return false;
+    }
+};
+
+std::string request(uint32_t id, const char* cmd, const char* extra = "") {
+    return "{\"v\":1,\"type\":\"request\",\"id\":" + std::to_string(id) + ",\"cmd\":\"" + cmd + "\"" + extra + "}";
+}
+
+void testQueriesOvertakeWrites() {
+    Device device;
+    device.send(request(1, "setActiveProfile", ",\"profileId\":1"));
+    device.send(request(2, "getActiveProfile"));
+    device.send(request(3, "deleteProfile", ",\"profileId\":200"));
+    device.send(request(4, "getCaps"));
+    device.run();
+
+    Replies replies(device.client);
+    std::vector<uint32_t> expected = { 2, 4, 1, 3 };
+    CHECK(replies.ids == expected, "queries first, then writes in arrival order (%zu replies)", replies.ids.size());
+
+    DynamicJsonDocument payload(256);
+    CHECK(replies.payload(2, payload) && (payload["profileId"] | -1) == 0, "query ran before the switch");
+    CHECK(replies.payload(1, payload) && (payload["success"] | false), "switch ran");
+}
+
+// A client may keep a full queue of requests in flight; each gets its reply
+// however few messages the transport can hold
+void testPipelinedQueries() {
+    Device device;
+    for (uint32_t id = 1; id <= PROTOCOL_QUEUE_DEPTH; id++) {
+        // setActiveProfile also sends an event
+        const char* cmd = id % 3 == 0 ? "setActiveProfile" : id % 3 == 1 ? "getProfile" : "getActiveProfile";
+        device.send(request(id, cmd, ",\"profileId\":1"));
+    }
+    // The loop comes round far more often than the client acks
+    for (uint32_t pass = 0; pass < PROTOCOL_QUEUE_DEPTH; pass++) {
+        device.handler.update();
+    }
+    device.run();
+    Replies replies(device.client);
+    CHECK(replies.ids.size() == PROTOCOL_QUEUE_DEPTH, "%zu replies to %u requests", replies.ids.size(),
+          (unsigned)PROTOCOL_QUEUE_DEPTH);
+}
+
+// The framed window closes while the queue is full, so a refusal is for
+// requests that come some other way (chunked writes, the WebSocket server)
+void testBusyWhenFull() {
+    Device device;
+    for (uint32_t id = 1; id <= PROTOCOL_QUEUE_DEPTH; id++) {
+        device.send(request(id, "getActiveProfile"));
+    }
+    CHECK(device.handler.isRequestQueueFull(), "queue full");
+    device.handler.handleMessage(String(request(99, "getActiveProfile").c_str()));
+    device.run();
+
+    Replies replies(device.client);
+    DynamicJsonDocument payload(256);
+    CHECK(!replies.ids.empty() && replies.ids[0] == 99, "refusal sent at once");
+    CHECK(replies.payload(99, payload) && (payload["busy"] | false) && !(payload["success"] | true),
+          "refused as busy");
+
+    device.send(request(100, "getActiveProfile"));
+    device.run();
+    Replies after(device.client);
+    CHECK(after.payload(100, payload) && payload["busy"].isNull(), "taken again once the queue drains");
+}
+
+void checkBatchResults(const Replies& replies, uint32_t id) {
+    DynamicJsonDocument payload(8192);
+    CHECK(replies.payload(id, payload), "batch reply %u", id);
+    JsonArrayConst results = payload["results"].as<JsonArrayConst>();
+    CHECK(results.size() == 4, "one result per request (%zu)", results.size());
+    CHECK((results[0]["profileId"] | -1) == 0, "getActiveProfile result");
+    CHECK((results[1]["maxProfiles"] | 0) == MAX_PROFILES, "getCaps result");
+    CHECK(strcmp(results[2]["error"] | "", "Not allowed in batch") == 0, "write refused in place");
+    CHECK(results[3]["profiles"].size() > 0 && (results[3]["total"] | 0u) == results[3]["profiles"].size(),
+          "listProfiles result");
+}
+
+void testBatchAssembly() {
+    Device device;
+    device.send(request(7, "batch", ",\"requests\":[{\"cmd\":\"getActiveProfile\"},{\"cmd\":\"getCaps\"},"
+                                      "{\"cmd\":\"setActiveProfile\",\"profileId\":1},{\"cmd\":\"listProfiles\"}]"));
+    device.run();
+    checkBatchResults(Replies(device.client), 7);
+
+    DynamicJsonDocument doc(1024);
+    doc["v"] = 1;
+    doc["type"] = "request";
+    doc["id"] = 8;
+    doc["cmd"] = "batch";
+    JsonArray requests = doc.createNestedArray("requests");
+    requests.createNestedObject()["cmd"] = "getActiveProfile";
+    requests.createNestedObject()["op"] = (int)ProtocolHandler::CMD_GET_CAPS;
+    JsonObject write = requests.createNestedObject();
+    write["cmd"] = "setActiveProfile";
+    write["profileId"] = 1;
+    requests.createNestedObject()["cmd"] = "listProfiles";
+    std::string packed(measureMsgPack(doc), '\0');
+    serializeMsgPack(doc, &packed[0], packed.size());
+    device.send(packed);
+    device.run();
+
+    Replies replies(device.client);
+    CHECK(device.client.messages.back()[0] != '{', "MessagePack request answered in MessagePack");
+    checkBatchResults(replies, 8);
+}
+
+// Every envelope field the filter keeps reaches the handler
+void testEnvelopeFields() {
+    Device device;
+    const ProfileManifestEntry* entry = device.profiles.getManifestEntry(0);
+    std::string extra = ",\"profileId\":0,\"ifNoneMatch\":" + std::to_string(entry->hash);
+    device.send(request(1, "getProfile", extra.c_str()));
+    device.run();
+    DynamicJsonDocument payload(256);
+    CHECK(Replies(device.client).payload(1, payload) && (payload["notModified"] | false), "ifNoneMatch read");
+}
+
+void storeMaximalProfile() {
+    ProfileStorage storage;
+    storage.init();
+    Profile* profile = new Profile;
+    buildMaximalProfile(*profile);
+    CHECK(storage.saveProfile(*profile), "store the largest profile");
+    delete profile;
+}
+
+std::string packedRequest(uint32_t id, const char* cmd, int profileId) {
+    StaticJsonDocument<256> doc;
+    doc["id"] = id;
+    doc["cmd"] = cmd;
+    doc["profileId"] = profileId;
+    std::string packed(measureMsgPack(doc), '\0');
+    serializeMsgPack(doc, &packed[0], packed.size());
+    return packed;
+}
+
+// Built from a document when the reply can't be framed straight off flash
+void testLargestProfileReply() {
+    Device device(storeMaximalProfile);
+    Profile* expected = new Profile;
+    buildMaximalProfile(*expected);
+    const MacroStepConfig& last = expected->encoders[1].pressAction.config.macro.steps[MAX_MACRO_STEPS - 1];
+    std::string lastText = profileText(last.textRef);
+    delete expected;
+
+    device.send(packedRequest(1, "getProfile", 99));
+    device.run();
+    DynamicJsonDocument payload(65536);
+    CHECK(Replies(device.client).payload(1, payload), "getProfile reply");
+    JsonVariantConst step = payload["encoders"][1]["pressAction"]["macroSteps"][MAX_MACRO_STEPS - 1];
+    CHECK(payload["keys"].size() == MATRIX_KEYS && lastText == (step["text"] | ""),
+          "whole profile sent (%s)", payload["error"] | "no error");
+}
+
+// Heap enough to load the profile and build the reply, not to hold it twice
+// for the envelope: an error goes out, not part of the reply
+void testReplyTooLarge() {
+    Device device(storeMaximalProfile);
+    size_t heap = hostJsonHeapLimit();
+    hostJsonHeapLimit() = 40 * 1024;
+    device.send(packedRequest(1, "getProfile", 99));
+    device.run();
+    hostJsonHeapLimit() = heap;
+
+    DynamicJsonDocument payload(1024);
+    CHECK(Replies(device.client).payload(1, payload) && strcmp(payload["error"] | "", "Reply too large") == 0,
+          "reply refused (%s)", payload["error"] | "no error");
+}
+
+// Four of the largest profile are more than one importAll message can carry
+void storeMaximalProfiles() {
+    ProfileStorage storage;
+    storage.init();
+    Profile* profile = new Profile;
+    buildMaximalProfile(*profile);
+    for (uint16_t id = 96; id <= 99; id++) {
+        profile->id = id;
+        CHECK(storage.saveProfile(*profile), "store profile %u", id);
+    }
+    delete profile;
+}
+
+void testExportTooLargeToImport() {
+    Device device(storeMaximalProfiles);
+    device.send(request(1, "exportAll"));
+    device.run();
+    DynamicJsonDocument payload(1024);
+    CHECK(Replies(device.client).payload(1, payload) &&
+          strcmp(payload["error"] | "", "Archive too large to import") == 0,
+          "export refused (%s)", payload["error"] | "no error");
+    CHECK(!LittleFS.exists(PROFILE_ARCHIVE_PATH), "archive removed");
+}
+
+std::string firstPageName(Device& device, uint32_t id) {
+    device.send(request(id, "listProfiles"));
+    device.run();
+    DynamicJsonDocument payload(4096);
+    CHECK(Replies(device.client).payload(id, payload), "listProfiles %u", id);
+    return payload["profiles"][0]["name"] | "";
+}
+
+void testListCacheFollowsManifest() {
+    Device device;
+    std::string before = firstPageName(device, 1);
+    CHECK(firstPageName(device, 2) == before, "cached page served again");
+
+    device.send(request(3, "setName", ",\"profileId\":0,\"name\":\"Renamed\""));
+    device.run();
+    CHECK(firstPageName(device, 4) == "Renamed", "page rebuilt after the manifest changed (was \"%s\")",
+          before.c_str());
+}
+
+}  // namespace
+
+int main() {
+    testQueriesOvertakeWrites();
+    testPipelinedQueries();
+    testBusyWhenFull();
+    testBatchAssembly();
+    testEnvelopeFields();
+    testLargestProfileReply();
+    testReplyTooLarge();
+    testExportTooLargeToImport();
+    testListCacheFollowsManifest();
+    return testResult("protocol handler");
+}
@@ -0,0 +1,288 @@
+// Power-cut test for ProfileStorage: every operation is first run to completion
+// to count its filesystem mutations, then re-run once per prefix of them with
+// the "power" cut at that point. After each cut the device reboots (a fresh
+// ProfileStorage over the same flash) and must hold exactly the state from
+// before the operation or the state after it, with a manifest that agrees
+// with the files, and must still accept a new save.
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <map>
+#include <string>
+#include "profile_storage.h"
+#include "profile_text.h"
+#include "test_support.h"
+
+namespace {
+
+const uint16_t USER_ID = 7;
+
+void setText(Action& action, const char* text) {
+    memset(&action, 0, sizeof(action));
+    action.type = ACTION_TEXT;
+    profileInternText(text, strlen(text), action.config.text.textRef);
+}
+
+// A profile whose content depends on `variant`, so old and new copies differ everywhere
+Profile* makeProfile(uint16_t id, int variant) {
+    char name[32];
+    snprintf(name, sizeof(name), "Profile %u v%d", id, variant);
+    Profile* profile = makeTestProfile(id, name);
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        if (i % 3 == 0) {
+            char text[48];
+            snprintf(text, sizeof(text), "text %d for key %u", variant, i);
+            setText(profile->keys[i].action, text);
+        } else {
+            setHotkey(profile->keys[i].action, (uint8_t)(i % 4), (uint8_t)(4 + i + variant));
+        }
+    }
+    for (uint8_t e = 0; e < 2; e++) {
+        setHotkey(profile->encoders[e].cwAction, 0, (uint8_t)(0x4F + e));
+        setHotkey(profile->encoders[e].ccwAction, 0, (uint8_t)(0x50 + e));
+        setText(profile->encoders[e].pressAction, variant % 2 ? "odd" : "even");
+        profile->encoders[e].acceleration = variant % 2;
+        profile->encoders[e].stepsPerDetent = 4;
+    }
+    return profile;
+}
+
+void describeAction(const Profile& profile, const Action& action, std::string& out) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "[%d:", action.type);
+    out += buf;
+    switch (action.type) {
+        case ACTION_TEXT:
+            out += profileText(action.config.text.textRef);
+            break;
+        case ACTION_HOTKEY:
+            snprintf(buf, sizeof(buf), "%u,%u", action.config.hotkey.modifiers, action.config.hotkey.key);
+            out += buf;
+            break;
+        default:
+            break;
+    }
+    out += "]";
+}
+
+// Everything a client could observe about a profile
+std::string describeProfile(const Profile& profile) {
+    std::string out = profile.name;
+    char buf[32];
+    snprintf(buf, sizeof(buf), " v%u ", profile.version);
+    out += buf;
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        describeAction(profile, profile.keys[i].action, out);
+    }
+    for (uint8_t e = 0; e < 2; e++) {
+        describeAction(profile, profile.encoders[e].cwAction, out);
+        describeAction(profile, profile.encoders[e].ccwAction, out);
+        describeAction(profile, profile.encoders[e].pressAction, out);
+        snprintf(buf, sizeof(buf), "{%d,%u}", profile.encoders[e].acceleration, profile.encoders[e].stepsPerDetent);
+        out += buf;
+    }
+    return out;
+}
+
+typedef std::map<uint16_t, std::string> StoreState;
+
+// The profiles a rebooted device serves, checking that the manifest agrees with them
+StoreState observe(ProfileStorage& storage, const char* context) {
+    StoreState state;
+    Profile* profile = new Profile;
+    for (uint16_t i = 0; i < storage.getProfileCount(); i++) {
+        const ProfileManifestEntry* entry = storage.getManifestEntryAt(i);
+        CHECK(entry && (i == 0 || storage.getManifestEntryAt(i - 1)->id < entry->id), "%s: manifest order", context);
+        if (!entry) break;
+        bool loaded = storage.loadProfile(entry->id, *profile);
+        CHECK(loaded, "%s: profile %u listed but does not load", context, entry->id);
+        if (!loaded) continue;
+        // A journal found at boot is summarized from the snapshot (hash 0) until compacted
+        CHECK(entry->hash == 0 || strcmp(entry->name, profile->name) == 0, "%s: manifest name '%s' vs profile '%s'",
+              context, entry->name, profile->name);
+        state[entry->id] = describeProfile(*profile);
+    }
+    delete profile;
+    return state;
+}
+
+// Boot a fresh ProfileStorage over whatever is on flash now
+StoreState reboot(const char* context) {
+    ProfileStorage storage;
+    CHECK(storage.init(), "%s: init failed", context);
+    StoreState state = observe(storage, context);
+    // Let background compaction run, then everything must still read the same
+    for (int i = 0; i < 4; i++) storage.update();
+    StoreState compacted = observe(storage, context);
+    CHECK(compacted == state, "%s: compaction changed the stored profiles", context);
+    for (uint16_t i = 0; i < storage.getProfileCount(); i++) {
+        CHECK(storage.getManifestEntryAt(i)->hash != 0, "%s: profile %u still pending after compaction", context,
+              storage.getManifestEntryAt(i)->id);
+    }
+    return state;
+}
+
+std::string diffStates(const StoreState& a, const StoreState& b) {
+    std::string out;
+    for (const auto& it : a) {
+        auto other = b.find(it.first);
+        if (other == b.end()) out += " -" + std::to_string(it.first);
+        else if (other->second != it.second) out += " ~" + std::to_string(it.first);
+    }
+    for (const auto& it : b) {
+        if (!a.count(it.first)) out += " +" + std::to_string(it.first);
+    }
+    return out;
+}
+
+struct Scenario {
+    const char* name;
+    void (*setup)(ProfileStorage& storage);
+    void (*operation)(ProfileStorage& storage);  // May fail part-way; must not CHECK
+    bool changesProfiles;                        // False for pure housekeeping (compaction)
+};
+
+bool saveVariant(ProfileStorage& storage, uint16_t id, int variant) {
+    Profile* profile = makeProfile(id, variant);
+    bool ok = storage.saveProfile(*profile);
+    delete profile;
+    return ok;
+}
+
+void setupNone(ProfileStorage&) {}
+void setupUser(ProfileStorage& storage) { CHECK(saveVariant(storage, USER_ID, 1), "setup save failed"); }
+void setupJournaled(ProfileStorage& storage) {
+    setupUser(storage);
+    Profile* profile = makeProfile(USER_ID, 1);
+    setHotkey(profile->keys[1].action, 1, 0x20);
+    CHECK(storage.saveProfileIncremental(*profile), "journaled edit failed");
+    delete profile;
+}
+void setupEditedBuiltin(ProfileStorage& storage) {
+    Profile* profile = new Profile;
+    CHECK(storage.loadProfile(DEFAULT_PROFILE, *profile), "built-in %d missing", DEFAULT_PROFILE);
+    strlcpy(profile->name, "Edited default", sizeof(profile->name));
+    CHECK(storage.saveProfile(*profile), "save of edited built-in failed");
+    delete profile;
+}
+
+void opSaveNew(ProfileStorage& storage) { saveVariant(storage, USER_ID, 2); }
+void opOverwrite(ProfileStorage& storage) { saveVariant(storage, USER_ID, 2); }
+void opJournalEdit(ProfileStorage& storage) {
+    Profile* profile = makeProfile(USER_ID, 1);
+    setText(profile->keys[3].action, "a journaled replacement text");
+    storage.saveProfileIncremental(*profile);
+    delete profile;
+}
+// One save touching several keys, an encoder and the name: journaled as one edit
+void editSeveralFields(Profile& profile) {
+    setText(profile.keys[3].action, "several fields at once");
+    setHotkey(profile.keys[4].action, 2, 0x21);
+    profile.encoders[1].stepsPerDetent = 2;
+    strlcpy(profile.name, "Renamed in one save", sizeof(profile.name));
+}
+void opJournalMultiEdit(ProfileStorage& storage) {
+    Profile* profile = makeProfile(USER_ID, 1);
+    editSeveralFields(*profile);
+    storage.saveProfileIncremental(*profile);
+    delete profile;
+}
+void setupJournaledMulti(ProfileStorage& storage) {
+    setupJournaled(storage);
+    Profile* profile = makeProfile(USER_ID, 1);
+    setHotkey(profile->keys[1].action, 1, 0x20);
+    editSeveralFields(*profile);
+    CHECK(storage.saveProfileIncremental(*profile), "journaled multi-field edit failed");
+    delete profile;
+}
+void opUndo(ProfileStorage& storage) { storage.undoLastEdit(USER_ID); }
+void opCompact(ProfileStorage& storage) {
+    // Same as a compaction pass: fold snapshot + journal into a new snapshot
+    Profile* profile = new Profile;
+    if (storage.loadProfile(USER_ID, *profile)) storage.saveProfile(*profile);
+    delete profile;
+}
+void opDeleteUser(ProfileStorage& storage) { storage.deleteProfile(USER_ID); }
+void opDeleteBuiltin(ProfileStorage& storage) { storage.deleteProfile(DEFAULT_PROFILE); }
+void opRestoreBuiltin(ProfileStorage& storage) { storage.restoreBuiltinProfile(DEFAULT_PROFILE); }
+
+const Scenario SCENARIOS[] = {
+    { "save new profile", setupNone, opSaveNew, true },
+    { "overwrite profile", setupUser, opOverwrite, true },
+    { "journaled edit", setupUser, opJournalEdit, true },
+    { "journaled multi-field edit", setupUser, opJournalMultiEdit, true },
+    { "undo journaled edit", setupJournaled, opUndo, true },
+    { "undo multi-field edit", setupJournaledMulti, opUndo, true },
+    { "compact journal", setupJournaled, opCompact, false },
+    { "delete user profile", setupUser, opDeleteUser, true },
+    { "delete built-in", setupNone, opDeleteBuiltin, true },
+    { "delete edited built-in", setupEditedBuiltin, opDeleteBuiltin, true },
+    { "restore built-in", setupEditedBuiltin, opRestoreBuiltin, true },
+};
+
+void runScenario(const Scenario& scenario) {
+    hostFsFormat();
+    {
+        ProfileStorage storage;
+        storage.init();
+        scenario.setup(storage);
+    }
+    const fs::HostFsState flashBefore = fs::hostFs();
+    StoreState before = reboot(scenario.name);
+
+    // Uninterrupted run: how many mutations, and what the end state is
+    fs::hostFs() = flashBefore;
+    unsigned long long total;
+    {
+        ProfileStorage storage;
+        storage.init();
+        hostFsResetCounter();
+        scenario.operation(storage);
+        total = hostFsUnitsSpent();
+    }
+    StoreState after = reboot(scenario.name);
+    CHECK((before != after) == scenario.changesProfiles, "%s: unexpected end state", scenario.name);
+
+    int sawBefore = 0;
+    int sawAfter = 0;
+    for (unsigned long long cut = 0; cut < total; cut++) {
+        char context[96];
+        snprintf(context, sizeof(context), "%s, cut after %llu of %llu", scenario.name, cut, total);
+
+        fs::hostFs() = flashBefore;
+        {
+            ProfileStorage storage;
+            storage.init();
+            hostFsCutAfter(cut);
+            scenario.operation(storage);
+            hostFsRestorePower();
+        }
+
+        StoreState state = reboot(context);
+        if (state == before) {
+            sawBefore++;
+        } else if (state == after) {
+            sawAfter++;
+        } else {
+            CHECK(false, "%s: neither the old nor the new state (vs old:%s, vs new:%s)", context,
+                  diffStates(before, state).c_str(), diffStates(after, state).c_str());
+        }
+
+        // The device keeps working after recovery
+        ProfileStorage storage;
+        storage.init();
+        Profile* profile = new Profile;
+        CHECK(saveVariant(storage, USER_ID + 1, 9) && storage.loadProfile(USER_ID + 1, *profile) && strcmp(profile->name, "Profile 8 v9") == 0,
+              "%s: save after recovery did not read back", context);
+        delete profile;
+    }
+    printf("  %-28s %4llu cut points: %d old, %d new\n", scenario.name, total, sawBefore, sawAfter);
+}
+
+}  // namespace
+
+int main() {
+    for (const Scenario& scenario : SCENARIOS) {
+        runScenario(scenario);
+    }
+    return testResult("storage fault injection");
+}
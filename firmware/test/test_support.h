@@ -0,0 +1,51 @@
+// Shared by the host tests: the CHECK macro with its failure count, the
+// result line every test ends with, and the profile fixtures they start from.
+// Each test is a single translation unit, so the counter is per test.
+#pragma once
+
+#include <Arduino.h>
+#include "profile.h"
+
+static int failures = 0;
+
+// Records a failure and carries on, so one run reports every broken check
+#define CHECK(cond, ...)                                              \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__);                             \
+            fprintf(stderr, "\n");                                    \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+// main()'s return value: prints "<name>: ok" or the number of failed checks
+inline int testResult(const char* name) {
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+inline void setHotkey(Action& action, uint8_t modifiers, uint8_t key) {
+    memset(&action, 0, sizeof(action));
+    action.type = ACTION_HOTKEY;
+    action.config.hotkey.modifiers = modifiers;
+    action.config.hotkey.key = key;
+}
+
+// A zeroed profile named `name` with hotkey 0x04 + i on key i. Heap-allocated
+// like the firmware's temporary profiles; the caller deletes it.
+inline Profile* makeTestProfile(uint16_t id, const char* name) {
+    Profile* profile = new Profile;
+    memset(profile, 0, sizeof(Profile));
+    profile->id = id;
+    profile->version = 1;
+    strlcpy(profile->name, name, sizeof(profile->name));
+    for (uint8_t i = 0; i < MATRIX_KEYS; i++) {
+        setHotkey(profile->keys[i].action, 0, (uint8_t)(0x04 + i));
+    }
+    return profile;
+}